@@ -0,0 +1,16 @@
+#!/bin/bash
+# Builds the benchmark from the objects of compile.sh and runs it
+# Arguments are passed to bench, e.g. ./bench.sh -json -o results.json
+# test.jpg is converted to a PPM image with ImageMagick when it is installed.
+mkdir obj 2>/dev/null
+gcc -I/usr/include -c "src/bench.c" -o "obj/bench.o" -std=gnu99 -m64 -fPIC &&
+gcc -L/usr/lib -o "bench" "obj/bench.o" "obj/addimg.o" "obj/artscii.o" "obj/atlas.o" "obj/charactermatch.o" "obj/compose.o" "obj/convolve.o" "obj/emit.o" "obj/fused.o" "obj/mult.o" "obj/nocl.o" "obj/nocl_charactermatch.o" "obj/nocl_convolve.o" "obj/nocl_fused.o" "obj/nocl_pyramid.o" "obj/nocl_sequence.o" "obj/nocl_simd.o" "obj/nocl_threads.o" "obj/preprocess.o" "obj/programcache.o" "obj/render.o" "obj/separable.o" "obj/specialize.o" "obj/tune.o" "obj/stats.o" "obj/strips.o" -lOpenCL -lpthread -lm -std=gnu99 -m64 &&
+echo "Compiled bench successfully" || exit 1
+
+image=()
+if [ -f "../test.jpg" ]; then
+	if command -v convert >/dev/null && convert "../test.jpg" "obj/test.ppm"; then image=(-image "obj/test.ppm")
+	else echo "ImageMagick was not found, so test.jpg is skipped" >&2
+	fi
+fi
+./bench "${image[@]}" "$@"
@@ -1 +1 @@
-mkdir obj & gcc -IC:\include -c "src\addimg.c" -o "obj\addimg.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\artscii.c" -o "obj\artscii.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\charactermatch.c" -o "obj\charactermatch.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\convolve.c" -o "obj\convolve.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\debug.c" -o "obj\debug.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\mult.c" -o "obj\mult.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl.c" -o "obj\nocl.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_charactermatch.c" -o "obj\nocl_charactermatch.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_convolve.c" -o "obj\nocl_convolve.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -LC:\lib -shared -o "artscii.dll" "obj\addimg.o" "obj\artscii.o" "obj\charactermatch.o" "obj\convolve.o" "obj\debug.o" "obj\mult.o" "obj\nocl.o" "obj\nocl_charactermatch.o" "obj\nocl_convolve.o" -mwindows -lopencl -std=gnu99 -m64 && echo "Compiled artscii.dll successfully"
+mkdir obj & gcc -IC:\include -c "src\addimg.c" -o "obj\addimg.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\artscii.c" -o "obj\artscii.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\atlas.c" -o "obj\atlas.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\charactermatch.c" -o "obj\charactermatch.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\compose.c" -o "obj\compose.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\convolve.c" -o "obj\convolve.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\debug.c" -o "obj\debug.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\emit.c" -o "obj\emit.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\fused.c" -o "obj\fused.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\mult.c" -o "obj\mult.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl.c" -o "obj\nocl.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_charactermatch.c" -o "obj\nocl_charactermatch.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_convolve.c" -o "obj\nocl_convolve.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_fused.c" -o "obj\nocl_fused.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_pyramid.c" -o "obj\nocl_pyramid.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_sequence.c" -o "obj\nocl_sequence.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_simd.c" -o "obj\nocl_simd.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\nocl_threads.c" -o "obj\nocl_threads.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\preprocess.c" -o "obj\preprocess.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\programcache.c" -o "obj\programcache.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\render.c" -o "obj\render.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\separable.c" -o "obj\separable.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\specialize.c" -o "obj\specialize.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\stats.c" -o "obj\stats.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\strips.c" -o "obj\strips.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -IC:\include -c "src\tune.c" -o "obj\tune.o" -mwindows -lopencl -std=gnu99 -m64 && gcc -LC:\lib -shared -o "artscii.dll" "obj\addimg.o" "obj\artscii.o" "obj\atlas.o" "obj\charactermatch.o" "obj\compose.o" "obj\convolve.o" "obj\debug.o" "obj\emit.o" "obj\fused.o" "obj\mult.o" "obj\nocl.o" "obj\nocl_charactermatch.o" "obj\nocl_convolve.o" "obj\nocl_fused.o" "obj\nocl_pyramid.o" "obj\nocl_sequence.o" "obj\nocl_simd.o" "obj\nocl_threads.o" "obj\preprocess.o" "obj\programcache.o" "obj\render.o" "obj\separable.o" "obj\specialize.o" "obj\stats.o" "obj\strips.o" "obj\tune.o" -mwindows -lopencl -lpthread -lm -std=gnu99 -m64 && echo "Compiled artscii.dll successfully"
@@ -2,12 +2,29 @@
 mkdir obj
 gcc -I/usr/include -c "src/addimg.c" -o "obj/addimg.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/artscii.c" -o "obj/artscii.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/atlas.c" -o "obj/atlas.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/charactermatch.c" -o "obj/charactermatch.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/compose.c" -o "obj/compose.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/convolve.c" -o "obj/convolve.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/debug.c" -o "obj/debug.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/emit.c" -o "obj/emit.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/fused.c" -o "obj/fused.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/mult.c" -o "obj/mult.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/nocl.c" -o "obj/nocl.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/nocl_charactermatch.c" -o "obj/nocl_charactermatch.o" -std=gnu99 -m64 -fPIC &&
 gcc -I/usr/include -c "src/nocl_convolve.c" -o "obj/nocl_convolve.o" -std=gnu99 -m64 -fPIC &&
-gcc -L/usr/lib -shared -o "artscii.so" "obj/addimg.o" "obj/artscii.o" "obj/charactermatch.o" "obj/convolve.o" "obj/debug.o" "obj/mult.o" "obj/nocl.o" "obj/nocl_charactermatch.o" "obj/nocl_convolve.o" -lOpenCL -std=gnu99 -m64 &&
+gcc -I/usr/include -c "src/nocl_fused.c" -o "obj/nocl_fused.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/nocl_pyramid.c" -o "obj/nocl_pyramid.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/nocl_sequence.c" -o "obj/nocl_sequence.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/nocl_simd.c" -o "obj/nocl_simd.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/nocl_threads.c" -o "obj/nocl_threads.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/preprocess.c" -o "obj/preprocess.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/programcache.c" -o "obj/programcache.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/render.c" -o "obj/render.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/separable.c" -o "obj/separable.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/specialize.c" -o "obj/specialize.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/stats.c" -o "obj/stats.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/strips.c" -o "obj/strips.o" -std=gnu99 -m64 -fPIC &&
+gcc -I/usr/include -c "src/tune.c" -o "obj/tune.o" -std=gnu99 -m64 -fPIC &&
+gcc -L/usr/lib -shared -o "artscii.so" "obj/addimg.o" "obj/artscii.o" "obj/atlas.o" "obj/charactermatch.o" "obj/compose.o" "obj/convolve.o" "obj/debug.o" "obj/emit.o" "obj/fused.o" "obj/mult.o" "obj/nocl.o" "obj/nocl_charactermatch.o" "obj/nocl_convolve.o" "obj/nocl_fused.o" "obj/nocl_pyramid.o" "obj/nocl_sequence.o" "obj/nocl_simd.o" "obj/nocl_threads.o" "obj/preprocess.o" "obj/programcache.o" "obj/render.o" "obj/separable.o" "obj/specialize.o" "obj/stats.o" "obj/strips.o" "obj/tune.o" -lOpenCL -lpthread -lm -std=gnu99 -m64 &&
 echo "Compiled artscii.so successfully"
@@ -7,35 +7,48 @@ extern void nocl_kAddImg(const unsigned char *a, const unsigned char *b,
 
 
 // Add two images together
-bool AddImg(size_t length, cl_mem imgA, cl_mem imgB, cl_mem *sum) {
+// sum may be the same buffer as imgA or imgB, since each work-item only reads its own pixel
+// The addition starts after the events in waitList, and event is set to the addition itself
+bool AddImg(size_t length, cl_mem imgA, cl_mem imgB, cl_mem sum,
+	        cl_uint numWait, const cl_event *waitList, cl_event *event) {
 	result = clSetKernelArg(clkAddImg, 0, sizeof(cl_mem), &imgA);
 	CHECK_RESULT(false)
 	result = clSetKernelArg(clkAddImg, 1, sizeof(cl_mem), &imgB);
 	CHECK_RESULT(false)
-
-	if (*sum != NULL) clReleaseMemObject(*sum);
-	*sum = clCreateBuffer(context, CL_MEM_READ_WRITE, length, NULL, &result);
+	result = clSetKernelArg(clkAddImg, 2, sizeof(cl_mem), &sum);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkAddImg, 2, sizeof(cl_mem), sum);
+	const cl_uint pixels = (cl_uint)(length / 3);
+	result = clSetKernelArg(clkAddImg, 3, sizeof(cl_uint), &pixels);
 	CHECK_RESULT(false)
 
 	const size_t globalWorkSize[] = { length / 3 };
-	const size_t localWorkSize[] = { 1 };
 
-	cl_event event;
-	result = clEnqueueNDRangeKernel(queue, clkAddImg, 1, NULL,
-		globalWorkSize, localWorkSize, 0, NULL, &event);
-	CHECK_RESULT(false)
-	
-	result = clFinish(queue);
+	result = tunedEnqueue(clkAddImg, "addImg", 1, globalWorkSize, numWait, waitList, event);
 	CHECK_RESULT(false)
+	statsEvent(*event, STATS_ADD, -1);
 
 	return true;
 }
 
+// Arguments shared by every tile of one nocl_AddImg() call
+typedef struct NOCL_AddImgTile {
+	const unsigned char *imgA,
+						*imgB;
+	unsigned char *sum;
+} NOCL_AddImgTile;
+
+// Runs nocl_kAddImg over pixels [begin, end)
+void nocl_addImgRange(void *args, size_t begin, size_t end) {
+	NOCL_AddImgTile *tile = args;
+	for (size_t i = begin; i < end; i++) {
+		nocl_kAddImg(tile->imgA, tile->imgB, tile->sum, i);
+	}
+}
+
 void nocl_AddImg(const size_t globalWorkSize, const unsigned char *imgA,
 			const unsigned char *imgB, unsigned char *sum) {
-	for (size_t i = 0; i < globalWorkSize; i++) {
-			nocl_kAddImg(imgA, imgB, sum, i);
-	}
+	const double start = perfNow();
+	NOCL_AddImgTile tile = { imgA, imgB, sum };
+	nocl_parallelFor(globalWorkSize, 0, nocl_addImgRange, &tile);
+	statsTime(STATS_ADD, -1, perfNow() - start);
 }
\ No newline at end of file
@@ -1,4 +1,10 @@
+#include <stdlib.h>
 #include "artscii.h"
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <time.h>
+#endif
 
 bool useCL = false;
 cl_platform_id platform = NULL;
@@ -8,41 +14,87 @@ cl_command_queue queue = NULL;
 cl_program program = NULL;
 cl_int result = CL_SUCCESS;
 
-struct TIMEB perfStart, perfEnd;
+// Import OpenCL C source (compile with -std=gnu99)
+const char *kernelSrc =
+	#include "kernels.cl"
+;
+
+double perfStart, perfEnd;
 long perfElapsed = 0;
 
 extern MultiConvolveArgs *multiConvolveArgs;
 extern CharacterMatchArgs *characterMatchArgs;
 extern NOCL_MultiConvolveArgs *nocl_multiConvolveArgs;
 extern NOCL_CharacterMatchArgs *nocl_characterMatchArgs;
-extern cl_kernel clkConvolve, clkAddImg, clkMult, clkCharacterMatch;
+extern cl_kernel clkConvolve, clkConvolveRows, clkConvolveColumns, clkConvolveTiled, clkAddImg, clkMult, clkCharacterMatch, clkCharacterMatchAtlas, clkFusedMatch;
 
 extern void freeMultiConvolveArgs();
 extern void freeCharacterMatchArgs();
+extern void freeFusedArgs();
 extern void nocl_freeMultiConvolveArgs();
 extern void nocl_freeCharacterMatchArgs();
-extern bool OCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels, size_t numKernels);
-extern bool OCL_CharacterMatch(cl_mem *imgs, int *imgSize, int numImgs, ImageInfo *characters,
-		int numChars, char *charMap, unsigned char *matches, cl_mem colorImg, unsigned char *colors);
-extern bool NOCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels,
-		const size_t numKernels);
-extern bool NOCL_CharacterMatch(unsigned char **imgs, const int *imgSize, const int numImgs,
-		ImageInfo *characters, const int numChars, char *charMap, unsigned char *matches,
-		unsigned char *colorImg, unsigned char *outColors);
+extern void nocl_freeSequence();
+extern int nocl_loadImage(ImageInfo *imgBufs, unsigned char *charBuf, size_t offset);
+extern bool multiConvolveImage(const ImageView *img, KernelInfo *kernels, size_t numKernels,
+		bool composed);
+extern bool OCL_CharacterMatch(cl_mem *imgs, cl_mem imgBlock, const cl_event *imgEvents, int *imgSize,
+		int numImgs, const GlyphAtlas *atlas, unsigned char *matches,
+		cl_mem colorImg, unsigned char *outColors);
+extern bool nocl_multiConvolveImage(const ImageView *img, KernelInfo *kernels,
+		const size_t numKernels, bool composed);
+extern bool NOCL_CharacterMatch(const unsigned char *imgs, int *imgSize, const int numImgs,
+		const GlyphAtlas *atlas, unsigned char *matches,
+		const unsigned char *colorImg, unsigned char *outColors);
+extern bool fused;
+extern size_t fusedGroupSize(const KernelInfo *kernels, size_t numKernels, const GlyphAtlas *atlas);
+extern bool fusedToAscii(const ImageView *img, KernelInfo *kernels, size_t numKernels,
+		const GlyphAtlas *atlas, bool composed, size_t groupSize, unsigned char *outChars,
+		unsigned char *outColors);
+extern bool nocl_fused;
+extern bool fusedKernels(const KernelInfo *kernels, size_t numKernels);
+extern bool nocl_fusedToAscii(const ImageView *img, KernelInfo *kernels, size_t numKernels,
+		const GlyphAtlas *atlas, bool composed, unsigned char *outChars, unsigned char *outColors);
 
 // Cleans up all dynamic memory associated with this library
 EXPORT void OCL_Cleanup() {
+	// Pending commands may still use the buffers released below
+	if (queue != NULL) clFinish(queue);
 	freeMultiConvolveArgs();
 	freeCharacterMatchArgs();
+	freeFusedArgs();
+	nocl_freeSequence();
+	nocl_freeThreadPool();
 	clReleaseKernel(clkConvolve);
+	clReleaseKernel(clkConvolveRows);
+	clReleaseKernel(clkConvolveColumns);
+	clReleaseKernel(clkConvolveTiled);
 	clReleaseKernel(clkAddImg);
 	clReleaseKernel(clkMult);
 	clReleaseKernel(clkCharacterMatch);
+	clReleaseKernel(clkCharacterMatchAtlas);
+	clReleaseKernel(clkFusedMatch);
+	freeTuning();
+	freeSpecializedPrograms();
 	clReleaseProgram(program);
-	clReleaseCommandQueue(queue);
+	if (queue != NULL) clReleaseCommandQueue(queue);
+	queue = NULL;
 	clReleaseContext(context);
 }
 
+// Milliseconds from a monotonic clock, for timing
+double perfNow() {
+#ifdef _WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter(&count);
+	QueryPerformanceFrequency(&frequency);
+	return (count.QuadPart * 1000.0) / frequency.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec * 1000.0) + (t.tv_nsec / 1e6);
+#endif
+}
+
 // Handles OpenCL errors and displays error messages
 void err(int errorCode) {
 	const char *errPrefix = "Error: ";
@@ -110,11 +162,6 @@ void err(int errorCode) {
 
 // Initializes the ArtSCII OpenCL library
 EXPORT bool OCL_Init() {
-	// Import OpenCL C source (compile with -std=gnu99)
-	const char *kernelSrc = 
-		#include "kernels.cl"
-	;
-
 	cl_uint count = 0;
 	result = clGetPlatformIDs(1, &platform, &count);
 	if (count == 0) return false;
@@ -129,81 +176,208 @@ EXPORT bool OCL_Init() {
 	context = clCreateContext(NULL, 1, &device, NULL, NULL, &result);
 	CHECK_RESULT(false)
 	
-	queue = clCreateCommandQueue(context, device, 0, &result);
+	// Commands are ordered with event wait lists, so the device may run them out of order
+	// Profiling times every command for STATS_Get()
+	cl_command_queue_properties queueProps = 0;
+	result = clGetDeviceInfo(device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(queueProps), &queueProps, NULL);
+	CHECK_RESULT(false)
+	queue = clCreateCommandQueue(context, device,
+		(queueProps & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) | CL_QUEUE_PROFILING_ENABLE, &result);
 	CHECK_RESULT(false)
 
-	program = clCreateProgramWithSource(context, 1, &kernelSrc, NULL, &result);
+	// Loaded from the cache set by OCL_SetCacheDirectory() when possible
+	program = buildProgram(kernelSrc, "");
 	CHECK_RESULT(false)
-	
-	result = clBuildProgram(program, 0, NULL, NULL, NULL, NULL);
-	if (result != CL_SUCCESS) {
-		// kernel.cl build logs
-		char buf[999999] = {};
-		clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 999999, buf, NULL);
-		printf("%s", buf);
-		err(result);
-		return false;
-	}
 
 	// Kernels
 	clkConvolve = clCreateKernel(program, "convolve", &result);
 	CHECK_RESULT(false)
+	clkConvolveRows = clCreateKernel(program, "convolveRows", &result);
+	CHECK_RESULT(false)
+	clkConvolveColumns = clCreateKernel(program, "convolveColumns", &result);
+	CHECK_RESULT(false)
+	clkConvolveTiled = clCreateKernel(program, "convolveTiled", &result);
+	CHECK_RESULT(false)
 	clkAddImg = clCreateKernel(program, "addImg", &result);
 	CHECK_RESULT(false)
 	clkMult = clCreateKernel(program, "mult", &result);
 	CHECK_RESULT(false)
 	clkCharacterMatch = clCreateKernel(program, "characterMatch", &result);
 	CHECK_RESULT(false)
+	clkCharacterMatchAtlas = clCreateKernel(program, "characterMatchAtlas", &result);
+	CHECK_RESULT(false)
+	clkFusedMatch = clCreateKernel(program, "fusedMatch", &result);
+	CHECK_RESULT(false)
+
+	// Local sizes tuned on this device by earlier runs (see tune.c)
+	loadTuning();
 	return true;
 }
 
-// Converts an Image to ASCII characters with OpenCL
-EXPORT bool OCL_ToAscii(ImageInfo *imgBufs, unsigned char *outChars,
-		unsigned char *outColors, KernelInfo *kernels, size_t numKernels, ImageInfo* charBufs,
-		int numChars, char *charMap) {
-	int imgSize[2] = { imgBufs[0].width, imgBufs[0].height };
+static bool oclToAsciiImage(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, bool composed) {
+	const ImageView img = { pixels, width, height, stride };
+	int imgSize[2] = { width, height };
+
+	if (fused) {
+		const size_t groupSize = fusedGroupSize(kernels, numKernels, atlas);
+		if (groupSize > 0) {
+			bool ok = fusedToAscii(&img, kernels, numKernels, atlas, composed, groupSize, outChars, outColors);
+			freeFusedArgs();
+			return ok;
+		}
+		fprintf(stderr, "Warning: These kernels cannot be fused. Using separate passes.\n");
+	}
 
-	if (!OCL_MultiConvolve(imgBufs, kernels, numKernels)) return false;
+	if (!multiConvolveImage(&img, kernels, numKernels, composed)) return false;
 
-	if (!OCL_CharacterMatch(multiConvolveArgs->outputs, imgSize, numKernels,
-						charBufs, numChars, charMap, outChars,
+	if (!OCL_CharacterMatch(multiConvolveArgs->outputs, multiConvolveArgs->outputBlock,
+						multiConvolveArgs->outputEvents, imgSize, numKernels, atlas, outChars,
 						multiConvolveArgs->input, outColors)) return false;
 	freeMultiConvolveArgs();
 	freeCharacterMatchArgs();
 	return true;
 }
 
-// Converts an Image to ASCII characters without OpenCL
-EXPORT bool NOCL_ToAscii(ImageInfo *imgBufs, unsigned char *outChars,
-		unsigned char *outColors, KernelInfo *kernels, size_t numKernels, ImageInfo* charBufs,
-		int numChars, char *charMap) {
-	int imgSize[2] = { imgBufs[0].width, imgBufs[0].height };
-
-	if (!NOCL_MultiConvolve(imgBufs, kernels, numKernels) ||
-		!NOCL_CharacterMatch(nocl_multiConvolveArgs->outputs, imgSize, numKernels,
-						charBufs, numChars, charMap, outChars,
-						nocl_multiConvolveArgs->input, outColors)) {
-		nocl_freeMultiConvolveArgs();
-		nocl_freeCharacterMatchArgs();
-		return false;
+// Converts an Image to ASCII characters with OpenCL
+// pixels is read in place: pixel (x, y) starts at pixels[(stride * y) + (x * 3)]
+// atlas holds every character back to back, as loaded by ATLAS_Load
+// composed runs one combined pass per kernel instead of numKernels^2 passes (see compose.c)
+// After OCL_SetFused(true), each cell is filtered and matched in one launch (see fused.c)
+EXPORT bool OCL_ToAsciiImage(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, bool composed) {
+	statsBegin();
+	bool ok = oclToAsciiImage(pixels, width, height, stride, outChars, outColors, kernels, numKernels,
+							  atlas, composed);
+	resolveTuning();
+	statsEnd();
+	return ok;
+}
+
+static bool noclToAsciiImage(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, int numThreads, bool composed) {
+	const ImageView img = { pixels, width, height, stride };
+	int imgSize[2] = { width, height };
+	nocl_setThreadCount(numThreads);
+
+	if (nocl_fused) {
+		if (fusedKernels(kernels, numKernels)) {
+			bool ok = nocl_fusedToAscii(&img, kernels, numKernels, atlas, composed, outChars, outColors);
+			nocl_freeCharacterMatchArgs();
+			return ok;
+		}
+		fprintf(stderr, "Warning: These kernels cannot be fused. Using separate passes.\n");
 	}
+	bool ok = nocl_multiConvolveImage(&img, kernels, numKernels, composed) &&
+			  NOCL_CharacterMatch(nocl_multiConvolveArgs->outputBlock, imgSize, numKernels,
+								  atlas, outChars, nocl_multiConvolveArgs->input, outColors);
 	nocl_freeMultiConvolveArgs();
 	nocl_freeCharacterMatchArgs();
+	return ok;
+}
+
+// Converts an Image to ASCII characters without OpenCL
+// pixels and atlas are read in place, as in OCL_ToAsciiImage
+// numThreads sets the number of CPU threads to use (0 = one per CPU)
+// composed runs one combined pass per kernel instead of numKernels^2 passes (see compose.c)
+// After NOCL_SetFused(true), each row of cells is filtered just before it is matched (see nocl_fused.c)
+EXPORT bool NOCL_ToAsciiImage(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, int numThreads, bool composed) {
+	statsBegin();
+	bool ok = noclToAsciiImage(pixels, width, height, stride, outChars, outColors, kernels, numKernels,
+							   atlas, numThreads, composed);
+	statsEnd();
+	return ok;
+}
+
+// Packs an image split into ImageInfo buffers into one buffer, which the caller frees
+bool gatherImage(ImageInfo *imgBufs, unsigned char **pixels, ImageView *img) {
+	img->width = imgBufs[0].width;
+	img->height = imgBufs[0].height;
+	img->stride = img->width * 3;
+	*pixels = malloc(img->stride * img->height);
+	if (*pixels == NULL) return false;
+	nocl_loadImage(imgBufs, *pixels, 0);
+	img->pixels = *pixels;
 	return true;
 }
 
-// Returns the number of buffers processed, or -1 if an error occurred.
-int loadImage(ImageInfo *imgBufs, cl_mem *clBuf, size_t offset) {
-	size_t i = 0;
-	while (true) {
-		result = clEnqueueWriteBuffer(queue, *clBuf, CL_TRUE, offset, imgBufs[i].bufSize,
-			imgBufs[i].buffer, 0, NULL, NULL);
-		CHECK_RESULT(-1)
-		offset += imgBufs[i].bufSize;
-		if (imgBufs[i].final) break;
-		i++;
+// Packs characters split into ImageInfo buffers into one atlas, whose pixels the caller frees
+bool gatherAtlas(ImageInfo *charBufs, int numChars, char *charMap, unsigned char **pixels,
+		GlyphAtlas *atlas) {
+	memset(atlas, 0, sizeof(GlyphAtlas));
+	atlas->numChars = numChars;
+	atlas->charWidth = charBufs[0].width;
+	atlas->charHeight = charBufs[0].height;
+	atlas->charMap = charMap;
+
+	const size_t charLen = atlas->charWidth * atlas->charHeight * 3;
+	*pixels = malloc(charLen * numChars);
+	if (*pixels == NULL) return false;
+	for (size_t c = 0, charBufX = 0; c < numChars; c++) {
+		charBufX += nocl_loadImage(&charBufs[charBufX], *pixels, c * charLen);
+	}
+	atlas->pixels = *pixels;
+	return true;
+}
+
+// Converts an Image to ASCII characters with OpenCL
+// Compatibility entry point for images and characters split into ImageInfo buffers
+// composed runs one combined pass per kernel instead of numKernels^2 passes (see compose.c)
+EXPORT bool OCL_ToAscii(ImageInfo *imgBufs, unsigned char *outChars,
+		unsigned char *outColors, KernelInfo *kernels, size_t numKernels, ImageInfo* charBufs,
+		int numChars, char *charMap, bool composed) {
+	unsigned char *pixels = NULL, *charPixels = NULL;
+	ImageView img;
+	GlyphAtlas atlas;
+	bool ok = gatherImage(imgBufs, &pixels, &img) &&
+			  gatherAtlas(charBufs, numChars, charMap, &charPixels, &atlas) &&
+			  OCL_ToAsciiImage(img.pixels, img.width, img.height, img.stride, outChars, outColors,
+							   kernels, numKernels, &atlas, composed);
+	free(pixels);
+	free(charPixels);
+	return ok;
+}
+
+// Converts an Image to ASCII characters without OpenCL
+// Compatibility entry point for images and characters split into ImageInfo buffers
+// numThreads sets the number of CPU threads to use (0 = one per CPU)
+// composed runs one combined pass per kernel instead of numKernels^2 passes (see compose.c)
+EXPORT bool NOCL_ToAscii(ImageInfo *imgBufs, unsigned char *outChars,
+		unsigned char *outColors, KernelInfo *kernels, size_t numKernels, ImageInfo* charBufs,
+		int numChars, char *charMap, int numThreads, bool composed) {
+	unsigned char *pixels = NULL, *charPixels = NULL;
+	ImageView img;
+	GlyphAtlas atlas;
+	bool ok = gatherImage(imgBufs, &pixels, &img) &&
+			  gatherAtlas(charBufs, numChars, charMap, &charPixels, &atlas) &&
+			  NOCL_ToAsciiImage(img.pixels, img.width, img.height, img.stride, outChars, outColors,
+								kernels, numKernels, &atlas, numThreads, composed);
+	free(pixels);
+	free(charPixels);
+	return ok;
+}
+
+// Uploads an image without blocking; event completes when it is on the device
+// Packed rows are written in one command, other strides with a rectangular write
+bool uploadImage(const ImageView *img, cl_mem clBuf, cl_event *event) {
+	const size_t rowLen = img->width * 3;
+	if (img->stride == rowLen) {
+		result = clEnqueueWriteBuffer(queue, clBuf, CL_FALSE, 0, rowLen * img->height, img->pixels,
+									  0, NULL, event);
 	}
-	result = clFinish(queue);
-	CHECK_RESULT(-1)
-	return i + 1;
+	else {
+		const size_t origin[3] = { 0, 0, 0 },
+					 region[3] = { rowLen, img->height, 1 };
+		result = clEnqueueWriteBufferRect(queue, clBuf, CL_FALSE, origin, origin, region, rowLen, 0,
+										  img->stride, 0, img->pixels, 0, NULL, event);
+	}
+	CHECK_RESULT(false)
+	statsEvent(*event, STATS_UPLOAD, -1);
+	statsTransfer(rowLen * img->height, 0);
+	return true;
 }
@@ -6,7 +6,6 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
-#include <sys/timeb.h>
 #include <sys/types.h>
 
 // ----------- Data structures from C# ----------- //
@@ -24,77 +23,275 @@ typedef struct ImageInfo {
 
 // 1KB KernelInfo buffer
 #define KNL_INFO_BUF_SIZE 256
+// Longest side of a separable kernel
+#define KNL_MAX_SIDE 64
 
 typedef struct KernelInfo {
 	unsigned int width;
 	unsigned int height;
 	float mult;
 	bool invert;
-	unsigned int bufSize;
+	unsigned int bufSize; // width * height, or 0 if only the factors are given
 	float buffer[KNL_INFO_BUF_SIZE]; // 1 KB buffer
+	bool separable; // Weight (x, y) is rowTaps[x] * colTaps[y], see separable.c
+	float rowTaps[KNL_MAX_SIDE],
+		  colTaps[KNL_MAX_SIDE];
 } KernelInfo;
 // ----------------------------------------------- //
 
+// ------------ Images in caller memory ---------- //
+// An RGB image that is read in place, see OCL_ToAsciiImage
+typedef struct ImageView {
+	const unsigned char *pixels; // Pixel (x, y) starts at pixels[(stride * y) + (x * 3)]
+	unsigned int width,
+				 height;
+	size_t stride; // Bytes per row, at least width * 3
+} ImageView;
+// ----------------------------------------------- //
+
+// --------------- Glyph atlas cache ------------- //
+// Library version, part of every atlas and program cache key
+#define ARTSCII_VERSION "2.0.0"
+// Bump when the atlas file layout changes
+#define ATLAS_FILE_VERSION 1
+
+// Every character of a font packed into one buffer, see atlas.c
+// The first five fields are read directly by C#
+typedef struct GlyphAtlas {
+	unsigned int numChars,
+				 charWidth,
+				 charHeight;
+	const char *charMap;
+	const unsigned char *pixels; // pixels[(x + (charWidth * (y + (charHeight * c)))) * 3]
+	void *mapping;
+	size_t mapSize;
+} GlyphAtlas;
+// ----------------------------------------------- //
+
+// ------------- OpenCL program cache ------------ //
+// Bump when the program file layout changes, see programcache.c
+#define PROGRAM_FILE_VERSION 1
+
+extern cl_program buildProgram(const char *src, const char *options);
+// ----------------------------------------------- //
+
+// ------------ Specialized programs ------------- //
+// Characters needed by matchOptions(), see specialize.c
+#define SPEC_MATCH_OPTIONS_LEN 96
+
+extern cl_kernel specializedKernel(const char *options, const char *name, cl_kernel fallback);
+extern void matchOptions(char *options, int numImgs, const int *charSize);
+extern bool convolveFixable(const KernelInfo *k, size_t index);
+extern char *convolveOptions(const KernelInfo *kernels, size_t numKernels);
+extern void freeSpecializedPrograms();
+// ----------------------------------------------- //
+
+// -------------- Work-group tuning -------------- //
+extern cl_int tunedEnqueue(cl_kernel kernel, const char *name, cl_uint dims, const size_t *globalSize,
+	cl_uint numWait, const cl_event *waitList, cl_event *event);
+extern void loadTuning();
+extern void resolveTuning();
+extern void freeTuning();
+// ----------------------------------------------- //
+
 // --------------- OpenCL arguments -------------- //
 typedef struct MultiConvolveArgs {
 	cl_mem input,
+	       outputBlock, // Every output back to back, if outputs are sub-buffers of it
 	       *outputs,
+	       *firstPasses,
+	       *pairPasses,
 	       *kernels,
-		   *knlSizes;
+		   *knlSizes,
+		   *rowTaps, // Factors of each separable kernel, NULL for the others
+		   *colTaps;
+	cl_kernel *fixedKernels; // convolveFixed<k> of each kernel baked into a program, NULL for the others
+	size_t *tileSizes; // convolveTiled local size and tile bytes of each kernel, 3 per kernel, 0s if it does not fit
+	cl_event inputEvent,
+	         *outputEvents; // Completes when the matching output is ready
 	float *knlMults;
 	unsigned char *knlInverts;
 	size_t numKernels;
 } MultiConvolveArgs;
 
+// Largest work-group (cell) size for characterMatchAtlas
+#define ATLAS_MAX_GROUP_SIZE 64
+// Largest and smallest sides of a convolveTiled work-group
+#define TILE_MAX_SIDE 16
+#define TILE_MIN_SIDE 4
+
 typedef struct CharacterMatchArgs {
 	cl_mem imgs,
 		   imgSize,
-		   charImg,
+		   atlas,       // Every character, for characterMatchAtlas
+		   charMap,
+		   charImgs[2], // Alternated between characters
 		   charSize,
 		   currentChar,
 		   diffs,
 		   matches,
 		   outColors;
-	size_t charBufX,
-	       charMapX;
+	cl_event charEvents[2],  // Upload of each character buffer
+	         charMatches[2], // Last match that read each character buffer
+	         lastMatch;
+	size_t charMapX;
 } CharacterMatchArgs;
+
+// Buffers of one fusedMatch launch, see fused.c
+typedef struct FusedArgs {
+	cl_mem input,
+		   imgSize,
+		   kernels,    // Every kernel's weights back to back
+		   knlSize,
+		   knlMults,
+		   knlInverts,
+		   atlas,
+		   charSize,
+		   charMap,
+		   matches,
+		   outColors;
+} FusedArgs;
 // ----------------------------------------------- //
 
 // --------------- NOCL arguments -------------- //
 typedef struct NOCL_MultiConvolveArgs {
 	float **kernels,
 		  *knlMults;
-	unsigned char *input,
+	const unsigned char *input; // The caller's image, or inputCopy
+	unsigned char *inputCopy,   // Only used if the caller's rows are not packed
+				  *outputBlock, // Every output back to back
 				  **outputs,
+				  *pass,        // Intermediate pass of the exact pipeline
 				  *knlInverts;
 	size_t *knlSizes,
-		   numKernels,
-		   outputIndex;
+		   numKernels;
 } NOCL_MultiConvolveArgs;
 
 typedef struct NOCL_CharacterMatchArgs {
 	char currentChar;
+	const char *charMap;
 	int *imgSize,
-		*charSize;
-	unsigned char *imgs,
-				  *charImg,
-				  *matches;
-	unsigned int *diffs;
-	size_t charMapX;
+		*charSize,
+		*sortedChars; // Character indices by ascending charSums
+	const unsigned char *imgs,    // Every filtered image back to back
+						*charImg, // Current character of the exhaustive matcher
+						*atlas;   // Every character back to back
+	unsigned char *matches;
+	unsigned int *diffs,
+				 *charSums; // Sum of every color channel of each character
+	size_t charMapX,
+		   numChars;
+	// nocl_cellDiff instantiated for charSize and the number of images, or NULL (see nocl_charactermatch.c)
+	unsigned int (*cellDiff)(const unsigned char *ch, const unsigned char *px, unsigned int bound,
+							 unsigned long long *visited);
 } NOCL_CharacterMatchArgs;
 // ----------------------------------------------- //
 
+// ---------------- NOCL pyramid ----------------- //
+// Block sizes 2x2 and 4x4
+#define NOCL_PYRAMID_LEVELS 2
+
+// Block sums of every character, for the coarse-to-fine search in nocl_pyramid.c
+typedef struct NOCL_Pyramid {
+	unsigned short *levels[NOCL_PYRAMID_LEVELS];
+	size_t levelSize[NOCL_PYRAMID_LEVELS]; // Blocks per character
+} NOCL_Pyramid;
+
+// Per-thread buffers used to score one cell at a time
+typedef struct NOCL_PyramidCell {
+	unsigned short *levels[NOCL_PYRAMID_LEVELS];
+	unsigned int *scores;
+	int *candidates,
+		*survivors;
+} NOCL_PyramidCell;
+
+// Per-thread buffers for the search matcher, see nocl_charactermatch.c
+typedef struct NOCL_SearchCell {
+	unsigned char *pixels; // pixels[(img + (numImgs * (xRel + (charW * yRel)))) * 3]
+	unsigned int sum;
+	NOCL_PyramidCell *pyramid; // NULL without nocl_topK
+	unsigned long long visited,
+					   agreed,
+					   checked;
+} NOCL_SearchCell;
+// ----------------------------------------------- //
+
+// ------------- NOCL frame sequences ------------ //
+// Everything kept between the frames of one sequence, see nocl_sequence.c
+typedef struct NOCL_Sequence {
+	KernelInfo *kernels; // Prepared by prepareKernels(), or composed once when composed is true
+	size_t numKernels;
+	bool composed;
+	const GlyphAtlas *atlas; // Borrowed until NOCL_EndSequence()
+	unsigned int threshold,
+				 halo[2],     // Pixels around a change whose filtered values can change
+				 blocks[2];   // Change detection grid, one block per character cell
+	int imgSize[2];
+	size_t globalSize[2],     // Cells, including the newline column
+		   frame;
+	unsigned char *input,     // Previous frame, as last converted
+				  *outputs,   // Every filtered image back to back
+				  *matches,
+				  *colors,
+				  *changed,   // Per block, for the current frame
+				  *dirty;     // Per cell, for the current frame
+	unsigned int *cells;      // Dirty cells of the current frame
+} NOCL_Sequence;
+// ----------------------------------------------- //
+
+// --------------- Separable kernels ------------- //
+extern bool kernelHasWeights(const KernelInfo *k);
+extern void expandKernel(const KernelInfo *k, float *weights);
+extern KernelInfo *prepareKernels(const KernelInfo *kernels, size_t numKernels);
+// ----------------------------------------------- //
+
+// ------------------ NOCL SIMD ------------------ //
+// One convolution pass over a padded image, see nocl_simd.c
+typedef struct NOCL_SimdConvolve {
+	const unsigned char *padded;
+	unsigned char *output;
+	size_t *tapOffsets; // Byte offset of each non-zero tap from the output position
+	float *taps;
+	int *iTaps;
+	size_t numTaps,
+		   padRow, // Bytes per padded row
+		   outRow; // Bytes per output row
+	float knlMult,
+		  alpha;
+	unsigned char knlInvert;
+	int accumulator;
+} NOCL_SimdConvolve;
+
+// Both passes of a separable kernel, see nocl_simd.c
+typedef struct NOCL_SimdSeparable {
+	NOCL_SimdConvolve rows; // Taps of the row pass, which also finishes the column pass
+	size_t *colRows;        // Row of the kernel read by each non-zero column tap
+	float *colTaps;
+	int *iColTaps;
+	size_t numColTaps,
+		   knlH;
+	bool failed;            // A thread could not allocate its rows
+} NOCL_SimdSeparable;
+// ----------------------------------------------- //
+
+// ---------------- NOCL threading --------------- //
+// Processes rows [begin, end) of a work grid
+typedef void (*NOCL_TileFunc)(void *args, size_t begin, size_t end);
+
+extern void nocl_parallelFor(size_t count, size_t tileSize, NOCL_TileFunc func, void *args);
+extern void nocl_setThreadCount(int numThreads);
+extern int nocl_getThreadCount();
+extern void nocl_freeThreadPool();
+// ----------------------------------------------- //
+
 // --------------- Global Variables -------------- //
+extern cl_platform_id platform;
 extern cl_command_queue queue;
+extern cl_device_id device;
 extern cl_context context;
 extern cl_int result;
 extern long perfElapsed;
-#ifdef _WIN32
-	#define TIMEB _timeb
-#else
-	#define TIMEB timeb
-#endif
-extern struct TIMEB perfStart, perfEnd;
+extern double perfStart, perfEnd;
 // ----------------------------------------------- //
 
 // ------------------ Debugging ------------------ //
@@ -117,15 +314,59 @@ extern void err(int errorCode);
 // ----------------------------------------------- //
 
 // ------------- Performance testing ------------- //
+// Milliseconds from a monotonic clock
+extern double perfNow();
+
 #define RESET_PERF_TIMER() perfElapsed = 0;      \
-						   _ftime_s(&perfStart);
+						   perfStart = perfNow();
 								
-#define LOG_PERFORMANCE(str) _ftime_s(&perfEnd);                                   \
-							perfElapsed = ((perfEnd.time - perfStart.time) * 1000) \
-								+ (perfEnd.millitm - perfStart.millitm);           \
+#define LOG_PERFORMANCE(str) perfEnd = perfNow();                         \
+							perfElapsed = (long)(perfEnd - perfStart);    \
 							printf(str, perfElapsed);
 // ----------------------------------------------- //
 
+// ------------- Conversion statistics ----------- //
+// Stages of a conversion, see stats.c
+enum {
+	STATS_UPLOAD,   // Host to device writes and copies
+	STATS_CONVOLVE,
+	STATS_ADD,
+	STATS_MATCH,
+	STATS_READBACK, // Device to host reads
+	STATS_NUM_STAGES
+};
+
+#define STATS_MAX_KERNELS 16
+#define STATS_MAX_GLYPHS 256
+
+// Filled by every *_ToAscii call, read by C# with STATS_Get()
+typedef struct ConversionStats {
+	double totalMs,                      // Host time of the whole call
+		   stageMs[STATS_NUM_STAGES],
+		   convolveMs[STATS_MAX_KERNELS],  // Per kernel index
+		   glyphMatchMs[STATS_MAX_GLYPHS]; // Per atlas character, only when matched one at a time
+	unsigned long long bytesUploaded,
+					   bytesRead,
+					   numAllocations,
+					   peakBytes,     // Most buffer memory held at once
+					   largestBuffer,
+					   numCommands;   // OpenCL commands enqueued
+	int deviceTimes,                  // 1 if stage times come from OpenCL profiling events
+		numKernels,
+		numGlyphs;                    // Entries of glyphMatchMs that were timed
+} ConversionStats;
+
+extern void statsBegin();
+extern void statsEnd();
+extern void statsTime(int stage, int index, double ms);
+extern void statsEvent(cl_event event, int stage, int index);
+extern void statsTransfer(size_t uploaded, size_t read);
+extern void statsAlloc(const void *handle, size_t size);
+extern void statsFree(const void *handle);
+extern cl_mem statsCreateBuffer(cl_mem_flags flags, size_t size, void *host);
+extern void statsReleaseBuffer(cl_mem mem);
+// ----------------------------------------------- //
+
 // -------------------- Exports ------------------ //
 #ifdef _WIN32
 	#define EXPORT __declspec(dllexport)
@@ -0,0 +1,190 @@
+// Glyph atlas cache
+// Rendering every character of a font is slow, so the rendered characters are saved in one file
+// and memory-mapped on later runs. The file is only used if its key matches, and the key always
+// includes ARTSCII_VERSION.
+//
+// File layout (native byte order):
+//   AtlasFileHeader
+//   key          keyLen bytes, not terminated
+//   charMap      numChars bytes
+//   padding      up to a multiple of 16 bytes
+//   pixels       numChars * charWidth * charHeight * 3 bytes, see GlyphAtlas
+
+#include <stdlib.h>
+#include "artscii.h"
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+typedef struct AtlasFileHeader {
+	char magic[8];
+	unsigned int version,
+				 keyLen,
+				 numChars,
+				 charWidth,
+				 charHeight,
+				 reserved;
+} AtlasFileHeader;
+
+static const char atlasMagic[8] = { 'A', 'R', 'T', 'A', 'T', 'L', 'A', 'S' };
+
+// Prefixes key with the library version, so atlases from other versions never match
+char *atlasKey(const char *key) {
+	const char *prefix = "ArtSCII " ARTSCII_VERSION "|";
+	char *full = malloc(strlen(prefix) + strlen(key) + 1);
+	if (full == NULL) return NULL;
+	strcpy(full, prefix);
+	strcat(full, key);
+	return full;
+}
+
+// Offset of the pixels from the start of the file
+size_t atlasPixelOffset(size_t keyLen, size_t numChars) {
+	return (sizeof(AtlasFileHeader) + keyLen + numChars + 15) & ~(size_t)15;
+}
+
+// Saves numChars characters to path
+// pixels uses the same layout as GlyphAtlas. The file is written next to path and then renamed,
+// so other processes never map a partial file.
+EXPORT bool ATLAS_Save(const char *path, const char *key, const char *charMap,
+		unsigned int numChars, unsigned int charWidth, unsigned int charHeight,
+		const unsigned char *pixels) {
+	char *fullKey = atlasKey(key);
+	char *tmpPath = malloc(strlen(path) + 5);
+	if (fullKey == NULL || tmpPath == NULL) {
+		free(fullKey);
+		free(tmpPath);
+		return false;
+	}
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+
+	AtlasFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, atlasMagic, sizeof(atlasMagic));
+	header.version = ATLAS_FILE_VERSION;
+	header.keyLen = strlen(fullKey);
+	header.numChars = numChars;
+	header.charWidth = charWidth;
+	header.charHeight = charHeight;
+
+	const size_t offset = atlasPixelOffset(header.keyLen, numChars),
+				 padLen = offset - (sizeof(header) + header.keyLen + numChars),
+				 pixelLen = (size_t)numChars * charWidth * charHeight * 3;
+	const char padding[16] = { 0 };
+
+	bool ok = false;
+	FILE *file = fopen(tmpPath, "wb");
+	if (file != NULL) {
+		ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+			 fwrite(fullKey, 1, header.keyLen, file) == header.keyLen &&
+			 fwrite(charMap, 1, numChars, file) == numChars &&
+			 fwrite(padding, 1, padLen, file) == padLen &&
+			 fwrite(pixels, 1, pixelLen, file) == pixelLen;
+		ok = (fclose(file) == 0) && ok;
+	#ifdef _WIN32
+		ok = ok && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING);
+	#else
+		ok = ok && rename(tmpPath, path) == 0;
+	#endif
+		if (!ok) remove(tmpPath);
+	}
+	free(fullKey);
+	free(tmpPath);
+	return ok;
+}
+
+void ATLAS_Free(GlyphAtlas *atlas);
+
+// Maps the atlas at path if it was saved with the same key
+// Returns NULL if the file is missing, does not match, or is damaged
+EXPORT GlyphAtlas *ATLAS_Load(const char *path, const char *key) {
+	GlyphAtlas *atlas = calloc(1, sizeof(GlyphAtlas));
+	if (atlas == NULL) return NULL;
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		free(atlas);
+		return NULL;
+	}
+	LARGE_INTEGER size;
+	HANDLE mapping = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	}
+	CloseHandle(file);
+	if (mapping != NULL) {
+		atlas->mapping = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		atlas->mapSize = (size_t)size.QuadPart;
+		CloseHandle(mapping);
+	}
+#else
+	int file = open(path, O_RDONLY);
+	if (file == -1) {
+		free(atlas);
+		return NULL;
+	}
+	struct stat info;
+	if (fstat(file, &info) == 0 && info.st_size > 0) {
+		void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+		if (mapping != MAP_FAILED) {
+			atlas->mapping = mapping;
+			atlas->mapSize = info.st_size;
+		}
+	}
+	close(file);
+#endif
+	if (atlas->mapping == NULL || atlas->mapSize < sizeof(AtlasFileHeader)) {
+		ATLAS_Free(atlas);
+		return NULL;
+	}
+
+	const AtlasFileHeader *header = atlas->mapping;
+	const char *data = atlas->mapping;
+	char *fullKey = atlasKey(key);
+	bool valid = fullKey != NULL &&
+				 memcmp(header->magic, atlasMagic, sizeof(atlasMagic)) == 0 &&
+				 header->version == ATLAS_FILE_VERSION &&
+				 header->keyLen == strlen(fullKey) &&
+				 header->numChars > 0 && header->charWidth > 0 && header->charHeight > 0;
+	size_t offset = 0;
+	if (valid) {
+		offset = atlasPixelOffset(header->keyLen, header->numChars);
+		valid = atlas->mapSize == offset +
+				((size_t)header->numChars * header->charWidth * header->charHeight * 3) &&
+				memcmp(&data[sizeof(AtlasFileHeader)], fullKey, header->keyLen) == 0;
+	}
+	free(fullKey);
+	if (!valid) {
+		ATLAS_Free(atlas);
+		return NULL;
+	}
+
+	atlas->numChars = header->numChars;
+	atlas->charWidth = header->charWidth;
+	atlas->charHeight = header->charHeight;
+	atlas->charMap = &data[sizeof(AtlasFileHeader) + header->keyLen];
+	atlas->pixels = (const unsigned char *)&data[offset];
+	return atlas;
+}
+
+// Unmaps an atlas returned by ATLAS_Load
+EXPORT void ATLAS_Free(GlyphAtlas *atlas) {
+	if (atlas != NULL) {
+		if (atlas->mapping != NULL) {
+		#ifdef _WIN32
+			UnmapViewOfFile(atlas->mapping);
+		#else
+			munmap(atlas->mapping, atlas->mapSize);
+		#endif
+		}
+		free(atlas);
+	}
+}
@@ -0,0 +1,425 @@
+// Benchmark of each stage of the conversion, with and without OpenCL
+// Built as its own executable by bench.sh, so it is not part of artscii.so.
+// Every case converts one image with a number of kernels and a glyph set: a few warmup passes run
+// first, then each stage is timed over many repetitions and summarized as percentiles. Images are
+// synthetic and the same on every run, plus any PPM files given with -image. The output is CSV, or
+// JSON with -json, so results of different builds can be compared.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+extern bool OCL_Init();
+extern void OCL_Cleanup();
+extern bool PRE_Preprocess(const unsigned char *src, size_t srcStride, unsigned int srcBpp, bool bgr,
+		unsigned int width, unsigned int height, bool grey, unsigned char *output, size_t stride);
+extern void NOCL_SetExhaustiveMatch(bool exhaustive);
+extern void nocl_setSimdLevel(int level);
+extern int nocl_getSimdLevel();
+
+extern MultiConvolveArgs *multiConvolveArgs;
+extern NOCL_MultiConvolveArgs *nocl_multiConvolveArgs;
+extern bool setMultiConvolveArgs(const ImageView *img, KernelInfo *kernels, size_t numKernels, bool composed);
+extern bool enqueueMultiConvolve(const ImageView *img, size_t numKernels);
+extern void freeMultiConvolveArgs();
+extern bool enqueueMatches(cl_mem *imgs, cl_mem imgBlock, const cl_event *imgEvents, int *imgSize,
+		int numImgs, const GlyphAtlas *atlas, unsigned char *matches,
+		cl_mem colorImg, unsigned char *outColors);
+extern bool readMatches(int *imgSize, const GlyphAtlas *atlas, unsigned char *matches,
+		unsigned char *outColors);
+extern void freeCharacterMatchArgs();
+extern bool nocl_setMultiConvolveArgs(const ImageView *img, KernelInfo *kernels, const size_t numKernels,
+		bool pass);
+extern bool nocl_runMultiConvolve(const ImageView *img, KernelInfo *kernels, const size_t numKernels);
+extern void nocl_freeMultiConvolveArgs();
+extern bool NOCL_CharacterMatch(const unsigned char *imgs, int *imgSize, const int numImgs,
+		const GlyphAtlas *atlas, unsigned char *matches,
+		const unsigned char *colorImg, unsigned char *outColors);
+extern void nocl_freeCharacterMatchArgs();
+
+#define BENCH_MAX_IMAGES 16
+#define BENCH_MAX_KERNELS 4
+#define BENCH_GLYPH_WIDTH 8
+#define BENCH_GLYPH_HEIGHT 16
+
+// Stages of one conversion, in order. total is the sum of the others.
+enum { STAGE_LOAD, STAGE_CONVOLVE, STAGE_MATCH, STAGE_READBACK, STAGE_TOTAL, NUM_STAGES };
+static const char *stageNames[NUM_STAGES] = { "load", "multiconvolve", "charactermatch", "readback", "total" };
+
+typedef struct BenchImage {
+	char name[64];
+	unsigned char *pixels; // Packed RGB, already preprocessed
+	unsigned int width,
+				 height;
+} BenchImage;
+
+typedef struct BenchOptions {
+	int warmup,
+		reps,
+		threads;
+	bool json,
+		 full,
+		 ocl,
+		 nocl;
+	FILE *out;
+} BenchOptions;
+
+static unsigned int benchSeed;
+
+// xorshift32, so every run generates the same images and glyphs
+static unsigned int benchRandom() {
+	benchSeed ^= benchSeed << 13;
+	benchSeed ^= benchSeed >> 17;
+	benchSeed ^= benchSeed << 5;
+	return benchSeed;
+}
+
+// Builds a width x height image of gradients, blocks and noise, then preprocesses it like the front-end
+bool syntheticImage(BenchImage *img, unsigned int width, unsigned int height) {
+	img->pixels = malloc((size_t)width * height * 3);
+	if (img->pixels == NULL) return false;
+	img->width = width;
+	img->height = height;
+	snprintf(img->name, sizeof(img->name), "synthetic_%ux%u", width, height);
+
+	benchSeed = 0x9e3779b9u ^ (width * 31) ^ height;
+	for (size_t y = 0; y < height; y++) {
+		for (size_t x = 0; x < width; x++) {
+			unsigned char *px = &img->pixels[((y * width) + x) * 3];
+			const unsigned int noise = benchRandom() & 0x1f,
+							   block = (((x / 37) + (y / 23)) % 5) * 40;
+			px[0] = (unsigned char)(((x * 200) / width) + noise);
+			px[1] = (unsigned char)(((y * 200) / height) + noise);
+			px[2] = (unsigned char)(block + noise);
+		}
+	}
+	return PRE_Preprocess(img->pixels, (size_t)width * 3, 3, false, width, height, false, img->pixels,
+						  (size_t)width * 3);
+}
+
+// Reads a binary PPM (P6) image with 8 bits per channel, then preprocesses it like the front-end
+bool loadPpm(BenchImage *img, const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (f == NULL) return false;
+	unsigned int header[3], maxVal;
+	bool ok = fgetc(f) == 'P' && fgetc(f) == '6';
+	for (int i = 0; i < 3 && ok; i++) {
+		// Skips whitespace and comments before each number
+		int c = fgetc(f);
+		while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			if (c == '#') while (c != '\n' && c != EOF) c = fgetc(f);
+			c = fgetc(f);
+		}
+		ungetc(c, f);
+		ok = fscanf(f, "%u", &header[i]) == 1;
+	}
+	maxVal = header[2];
+	ok = ok && fgetc(f) != EOF && maxVal == 255 && header[0] > 0 && header[1] > 0;
+
+	img->pixels = ok? malloc((size_t)header[0] * header[1] * 3) : NULL;
+	ok = img->pixels != NULL &&
+		 fread(img->pixels, 3, (size_t)header[0] * header[1], f) == (size_t)header[0] * header[1];
+	fclose(f);
+	if (!ok) {
+		free(img->pixels);
+		return false;
+	}
+	img->width = header[0];
+	img->height = header[1];
+	const char *name = strrchr(path, '/');
+	snprintf(img->name, sizeof(img->name), "%s", (name != NULL)? name + 1 : path);
+	return PRE_Preprocess(img->pixels, (size_t)img->width * 3, 3, false, img->width, img->height, false,
+						  img->pixels, (size_t)img->width * 3);
+}
+
+// The first numKernels kernels of the front-end (Convolver.cs)
+void benchKernels(KernelInfo *kernels, size_t numKernels) {
+	static const float weights[BENCH_MAX_KERNELS][9] = {
+		{ 0, 0, 0,  0, 1, 0,  0, 0, 0 },       // Unfiltered
+		{ 0, -1, 0,  -1, 5, -1,  0, -1, 0 },   // Sharpen
+		{ -1, -1, -1,  -1, 8, -1,  -1, -1, -1 }, // Edge detection
+		{ 1, 2, 1,  2, 4, 2,  1, 2, 1 }        // Gaussian blur
+	};
+	static const float mults[BENCH_MAX_KERNELS] = { 1.f, 1.f, 50.f, 1.f / 16.f };
+	for (size_t k = 0; k < numKernels; k++) {
+		memset(&kernels[k], 0, sizeof(KernelInfo));
+		kernels[k].width = 3;
+		kernels[k].height = 3;
+		kernels[k].mult = mults[k];
+		kernels[k].invert = false;
+		kernels[k].bufSize = 9;
+		memcpy(kernels[k].buffer, weights[k], sizeof(weights[k]));
+	}
+}
+
+// Builds an atlas of numChars random glyphs, drawn in white over the same grey as real fonts
+bool benchAtlas(GlyphAtlas *atlas, unsigned int numChars) {
+	const size_t charLen = BENCH_GLYPH_WIDTH * BENCH_GLYPH_HEIGHT * 3;
+	char *charMap = malloc(numChars);
+	unsigned char *pixels = malloc(charLen * numChars);
+	if (charMap == NULL || pixels == NULL) {
+		free(charMap);
+		free(pixels);
+		return false;
+	}
+	benchSeed = 0x2545f491u;
+	for (unsigned int c = 0; c < numChars; c++) {
+		charMap[c] = (char)(32 + c);
+		// Denser glyphs further into the set, like the shading characters of a font
+		const unsigned int density = 1 + ((c * 14) / numChars);
+		for (size_t p = 0; p < charLen; p += 3) {
+			const unsigned char v = ((benchRandom() & 15) < density)? 255 : 17;
+			pixels[(c * charLen) + p] = pixels[(c * charLen) + p + 1] = pixels[(c * charLen) + p + 2] = v;
+		}
+	}
+	memset(atlas, 0, sizeof(GlyphAtlas));
+	atlas->numChars = numChars;
+	atlas->charWidth = BENCH_GLYPH_WIDTH;
+	atlas->charHeight = BENCH_GLYPH_HEIGHT;
+	atlas->charMap = charMap;
+	atlas->pixels = pixels;
+	return true;
+}
+
+// Times the stages of one conversion with OpenCL
+// Each stage waits for the device before it ends, so the stages do not overlap as they do in
+// OCL_ToAsciiImage.
+bool oclConvert(const ImageView *img, KernelInfo *kernels, size_t numKernels, const GlyphAtlas *atlas,
+		unsigned char *chars, unsigned char *colors, double *times) {
+	int imgSize[2] = { img->width, img->height };
+	double start = perfNow();
+	bool ok = setMultiConvolveArgs(img, kernels, numKernels, false) &&
+			  clWaitForEvents(1, &multiConvolveArgs->inputEvent) == CL_SUCCESS;
+	times[STAGE_LOAD] = perfNow() - start;
+
+	start = perfNow();
+	ok = ok && enqueueMultiConvolve(img, numKernels) && clFinish(queue) == CL_SUCCESS;
+	times[STAGE_CONVOLVE] = perfNow() - start;
+
+	start = perfNow();
+	ok = ok && enqueueMatches(multiConvolveArgs->outputs, multiConvolveArgs->outputBlock,
+							  multiConvolveArgs->outputEvents, imgSize, numKernels, atlas, chars,
+							  multiConvolveArgs->input, colors) &&
+		 clFinish(queue) == CL_SUCCESS;
+	times[STAGE_MATCH] = perfNow() - start;
+
+	start = perfNow();
+	ok = ok && readMatches(imgSize, atlas, chars, colors);
+	times[STAGE_READBACK] = perfNow() - start;
+
+	freeMultiConvolveArgs();
+	freeCharacterMatchArgs();
+	return ok;
+}
+
+// Times the stages of one conversion without OpenCL
+// The matches are written straight to chars and colors, so readback is always 0.
+bool noclConvert(const ImageView *img, KernelInfo *kernels, size_t numKernels, const GlyphAtlas *atlas,
+		unsigned char *chars, unsigned char *colors, double *times) {
+	int imgSize[2] = { img->width, img->height };
+	double start = perfNow();
+	bool ok = nocl_setMultiConvolveArgs(img, kernels, numKernels, true);
+	times[STAGE_LOAD] = perfNow() - start;
+
+	start = perfNow();
+	ok = ok && nocl_runMultiConvolve(img, kernels, numKernels);
+	times[STAGE_CONVOLVE] = perfNow() - start;
+
+	start = perfNow();
+	ok = ok && NOCL_CharacterMatch(nocl_multiConvolveArgs->outputBlock, imgSize, numKernels, atlas, chars,
+								   nocl_multiConvolveArgs->input, colors);
+	times[STAGE_MATCH] = perfNow() - start;
+	times[STAGE_READBACK] = 0;
+
+	nocl_freeMultiConvolveArgs();
+	nocl_freeCharacterMatchArgs();
+	return ok;
+}
+
+static int compareTimes(const void *a, const void *b) {
+	const double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted times
+static double percentile(const double *sorted, int count, double p) {
+	int rank = (int)((p / 100.0) * count + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > count) rank = count;
+	return sorted[rank - 1];
+}
+
+// Runs one case and writes a record per stage
+bool benchCase(const BenchOptions *o, bool useCL, const BenchImage *bi, size_t numKernels,
+		const GlyphAtlas *atlas, bool *first) {
+	const ImageView img = { bi->pixels, bi->width, bi->height, (size_t)bi->width * 3 };
+	const size_t numCells = ((bi->width / atlas->charWidth) + 1) * (bi->height / atlas->charHeight);
+	KernelInfo kernels[BENCH_MAX_KERNELS];
+	benchKernels(kernels, numKernels);
+	unsigned char *chars = malloc(numCells + 1),
+				  *colors = malloc((numCells * 3) + 1);
+	double *times = malloc(sizeof(double) * NUM_STAGES * o->reps),
+		   rep[NUM_STAGES];
+	bool ok = chars != NULL && colors != NULL && times != NULL;
+
+	for (int r = -o->warmup; r < o->reps && ok; r++) {
+		ok = useCL? oclConvert(&img, kernels, numKernels, atlas, chars, colors, rep) :
+					noclConvert(&img, kernels, numKernels, atlas, chars, colors, rep);
+		rep[STAGE_TOTAL] = rep[STAGE_LOAD] + rep[STAGE_CONVOLVE] + rep[STAGE_MATCH] + rep[STAGE_READBACK];
+		if (r < 0) continue;
+		for (int s = 0; s < NUM_STAGES; s++) times[(s * o->reps) + r] = rep[s];
+	}
+	if (!ok) {
+		fprintf(stderr, "Warning: %s failed on %s with %zu kernels and %u glyphs.\n",
+				useCL? "OCL" : "NOCL", bi->name, numKernels, atlas->numChars);
+	}
+
+	for (int s = 0; s < NUM_STAGES && ok; s++) {
+		double *st = &times[s * o->reps], sum = 0;
+		qsort(st, o->reps, sizeof(double), compareTimes);
+		for (int r = 0; r < o->reps; r++) sum += st[r];
+		const double p50 = percentile(st, o->reps, 50),
+					 mpixPerSec = (p50 > 0)? ((double)bi->width * bi->height / 1e6) / (p50 / 1000.0) : 0;
+		const char *fmt = o->json?
+			"%s\n    { \"backend\": \"%s\", \"image\": \"%s\", \"width\": %u, \"height\": %u, "
+			"\"kernels\": %zu, \"glyphs\": %u, \"stage\": \"%s\", \"reps\": %d, \"mean_ms\": %.3f, "
+			"\"min_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+			"\"mpix_per_s\": %.2f }" :
+			"%s%s,%s,%u,%u,%zu,%u,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f\n";
+		fprintf(o->out, fmt, o->json? (*first? "" : ",") : "", useCL? "OCL" : "NOCL", bi->name, bi->width,
+				bi->height, numKernels, atlas->numChars, stageNames[s], o->reps, sum / o->reps, st[0], p50,
+				percentile(st, o->reps, 90), percentile(st, o->reps, 99), st[o->reps - 1], mpixPerSec);
+		*first = false;
+	}
+	fflush(o->out);
+	free(chars);
+	free(colors);
+	free(times);
+	return ok;
+}
+
+static void usage() {
+	printf("Usage: bench [options]\n"
+		   "  -reps N       Timed repetitions of each case (default 10)\n"
+		   "  -warmup N     Untimed runs before each case (default 2)\n"
+		   "  -threads N    NOCL threads, 0 = one per CPU (default 0)\n"
+		   "  -simd N       Highest NOCL instruction set: 0 = none, 1 = SSE2, 2 = AVX2\n"
+		   "  -image FILE   Also run every case on a binary PPM (P6) image\n"
+		   "  -full         Run every combination of size, kernel count and glyph count\n"
+		   "  -ocl, -nocl   Only run one backend\n"
+		   "  -exhaustive   Compare every character in NOCL_* instead of searching\n"
+		   "  -json         Write JSON instead of CSV\n"
+		   "  -o FILE       Write the results to a file instead of stdout\n");
+}
+
+int main(int argc, char **argv) {
+	static const unsigned int sizes[][2] = { { 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1920, 1080 },
+											 { 3840, 2160 } },
+							  kernelCounts[] = { 1, 2, 4 },
+							  glyphCounts[] = { 16, 95, 224 };
+	// Defaults of the front-end, and the image size the kernel and glyph sweeps use
+	const size_t defaultKernels = 4;
+	const unsigned int defaultGlyphs = 95,
+					   sweepImage = 2;
+	const size_t numSizes = sizeof(sizes) / sizeof(sizes[0]),
+				 numKernelCounts = sizeof(kernelCounts) / sizeof(kernelCounts[0]),
+				 numGlyphCounts = sizeof(glyphCounts) / sizeof(glyphCounts[0]);
+
+	BenchOptions o = { 2, 10, 0, false, false, true, true, stdout };
+	const char *imagePaths[BENCH_MAX_IMAGES];
+	size_t numPaths = 0;
+	for (int a = 1; a < argc; a++) {
+		const bool hasValue = a + 1 < argc;
+		if (!strcmp(argv[a], "-reps") && hasValue) o.reps = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-warmup") && hasValue) o.warmup = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-threads") && hasValue) o.threads = atoi(argv[++a]);
+		else if (!strcmp(argv[a], "-simd") && hasValue) nocl_setSimdLevel(atoi(argv[++a]));
+		else if (!strcmp(argv[a], "-image") && hasValue && numPaths + numSizes < BENCH_MAX_IMAGES) {
+			imagePaths[numPaths++] = argv[++a];
+		}
+		else if (!strcmp(argv[a], "-full")) o.full = true;
+		else if (!strcmp(argv[a], "-ocl")) o.nocl = false;
+		else if (!strcmp(argv[a], "-nocl")) o.ocl = false;
+		else if (!strcmp(argv[a], "-exhaustive")) NOCL_SetExhaustiveMatch(true);
+		else if (!strcmp(argv[a], "-json")) o.json = true;
+		else if (!strcmp(argv[a], "-o") && hasValue) {
+			o.out = fopen(argv[++a], "w");
+			if (o.out == NULL) {
+				fprintf(stderr, "Error: Could not create \"%s\".\n", argv[a]);
+				return 1;
+			}
+		}
+		else {
+			usage();
+			return 1;
+		}
+	}
+	if (o.reps < 1) o.reps = 1;
+	if (o.warmup < 0) o.warmup = 0;
+	nocl_setThreadCount(o.threads);
+
+	BenchImage images[BENCH_MAX_IMAGES];
+	size_t numImages = 0;
+	for (size_t s = 0; s < numSizes; s++) {
+		if (!syntheticImage(&images[numImages], sizes[s][0], sizes[s][1])) {
+			fprintf(stderr, "Error: Not enough memory for a %ux%u image.\n", sizes[s][0], sizes[s][1]);
+			return 1;
+		}
+		numImages++;
+	}
+	for (size_t p = 0; p < numPaths; p++) {
+		if (loadPpm(&images[numImages], imagePaths[p])) numImages++;
+		else fprintf(stderr, "Warning: \"%s\" is not a binary PPM image with 8-bit channels.\n", imagePaths[p]);
+	}
+
+	GlyphAtlas atlases[sizeof(glyphCounts) / sizeof(glyphCounts[0])];
+	for (size_t g = 0; g < numGlyphCounts; g++) {
+		if (!benchAtlas(&atlases[g], glyphCounts[g])) {
+			fprintf(stderr, "Error: Not enough memory for the glyphs.\n");
+			return 1;
+		}
+	}
+
+	if (o.ocl && !OCL_Init()) {
+		fprintf(stderr, "Warning: OpenCL is not available, so only NOCL_* is measured.\n");
+		o.ocl = false;
+	}
+
+	if (o.json) {
+		fprintf(o.out, "{\n  \"version\": \"%s\",\n  \"simd\": %d,\n  \"warmup\": %d,\n  \"results\": [",
+				ARTSCII_VERSION, nocl_getSimdLevel(), o.warmup);
+	}
+	else {
+		fprintf(o.out, "backend,image,width,height,kernels,glyphs,stage,reps,mean_ms,min_ms,p50_ms,p90_ms,"
+					   "p99_ms,max_ms,mpix_per_s\n");
+	}
+
+	// Without -full, sizes run with the default kernels and glyphs, and the kernel and glyph counts
+	// are swept on one size and on every PPM image
+	bool ok = true, first = true;
+	for (int backend = 0; backend < 2; backend++) {
+		const bool useCL = backend == 0;
+		if ((useCL && !o.ocl) || (!useCL && !o.nocl)) continue;
+		for (size_t i = 0; i < numImages; i++) {
+			const bool sweep = o.full || i == sweepImage || i >= numSizes;
+			for (size_t k = 0; k < numKernelCounts; k++) {
+				for (size_t g = 0; g < numGlyphCounts; g++) {
+					const bool isDefault = kernelCounts[k] == defaultKernels && glyphCounts[g] == defaultGlyphs,
+							   inSweep = kernelCounts[k] == defaultKernels || glyphCounts[g] == defaultGlyphs;
+					if (!isDefault && !(sweep && (o.full || inSweep))) continue;
+					ok = benchCase(&o, useCL, &images[i], kernelCounts[k], &atlases[g], &first) && ok;
+				}
+			}
+		}
+	}
+
+	if (o.json) fprintf(o.out, "\n  ]\n}\n");
+	if (o.out != stdout) fclose(o.out);
+	if (o.ocl) OCL_Cleanup();
+	nocl_freeThreadPool();
+	for (size_t i = 0; i < numImages; i++) free(images[i].pixels);
+	for (size_t g = 0; g < numGlyphCounts; g++) {
+		free((char *)atlases[g].charMap);
+		free((unsigned char *)atlases[g].pixels);
+	}
+	return ok? 0 : 1;
+}
@@ -2,156 +2,353 @@
 
 CharacterMatchArgs *characterMatchArgs = NULL;
 
-cl_kernel clkCharacterMatch;
+cl_kernel clkCharacterMatch, clkCharacterMatchAtlas;
+// Kernels of the current match, built for its cell size and number of images when possible
+static cl_kernel matchKernel, matchAtlasKernel;
 
-extern int loadImage(ImageInfo *imgBufs, cl_mem *clBuf, size_t offset);
 
 void freeCharacterMatchArgs() {
 	if (characterMatchArgs != NULL) {
-		if (characterMatchArgs->imgs != NULL) clReleaseMemObject(characterMatchArgs->imgs);
-		if (characterMatchArgs->imgSize != NULL) clReleaseMemObject(characterMatchArgs->imgSize);
-		if (characterMatchArgs->charImg != NULL) clReleaseMemObject(characterMatchArgs->charImg);
-		if (characterMatchArgs->charSize != NULL) clReleaseMemObject(characterMatchArgs->charSize);
-		if (characterMatchArgs->currentChar != NULL) clReleaseMemObject(characterMatchArgs->currentChar);
-		if (characterMatchArgs->diffs != NULL) clReleaseMemObject(characterMatchArgs->diffs);
-		if (characterMatchArgs->matches != NULL) clReleaseMemObject(characterMatchArgs->matches);
-		if (characterMatchArgs->outColors != NULL) clReleaseMemObject(characterMatchArgs->outColors);
+		if (characterMatchArgs->imgs != NULL) statsReleaseBuffer(characterMatchArgs->imgs);
+		if (characterMatchArgs->imgSize != NULL) statsReleaseBuffer(characterMatchArgs->imgSize);
+		for (int i = 0; i < 2; i++) {
+			if (characterMatchArgs->charImgs[i] != NULL) statsReleaseBuffer(characterMatchArgs->charImgs[i]);
+			if (characterMatchArgs->charEvents[i] != NULL) clReleaseEvent(characterMatchArgs->charEvents[i]);
+			if (characterMatchArgs->charMatches[i] != NULL) clReleaseEvent(characterMatchArgs->charMatches[i]);
+		}
+		if (characterMatchArgs->lastMatch != NULL) clReleaseEvent(characterMatchArgs->lastMatch);
+		if (characterMatchArgs->atlas != NULL) statsReleaseBuffer(characterMatchArgs->atlas);
+		if (characterMatchArgs->charMap != NULL) statsReleaseBuffer(characterMatchArgs->charMap);
+		if (characterMatchArgs->charSize != NULL) statsReleaseBuffer(characterMatchArgs->charSize);
+		if (characterMatchArgs->currentChar != NULL) statsReleaseBuffer(characterMatchArgs->currentChar);
+		if (characterMatchArgs->diffs != NULL) statsReleaseBuffer(characterMatchArgs->diffs);
+		if (characterMatchArgs->matches != NULL) statsReleaseBuffer(characterMatchArgs->matches);
+		if (characterMatchArgs->outColors != NULL) statsReleaseBuffer(characterMatchArgs->outColors);
 		free(characterMatchArgs);
 		characterMatchArgs = NULL;
 	}
 }
 
-// Initializes characterMatchArgs
-bool setCharacterMatchArgs(cl_mem *imgs, int *imgSize, int numImgs, ImageInfo *characters,
-		int *charSize, int numChars, char *charMap, unsigned char *matches,
-		cl_mem colorImg, unsigned char *outColors, size_t *globalSize) {
-	freeCharacterMatchArgs();
-	characterMatchArgs = calloc(1, sizeof(CharacterMatchArgs));
+// Returns the work-group size for characterMatchAtlas, or 0 if a cell does not fit in local memory
+// The size is a power of 2 no larger than needed to give each work-item one character
+size_t atlasGroupSize(int numImgs, const int *charSize, int numChars) {
+	size_t maxGroup = 0;
+	cl_ulong localMem = 0, kernelLocalMem = 0;
+	result = clGetKernelWorkGroupInfo(matchAtlasKernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+									  sizeof(size_t), &maxGroup, NULL);
+	if (result != CL_SUCCESS) return 0;
+	result = clGetKernelWorkGroupInfo(matchAtlasKernel, device, CL_KERNEL_LOCAL_MEM_SIZE,
+									  sizeof(cl_ulong), &kernelLocalMem, NULL);
+	if (result != CL_SUCCESS) return 0;
+	result = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMem, NULL);
+	if (result != CL_SUCCESS) return 0;
+
+	size_t groupSize = 1;
+	while (groupSize * 2 <= maxGroup && groupSize * 2 <= ATLAS_MAX_GROUP_SIZE &&
+		   groupSize < (size_t)numChars) groupSize *= 2;
 
-	characterMatchArgs->imgs = clCreateBuffer(context, CL_MEM_READ_ONLY,
-											  imgSize[0] * imgSize[1] * 3 * numImgs, NULL, &result);
+	const cl_ulong cellMem = (cl_ulong)charSize[0] * charSize[1] * 3 * numImgs,
+				   reduceMem = groupSize * (sizeof(cl_uint) + sizeof(cl_int));
+	if (kernelLocalMem + cellMem + reduceMem > localMem) return 0;
+	return groupSize;
+}
+
+// Uploads the atlas and sets the characterMatchAtlas args
+bool setAtlasArgs(int numImgs, const GlyphAtlas *atlas, int *charSize, cl_mem colorImg, size_t groupSize) {
+	const size_t charLen = charSize[0] * charSize[1] * 3;
+	const int numChars = atlas->numChars;
+	characterMatchArgs->atlas = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+												  charLen * numChars, (void *)atlas->pixels);
 	CHECK_RESULT(false)
 
-	for (size_t i = 0; i < numImgs; i++) {
-		result = clEnqueueCopyBuffer(queue, imgs[i], characterMatchArgs->imgs, 0,
-									 i * imgSize[0] * imgSize[1] * 3, imgSize[0] * imgSize[1] * 3,
-									 0, NULL, NULL);
-		CHECK_RESULT(false)
-	}
-	result = clFinish(queue);
+	characterMatchArgs->charMap = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+													sizeof(char) * numChars, (void *)atlas->charMap);
 	CHECK_RESULT(false)
 
-	characterMatchArgs->imgSize = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-									   sizeof(int) * 2, imgSize, &result);
+	result = clSetKernelArg(matchAtlasKernel, 0, sizeof(cl_mem), &characterMatchArgs->imgs);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 1, sizeof(cl_mem), &characterMatchArgs->imgSize);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 2, sizeof(int), &numImgs);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 3, sizeof(cl_mem), &characterMatchArgs->atlas);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 4, sizeof(cl_mem), &characterMatchArgs->charSize);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 5, sizeof(int), &numChars);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 6, sizeof(cl_mem), &characterMatchArgs->charMap);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 7, sizeof(cl_mem), &characterMatchArgs->matches);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 8, sizeof(cl_mem), &colorImg);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 9, sizeof(cl_mem), &characterMatchArgs->outColors);
 	CHECK_RESULT(false)
 
-	characterMatchArgs->charImg = clCreateBuffer(context, CL_MEM_READ_ONLY, 
-											   charSize[0] * charSize[1] * 3, NULL, &result);
+	// Local memory: the cell in every filtered image, then the best match of each work-item
+	result = clSetKernelArg(matchAtlasKernel, 10, charLen * numImgs, NULL);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 11, sizeof(cl_uint) * groupSize, NULL);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchAtlasKernel, 12, sizeof(cl_int) * groupSize, NULL);
 	CHECK_RESULT(false)
 
-	int res = loadImage(characters, &characterMatchArgs->charImg, 0);
-	if (res == -1) return false;
+	return true;
+}
 
-	characterMatchArgs->charBufX = res;
-	characterMatchArgs->charMapX = 1;
-	characterMatchArgs->charSize = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-									   			  sizeof(int) * 2, charSize, &result);
+// Uploads the first character and sets the characterMatch args, for one launch per character
+// copyEvents gets the events that the first launch has to wait on
+bool setPerCharacterArgs(int numImgs, const GlyphAtlas *atlas, int *charSize,
+		cl_mem colorImg, size_t *globalSize, cl_event *copyEvents) {
+	const char *charMap = atlas->charMap;
+	const size_t charLen = charSize[0] * charSize[1] * 3;
+	// Two character buffers, so the next character uploads while the current one is matched
+	for (int i = 0; i < 2; i++) {
+		characterMatchArgs->charImgs[i] = statsCreateBuffer(CL_MEM_READ_ONLY, charLen, NULL);
+		CHECK_RESULT(false)
+	}
+
+	// Characters are uploaded straight from the atlas, which outlives the match
+	result = clEnqueueWriteBuffer(queue, characterMatchArgs->charImgs[0], CL_FALSE, 0, charLen,
+								  atlas->pixels, 0, NULL, &characterMatchArgs->charEvents[0]);
 	CHECK_RESULT(false)
+	statsEvent(characterMatchArgs->charEvents[0], STATS_UPLOAD, -1);
+	statsTransfer(charLen, 0);
+	characterMatchArgs->charMapX = 1;
 
-	characterMatchArgs->currentChar = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-													 sizeof(char), charMap, &result);
+	characterMatchArgs->currentChar = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+														sizeof(char), (void *)charMap);
 	CHECK_RESULT(false)
 
 	unsigned int diffLen = (globalSize[0] - 1) * globalSize[1];
-	unsigned int *diffs = malloc(sizeof(unsigned int) * diffLen);
-	for (size_t d = 0; d < diffLen; d++) diffs[d] = 0xffffffff;
-	characterMatchArgs->diffs = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
-											   sizeof(unsigned int) * diffLen,
-											   diffs, &result);
-	CHECK_RESULT_AND_FREE(diffs)
-	free(diffs);
-
-	characterMatchArgs->matches = clCreateBuffer(context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
-												 sizeof(unsigned char) * globalSize[0] * globalSize[1],
-												 matches, &result);
+	const unsigned int maxDiff = 0xffffffff;
+	characterMatchArgs->diffs = statsCreateBuffer(CL_MEM_READ_WRITE, sizeof(unsigned int) * diffLen, NULL);
 	CHECK_RESULT(false)
-
-	characterMatchArgs->outColors = clCreateBuffer(context, CL_MEM_READ_WRITE,
-												   3 * sizeof(unsigned char) * globalSize[0] * globalSize[1],
-												   NULL, &result);
+	result = clEnqueueFillBuffer(queue, characterMatchArgs->diffs, &maxDiff, sizeof(maxDiff),
+								 0, sizeof(unsigned int) * diffLen, 0, NULL, &copyEvents[0]);
 	CHECK_RESULT(false)
+	statsEvent(copyEvents[0], STATS_MATCH, -1);
+	copyEvents[1] = characterMatchArgs->charEvents[0];
+	clRetainEvent(copyEvents[1]);
 
-	result = clSetKernelArg(clkCharacterMatch, 0, sizeof(cl_mem), &characterMatchArgs->imgs);
+	result = clSetKernelArg(matchKernel, 0, sizeof(cl_mem), &characterMatchArgs->imgs);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchKernel, 1, sizeof(cl_mem), &characterMatchArgs->imgSize);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 1, sizeof(cl_mem), &characterMatchArgs->imgSize);
+	result = clSetKernelArg(matchKernel, 2, sizeof(int), &numImgs);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 2, sizeof(int), &numImgs);
+	result = clSetKernelArg(matchKernel, 4, sizeof(cl_mem), &characterMatchArgs->charSize);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 3, sizeof(cl_mem), &characterMatchArgs->charImg);
+	result = clSetKernelArg(matchKernel, 5, sizeof(char), &charMap[0]);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 4, sizeof(cl_mem), &characterMatchArgs->charSize);
+	result = clSetKernelArg(matchKernel, 6, sizeof(cl_mem), &characterMatchArgs->diffs);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 5, sizeof(char), &charMap[0]);
+	result = clSetKernelArg(matchKernel, 7, sizeof(cl_mem), &characterMatchArgs->matches);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 6, sizeof(cl_mem), &characterMatchArgs->diffs);
+	result = clSetKernelArg(matchKernel, 8, sizeof(cl_mem), &colorImg);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 7, sizeof(cl_mem), &characterMatchArgs->matches);
+	result = clSetKernelArg(matchKernel, 9, sizeof(cl_mem), &characterMatchArgs->outColors);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 8, sizeof(cl_mem), &colorImg);
+	const cl_uint grid[] = { (cl_uint)globalSize[0], (cl_uint)globalSize[1] };
+	result = clSetKernelArg(matchKernel, 10, sizeof(cl_uint), &grid[0]);
 	CHECK_RESULT(false)
-	result = clSetKernelArg(clkCharacterMatch, 9, sizeof(cl_mem), &characterMatchArgs->outColors);
+	result = clSetKernelArg(matchKernel, 11, sizeof(cl_uint), &grid[1]);
+	CHECK_RESULT(false)
+
+	return true;
+}
+
+// Initializes characterMatchArgs
+// imgBlock holds every image back to back, or is NULL if imgs are separate buffers that have to be
+// copied into one. The match starts once the events in imgEvents (one per image) complete.
+// groupSize selects the single-launch atlas matcher, or 0 for one launch per character
+bool setCharacterMatchArgs(cl_mem *imgs, cl_mem imgBlock, const cl_event *imgEvents, int *imgSize,
+		int numImgs, const GlyphAtlas *atlas, int *charSize, unsigned char *matches,
+		cl_mem colorImg, unsigned char *outColors, size_t *globalSize, size_t groupSize) {
+	freeCharacterMatchArgs();
+	characterMatchArgs = calloc(1, sizeof(CharacterMatchArgs));
+
+	// The first match waits on every image, so their events are collected into one marker
+	cl_event *copyEvents = calloc(numImgs + 2, sizeof(cl_event));
+	if (imgBlock != NULL) {
+		characterMatchArgs->imgs = imgBlock;
+		clRetainMemObject(imgBlock);
+		for (size_t i = 0; i < numImgs; i++) {
+			copyEvents[i] = imgEvents[i];
+			clRetainEvent(copyEvents[i]);
+		}
+	}
+	else {
+		characterMatchArgs->imgs = statsCreateBuffer(CL_MEM_READ_ONLY,
+													 imgSize[0] * imgSize[1] * 3 * numImgs, NULL);
+		CHECK_RESULT_AND_FREE(copyEvents)
+		for (size_t i = 0; i < numImgs; i++) {
+			result = clEnqueueCopyBuffer(queue, imgs[i], characterMatchArgs->imgs, 0,
+										 i * imgSize[0] * imgSize[1] * 3, imgSize[0] * imgSize[1] * 3,
+										 1, &imgEvents[i], &copyEvents[i]);
+			CHECK_RESULT_AND_FREE(copyEvents)
+			statsEvent(copyEvents[i], STATS_UPLOAD, -1);
+		}
+	}
+
+	characterMatchArgs->imgSize = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+													sizeof(int) * 2, imgSize);
+	CHECK_RESULT_AND_FREE(copyEvents)
+
+	characterMatchArgs->charSize = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+													 sizeof(int) * 2, charSize);
+	CHECK_RESULT_AND_FREE(copyEvents)
+
+	characterMatchArgs->matches = statsCreateBuffer(CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
+													sizeof(unsigned char) * globalSize[0] * globalSize[1],
+													matches);
+	CHECK_RESULT_AND_FREE(copyEvents)
+
+	characterMatchArgs->outColors = statsCreateBuffer(CL_MEM_READ_WRITE,
+													  3 * sizeof(unsigned char) * globalSize[0] * globalSize[1], NULL);
+	CHECK_RESULT_AND_FREE(copyEvents)
+
+	bool ok = (groupSize > 0)?
+		setAtlasArgs(numImgs, atlas, charSize, colorImg, groupSize) :
+		setPerCharacterArgs(numImgs, atlas, charSize, colorImg, globalSize, &copyEvents[numImgs]);
+	const size_t numEvents = (groupSize > 0)? numImgs : numImgs + 2;
+
+	if (ok) {
+		result = clEnqueueMarkerWithWaitList(queue, numEvents, copyEvents, &characterMatchArgs->lastMatch);
+	}
+	for (size_t i = 0; i < numEvents; i++) {
+		if (copyEvents[i] != NULL) clReleaseEvent(copyEvents[i]);
+	}
+	free(copyEvents);
+	if (!ok) return false;
 	CHECK_RESULT(false)
 
 	return true;
 }
 
 // Switches to the next character for comparison to the image
-bool setNextCharacter(ImageInfo *characters, char *charMap) {
-	int res = loadImage(&characters[characterMatchArgs->charBufX], &characterMatchArgs->charImg, 0);
-	if (res == -1) return false;
-	characterMatchArgs->charBufX += res;
+// Uploads it into the character buffer that the previous match is not using
+bool setNextCharacter(const GlyphAtlas *atlas) {
+	const int next = characterMatchArgs->charMapX % 2;
+	const size_t charLen = atlas->charWidth * atlas->charHeight * 3;
+	if (characterMatchArgs->charEvents[next] != NULL) clReleaseEvent(characterMatchArgs->charEvents[next]);
+	characterMatchArgs->charEvents[next] = NULL;
 
-	result = clSetKernelArg(clkCharacterMatch, 5, sizeof(char), &charMap[characterMatchArgs->charMapX++]);
+	// Only the match that last read this buffer has to finish first
+	const cl_event *wait = &characterMatchArgs->charMatches[next];
+	result = clEnqueueWriteBuffer(queue, characterMatchArgs->charImgs[next], CL_FALSE, 0, charLen,
+								  &atlas->pixels[characterMatchArgs->charMapX * charLen],
+								  (*wait != NULL)? 1 : 0, (*wait != NULL)? wait : NULL,
+								  &characterMatchArgs->charEvents[next]);
 	CHECK_RESULT(false)
-	
+	statsEvent(characterMatchArgs->charEvents[next], STATS_UPLOAD, -1);
+	statsTransfer(charLen, 0);
+	characterMatchArgs->charMapX++;
 	return true;
 }
 
-// Matches ASCII characters and colors to the input Image
-bool OCL_CharacterMatch(cl_mem *imgs, int *imgSize, int numImgs, ImageInfo *characters, int numChars,
-		char *charMap, unsigned char *matches, cl_mem colorImg, unsigned char *outColors) {
-	int charSize[2] = { characters[0].width, characters[0].height };
+// Enqueues the match for charMap[charMapX - 1] once its upload and the previous match are done
+bool enqueueCharacterMatch(const char *charMap, const size_t *globalSize) {
+	const int current = (characterMatchArgs->charMapX - 1) % 2;
+	result = clSetKernelArg(matchKernel, 3, sizeof(cl_mem), &characterMatchArgs->charImgs[current]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(matchKernel, 5, sizeof(char), &charMap[characterMatchArgs->charMapX - 1]);
+	CHECK_RESULT(false)
+
+	cl_event wait[] = { characterMatchArgs->charEvents[current], characterMatchArgs->lastMatch }, match;
+	result = tunedEnqueue(matchKernel, "characterMatch", 2, globalSize, 2, wait, &match);
+	CHECK_RESULT(false)
+	statsEvent(match, STATS_MATCH, characterMatchArgs->charMapX - 1);
+	clReleaseEvent(characterMatchArgs->lastMatch);
+	characterMatchArgs->lastMatch = match;
+	if (characterMatchArgs->charMatches[current] != NULL) clReleaseEvent(characterMatchArgs->charMatches[current]);
+	characterMatchArgs->charMatches[current] = match;
+	clRetainEvent(match);
+	return true;
+}
+
+// Enqueues the matching of ASCII characters and colors to the input Image, without waiting
+// imgEvents holds one event per image that completes when it is ready.
+// imgBlock is the buffer that imgs are sub-buffers of, or NULL if they are separate buffers
+// All characters are matched in one launch when a cell fits in local memory, otherwise
+// characterMatch is launched once per character. characterMatchArgs->lastMatch completes at the end.
+bool enqueueMatches(cl_mem *imgs, cl_mem imgBlock, const cl_event *imgEvents, int *imgSize,
+		int numImgs, const GlyphAtlas *atlas, unsigned char *matches,
+		cl_mem colorImg, unsigned char *outColors) {
+	int charSize[2] = { atlas->charWidth, atlas->charHeight };
+	const int numChars = atlas->numChars;
 	size_t globalSize[2] = { (size_t)((imgSize[0] / charSize[0]) + 1),
 							 (size_t)((imgSize[1] / charSize[1])) };
-	size_t localSize[2] = { 1, 1 };
 
-	if (!setCharacterMatchArgs(imgs, imgSize, numImgs, characters, charSize, numChars,
-							   charMap, matches, colorImg, outColors, globalSize)) return false;
+	char options[SPEC_MATCH_OPTIONS_LEN];
+	matchOptions(options, numImgs, charSize);
+	matchKernel = specializedKernel(options, "characterMatch", clkCharacterMatch);
+	matchAtlasKernel = specializedKernel(options, "characterMatchAtlas", clkCharacterMatchAtlas);
+	const size_t groupSize = atlasGroupSize(numImgs, charSize, numChars);
 
-	while (true) {
-		result = clEnqueueNDRangeKernel(queue, clkCharacterMatch, 2, NULL, 
-			globalSize, localSize, 0, NULL, NULL);
-		CHECK_RESULT(false)
-	
-		result = clFinish(queue);
+	if (!setCharacterMatchArgs(imgs, imgBlock, imgEvents, imgSize, numImgs, atlas, charSize,
+							   matches, colorImg, outColors, globalSize, groupSize)) return false;
+
+	if (groupSize > 0) {
+		// One work-group per cell
+		const size_t atlasGlobalSize[2] = { globalSize[0] * groupSize, globalSize[1] },
+					 atlasLocalSize[2] = { groupSize, 1 };
+		cl_event match;
+		result = clEnqueueNDRangeKernel(queue, matchAtlasKernel, 2, NULL,
+			atlasGlobalSize, atlasLocalSize, 1, &characterMatchArgs->lastMatch, &match);
 		CHECK_RESULT(false)
+		statsEvent(match, STATS_MATCH, -1);
+		clReleaseEvent(characterMatchArgs->lastMatch);
+		characterMatchArgs->lastMatch = match;
+	}
+	else {
+		while (true) {
+			if (!enqueueCharacterMatch(atlas->charMap, globalSize)) return false;
 
-		if (characterMatchArgs->charMapX < numChars) {
-			setNextCharacter(characters, charMap);
+			if (characterMatchArgs->charMapX < numChars) {
+				if (!setNextCharacter(atlas)) return false;
+			}
+			else break;
 		}
-		else break;
 	}
+	return true;
+}
 
-	result = clEnqueueReadBuffer(queue, characterMatchArgs->matches, CL_TRUE,
-		0, sizeof(char) * globalSize[0] * globalSize[1], matches, 0, NULL, NULL);
+// Reads the matched characters and colors back once the last match is done
+bool readMatches(int *imgSize, const GlyphAtlas *atlas, unsigned char *matches,
+		unsigned char *outColors) {
+	const size_t globalSize[2] = { (size_t)((imgSize[0] / atlas->charWidth) + 1),
+								   (size_t)((imgSize[1] / atlas->charHeight)) };
+	cl_event reads[2];
+	result = clEnqueueReadBuffer(queue, characterMatchArgs->matches, CL_FALSE,
+		0, sizeof(char) * globalSize[0] * globalSize[1], matches,
+		1, &characterMatchArgs->lastMatch, &reads[0]);
 	CHECK_RESULT(false)
 
-	result = clEnqueueReadBuffer(queue, characterMatchArgs->outColors, CL_TRUE,
-		0, 3 * sizeof(unsigned char) * globalSize[0] * globalSize[1], outColors, 0, NULL, NULL);
+	result = clEnqueueReadBuffer(queue, characterMatchArgs->outColors, CL_FALSE,
+		0, 3 * sizeof(unsigned char) * globalSize[0] * globalSize[1], outColors,
+		1, &characterMatchArgs->lastMatch, &reads[1]);
+	if (result != CL_SUCCESS) clReleaseEvent(reads[0]);
 	CHECK_RESULT(false)
 
-	result = clFinish(queue);
+	statsEvent(reads[0], STATS_READBACK, -1);
+	statsEvent(reads[1], STATS_READBACK, -1);
+	statsTransfer(0, globalSize[0] * globalSize[1] * 4);
+
+	result = clWaitForEvents(2, reads);
+	clReleaseEvent(reads[0]);
+	clReleaseEvent(reads[1]);
 	CHECK_RESULT(false)
 
 	return true;
 }
+
+// Matches ASCII characters and colors to the input Image
+// The readback at the end is the only point where the host waits for the device.
+bool OCL_CharacterMatch(cl_mem *imgs, cl_mem imgBlock, const cl_event *imgEvents, int *imgSize,
+		int numImgs, const GlyphAtlas *atlas, unsigned char *matches,
+		cl_mem colorImg, unsigned char *outColors) {
+	return enqueueMatches(imgs, imgBlock, imgEvents, imgSize, numImgs, atlas, matches, colorImg, outColors) &&
+		   readMatches(imgSize, atlas, matches, outColors);
+}
@@ -0,0 +1,113 @@
+// Composed kernel mode
+// MultiConvolve normally runs numKernels^2 passes: every kernel k, then every kernel k2 on
+// top of k's output, with each result clamped. Without the intermediate clamps the passes are
+// linear, so every pass that starts with k can be folded into one larger kernel.
+
+#include <math.h>
+#include <stdlib.h>
+#include "artscii.h"
+
+extern bool NOCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels,
+		const size_t numKernels, bool composed);
+extern NOCL_MultiConvolveArgs *nocl_multiConvolveArgs;
+extern void nocl_freeMultiConvolveArgs();
+
+// Fills composed[k] with the sum of all passes that begin with kernels[k]
+// Returns false if a kernel cannot be composed (even size, inverted, too large, or only given as factors)
+bool composeKernels(KernelInfo *kernels, size_t numKernels, KernelInfo *composed) {
+	unsigned int maxW = 0, maxH = 0;
+	for (size_t k = 0; k < numKernels; k++) {
+		if (kernels[k].width % 2 == 0 || kernels[k].height % 2 == 0 || kernels[k].invert ||
+			!kernelHasWeights(&kernels[k])) return false;
+		if (kernels[k].width > maxW) maxW = kernels[k].width;
+		if (kernels[k].height > maxH) maxH = kernels[k].height;
+	}
+	const float alpha = 1.f / (float)numKernels;
+
+	for (size_t k = 0; k < numKernels; k++) {
+		const unsigned int kw = kernels[k].width,
+						   kh = kernels[k].height,
+						   cw = kw + maxW - 1,
+						   ch = kh + maxH - 1;
+		if (cw * ch > KNL_INFO_BUF_SIZE) return false;
+
+		memset(&composed[k], 0, sizeof(KernelInfo));
+		composed[k].width = cw;
+		composed[k].height = ch;
+		composed[k].mult = 1.f;
+		composed[k].invert = false;
+		composed[k].bufSize = cw * ch;
+		float *c = composed[k].buffer;
+
+		for (size_t k2 = 0; k2 < numKernels; k2++) {
+			if (k == k2) {
+				// Single pass, centered in the composed kernel
+				const float scale = kernels[k].mult * alpha;
+				const unsigned int ox = (cw - kw) / 2, oy = (ch - kh) / 2;
+				for (unsigned int y = 0; y < kh; y++) {
+					for (unsigned int x = 0; x < kw; x++) {
+						c[(x + ox) + (cw * (y + oy))] += kernels[k].buffer[x + (kw * y)] * scale;
+					}
+				}
+				continue;
+			}
+			// k2 applied to the output of k: the tap offsets of both kernels add together
+			const unsigned int k2w = kernels[k2].width,
+							   k2h = kernels[k2].height,
+							   ox = (cw - (kw + k2w - 1)) / 2,
+							   oy = (ch - (kh + k2h - 1)) / 2;
+			const float scale = kernels[k].mult * kernels[k2].mult * alpha;
+			for (unsigned int y2 = 0; y2 < k2h; y2++) {
+				for (unsigned int x2 = 0; x2 < k2w; x2++) {
+					const float w2 = kernels[k2].buffer[x2 + (k2w * y2)] * scale;
+					if (w2 == 0.f) continue;
+					for (unsigned int y = 0; y < kh; y++) {
+						for (unsigned int x = 0; x < kw; x++) {
+							c[(x + x2 + ox) + (cw * (y + y2 + oy))] += kernels[k].buffer[x + (kw * y)] * w2;
+						}
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Measures how far the composed mode is from the exact pipeline for one image
+// meanDiff and maxDiff are per color channel, over all filtered images
+EXPORT bool NOCL_CompareComposed(ImageInfo *imgBufs, KernelInfo *kernels, size_t numKernels,
+		int numThreads, double *meanDiff, unsigned int *maxDiff) {
+	const size_t length = imgBufs[0].width * imgBufs[0].height * 3;
+	unsigned char *exact = malloc(length * numKernels);
+	nocl_setThreadCount(numThreads);
+
+	if (exact == NULL || !NOCL_MultiConvolve(imgBufs, kernels, numKernels, false)) {
+		nocl_freeMultiConvolveArgs();
+		free(exact);
+		return false;
+	}
+	for (size_t k = 0; k < numKernels; k++) {
+		memcpy(&exact[k * length], nocl_multiConvolveArgs->outputs[k], length);
+	}
+
+	if (!NOCL_MultiConvolve(imgBufs, kernels, numKernels, true)) {
+		nocl_freeMultiConvolveArgs();
+		free(exact);
+		return false;
+	}
+	unsigned long long total = 0;
+	*maxDiff = 0;
+	for (size_t k = 0; k < numKernels; k++) {
+		const unsigned char *out = nocl_multiConvolveArgs->outputs[k];
+		for (size_t i = 0; i < length; i++) {
+			unsigned int diff = abs((int)out[i] - (int)exact[(k * length) + i]);
+			total += diff;
+			if (diff > *maxDiff) *maxDiff = diff;
+		}
+	}
+	*meanDiff = (double)total / (double)(length * numKernels);
+
+	nocl_freeMultiConvolveArgs();
+	free(exact);
+	return true;
+}
@@ -2,22 +2,48 @@
 
 MultiConvolveArgs *multiConvolveArgs = NULL;
 
-cl_kernel clkConvolve;
+cl_kernel clkConvolve,
+		  clkConvolveRows,
+		  clkConvolveColumns,
+		  clkConvolveTiled;
 
-extern bool AddImg(size_t length, cl_mem imgA, cl_mem imgB, cl_mem *sum);
-extern int loadImage(ImageInfo *imgBufs, cl_mem *clBuf, size_t offset);
+extern bool AddImg(size_t length, cl_mem imgA, cl_mem imgB, cl_mem sum,
+	cl_uint numWait, const cl_event *waitList, cl_event *event);
+extern bool uploadImage(const ImageView *img, cl_mem clBuf, cl_event *event);
+extern bool gatherImage(ImageInfo *imgBufs, unsigned char **pixels, ImageView *img);
+extern bool composeKernels(KernelInfo *kernels, size_t numKernels, KernelInfo *composed);
 
 void freeMultiConvolveArgs() {
 	if (multiConvolveArgs != NULL) {
-		clReleaseMemObject(multiConvolveArgs->input);
+		statsReleaseBuffer(multiConvolveArgs->input);
+		if (multiConvolveArgs->inputEvent != NULL) clReleaseEvent(multiConvolveArgs->inputEvent);
 		for (int i = 0; i < multiConvolveArgs->numKernels; i++) {
-			if (multiConvolveArgs->outputs != NULL) clReleaseMemObject(multiConvolveArgs->outputs[i]);
-			if (multiConvolveArgs->kernels != NULL) clReleaseMemObject(multiConvolveArgs->kernels[i]);
-			if (multiConvolveArgs->knlSizes != NULL) clReleaseMemObject(multiConvolveArgs->knlSizes[i]);
+			if (multiConvolveArgs->outputs != NULL) statsReleaseBuffer(multiConvolveArgs->outputs[i]);
+			if (multiConvolveArgs->outputEvents != NULL && multiConvolveArgs->outputEvents[i] != NULL) {
+				clReleaseEvent(multiConvolveArgs->outputEvents[i]);
+			}
+			if (multiConvolveArgs->firstPasses != NULL) statsReleaseBuffer(multiConvolveArgs->firstPasses[i]);
+			if (multiConvolveArgs->pairPasses != NULL) statsReleaseBuffer(multiConvolveArgs->pairPasses[i]);
+			if (multiConvolveArgs->kernels != NULL) statsReleaseBuffer(multiConvolveArgs->kernels[i]);
+			if (multiConvolveArgs->knlSizes != NULL) statsReleaseBuffer(multiConvolveArgs->knlSizes[i]);
+			if (multiConvolveArgs->rowTaps != NULL && multiConvolveArgs->rowTaps[i] != NULL) {
+				statsReleaseBuffer(multiConvolveArgs->rowTaps[i]);
+			}
+			if (multiConvolveArgs->colTaps != NULL && multiConvolveArgs->colTaps[i] != NULL) {
+				statsReleaseBuffer(multiConvolveArgs->colTaps[i]);
+			}
 		}
+		if (multiConvolveArgs->outputBlock != NULL) statsReleaseBuffer(multiConvolveArgs->outputBlock);
 		if (multiConvolveArgs->outputs != NULL) free(multiConvolveArgs->outputs);
+		if (multiConvolveArgs->outputEvents != NULL) free(multiConvolveArgs->outputEvents);
+		if (multiConvolveArgs->firstPasses != NULL) free(multiConvolveArgs->firstPasses);
+		if (multiConvolveArgs->pairPasses != NULL) free(multiConvolveArgs->pairPasses);
 		if (multiConvolveArgs->kernels != NULL) free(multiConvolveArgs->kernels);
 		if (multiConvolveArgs->knlSizes != NULL) free(multiConvolveArgs->knlSizes);
+		if (multiConvolveArgs->rowTaps != NULL) free(multiConvolveArgs->rowTaps);
+		if (multiConvolveArgs->colTaps != NULL) free(multiConvolveArgs->colTaps);
+		if (multiConvolveArgs->fixedKernels != NULL) free(multiConvolveArgs->fixedKernels);
+		if (multiConvolveArgs->tileSizes != NULL) free(multiConvolveArgs->tileSizes);
 		if (multiConvolveArgs->knlMults != NULL) free(multiConvolveArgs->knlMults);
 		if (multiConvolveArgs->knlInverts != NULL) free(multiConvolveArgs->knlInverts);
 		free(multiConvolveArgs);
@@ -25,30 +51,115 @@ void freeMultiConvolveArgs() {
 	}
 }
 
+// Sets tile to the work-group size of convolveTiled for k and the bytes of its tile, or to 0s if
+// none fits. Starts from TILE_MAX_SIDE on each side and halves the longer side until the group is
+// allowed and its tile fits in local memory, stopping at TILE_MIN_SIDE.
+void tiledGroupSize(const KernelInfo *k, size_t *tile) {
+	size_t maxGroup = 0, maxItems[8] = { 0 };
+	cl_ulong localMem = 0, kernelLocalMem = 0;
+	tile[0] = tile[1] = tile[2] = 0;
+	if (clGetKernelWorkGroupInfo(clkConvolveTiled, device, CL_KERNEL_WORK_GROUP_SIZE,
+								 sizeof(size_t), &maxGroup, NULL) != CL_SUCCESS ||
+		clGetKernelWorkGroupInfo(clkConvolveTiled, device, CL_KERNEL_LOCAL_MEM_SIZE,
+								 sizeof(cl_ulong), &kernelLocalMem, NULL) != CL_SUCCESS ||
+		clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMem, NULL) != CL_SUCCESS ||
+		clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL) != CL_SUCCESS) {
+		return;
+	}
+
+	const cl_ulong rx = k->width / 2,
+				   ry = k->height / 2;
+	size_t x = TILE_MAX_SIDE, y = TILE_MAX_SIDE;
+	while (x * y > maxGroup || x > maxItems[0] || y > maxItems[1] ||
+		   kernelLocalMem + ((x + (2 * rx)) * (y + (2 * ry)) * 3) > localMem) {
+		if (x <= TILE_MIN_SIDE && y <= TILE_MIN_SIDE) return;
+		if (y >= x) y /= 2;
+		else x /= 2;
+	}
+	tile[0] = x;
+	tile[1] = y;
+	tile[2] = (x + (2 * rx)) * (y + (2 * ry)) * 3;
+}
+
 // Loads Kernel information into multiConvolveArgs
+// Kernels only given as factors are expanded, for the passes that cannot run them separably
+// Kernels with few enough taps also get a convolveFixed<k> with their taps baked in (see specialize.c)
 bool loadKernels(KernelInfo *kernelBufs, size_t numKernels) {
 	multiConvolveArgs->kernels = malloc(sizeof(cl_mem) * numKernels);
 	multiConvolveArgs->knlSizes = malloc(sizeof(cl_mem) * numKernels);
+	multiConvolveArgs->rowTaps = calloc(numKernels, sizeof(cl_mem));
+	multiConvolveArgs->colTaps = calloc(numKernels, sizeof(cl_mem));
+	multiConvolveArgs->fixedKernels = calloc(numKernels, sizeof(cl_kernel));
+	multiConvolveArgs->tileSizes = calloc(numKernels * 3, sizeof(size_t));
 	multiConvolveArgs->knlMults = malloc(sizeof(float) * numKernels);
 	multiConvolveArgs->knlInverts = malloc(sizeof(unsigned char) * numKernels);
 	multiConvolveArgs->numKernels = numKernels;
 
 	for (int i = 0; i < numKernels; i++) {
-		multiConvolveArgs->kernels[i] = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-			kernelBufs[i].bufSize * sizeof(float), kernelBufs[i].buffer, &result);
-		CHECK_RESULT(false)
-
 		unsigned int knlSize[2] = { kernelBufs[i].width, kernelBufs[i].height };
-		multiConvolveArgs->knlSizes[i] = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
-			sizeof(unsigned int) * 2, knlSize, &result);
+		float *weights = malloc(sizeof(float) * knlSize[0] * knlSize[1]);
+		if (weights == NULL) return false;
+		expandKernel(&kernelBufs[i], weights);
+		multiConvolveArgs->kernels[i] = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			sizeof(float) * knlSize[0] * knlSize[1], weights);
+		CHECK_RESULT_AND_FREE(weights)
+		free(weights);
+
+		multiConvolveArgs->knlSizes[i] = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+			sizeof(unsigned int) * 2, knlSize);
 		CHECK_RESULT(false)
 
+		if (kernelBufs[i].separable) {
+			multiConvolveArgs->rowTaps[i] = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+				sizeof(float) * knlSize[0], kernelBufs[i].rowTaps);
+			CHECK_RESULT(false)
+			multiConvolveArgs->colTaps[i] = statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+				sizeof(float) * knlSize[1], kernelBufs[i].colTaps);
+			CHECK_RESULT(false)
+		}
+
 		multiConvolveArgs->knlMults[i] = kernelBufs[i].mult;
 		multiConvolveArgs->knlInverts[i] = kernelBufs[i].invert? 1 : 0;
+		tiledGroupSize(&kernelBufs[i], &multiConvolveArgs->tileSizes[i * 3]);
+	}
+
+	char *options = convolveOptions(kernelBufs, numKernels);
+	if (options != NULL) {
+		char name[32];
+		for (size_t i = 0; i < numKernels; i++) {
+			if (!convolveFixable(&kernelBufs[i], i)) continue;
+			snprintf(name, sizeof(name), "convolveFixed%u", (unsigned int)i);
+			multiConvolveArgs->fixedKernels[i] = specializedKernel(options, name, NULL);
+		}
+		free(options);
 	}
 	return true;
 }
 
+// Filter an Image through a Kernel whose taps are baked into a convolveFixed<k>
+bool convolveFixed(cl_mem input, cl_mem output, unsigned int kernelIndex,
+	          const size_t globalWorkSize[], float alpha,
+	          cl_uint numWait, const cl_event *waitList, cl_event *event) {
+	cl_kernel kernel = multiConvolveArgs->fixedKernels[kernelIndex];
+	const cl_uint size[] = { (cl_uint)globalWorkSize[0], (cl_uint)globalWorkSize[1] };
+	result = clSetKernelArg(kernel, 0, sizeof(cl_mem), &input);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(kernel, 1, sizeof(cl_mem), &output);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(kernel, 2, sizeof(float), &alpha);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(kernel, 3, sizeof(cl_uint), &size[0]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(kernel, 4, sizeof(cl_uint), &size[1]);
+	CHECK_RESULT(false)
+
+	// Every convolveFixed<k> shares one tuned local size
+	result = tunedEnqueue(kernel, "convolveFixed", 3, globalWorkSize, numWait, waitList, event);
+	CHECK_RESULT(false)
+	statsEvent(*event, STATS_CONVOLVE, kernelIndex);
+	return true;
+}
+
 // Sets the current Kernel to the one at index i
 bool setStdKernel(size_t i) {
 	result = clSetKernelArg(clkConvolve, 2, sizeof(cl_mem), &multiConvolveArgs->kernels[i]);
@@ -62,22 +173,60 @@ bool setStdKernel(size_t i) {
 	return true;
 }
 
+// Creates the output buffers
+// They are sub-buffers of one block when the device allows it, so the matcher can read them
+// all without copying them into one buffer first
+bool createOutputs(size_t length, size_t numKernels) {
+	multiConvolveArgs->outputs = calloc(numKernels, sizeof(cl_mem));
+	multiConvolveArgs->outputEvents = calloc(numKernels, sizeof(cl_event));
+
+	// Every sub-buffer has to start on the device's base address alignment
+	cl_uint alignBits = 0;
+	result = clGetDeviceInfo(device, CL_DEVICE_MEM_BASE_ADDR_ALIGN, sizeof(cl_uint), &alignBits, NULL);
+	if (result == CL_SUCCESS && alignBits >= 8 && length % (alignBits / 8) == 0) {
+		multiConvolveArgs->outputBlock = statsCreateBuffer(CL_MEM_READ_WRITE, length * numKernels, NULL);
+		CHECK_RESULT(false)
+		for (int k = 0; k < numKernels; k++) {
+			const cl_buffer_region region = { k * length, length };
+			multiConvolveArgs->outputs[k] = clCreateSubBuffer(multiConvolveArgs->outputBlock, CL_MEM_READ_WRITE,
+															  CL_BUFFER_CREATE_TYPE_REGION, &region, &result);
+			CHECK_RESULT(false)
+		}
+		return true;
+	}
+
+	for (int k = 0; k < numKernels; k++) {
+		multiConvolveArgs->outputs[k] = statsCreateBuffer(CL_MEM_READ_WRITE, length, NULL);
+		CHECK_RESULT(false)
+	}
+	return true;
+}
+
 // Initializes multiConvolveArgs
-bool setMultiConvolveArgs(ImageInfo *imgBufs, KernelInfo *kernels, size_t numKernels) {
+// The input upload is enqueued without waiting; inputEvent completes when it is on the device
+// img is read in place, so it has to stay valid until then
+bool setMultiConvolveArgs(const ImageView *img, KernelInfo *kernels, size_t numKernels, bool composed) {
 	freeMultiConvolveArgs();
 	multiConvolveArgs = calloc(1, sizeof(MultiConvolveArgs));
+	const size_t length = img->width * img->height * 3;
 
-	multiConvolveArgs->input = clCreateBuffer(context, CL_MEM_READ_ONLY,
-		imgBufs[0].width * imgBufs[0].height * 3, NULL, &result);
+	multiConvolveArgs->input = statsCreateBuffer(CL_MEM_READ_ONLY, length, NULL);
 	CHECK_RESULT(false)
 
-	if(loadImage(imgBufs, &multiConvolveArgs->input, 0) == -1) return false;
+	if (!uploadImage(img, multiConvolveArgs->input, &multiConvolveArgs->inputEvent)) return false;
 
-	multiConvolveArgs->outputs = malloc(sizeof(cl_mem) * numKernels);
-	for (int k = 0; k < numKernels; k++) {
-		multiConvolveArgs->outputs[k] = clCreateBuffer(context, CL_MEM_READ_WRITE,
-			imgBufs[0].width * imgBufs[0].height * 3, NULL, &result);
-		CHECK_RESULT(false)
+	if (!createOutputs(length, numKernels)) return false;
+
+	// Each kernel gets its own intermediate buffers so the kernels can run concurrently
+	if (!composed) {
+		multiConvolveArgs->firstPasses = calloc(numKernels, sizeof(cl_mem));
+		multiConvolveArgs->pairPasses = calloc(numKernels, sizeof(cl_mem));
+		for (int k = 0; k < numKernels; k++) {
+			multiConvolveArgs->firstPasses[k] = statsCreateBuffer(CL_MEM_READ_WRITE, length, NULL);
+			CHECK_RESULT(false)
+			multiConvolveArgs->pairPasses[k] = statsCreateBuffer(CL_MEM_READ_WRITE, length, NULL);
+			CHECK_RESULT(false)
+		}
 	}
 
 	if (!loadKernels(kernels, numKernels)) return false;
@@ -85,94 +234,233 @@ bool setMultiConvolveArgs(ImageInfo *imgBufs, KernelInfo *kernels, size_t numKer
 	return true;
 }
 
-// Pads an image for use with a Kernel
-bool pad(cl_mem *img, cl_mem *padded, size_t imgW, size_t imgH, size_t kernelW, size_t kernelH) {
-	size_t padW = imgW + kernelW - 1,
-		   padH = imgH + kernelH - 1;
-	unsigned char *temp = calloc(padW * padH * 3, sizeof(unsigned char));
+// Filter an Image through a separable Kernel, as a row pass then a column pass
+// The float rows between the passes are released right away; OpenCL frees them once both passes end
+bool convolveSeparable(cl_mem input, cl_mem output, unsigned int kernelIndex,
+	          const size_t globalWorkSize[], float alpha,
+	          cl_uint numWait, const cl_event *waitList, cl_event *event) {
+	const cl_uint size[] = { (cl_uint)globalWorkSize[0], (cl_uint)globalWorkSize[1] };
+	cl_mem rows = statsCreateBuffer(CL_MEM_READ_WRITE,
+		sizeof(float) * 3 * globalWorkSize[0] * globalWorkSize[1], NULL);
+	CHECK_RESULT(false)
+	cl_event rowsReady = NULL;
 
-	size_t offset = 0; // Start at the beginning of the input
-	size_t padOffset = (padW * 3) + ((kernelW / 2) * 3); // Empty first row + Initial padding for second row
-	for (size_t row = 0; row < imgH; row++) {
-		result = clEnqueueReadBuffer(queue, *img, CL_TRUE, offset, imgW * 3, &temp[padOffset], 0, NULL, NULL);
-		CHECK_RESULT_AND_FREE(temp)
-		offset += imgW * 3;
-		padOffset += padW * 3;
+	result = clSetKernelArg(clkConvolveRows, 0, sizeof(cl_mem), &input);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveRows, 1, sizeof(cl_mem), &rows);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveRows, 2, sizeof(cl_mem),
+													  &multiConvolveArgs->rowTaps[kernelIndex]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveRows, 3, sizeof(cl_mem),
+													  &multiConvolveArgs->knlSizes[kernelIndex]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveRows, 4, sizeof(cl_uint), &size[0]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveRows, 5, sizeof(cl_uint), &size[1]);
+	if (result == CL_SUCCESS) result = tunedEnqueue(clkConvolveRows, "convolveRows", 3, globalWorkSize,
+													numWait, waitList, &rowsReady);
+	if (result == CL_SUCCESS) {
+		statsEvent(rowsReady, STATS_CONVOLVE, kernelIndex);
+		result = clSetKernelArg(clkConvolveColumns, 0, sizeof(cl_mem), &rows);
 	}
-	result = clFinish(queue);
-	CHECK_RESULT_AND_FREE(temp)
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 1, sizeof(cl_mem), &output);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 2, sizeof(cl_mem),
+													  &multiConvolveArgs->colTaps[kernelIndex]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 3, sizeof(cl_mem),
+													  &multiConvolveArgs->knlSizes[kernelIndex]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 4, sizeof(float),
+													  &multiConvolveArgs->knlMults[kernelIndex]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 5, sizeof(unsigned char),
+													  &multiConvolveArgs->knlInverts[kernelIndex]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 6, sizeof(float), &alpha);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 7, sizeof(cl_uint), &size[0]);
+	if (result == CL_SUCCESS) result = clSetKernelArg(clkConvolveColumns, 8, sizeof(cl_uint), &size[1]);
+	if (result == CL_SUCCESS) result = tunedEnqueue(clkConvolveColumns, "convolveColumns", 3, globalWorkSize,
+													1, &rowsReady, event);
 
-	if (padded != NULL) clReleaseMemObject(*padded);
-	*padded = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, padW * padH * 3, temp, &result);
-	CHECK_RESULT_AND_FREE(temp)
+	if (rowsReady != NULL) clReleaseEvent(rowsReady);
+	statsReleaseBuffer(rows);
+	CHECK_RESULT(false)
+	statsEvent(*event, STATS_CONVOLVE, kernelIndex);
+	return true;
+}
+
+// Filter an Image through a Kernel, from tiles of it staged in local memory
+// The global size is padded to whole work-groups of tileSizes[kernelIndex]
+bool convolveTiled(cl_mem input, cl_mem output, unsigned int kernelIndex,
+	          const size_t globalWorkSize[], float alpha,
+	          cl_uint numWait, const cl_event *waitList, cl_event *event) {
+	const size_t *tileSize = &multiConvolveArgs->tileSizes[kernelIndex * 3],
+				 localWorkSize[] = { tileSize[0], tileSize[1], 1 },
+				 paddedWorkSize[] = { ((globalWorkSize[0] + tileSize[0] - 1) / tileSize[0]) * tileSize[0],
+									  ((globalWorkSize[1] + tileSize[1] - 1) / tileSize[1]) * tileSize[1], 1 };
+	const cl_uint size[] = { (cl_uint)globalWorkSize[0], (cl_uint)globalWorkSize[1] };
+	result = clSetKernelArg(clkConvolveTiled, 0, sizeof(cl_mem), &input);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 1, sizeof(cl_mem), &output);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 2, sizeof(cl_mem), &multiConvolveArgs->kernels[kernelIndex]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 3, sizeof(cl_mem), &multiConvolveArgs->knlSizes[kernelIndex]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 4, sizeof(float), &multiConvolveArgs->knlMults[kernelIndex]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 5, sizeof(unsigned char), &multiConvolveArgs->knlInverts[kernelIndex]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 6, sizeof(float), &alpha);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 7, sizeof(cl_uint), &size[0]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 8, sizeof(cl_uint), &size[1]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolveTiled, 9, tileSize[2], NULL);
+	CHECK_RESULT(false)
 
-	free(temp);
+	result = clEnqueueNDRangeKernel(queue, clkConvolveTiled, 3, NULL,
+		paddedWorkSize, localWorkSize, numWait, waitList, event);
+	CHECK_RESULT(false)
+	statsEvent(*event, STATS_CONVOLVE, kernelIndex);
 	return true;
 }
 
 // Filter an Image through a Kernel
-bool convolve(cl_mem *input, ImageInfo imgBuf, KernelInfo kernelBuf, unsigned int kernelIndex,
-	          const size_t globalWorkSize[], const size_t localWorkSize[], float alpha) {
+// Pixels outside the image are treated as 0 by the convolve kernel, so nothing is padded
+// Kernels with a convolveFixed<k> use it, then separable kernels run as two passes, then the others
+// use convolveTiled when their tile fits in local memory
+// The pass starts after the events in waitList, and event is set to the pass itself
+bool convolve(cl_mem input, cl_mem output, unsigned int kernelIndex,
+	          const size_t globalWorkSize[], float alpha,
+	          cl_uint numWait, const cl_event *waitList, cl_event *event) {
+	if (multiConvolveArgs->fixedKernels[kernelIndex] != NULL) {
+		return convolveFixed(input, output, kernelIndex, globalWorkSize, alpha,
+							 numWait, waitList, event);
+	}
+	if (multiConvolveArgs->rowTaps[kernelIndex] != NULL) {
+		return convolveSeparable(input, output, kernelIndex, globalWorkSize, alpha,
+								 numWait, waitList, event);
+	}
+	if (multiConvolveArgs->tileSizes[kernelIndex * 3] != 0) {
+		return convolveTiled(input, output, kernelIndex, globalWorkSize, alpha,
+							 numWait, waitList, event);
+	}
+	const cl_uint size[] = { (cl_uint)globalWorkSize[0], (cl_uint)globalWorkSize[1] };
 	if (!setStdKernel(kernelIndex)) return false;
 
-	cl_event event;
-	cl_mem padded = NULL;
-	pad(input, &padded, imgBuf.width, imgBuf.height, kernelBuf.width, kernelBuf.height);
-	result = clSetKernelArg(clkConvolve, 0, sizeof(cl_mem), &padded);
+	result = clSetKernelArg(clkConvolve, 0, sizeof(cl_mem), &input);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolve, 1, sizeof(cl_mem), &output);
 	CHECK_RESULT(false)
 
 	result = clSetKernelArg(clkConvolve, 6, sizeof(float), &alpha);
 	CHECK_RESULT(false)
-
-	result = clEnqueueNDRangeKernel(queue, clkConvolve, 3, NULL,
-		globalWorkSize, localWorkSize, 0, NULL, &event);
+	result = clSetKernelArg(clkConvolve, 7, sizeof(cl_uint), &size[0]);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(clkConvolve, 8, sizeof(cl_uint), &size[1]);
 	CHECK_RESULT(false)
 
-	result = clFinish(queue);
+	result = tunedEnqueue(clkConvolve, "convolve", 3, globalWorkSize, numWait, waitList, event);
 	CHECK_RESULT(false)
+	statsEvent(*event, STATS_CONVOLVE, kernelIndex);
 
 	return true;
 }
 
-// Run all Kernels to prepare an image for ASCII matching
-EXPORT bool OCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels,
-		size_t numKernels) {
-	if (!setMultiConvolveArgs(imgBufs, kernels, numKernels)) return false;
+// Runs one pass per kernel with kernels already composed by composeKernels()
+bool composedConvolve(const ImageView *img, KernelInfo *composed, size_t numKernels) {
+	if (!setMultiConvolveArgs(img, composed, numKernels, true)) return false;
 
-	const size_t globalWorkSize[] = { imgBufs[0].width + kernels[0].width - 1,
-									  imgBufs[0].height + kernels[0].height - 1,
-									  1 };
-	const size_t localWorkSize[] = { 1, 1, 1 };
+	const size_t globalWorkSize[] = { img->width, img->height, 1 };
+	for (int k = 0; k < numKernels; k++) {
+		if (!convolve(multiConvolveArgs->input, multiConvolveArgs->outputs[k], k,
+					  globalWorkSize, 1.f,
+					  1, &multiConvolveArgs->inputEvent, &multiConvolveArgs->outputEvents[k])) return false;
+	}
+	return true;
+}
 
-	const size_t length = imgBufs[0].width * imgBufs[0].height * 3;
-	cl_mem sum = NULL, totalOutput = NULL;
+// Enqueues every pass of the exact pipeline, on the buffers set by setMultiConvolveArgs
+// Nothing is waited on here: outputEvents[k] completes when outputs[k] is ready
+bool enqueueMultiConvolve(const ImageView *img, size_t numKernels) {
+	const size_t globalWorkSize[] = { img->width, img->height, 1 };
+	const size_t length = img->width * img->height * 3;
+	const float alpha = 1.f / (float)numKernels;
+	const unsigned char zero = 0;
+
+	// Each kernel k is an independent chain of events:
+	// outputs[k] = sum over k2 of k2(k(input)), or k(input) alone when k == k2
 	for (int k = 0; k < numKernels; k++) {
-		result = clSetKernelArg(clkConvolve, 1, sizeof(cl_mem), &multiConvolveArgs->outputs[k]);
+		cl_mem output = multiConvolveArgs->outputs[k],
+			   firstPass = multiConvolveArgs->firstPasses[k],
+			   pairPass = multiConvolveArgs->pairPasses[k];
+		cl_event sumReady, firstReady, pairReady, wait[2];
+
+		result = clEnqueueFillBuffer(queue, output, &zero, sizeof(zero), 0, length, 0, NULL, &sumReady);
 		CHECK_RESULT(false)
-		totalOutput = clCreateBuffer(context, CL_MEM_READ_WRITE, length, NULL, &result);
+		statsEvent(sumReady, STATS_ADD, -1);
+
+		// k(input) is the same for every k2, so it is only run once
+		if (!convolve(multiConvolveArgs->input, firstPass, k, globalWorkSize, 1.f,
+					  1, &multiConvolveArgs->inputEvent, &firstReady)) return false;
+
 		for (int k2 = 0; k2 < numKernels; k2++) {
+			// pairPass is still being read by the previous AddImg until sumReady
+			wait[1] = sumReady;
 			if (k == k2) {
-				if (!convolve(&multiConvolveArgs->input, imgBufs[0], kernels[k], k,
-	          				  globalWorkSize, localWorkSize, 1.f / (float)numKernels)) return false;
+				wait[0] = multiConvolveArgs->inputEvent;
+				if (!convolve(multiConvolveArgs->input, pairPass, k, globalWorkSize,
+							  alpha, 2, wait, &pairReady)) return false;
 			}
 			else {
-				if (!convolve(&multiConvolveArgs->input, imgBufs[0], kernels[k], k,
-	          				  globalWorkSize, localWorkSize, 1.f)) return false;
-
-				if (!convolve(&multiConvolveArgs->outputs[k], imgBufs[0], kernels[k2], k2,
-	          				  globalWorkSize, localWorkSize, 1.f / (float)numKernels)) return false;
-			}
-			if (!AddImg(length, multiConvolveArgs->outputs[k], totalOutput, &sum)) {
-				if (totalOutput != NULL) clReleaseMemObject(totalOutput);
-				if (sum != NULL) clReleaseMemObject(sum);
-				return false;
+				wait[0] = firstReady;
+				if (!convolve(firstPass, pairPass, k2, globalWorkSize,
+							  alpha, 2, wait, &pairReady)) return false;
 			}
-			clReleaseMemObject(totalOutput);
-			totalOutput = sum;
-			sum = NULL;
+			clReleaseEvent(sumReady);
+
+			if (!AddImg(length, pairPass, output, output, 1, &pairReady, &sumReady)) return false;
+			clReleaseEvent(pairReady);
 		}
-		clReleaseMemObject(multiConvolveArgs->outputs[k]);
-		multiConvolveArgs->outputs[k] = totalOutput;
+		clReleaseEvent(firstReady);
+		multiConvolveArgs->outputEvents[k] = sumReady;
 	}
+	// Start the device while the caller enqueues the next stage
+	result = clFlush(queue);
+	CHECK_RESULT(false)
 	return true;
 }
+
+// Run all Kernels to prepare an image for ASCII matching
+// If composed is true, each kernel's passes are folded into one larger kernel (see compose.c)
+// Separable kernels are found first (see separable.c)
+// Nothing is waited on here: outputEvents[k] completes when outputs[k] is ready
+bool multiConvolveImage(const ImageView *img, KernelInfo *kernels,
+		size_t numKernels, bool composed) {
+	KernelInfo *prepared = prepareKernels(kernels, numKernels);
+	if (prepared == NULL) return false;
+	if (composed) {
+		KernelInfo *composedKernels = malloc(sizeof(KernelInfo) * numKernels);
+		if (composeKernels(prepared, numKernels, composedKernels)) {
+			bool ret = composedConvolve(img, composedKernels, numKernels);
+			free(composedKernels);
+			free(prepared);
+			return ret;
+		}
+		free(composedKernels);
+		fprintf(stderr, "Warning: These kernels cannot be composed. Using the exact pipeline.\n");
+	}
+	bool ret = setMultiConvolveArgs(img, prepared, numKernels, false) && enqueueMultiConvolve(img, numKernels);
+	free(prepared);
+	return ret;
+}
+
+// Run all Kernels to prepare an image for ASCII matching
+// Compatibility entry point for images split into ImageInfo buffers
+EXPORT bool OCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels,
+		size_t numKernels, bool composed) {
+	unsigned char *pixels = NULL;
+	ImageView img;
+	if (!gatherImage(imgBufs, &pixels, &img)) return false;
+	bool ret = multiConvolveImage(&img, kernels, numKernels, composed);
+	// The packed copy is uploaded without blocking, so it is only freed once it is on the device
+	if (multiConvolveArgs != NULL && multiConvolveArgs->inputEvent != NULL) {
+		clWaitForEvents(1, &multiConvolveArgs->inputEvent);
+	}
+	free(pixels);
+	return ret;
+}
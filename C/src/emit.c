@@ -0,0 +1,278 @@
+// Text output emitters
+// Writes the output of *_ToAscii as HTML, ANSI 24-bit colour text or plain text in one pass. The
+// document is built in a fixed buffer that is handed to a write callback whenever it fills, so memory
+// use does not depend on the image size. Characters above 127 are written as UTF-8.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+#define EMIT_BUFFER_SIZE 65536
+
+// Writes len bytes of the document; returns false to stop
+typedef bool (*EmitWriteFunc)(const unsigned char *buf, size_t len);
+
+typedef struct Emitter {
+	EmitWriteFunc write;
+	unsigned long long written;
+	size_t len;
+	bool ok;
+	unsigned char buf[EMIT_BUFFER_SIZE];
+} Emitter;
+
+// One colour of the HTML class table
+typedef struct EmitColor {
+	unsigned int key,   // 0xRRGGBB + 1, 0 = empty slot
+				 count;
+	size_t id;          // Index of the second cell with this colour, which names its class
+} EmitColor;
+
+typedef struct EmitColorTable {
+	EmitColor *slots;
+	size_t mask,
+		   *order,      // Slots in the order their colours first appear
+		   numColors;
+} EmitColorTable;
+
+Emitter *emitBegin(EmitWriteFunc write) {
+	Emitter *e = malloc(sizeof(Emitter));
+	if (e == NULL) return NULL;
+	e->write = write;
+	e->written = 0;
+	e->len = 0;
+	e->ok = true;
+	return e;
+}
+
+void emitFlush(Emitter *e) {
+	if (e->ok && e->len > 0) {
+		e->ok = e->write(e->buf, e->len);
+		e->written += e->len;
+	}
+	e->len = 0;
+}
+
+// Writes what is left and frees e
+// Returns false if a write failed. bytesWritten is set to the size of the document if it is not NULL.
+bool emitEnd(Emitter *e, unsigned long long *bytesWritten) {
+	emitFlush(e);
+	const bool ok = e->ok;
+	if (bytesWritten != NULL) *bytesWritten = e->written;
+	free(e);
+	return ok;
+}
+
+static inline void emitBytes(Emitter *e, const char *bytes, size_t len) {
+	if (e->len + len > EMIT_BUFFER_SIZE) emitFlush(e);
+	memcpy(&e->buf[e->len], bytes, len);
+	e->len += len;
+}
+
+static inline void emitString(Emitter *e, const char *str) {
+	const size_t len = strlen(str);
+	if (len > EMIT_BUFFER_SIZE) {
+		// Longer than the buffer, so it is written on its own
+		emitFlush(e);
+		if (e->ok) e->ok = e->write((const unsigned char *)str, len);
+		e->written += len;
+	}
+	else emitBytes(e, str, len);
+}
+
+// Writes a character as UTF-8
+static inline void emitChar(Emitter *e, unsigned char c) {
+	if (e->len + 2 > EMIT_BUFFER_SIZE) emitFlush(e);
+	if (c < 0x80) e->buf[e->len++] = c;
+	else {
+		e->buf[e->len++] = 0xc0 | (c >> 6);
+		e->buf[e->len++] = 0x80 | (c & 0x3f);
+	}
+}
+
+static inline unsigned int emitColorKey(const unsigned char *color) {
+	return ((unsigned int)color[0] << 16) | ((unsigned int)color[1] << 8) | color[2];
+}
+
+// Slot of a colour, or the empty slot where it belongs
+static inline EmitColor *emitFindColor(const EmitColorTable *t, unsigned int key) {
+	size_t s = ((key + 1) * 2654435761u) & t->mask;
+	while (t->slots[s].key != 0 && t->slots[s].key != key + 1) s = (s + 1) & t->mask;
+	return &t->slots[s];
+}
+
+void emitFreeColorTable(EmitColorTable *t) {
+	free(t->slots);
+	free(t->order);
+}
+
+// Counts the colour of every cell, in one pass
+bool emitCountColors(EmitColorTable *t, const unsigned char *colors, size_t numChars) {
+	size_t size = 16;
+	while (size < numChars * 2) size *= 2;
+	t->slots = calloc(size, sizeof(EmitColor));
+	t->order = malloc(sizeof(size_t) * (numChars + 1));
+	t->mask = size - 1;
+	t->numColors = 0;
+	if (t->slots == NULL || t->order == NULL) {
+		emitFreeColorTable(t);
+		return false;
+	}
+	for (size_t i = 0; i < numChars; i++) {
+		const unsigned int key = emitColorKey(&colors[i * 3]);
+		EmitColor *c = emitFindColor(t, key);
+		if (c->key == 0) {
+			c->key = key + 1;
+			t->order[t->numColors++] = c - t->slots;
+		}
+		else if (c->count == 1) c->id = i;
+		c->count++;
+	}
+	return true;
+}
+
+// Writes "#rrggbb"
+static inline void emitHexColor(Emitter *e, unsigned int key) {
+	static const char hex[] = "0123456789abcdef";
+	char str[7] = { '#' };
+	for (int d = 0; d < 6; d++) str[1 + d] = hex[(key >> (20 - (4 * d))) & 0xf];
+	emitBytes(e, str, sizeof(str));
+}
+
+// Writes a cell index in lowercase hex, without leading zeros
+static inline void emitHexIndex(Emitter *e, size_t id) {
+	char str[2 * sizeof(size_t)];
+	size_t len = 0;
+	do {
+		str[sizeof(str) - 1 - len++] = "0123456789abcdef"[id & 0xf];
+		id >>= 4;
+	} while (id > 0);
+	emitBytes(e, &str[sizeof(str) - len], len);
+}
+
+// Writes an unsigned number in decimal
+static inline void emitDecimal(Emitter *e, unsigned int n) {
+	char str[10];
+	size_t len = 0;
+	do {
+		str[sizeof(str) - 1 - len++] = (char)('0' + (n % 10));
+		n /= 10;
+	} while (n > 0);
+	emitBytes(e, &str[sizeof(str) - len], len);
+}
+
+// Writes the output as an HTML document
+// head is written first. Colours used by more than one cell get a CSS class; the others are set on
+// their span. Each run of cells with the same colour on a line shares one span.
+EXPORT bool EMIT_Html(const unsigned char *chars, const unsigned char *colors, size_t numChars,
+		const char *head, const char *fontName, unsigned int fontSize, EmitWriteFunc write,
+		unsigned long long *bytesWritten) {
+	EmitColorTable table;
+	if (!emitCountColors(&table, colors, numChars)) return false;
+	Emitter *e = emitBegin(write);
+	if (e == NULL) {
+		emitFreeColorTable(&table);
+		return false;
+	}
+
+	emitString(e, head);
+	emitString(e, "<!DOCTYPE html><html><head><style>\n");
+	for (size_t i = 0; i < table.numColors; i++) {
+		const EmitColor *c = &table.slots[table.order[i]];
+		if (c->count < 2) continue;
+		emitBytes(e, ".c", 2);
+		emitHexIndex(e, c->id);
+		emitString(e, "{color:");
+		emitHexColor(e, c->key - 1);
+		emitString(e, ";}\n");
+	}
+	emitString(e, "\nbody{font-family:\"");
+	emitString(e, fontName);
+	emitString(e, "\",monospace;font-size:");
+	emitDecimal(e, fontSize);
+	emitString(e, "px;background-color:#111111;white-space:pre;}\n</style></head><body>\n");
+
+	bool inSpan = false;
+	unsigned int last = 0;
+	for (size_t i = 0; i < numChars && e->ok; i++) {
+		const unsigned char ch = chars[i];
+		if (ch == '\n') {
+			emitString(e, "</span><br>");
+			inSpan = false;
+			continue;
+		}
+		const unsigned int key = emitColorKey(&colors[i * 3]);
+		if (!inSpan || key != last) {
+			// Starts a new run
+			if (inSpan) emitString(e, "</span>");
+			const EmitColor *c = emitFindColor(&table, key);
+			if (c->count > 1) {
+				emitString(e, "<span class='c");
+				emitHexIndex(e, c->id);
+				emitString(e, "'>");
+			}
+			else {
+				emitString(e, "<span style='color:");
+				emitHexColor(e, key);
+				emitString(e, ";'>");
+			}
+			inSpan = true;
+			last = key;
+		}
+		switch (ch) {
+			case '&': emitString(e, "&amp;"); break;
+			case '>': emitString(e, "&gt;"); break;
+			case '<': emitString(e, "&lt;"); break;
+			case '"': emitString(e, "&quot;"); break;
+			case '\'': emitString(e, "&#39;"); break;
+			default: emitChar(e, ch);
+		}
+	}
+	emitString(e, "\n</body></html>\n");
+	emitFreeColorTable(&table);
+	return emitEnd(e, bytesWritten);
+}
+
+// Writes the output as text with ANSI 24-bit colour escape codes
+// Each run of cells with the same colour on a line is written after one colour code, and every line
+// ends by resetting the colour.
+EXPORT bool EMIT_Ansi(const unsigned char *chars, const unsigned char *colors, size_t numChars,
+		EmitWriteFunc write, unsigned long long *bytesWritten) {
+	Emitter *e = emitBegin(write);
+	if (e == NULL) return false;
+
+	bool inRun = false;
+	unsigned int last = 0;
+	for (size_t i = 0; i < numChars && e->ok; i++) {
+		const unsigned char ch = chars[i];
+		if (ch == '\n') {
+			if (inRun) emitString(e, "\x1b[0m");
+			emitChar(e, '\n');
+			inRun = false;
+			continue;
+		}
+		const unsigned int key = emitColorKey(&colors[i * 3]);
+		if (!inRun || key != last) {
+			emitString(e, "\x1b[38;2;");
+			emitDecimal(e, colors[i * 3]);
+			emitChar(e, ';');
+			emitDecimal(e, colors[(i * 3) + 1]);
+			emitChar(e, ';');
+			emitDecimal(e, colors[(i * 3) + 2]);
+			emitChar(e, 'm');
+			inRun = true;
+			last = key;
+		}
+		emitChar(e, ch);
+	}
+	if (inRun) emitString(e, "\x1b[0m");
+	return emitEnd(e, bytesWritten);
+}
+
+// Writes the characters of the output as plain text
+EXPORT bool EMIT_Text(const unsigned char *chars, size_t numChars, EmitWriteFunc write,
+		unsigned long long *bytesWritten) {
+	Emitter *e = emitBegin(write);
+	if (e == NULL) return false;
+
+	for (size_t i = 0; i < numChars && e->ok; i++) emitChar(e, chars[i]);
+	return emitEnd(e, bytesWritten);
+}
@@ -0,0 +1,254 @@
+// Fused convolution and matching with OpenCL
+// fusedMatch filters each cell in local memory and matches it in the same launch, so the filtered
+// images are never written to device memory. See nocl_fused.c for the CPU version.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+FusedArgs *fusedArgs = NULL;
+cl_kernel clkFusedMatch;
+// fusedMatch built for the cell size and number of kernels of the current call when possible
+static cl_kernel fusedKernel;
+bool fused = false;
+
+extern bool fusedKernels(const KernelInfo *kernels, size_t numKernels);
+extern bool composeKernels(KernelInfo *kernels, size_t numKernels, KernelInfo *composed);
+extern bool uploadImage(const ImageView *img, cl_mem clBuf, cl_event *event);
+
+void freeFusedArgs() {
+	if (fusedArgs != NULL) {
+		if (fusedArgs->input != NULL) statsReleaseBuffer(fusedArgs->input);
+		if (fusedArgs->imgSize != NULL) statsReleaseBuffer(fusedArgs->imgSize);
+		if (fusedArgs->kernels != NULL) statsReleaseBuffer(fusedArgs->kernels);
+		if (fusedArgs->knlSize != NULL) statsReleaseBuffer(fusedArgs->knlSize);
+		if (fusedArgs->knlMults != NULL) statsReleaseBuffer(fusedArgs->knlMults);
+		if (fusedArgs->knlInverts != NULL) statsReleaseBuffer(fusedArgs->knlInverts);
+		if (fusedArgs->atlas != NULL) statsReleaseBuffer(fusedArgs->atlas);
+		if (fusedArgs->charSize != NULL) statsReleaseBuffer(fusedArgs->charSize);
+		if (fusedArgs->charMap != NULL) statsReleaseBuffer(fusedArgs->charMap);
+		if (fusedArgs->matches != NULL) statsReleaseBuffer(fusedArgs->matches);
+		if (fusedArgs->outColors != NULL) statsReleaseBuffer(fusedArgs->outColors);
+		free(fusedArgs);
+		fusedArgs = NULL;
+	}
+}
+
+// Selects whether OCL_ToAsciiImage filters and matches each cell in one launch
+// Needs kernels of the same odd size and enough local memory, otherwise the separate passes are used.
+EXPORT void OCL_SetFused(bool enable) {
+	fused = enable;
+}
+
+// Returns the work-group size for fusedMatch, or 0 if the kernels cannot be fused or a cell does
+// not fit in local memory
+// The first passes of the exact pipeline are always counted, since composed kernels fall back to it.
+// Also selects the fusedMatch that fusedToAscii() launches.
+size_t fusedGroupSize(const KernelInfo *kernels, size_t numKernels, const GlyphAtlas *atlas) {
+	if (!fusedKernels(kernels, numKernels)) return 0;
+	const int charSize[2] = { atlas->charWidth, atlas->charHeight };
+	char options[SPEC_MATCH_OPTIONS_LEN];
+	matchOptions(options, numKernels, charSize);
+	fusedKernel = specializedKernel(options, "fusedMatch", clkFusedMatch);
+
+	size_t maxGroup = 0;
+	cl_ulong localMem = 0, kernelLocalMem = 0;
+	result = clGetKernelWorkGroupInfo(fusedKernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+									  sizeof(size_t), &maxGroup, NULL);
+	if (result != CL_SUCCESS) return 0;
+	result = clGetKernelWorkGroupInfo(fusedKernel, device, CL_KERNEL_LOCAL_MEM_SIZE,
+									  sizeof(cl_ulong), &kernelLocalMem, NULL);
+	if (result != CL_SUCCESS) return 0;
+	result = clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &localMem, NULL);
+	if (result != CL_SUCCESS) return 0;
+
+	size_t groupSize = 1;
+	while (groupSize * 2 <= maxGroup && groupSize * 2 <= ATLAS_MAX_GROUP_SIZE &&
+		   groupSize < atlas->numChars) groupSize *= 2;
+
+	const cl_ulong cw = atlas->charWidth,
+				   ch = atlas->charHeight,
+				   rx = kernels[0].width / 2,
+				   ry = kernels[0].height / 2,
+				   tileMem = (cw + (4 * rx)) * (ch + (4 * ry)) * 3,
+				   firstMem = (cw + (2 * rx)) * (ch + (2 * ry)) * 3 * numKernels,
+				   cellMem = cw * ch * 3 * numKernels,
+				   reduceMem = groupSize * (sizeof(cl_uint) + sizeof(cl_int));
+	if (kernelLocalMem + tileMem + firstMem + cellMem + reduceMem > localMem) return 0;
+	return groupSize;
+}
+
+// Creates a read-only buffer holding a copy of data
+cl_mem fusedBuffer(size_t size, const void *data) {
+	return statsCreateBuffer(CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, size, (void *)data);
+}
+
+// Uploads the image, kernels and atlas, and sets the fusedMatch args
+bool setFusedArgs(const ImageView *img, const KernelInfo *kernels, size_t numKernels, bool composed,
+		const GlyphAtlas *atlas, int *imgSize, int *charSize, unsigned char *matches,
+		const size_t *globalSize, size_t groupSize, cl_event *uploaded) {
+	freeFusedArgs();
+	fusedArgs = calloc(1, sizeof(FusedArgs));
+	if (fusedArgs == NULL) return false;
+
+	// Kernels are uploaded as flat arrays, like loadKernels() in convolve.c
+	const unsigned int knlSize[2] = { kernels[0].width, kernels[0].height },
+					   knlLen = knlSize[0] * knlSize[1];
+	float *weights = malloc(sizeof(float) * knlLen * numKernels),
+		  *mults = malloc(sizeof(float) * numKernels);
+	unsigned char *inverts = malloc(numKernels);
+	if (weights == NULL || mults == NULL || inverts == NULL) {
+		free(weights);
+		free(mults);
+		free(inverts);
+		return false;
+	}
+	for (size_t k = 0; k < numKernels; k++) {
+		memcpy(&weights[k * knlLen], kernels[k].buffer, sizeof(float) * knlLen);
+		mults[k] = kernels[k].mult;
+		inverts[k] = kernels[k].invert? 1 : 0;
+	}
+	fusedArgs->kernels = fusedBuffer(sizeof(float) * knlLen * numKernels, weights);
+	if (result == CL_SUCCESS) fusedArgs->knlMults = fusedBuffer(sizeof(float) * numKernels, mults);
+	if (result == CL_SUCCESS) fusedArgs->knlInverts = fusedBuffer(numKernels, inverts);
+	free(weights);
+	free(mults);
+	free(inverts);
+	CHECK_RESULT(false)
+	fusedArgs->knlSize = fusedBuffer(sizeof(knlSize), knlSize);
+	CHECK_RESULT(false)
+
+	fusedArgs->input = statsCreateBuffer(CL_MEM_READ_ONLY, (size_t)img->width * img->height * 3, NULL);
+	CHECK_RESULT(false)
+	if (!uploadImage(img, fusedArgs->input, uploaded)) return false;
+
+	fusedArgs->imgSize = fusedBuffer(sizeof(int) * 2, imgSize);
+	CHECK_RESULT(false)
+	fusedArgs->charSize = fusedBuffer(sizeof(int) * 2, charSize);
+	CHECK_RESULT(false)
+	fusedArgs->atlas = fusedBuffer((size_t)charSize[0] * charSize[1] * 3 * atlas->numChars, atlas->pixels);
+	CHECK_RESULT(false)
+	fusedArgs->charMap = fusedBuffer(sizeof(char) * atlas->numChars, atlas->charMap);
+	CHECK_RESULT(false)
+	fusedArgs->matches = statsCreateBuffer(CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
+										   globalSize[0] * globalSize[1], matches);
+	CHECK_RESULT(false)
+	fusedArgs->outColors = statsCreateBuffer(CL_MEM_READ_WRITE, globalSize[0] * globalSize[1] * 3, NULL);
+	CHECK_RESULT(false)
+
+	const int numImgs = numKernels,
+			  numChars = atlas->numChars;
+	const unsigned char isComposed = composed? 1 : 0;
+	result = clSetKernelArg(fusedKernel, 0, sizeof(cl_mem), &fusedArgs->input);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 1, sizeof(cl_mem), &fusedArgs->imgSize);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 2, sizeof(int), &numImgs);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 3, sizeof(cl_mem), &fusedArgs->kernels);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 4, sizeof(cl_mem), &fusedArgs->knlSize);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 5, sizeof(cl_mem), &fusedArgs->knlMults);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 6, sizeof(cl_mem), &fusedArgs->knlInverts);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 7, sizeof(unsigned char), &isComposed);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 8, sizeof(cl_mem), &fusedArgs->atlas);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 9, sizeof(cl_mem), &fusedArgs->charSize);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 10, sizeof(int), &numChars);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 11, sizeof(cl_mem), &fusedArgs->charMap);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 12, sizeof(cl_mem), &fusedArgs->matches);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 13, sizeof(cl_mem), &fusedArgs->outColors);
+	CHECK_RESULT(false)
+
+	// Local memory: the input around the cell, the first passes, the cell in every filtered image,
+	// then the best match of each work-item. Composed kernels skip the first passes, but local
+	// arguments cannot be empty.
+	const size_t rx = composed? knlSize[0] / 4 : knlSize[0] / 2,
+				 ry = composed? knlSize[1] / 4 : knlSize[1] / 2,
+				 tileLen = (charSize[0] + (4 * rx)) * (charSize[1] + (4 * ry)) * 3,
+				 firstLen = composed? 1 : (charSize[0] + (2 * rx)) * (charSize[1] + (2 * ry)) * 3 * numKernels,
+				 cellLen = (size_t)charSize[0] * charSize[1] * 3 * numKernels;
+	result = clSetKernelArg(fusedKernel, 14, tileLen, NULL);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 15, firstLen, NULL);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 16, cellLen, NULL);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 17, sizeof(cl_uint) * groupSize, NULL);
+	CHECK_RESULT(false)
+	result = clSetKernelArg(fusedKernel, 18, sizeof(cl_int) * groupSize, NULL);
+	CHECK_RESULT(false)
+
+	return true;
+}
+
+// Converts an Image to ASCII characters with one fusedMatch launch
+// groupSize comes from fusedGroupSize()
+bool fusedToAscii(const ImageView *img, KernelInfo *kernels, size_t numKernels,
+		const GlyphAtlas *atlas, bool composed, size_t groupSize, unsigned char *outChars,
+		unsigned char *outColors) {
+	int imgSize[2] = { img->width, img->height },
+		charSize[2] = { atlas->charWidth, atlas->charHeight };
+	const size_t globalSize[2] = { (size_t)((imgSize[0] / charSize[0]) + 1),
+								  (size_t)((imgSize[1] / charSize[1])) };
+
+	KernelInfo *composedKernels = NULL;
+	if (composed) {
+		composedKernels = malloc(sizeof(KernelInfo) * numKernels);
+		if (composedKernels == NULL) return false;
+		if (!composeKernels(kernels, numKernels, composedKernels)) {
+			free(composedKernels);
+			composedKernels = NULL;
+			fprintf(stderr, "Warning: These kernels cannot be composed. Using the exact pipeline.\n");
+		}
+	}
+
+	cl_event uploaded = NULL;
+	bool ok = setFusedArgs(img, (composedKernels != NULL)? composedKernels : kernels, numKernels,
+						   composedKernels != NULL, atlas, imgSize, charSize, outChars, globalSize,
+						   groupSize, &uploaded);
+	free(composedKernels);
+	if (!ok) {
+		if (uploaded != NULL) clReleaseEvent(uploaded);
+		return false;
+	}
+
+	// One work-group per cell
+	const size_t fusedGlobalSize[2] = { globalSize[0] * groupSize, globalSize[1] },
+				 fusedLocalSize[2] = { groupSize, 1 };
+	cl_event match;
+	result = clEnqueueNDRangeKernel(queue, fusedKernel, 2, NULL, fusedGlobalSize, fusedLocalSize,
+									1, &uploaded, &match);
+	clReleaseEvent(uploaded);
+	CHECK_RESULT(false)
+	// Filtering and matching are one launch, so its time counts as the match
+	statsEvent(match, STATS_MATCH, -1);
+
+	cl_event reads[2];
+	result = clEnqueueReadBuffer(queue, fusedArgs->matches, CL_FALSE, 0, globalSize[0] * globalSize[1],
+								 outChars, 1, &match, &reads[0]);
+	if (result != CL_SUCCESS) clReleaseEvent(match);
+	CHECK_RESULT(false)
+	result = clEnqueueReadBuffer(queue, fusedArgs->outColors, CL_FALSE, 0,
+								 globalSize[0] * globalSize[1] * 3, outColors, 1, &match, &reads[1]);
+	clReleaseEvent(match);
+	if (result != CL_SUCCESS) clReleaseEvent(reads[0]);
+	CHECK_RESULT(false)
+
+	statsEvent(reads[0], STATS_READBACK, -1);
+	statsEvent(reads[1], STATS_READBACK, -1);
+	statsTransfer(0, globalSize[0] * globalSize[1] * 4);
+
+	result = clWaitForEvents(2, reads);
+	clReleaseEvent(reads[0]);
+	clReleaseEvent(reads[1]);
+	CHECK_RESULT(false)
+	return true;
+}
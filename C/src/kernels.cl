@@ -1,28 +1,42 @@
 R"(
 // Changes here should have corresponding changes in nocl.c
 
+// Match sizes baked in by specialize.c, or read from the kernel arguments
+#ifdef MATCH_NUM_IMGS
+	#define NUM_IMGS MATCH_NUM_IMGS
+	#define CHAR_W MATCH_CHAR_W
+	#define CHAR_H MATCH_CHAR_H
+#else
+	#define NUM_IMGS numImgs
+	#define CHAR_W charSize[0]
+	#define CHAR_H charSize[1]
+#endif
+
 // Filters an image thru a kernel
 // 2D, img[x, y] = global_id[0] + (imgW * global_id[1])
-__kernel void convolve(constant uchar *img, global uchar *output, constant float *k,
-		constant uint *knlSize, float knlMult, uchar knlInvert, float alpha) {
-	size_t px = get_global_id(0),
-		   py = get_global_id(1),
-		   imgW = get_global_size(0),
-		   imgH = get_global_size(1),
-		   xMin = px - (size_t)(knlSize[0] / 2),
-		   xMax = px + (size_t)(knlSize[0] / 2),
-		   yMin = py - (size_t)(knlSize[1] / 2),
-		   yMax = py + (size_t)(knlSize[1] / 2);
-	if (xMin >= imgW || xMax >= imgW || yMin >= imgH || yMax >= imgH) {
-		return;
-	}
+// The global size may be padded past width x height (see tune.c); those work-items do nothing.
+// Pixels outside the image are read as 0, the same as nocl_pad() on the host
+// Each tap reads the input again; convolveTiled reads it once per work-group instead.
+__kernel void convolve(global const uchar *img, global uchar *output, constant float *k,
+		constant uint *knlSize, float knlMult, uchar knlInvert, float alpha, uint width, uint height) {
+	long px = get_global_id(0),
+		 py = get_global_id(1),
+		 imgW = width,
+		 imgH = height,
+		 xMin = px - (long)(knlSize[0] / 2),
+		 xMax = px + (long)(knlSize[0] / 2),
+		 yMin = py - (long)(knlSize[1] / 2),
+		 yMax = py + (long)(knlSize[1] / 2);
 	uchar3 src;
 	float3 pixel = (float3)(0.f, 0.f, 0.f);
-	size_t x = xMin, xRel = 0, y, yRel;
+	long x = xMin, xRel = 0, y, yRel;
 	size_t ip, ik;
+	if (px >= imgW || py >= imgH) return;
 	for (; x <= xMax; x++, xRel++) {
+		if (x < 0 || x >= imgW) continue;
 		yRel = 0;
 		for (y = yMin; y <= yMax; y++, yRel++) {
+			if (y < 0 || y >= imgH) continue;
 			ip = x + (imgW * y);
 			ik = xRel + (knlSize[0] * yRel);
 			src = vload3(ip, img);
@@ -37,14 +51,80 @@ __kernel void convolve(constant uchar *img, global uchar *output, constant float
 	if (knlInvert > 0) pixel = 255.f - pixel;
 	pixel *= alpha;
 	uchar3 out = (uchar3)(pixel.x, pixel.y, pixel.z);
-	size_t i = ((px - (knlSize[0] / 2)) + ((py - (knlSize[1] / 2)) * (imgW - knlSize[0] + 1)));
-	vstore3(out, i, output);
+	vstore3(out, px + (imgW * py), output);
+}
+
+// convolve with the taps of one kernel baked in by specialize.c
+// taps is TAP(dx, dy, weight) for each non-zero weight, in the same order as convolve. Instantiated
+// as convolveFixed<k> at the end of this file, once fusedFinish is declared.
+#define TAP(dx, dy, w) \
+	x = px + (dx); \
+	y = py + (dy); \
+	if (x >= 0 && x < imgW && y >= 0 && y < imgH) pixel += convert_float3(vload3(x + (imgW * y), img)) * (w);
+#define CONVOLVE_FIXED(name, taps, knlMult, knlInvert) \
+	__kernel void name(global const uchar *img, global uchar *output, float alpha, uint width, \
+			uint height) { \
+		long px = get_global_id(0), \
+			 py = get_global_id(1), \
+			 imgW = width, \
+			 imgH = height, \
+			 x, y; \
+		float3 pixel = (float3)(0.f, 0.f, 0.f); \
+		if (px >= imgW || py >= imgH) return; \
+		taps \
+		vstore3(fusedFinish(pixel, knlMult, knlInvert, alpha), px + (imgW * py), output); \
+	}
+
+// Row pass of a separable kernel, into one float per channel
+// 2D, img[x, y] = global_id[0] + (imgW * global_id[1])
+// The CPU version is nocl_separableRows() in nocl_simd.c
+__kernel void convolveRows(global const uchar *img, global float *rows, constant float *rowK,
+		constant uint *knlSize, uint width, uint height) {
+	long px = get_global_id(0),
+		 py = get_global_id(1),
+		 imgW = width,
+		 xMin = px - (long)(knlSize[0] / 2);
+	float3 pixel = (float3)(0.f, 0.f, 0.f);
+	if (px >= imgW || py >= height) return;
+	for (uint i = 0; i < knlSize[0]; i++) {
+		long x = xMin + i;
+		if (x < 0 || x >= imgW || rowK[i] == 0.f) continue;
+		pixel += convert_float3(vload3(x + (imgW * py), img)) * rowK[i];
+	}
+	vstore3(pixel, px + (imgW * py), rows);
+}
+
+// Column pass of a separable kernel, over the rows of convolveRows
+// 2D, img[x, y] = global_id[0] + (imgW * global_id[1])
+// Pixels are finished the same as convolve
+__kernel void convolveColumns(global const float *rows, global uchar *output, constant float *colK,
+		constant uint *knlSize, float knlMult, uchar knlInvert, float alpha, uint width, uint height) {
+	long px = get_global_id(0),
+		 py = get_global_id(1),
+		 imgW = width,
+		 imgH = height,
+		 yMin = py - (long)(knlSize[1] / 2);
+	float3 pixel = (float3)(0.f, 0.f, 0.f);
+	if (px >= imgW || py >= imgH) return;
+	for (uint j = 0; j < knlSize[1]; j++) {
+		long y = yMin + j;
+		if (y < 0 || y >= imgH || colK[j] == 0.f) continue;
+		pixel += vload3(px + (imgW * y), rows) * colK[j];
+	}
+	pixel.x = fmax(fmin(pixel.x * knlMult, 255.f), 0.f);
+	pixel.y = fmax(fmin(pixel.y * knlMult, 255.f), 0.f);
+	pixel.z = fmax(fmin(pixel.z * knlMult, 255.f), 0.f);
+	if (knlInvert > 0) pixel = 255.f - pixel;
+	pixel *= alpha;
+	uchar3 out = (uchar3)(pixel.x, pixel.y, pixel.z);
+	vstore3(out, px + (imgW * py), output);
 }
 
 // Adds two images together
-// 1D, image index = global_id[0]
-__kernel void addImg(global uchar *a, global uchar *b, global uchar *sum) {
+// 1D, image index = global_id[0], for the first length pixels
+__kernel void addImg(global uchar *a, global uchar *b, global uchar *sum, uint length) {
 	size_t i = get_global_id(0);
+	if (i >= length) return;
 	uchar3 a3 = vload3(i, a), b3 = vload3(i, b);
 	float3 s = (float3)(a3.x + b3.x, a3.y + b3.y, a3.z + b3.z);
 	s = (float3)(fmax(fmin(s.x, 255.f), 0.f), fmax(fmin(s.y, 255.f), 0.f), fmax(fmin(s.z, 255.f), 0.f));
@@ -52,51 +132,56 @@ __kernel void addImg(global uchar *a, global uchar *b, global uchar *sum) {
 }
 
 // Multiplies all pixels in an image by a scalar value
-// 1D, image index = global_id[0]
-__kernel void mult(global uchar *a, float m, global uchar *product) {
+// 1D, image index = global_id[0], for the first length pixels
+__kernel void mult(global uchar *a, float m, global uchar *product, uint length) {
 	size_t i = get_global_id(0);
+	if (i >= length) return;
 	uchar3 p = vload3(i, a);
 	float3 ip = (float3)(fmax(fmin(p.x * m, 255.f), 0.f), fmax(fmin(p.y * m, 255.f), 0.f), fmax(fmin(p.z * m, 255.f), 0.f));
 	vstore3((uchar3)(ip.x, ip.y, ip.z), i, product);
 }
 
+// Average original color of a cell, from the sum of its input pixels
+// The input was remapped to (c * 0.75) + 64 by PRE_Preprocess, which is undone once per cell.
+uchar3 cellColor(uint3 sum, uint area) {
+	const uint3 bias = (uint3)(64 * area);
+	return convert_uchar3_sat(select((uint3)(0), ((sum - bias) * 4) / (3 * area), sum > bias));
+}
+
 // Matches characters to parts of an image
 // Work-item is the size in pixels of one character
-__kernel void characterMatch(constant uchar *imgs, constant int *imgSize,
+// 2D, cols x rows cells, the last column being the newlines; padded work-items do nothing
+__kernel void characterMatch(global const uchar *imgs, constant int *imgSize,
 		int numImgs, constant uchar *charImg, constant int *charSize,
 		char currentChar, global uint *diffs, global uchar *matches,
-		constant uchar *colorImg, global uchar *colors) {
-	size_t gID = get_global_id(0) + (get_global_size(0) * get_global_id(1));
-	if (get_global_id(0) == get_global_size(0) - 1) {
+		global const uchar *colorImg, global uchar *colors, uint cols, uint rows) {
+	if (get_global_id(0) >= cols || get_global_id(1) >= rows) return;
+	size_t gID = get_global_id(0) + (cols * get_global_id(1));
+	if (get_global_id(0) == cols - 1) {
 		matches[gID] = '\n';
 		vstore3((uchar3)(255, 255, 255), gID, colors);
 		return;
 	}
 	// diffs has one less column than global size, can't use gID
-	size_t diffID = get_global_id(0) + ((get_global_size(0) - 1) * get_global_id(1));
-	size_t bx = get_global_id(0) * charSize[0],
-		   by = get_global_id(1) * charSize[1],
-		   ex = bx + charSize[0],
-		   ey = by + charSize[1],
+	size_t diffID = get_global_id(0) + ((cols - 1) * get_global_id(1));
+	size_t bx = get_global_id(0) * CHAR_W,
+		   by = get_global_id(1) * CHAR_H,
+		   ex = bx + CHAR_W,
+		   ey = by + CHAR_H,
 		   x, y, xRel, yRel, i, iRel, img;
-	uchar3 pixel, colorPixel, ch;
+	uchar3 pixel, ch;
 	uint3 color = (uint3)(0, 0, 0);
-	uint diff = 0, area = charSize[0] * charSize[1];
+	uint diff = 0, area = CHAR_W * CHAR_H;
 	if (ex > imgSize[0]) ex = imgSize[0];
 	if (ey > imgSize[1]) ey = imgSize[1];
 	for (x = bx, xRel = 0; x < ex; x++, xRel++) {
 		for (y = by, yRel = 0; y < ey; y++, yRel++) {
 			i = x + (imgSize[0] * y);
-			iRel = xRel + (charSize[0] * yRel);
+			iRel = xRel + (CHAR_W * yRel);
 			ch = vload3(iRel, charImg);
-			for (img = 0; img < numImgs; img++) {
+			for (img = 0; img < NUM_IMGS; img++) {
 				pixel = vload3(i + (img * imgSize[0] * imgSize[1]), imgs);
-				if(img == 0) {
-					colorPixel = vload3(i, colorImg);
-					color.x += (colorPixel.x - 64) * 1.333333f;
-					color.y += (colorPixel.y - 64) * 1.333333f;
-					color.z += (colorPixel.z - 64) * 1.333333f;
-				}
+				if(img == 0) color += convert_uint3(vload3(i, colorImg));
 				diff += abs((int)ch.x - (int)pixel.x);
 				diff += abs((int)ch.y - (int)pixel.y);
 				diff += abs((int)ch.z - (int)pixel.z);
@@ -107,6 +192,324 @@ __kernel void characterMatch(constant uchar *imgs, constant int *imgSize,
 		diffs[diffID] = diff;
 		matches[gID] = currentChar;
 	}
-	vstore3((uchar3)(color.x / area, color.y / area, color.z / area), gID, colors);
+	vstore3(cellColor(color, area), gID, colors);
 }
+
+// Matches every character to a cell staged in local memory, and sets its color
+// Called by every work-item of the cell's group. cell[p + (cellLen * img)] with p = xRel + (cw * yRel)
+// holds the cell [bx, ex) x [by, ey) of every filtered image.
+void matchStagedCell(local const uchar *cell, size_t cellLen, size_t cw, int numImgs,
+		global const uchar *atlas, constant int *charSize, int numChars, constant char *charMap,
+		global uchar *matches, constant int *imgSize, global const uchar *colorImg,
+		global uchar *colors, local uint *bestDiffs, local int *bestChars, size_t gID,
+		size_t bx, size_t by, size_t ex, size_t ey) {
+	size_t lID = get_local_id(0),
+		   lSize = get_local_size(0),
+		   charLen = CHAR_W * CHAR_H,
+		   p, c, img, xRel, yRel;
+
+	// Each work-item keeps its best character; ties go to the lower index like characterMatch
+	uint best = 0xffffffff, diff;
+	int bestChar = numChars;
+	uchar3 pixel, ch;
+	for (c = lID; c < numChars; c += lSize) {
+		diff = 0;
+		for (p = 0; p < cellLen; p++) {
+			xRel = p % cw;
+			yRel = p / cw;
+			ch = vload3(xRel + (CHAR_W * yRel) + (c * charLen), atlas);
+			for (img = 0; img < NUM_IMGS; img++) {
+				pixel = vload3(p + (img * cellLen), cell);
+				diff += abs((int)ch.x - (int)pixel.x);
+				diff += abs((int)ch.y - (int)pixel.y);
+				diff += abs((int)ch.z - (int)pixel.z);
+			}
+		}
+		if (diff < best) {
+			best = diff;
+			bestChar = c;
+		}
+	}
+	bestDiffs[lID] = best;
+	bestChars[lID] = bestChar;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (size_t s = lSize / 2; s > 0; s /= 2) {
+		if (lID < s && (bestDiffs[lID + s] < bestDiffs[lID] ||
+			(bestDiffs[lID + s] == bestDiffs[lID] && bestChars[lID + s] < bestChars[lID]))) {
+			bestDiffs[lID] = bestDiffs[lID + s];
+			bestChars[lID] = bestChars[lID + s];
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if (lID != 0) return;
+
+	if (bestChars[0] < numChars) matches[gID] = charMap[bestChars[0]];
+	// Same color as characterMatch
+	uint3 color = (uint3)(0, 0, 0);
+	for (size_t x = bx; x < ex; x++) {
+		for (size_t y = by; y < ey; y++) {
+			color += convert_uint3(vload3(x + (imgSize[0] * y), colorImg));
+		}
+	}
+	vstore3(cellColor(color, charLen), gID, colors);
+}
+
+// Matches every character to the image in one launch
+// 2D, one work-group per cell: group_id[0] = cell column, group_id[1] = cell row
+// atlas holds numChars character images of charSize pixels each, back to back
+// Local size must be a power of 2. cell holds charSize * numImgs pixels, bestDiffs and
+// bestChars hold one value per work-item.
+__kernel void characterMatchAtlas(global const uchar *imgs, constant int *imgSize,
+		int numImgs, global const uchar *atlas, constant int *charSize, int numChars,
+		constant char *charMap, global uchar *matches, global const uchar *colorImg,
+		global uchar *colors, local uchar *cell, local uint *bestDiffs, local int *bestChars) {
+	size_t lID = get_local_id(0),
+		   lSize = get_local_size(0),
+		   cols = get_num_groups(0),
+		   gID = get_group_id(0) + (cols * get_group_id(1));
+	if (get_group_id(0) == cols - 1) {
+		if (lID == 0) {
+			matches[gID] = '\n';
+			vstore3((uchar3)(255, 255, 255), gID, colors);
+		}
+		return;
+	}
+	size_t bx = get_group_id(0) * CHAR_W,
+		   by = get_group_id(1) * CHAR_H,
+		   ex = min(bx + CHAR_W, (size_t)imgSize[0]),
+		   ey = min(by + CHAR_H, (size_t)imgSize[1]),
+		   cw = ex - bx,
+		   cellLen = cw * (ey - by),
+		   imgLen = imgSize[0] * imgSize[1],
+		   p, img, xRel, yRel, i;
+
+	// Stage the cell of every image, cell[p + (cellLen * img)] with p = xRel + (cw * yRel)
+	for (p = lID; p < cellLen * NUM_IMGS; p += lSize) {
+		img = p / cellLen;
+		i = p - (img * cellLen);
+		xRel = i % cw;
+		yRel = i / cw;
+		vstore3(vload3(bx + xRel + (imgSize[0] * (by + yRel)) + (img * imgLen), imgs), p, cell);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	matchStagedCell(cell, cellLen, cw, NUM_IMGS, atlas, charSize, numChars, charMap, matches, imgSize,
+					colorImg, colors, bestDiffs, bestChars, gID, bx, by, ex, ey);
+}
+
+// Sum of one pass of k over src, with the top-left tap on src[x, y]
+// src is srcW pixels wide. Taps are added in the same order as convolve.
+float3 fusedSum(local const uchar *src, size_t srcW, size_t x, size_t y, constant float *k,
+		uint kw, uint kh) {
+	float3 pixel = (float3)(0.f, 0.f, 0.f);
+	uchar3 s;
+	for (size_t xRel = 0; xRel < kw; xRel++) {
+		for (size_t yRel = 0; yRel < kh; yRel++) {
+			s = vload3(x + xRel + (srcW * (y + yRel)), src);
+			pixel.x += s.x * k[xRel + (kw * yRel)];
+			pixel.y += s.y * k[xRel + (kw * yRel)];
+			pixel.z += s.z * k[xRel + (kw * yRel)];
+		}
+	}
+	return pixel;
+}
+
+// Same as the end of convolve
+uchar3 fusedFinish(float3 pixel, float knlMult, uchar knlInvert, float alpha) {
+	pixel.x = fmax(fmin(pixel.x * knlMult, 255.f), 0.f);
+	pixel.y = fmax(fmin(pixel.y * knlMult, 255.f), 0.f);
+	pixel.z = fmax(fmin(pixel.z * knlMult, 255.f), 0.f);
+	if (knlInvert > 0) pixel = 255.f - pixel;
+	pixel *= alpha;
+	return (uchar3)(pixel.x, pixel.y, pixel.z);
+}
+
+// Filters and matches one cell in local memory, without writing the filtered images
+// 2D, one work-group per cell, like characterMatchAtlas
+// knls holds numImgs kernels of knlSize taps, back to back. With composed they are composed kernels
+// (see compose.c), run once each. Otherwise every pair of kernels is run, like the separate passes.
+// tile holds the input with 2 * r pixels around the cell, where r is half the size of the original
+// kernels. first holds the first pass of every kernel with r pixels around the cell (unused with
+// composed). cell, bestDiffs and bestChars are the same as in characterMatchAtlas.
+__kernel void fusedMatch(global const uchar *img, constant int *imgSize, int numImgs,
+		constant float *knls, constant uint *knlSize, constant float *knlMults,
+		constant uchar *knlInverts, uchar composed, global const uchar *atlas,
+		constant int *charSize, int numChars, constant char *charMap, global uchar *matches,
+		global uchar *colors, local uchar *tile, local uchar *first, local uchar *cell,
+		local uint *bestDiffs, local int *bestChars) {
+	size_t lID = get_local_id(0),
+		   lSize = get_local_size(0),
+		   cols = get_num_groups(0),
+		   gID = get_group_id(0) + (cols * get_group_id(1));
+	if (get_group_id(0) == cols - 1) {
+		if (lID == 0) {
+			matches[gID] = '\n';
+			vstore3((uchar3)(255, 255, 255), gID, colors);
+		}
+		return;
+	}
+	// The grid only has whole cells, so a cell never crosses the edge of the image
+	const uint kw = knlSize[0],
+			   kh = knlSize[1],
+			   kLen = kw * kh,
+			   rx = composed? kw / 4 : kw / 2,
+			   ry = composed? kh / 4 : kh / 2;
+	const size_t bx = get_group_id(0) * CHAR_W,
+				 by = get_group_id(1) * CHAR_H,
+				 cw = CHAR_W,
+				 cellLen = cw * CHAR_H,
+				 tileW = cw + (4 * rx),
+				 tileLen = tileW * (CHAR_H + (4 * ry)),
+				 firstW = cw + (2 * rx),
+				 firstLen = firstW * (CHAR_H + (2 * ry));
+	size_t p, i, k, k2, x, y;
+	long ix, iy;
+	uchar3 pixel;
+
+	// Pixels outside the image are read as 0, like convolve
+	for (p = lID; p < tileLen; p += lSize) {
+		ix = (long)(bx + (p % tileW)) - (long)(2 * rx);
+		iy = (long)(by + (p / tileW)) - (long)(2 * ry);
+		pixel = (uchar3)(0, 0, 0);
+		if (ix >= 0 && ix < imgSize[0] && iy >= 0 && iy < imgSize[1]) {
+			pixel = vload3(ix + (imgSize[0] * iy), img);
+		}
+		vstore3(pixel, p, tile);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	if (composed) {
+		for (p = lID; p < cellLen * NUM_IMGS; p += lSize) {
+			k = p / cellLen;
+			i = p - (k * cellLen);
+			pixel = fusedFinish(fusedSum(tile, tileW, i % cw, i / cw, &knls[k * kLen], kw, kh),
+								knlMults[k], knlInverts[k], 1.f);
+			vstore3(pixel, p, cell);
+		}
+	}
+	else {
+		// k(input), which is 0 outside the image like the output of convolve
+		for (p = lID; p < firstLen * NUM_IMGS; p += lSize) {
+			k = p / firstLen;
+			i = p - (k * firstLen);
+			x = i % firstW;
+			y = i / firstW;
+			ix = (long)(bx + x) - (long)rx;
+			iy = (long)(by + y) - (long)ry;
+			pixel = (uchar3)(0, 0, 0);
+			if (ix >= 0 && ix < imgSize[0] && iy >= 0 && iy < imgSize[1]) {
+				pixel = fusedFinish(fusedSum(tile, tileW, x, y, &knls[k * kLen], kw, kh),
+									knlMults[k], knlInverts[k], 1.f);
+			}
+			vstore3(pixel, p, first);
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		// Sum over k2 of k2(k(input)), or k(input) alone when k == k2, clamped like addImg
+		const float alpha = 1.f / (float)NUM_IMGS;
+		for (p = lID; p < cellLen * NUM_IMGS; p += lSize) {
+			k = p / cellLen;
+			i = p - (k * cellLen);
+			x = i % cw;
+			y = i / cw;
+			uint3 sum = (uint3)(0, 0, 0);
+			for (k2 = 0; k2 < NUM_IMGS; k2++) {
+				if (k == k2) {
+					pixel = fusedFinish(fusedSum(tile, tileW, x + rx, y + ry, &knls[k * kLen], kw, kh),
+										knlMults[k], knlInverts[k], alpha);
+				}
+				else {
+					pixel = fusedFinish(fusedSum(&first[k * firstLen * 3], firstW, x, y, &knls[k2 * kLen],
+												 kw, kh), knlMults[k2], knlInverts[k2], alpha);
+				}
+				sum = min(sum + convert_uint3(pixel), (uint3)(255, 255, 255));
+			}
+			vstore3(convert_uchar3(sum), p, cell);
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	matchStagedCell(cell, cellLen, cw, NUM_IMGS, atlas, charSize, numChars, charMap, matches, imgSize,
+					img, colors, bestDiffs, bestChars, gID, bx, by, bx + cw, by + CHAR_H);
+}
+
+// Filters an image thru a kernel, like convolve, from a tile of it in local memory
+// 2D, the global size is padded to a multiple of the local size, and work-items past width x height
+// only help load the tile. Each work-group loads its pixels and the r pixels around them once, where
+// r is half the size of the kernel, then every tap reads the tile.
+// tile holds (local_size[0] + 2 * rx) x (local_size[1] + 2 * ry) pixels. Taps are added in the same
+// order as convolve, so the output is the same.
+__kernel void convolveTiled(global const uchar *img, global uchar *output, constant float *k,
+		constant uint *knlSize, float knlMult, uchar knlInvert, float alpha, uint width, uint height,
+		local uchar *tile) {
+	const long rx = knlSize[0] / 2,
+			   ry = knlSize[1] / 2,
+			   lx = get_local_id(0),
+			   ly = get_local_id(1),
+			   lw = get_local_size(0),
+			   lh = get_local_size(1),
+			   tileW = lw + (2 * rx),
+			   tileLen = tileW * (lh + (2 * ry)),
+			   ox = (get_group_id(0) * lw) - rx,
+			   oy = (get_group_id(1) * lh) - ry,
+			   px = get_global_id(0),
+			   py = get_global_id(1),
+			   imgW = width,
+			   imgH = height;
+	long p, x, y, xRel, yRel;
+	uchar3 src;
+
+	// Pixels outside the image are staged as 0
+	for (p = lx + (lw * ly); p < tileLen; p += lw * lh) {
+		x = ox + (p % tileW);
+		y = oy + (p / tileW);
+		src = (uchar3)(0, 0, 0);
+		if (x >= 0 && x < imgW && y >= 0 && y < imgH) src = vload3(x + (imgW * y), img);
+		vstore3(src, p, tile);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+	if (px >= imgW || py >= imgH) return;
+
+	float3 pixel = (float3)(0.f, 0.f, 0.f);
+	size_t ik;
+	for (x = px - rx, xRel = 0; xRel <= 2 * rx; x++, xRel++) {
+		if (x < 0 || x >= imgW) continue;
+		for (y = py - ry, yRel = 0; yRel <= 2 * ry; y++, yRel++) {
+			if (y < 0 || y >= imgH) continue;
+			ik = xRel + (knlSize[0] * yRel);
+			src = vload3(lx + xRel + (tileW * (ly + yRel)), tile);
+			pixel.x += src.x * k[ik];
+			pixel.y += src.y * k[ik];
+			pixel.z += src.z * k[ik];
+		}
+	}
+	vstore3(fusedFinish(pixel, knlMult, knlInvert, alpha), px + (imgW * py), output);
+}
+
+// Kernels baked in by specialize.c, see CONVOLVE_FIXED
+#ifdef KNL0_TAPS
+CONVOLVE_FIXED(convolveFixed0, KNL0_TAPS, KNL0_MULT, KNL0_INVERT)
+#endif
+#ifdef KNL1_TAPS
+CONVOLVE_FIXED(convolveFixed1, KNL1_TAPS, KNL1_MULT, KNL1_INVERT)
+#endif
+#ifdef KNL2_TAPS
+CONVOLVE_FIXED(convolveFixed2, KNL2_TAPS, KNL2_MULT, KNL2_INVERT)
+#endif
+#ifdef KNL3_TAPS
+CONVOLVE_FIXED(convolveFixed3, KNL3_TAPS, KNL3_MULT, KNL3_INVERT)
+#endif
+#ifdef KNL4_TAPS
+CONVOLVE_FIXED(convolveFixed4, KNL4_TAPS, KNL4_MULT, KNL4_INVERT)
+#endif
+#ifdef KNL5_TAPS
+CONVOLVE_FIXED(convolveFixed5, KNL5_TAPS, KNL5_MULT, KNL5_INVERT)
+#endif
+#ifdef KNL6_TAPS
+CONVOLVE_FIXED(convolveFixed6, KNL6_TAPS, KNL6_MULT, KNL6_INVERT)
+#endif
+#ifdef KNL7_TAPS
+CONVOLVE_FIXED(convolveFixed7, KNL7_TAPS, KNL7_MULT, KNL7_INVERT)
+#endif
 )"
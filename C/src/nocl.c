@@ -96,6 +96,15 @@ void nocl_kMult(const uchar *a, float m, uchar *product, const size_t global_id)
 	nocl_vstore3(p, global_id, product);
 }
 
+// Average original color of a cell, from the sum of one channel of its input pixels
+// The input was remapped to (c * 0.75) + 64 by PRE_Preprocess, which is undone once per cell.
+uchar nocl_cellColor(uint sum, uint area) {
+	const uint bias = 64 * area;
+	if (sum <= bias) return 0;
+	const uint c = ((sum - bias) * 4) / (3 * area);
+	return (c > 255)? 255 : (uchar)c;
+}
+
 // Matches characters to parts of an image
 // Work-item is the size in pixels of one character
 void nocl_kCharacterMatch(const uchar *imgs, const int *imgSize,
@@ -131,9 +140,9 @@ void nocl_kCharacterMatch(const uchar *imgs, const int *imgSize,
 				nocl_vload3(pixel, i + (img * imgSize[0] * imgSize[1]), imgs);
 				if(img == 0) {
 					nocl_vload3(colorPixel, i, colorImg);
-					color[0] += (colorPixel[0] - 64) * 1.333333f;
-					color[1] += (colorPixel[1] - 64) * 1.333333f;
-					color[2] += (colorPixel[2] - 64) * 1.333333f;
+					color[0] += colorPixel[0];
+					color[1] += colorPixel[1];
+					color[2] += colorPixel[2];
 				}
 				diff += abs((int)ch[0] - (int)pixel[0]);
 				diff += abs((int)ch[1] - (int)pixel[1]);
@@ -146,20 +155,19 @@ void nocl_kCharacterMatch(const uchar *imgs, const int *imgSize,
 		matches[gID] = currentChar;
 	}
 	uchar out[3];
-	out[0] = (uchar)(color[0] / area);
-	out[1] = (uchar)(color[1] / area);
-	out[2] = (uchar)(color[2] / area);
+	out[0] = nocl_cellColor(color[0], area);
+	out[1] = nocl_cellColor(color[1], area);
+	out[2] = nocl_cellColor(color[2], area);
 	nocl_vstore3(out, gID, colors);
 }
 
 
+// Copies an image split into ImageInfo buffers into charBuf, starting at offset
 // Returns the number of buffers processed
 int nocl_loadImage(ImageInfo *imgBufs, unsigned char *charBuf, size_t offset) {
 	size_t i = 0;
 	while (true) {
-		for (size_t j = offset, k = 0; k < imgBufs[i].bufSize; j++, k++) {
-			charBuf[j] = imgBufs[i].buffer[k];
-		}
+		memcpy(&charBuf[offset], imgBufs[i].buffer, imgBufs[i].bufSize);
 		offset += imgBufs[i].bufSize;
 		if (imgBufs[i].final) break;
 		i++;
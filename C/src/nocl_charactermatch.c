@@ -1,8 +1,28 @@
+#include <stdlib.h>
 #include "artscii.h"
 
 NOCL_CharacterMatchArgs *nocl_characterMatchArgs = NULL;
+bool nocl_exhaustiveMatch = false;
+// Pixels compared by the search matcher, and the pixels an exhaustive match would compare
+unsigned long long nocl_visitedPixels = 0,
+				   nocl_totalPixels = 0;
+// Cells where the pyramid search picked the same character as the full search
+bool nocl_checkTopK = false;
+unsigned long long nocl_agreedCells = 0,
+				   nocl_checkedCells = 0;
 
-extern int nocl_loadImage(ImageInfo *imgBufs, unsigned char *charBuf, size_t offset);
+extern NOCL_Pyramid *nocl_pyramid;
+extern size_t nocl_topK;
+extern bool nocl_setPyramid(const unsigned char *atlas, const int *charSize, const int numChars);
+extern void nocl_freePyramid();
+extern NOCL_PyramidCell *nocl_newPyramidCell(const int numImgs);
+extern void nocl_freePyramidCell(NOCL_PyramidCell *cell);
+extern size_t nocl_pyramidCandidates(NOCL_PyramidCell *cell, const unsigned char *pixels,
+		const int *charSize, const int numChars, const int numImgs);
+
+extern void nocl_vload3(unsigned char *u3, size_t index, const unsigned char *data);
+extern void nocl_vstore3(const unsigned char *u3, size_t index, unsigned char *data);
+extern unsigned char nocl_cellColor(unsigned int sum, unsigned int area);
 extern void nocl_kCharacterMatch(const unsigned char *imgs, const int *imgSize,
 		int numImgs, const unsigned char *charImg, const int *charSize,
 		char currentChar, unsigned int *diffs, unsigned char *matches,
@@ -11,89 +31,469 @@ extern void nocl_kCharacterMatch(const unsigned char *imgs, const int *imgSize,
 
 void nocl_freeCharacterMatchArgs() {
 	if (nocl_characterMatchArgs != NULL) {
-		if (nocl_characterMatchArgs->imgs != NULL) free(nocl_characterMatchArgs->imgs);
-		if (nocl_characterMatchArgs->charImg != NULL) free(nocl_characterMatchArgs->charImg);
+		statsFree(nocl_characterMatchArgs->diffs);
 		if (nocl_characterMatchArgs->diffs != NULL) free(nocl_characterMatchArgs->diffs);
+		if (nocl_characterMatchArgs->charSums != NULL) free(nocl_characterMatchArgs->charSums);
+		if (nocl_characterMatchArgs->sortedChars != NULL) free(nocl_characterMatchArgs->sortedChars);
+		nocl_freePyramid();
 		free(nocl_characterMatchArgs);
 		nocl_characterMatchArgs = NULL;
 	}
 }
 
+// Sorts character indices by ascending charSums
+int nocl_compareCharSums(const void *a, const void *b) {
+	const unsigned int sa = nocl_characterMatchArgs->charSums[*(const int *)a],
+					   sb = nocl_characterMatchArgs->charSums[*(const int *)b];
+	if (sa != sb) return (sa < sb)? -1 : 1;
+	return *(const int *)a - *(const int *)b;
+}
+
+// Sorts the characters of the atlas for the search matcher
+bool nocl_setAtlas(const int *charSize, const int numChars) {
+	const size_t charLen = charSize[0] * charSize[1] * 3;
+	nocl_characterMatchArgs->charSums = calloc(numChars, sizeof(unsigned int));
+	nocl_characterMatchArgs->sortedChars = malloc(sizeof(int) * numChars);
+	if (nocl_characterMatchArgs->charSums == NULL || nocl_characterMatchArgs->sortedChars == NULL) return false;
+
+	for (size_t c = 0; c < numChars; c++) {
+		const unsigned char *ch = &nocl_characterMatchArgs->atlas[c * charLen];
+		for (size_t i = 0; i < charLen; i++) nocl_characterMatchArgs->charSums[c] += ch[i];
+		nocl_characterMatchArgs->sortedChars[c] = c;
+	}
+	qsort(nocl_characterMatchArgs->sortedChars, numChars, sizeof(int), nocl_compareCharSums);
+
+	if (nocl_topK > 0 && nocl_topK < numChars) {
+		return nocl_setPyramid(nocl_characterMatchArgs->atlas, charSize, numChars);
+	}
+	return true;
+}
+
+// nocl_cellDiff for cells of charW x charH pixels and numImgs images
+// Only called with constant sizes, so each instantiation below has fixed loop counts.
+__attribute__((always_inline))
+static inline unsigned int nocl_cellDiffFixed(const unsigned char *ch, const unsigned char *px,
+		const unsigned int bound, unsigned long long *visited, const int charW, const int charH,
+		const int numImgs) {
+	unsigned int diff = 0;
+	for (int y = 0; y < charH; y++) {
+		for (int x = 0; x < charW * 3; x += 3) {
+			for (int img = 0; img < numImgs; img++, px += 3) {
+				diff += abs((int)ch[x] - (int)px[0]);
+				diff += abs((int)ch[x + 1] - (int)px[1]);
+				diff += abs((int)ch[x + 2] - (int)px[2]);
+			}
+		}
+		ch += charW * 3;
+		*visited += charW * numImgs;
+		if (diff > bound) break;
+	}
+	return diff;
+}
+
+#define NOCL_CELL_DIFF(w, h, n) \
+	static unsigned int nocl_cellDiff_##w##x##h##x##n(const unsigned char *ch, const unsigned char *px, \
+			unsigned int bound, unsigned long long *visited) { \
+		return nocl_cellDiffFixed(ch, px, bound, visited, w, h, n); \
+	}
+// Cells of common monospace fonts from 10 to 18 pixels, with the 4 default kernels
+NOCL_CELL_DIFF(6, 12, 4)
+NOCL_CELL_DIFF(7, 12, 4)
+NOCL_CELL_DIFF(7, 14, 4)
+NOCL_CELL_DIFF(8, 14, 4)
+NOCL_CELL_DIFF(8, 16, 4)
+NOCL_CELL_DIFF(9, 16, 4)
+NOCL_CELL_DIFF(9, 18, 4)
+NOCL_CELL_DIFF(10, 18, 4)
+
+typedef struct NOCL_FixedCellDiff {
+	int charW, charH, numImgs;
+	unsigned int (*cellDiff)(const unsigned char *ch, const unsigned char *px, unsigned int bound,
+							 unsigned long long *visited);
+} NOCL_FixedCellDiff;
+
+static const NOCL_FixedCellDiff nocl_fixedCellDiffs[] = {
+	{ 6, 12, 4, nocl_cellDiff_6x12x4 },
+	{ 7, 12, 4, nocl_cellDiff_7x12x4 },
+	{ 7, 14, 4, nocl_cellDiff_7x14x4 },
+	{ 8, 14, 4, nocl_cellDiff_8x14x4 },
+	{ 8, 16, 4, nocl_cellDiff_8x16x4 },
+	{ 9, 16, 4, nocl_cellDiff_9x16x4 },
+	{ 9, 18, 4, nocl_cellDiff_9x18x4 },
+	{ 10, 18, 4, nocl_cellDiff_10x18x4 }
+};
+
 // Initializes nocl_characterMatchArgs
-bool nocl_setCharacterMatchArgs(unsigned char **imgs, int *imgSize,
-		const int numImgs, ImageInfo *characters, int *charSize,
-		const int numChars, char *charMap, unsigned char *matches,
-		unsigned char *outColors, const size_t *globalSize) {
+// imgs and atlas are read in place, and must stay valid until the match is done
+bool nocl_setCharacterMatchArgs(const unsigned char *imgs, int *imgSize,
+		const int numImgs, const GlyphAtlas *atlas, int *charSize,
+		unsigned char *matches, unsigned char *outColors, const size_t *globalSize) {
 	nocl_freeCharacterMatchArgs();
 	nocl_characterMatchArgs = calloc(1, sizeof(NOCL_CharacterMatchArgs));
+	if (nocl_characterMatchArgs == NULL) return false;
 
-	const size_t length = imgSize[0] * imgSize[1] * 3;
-
-	nocl_characterMatchArgs->imgs = malloc(length * numImgs);
-	for (size_t i = 0; i < numImgs; i++) {
-		const size_t offset = i * length;
-		for (size_t j = offset; j < (length * (i + 1)); j++) {
-			nocl_characterMatchArgs->imgs[j] = imgs[i][j - offset];
+	nocl_characterMatchArgs->imgs = imgs;
+	nocl_characterMatchArgs->imgSize = imgSize;
+	nocl_characterMatchArgs->charSize = charSize;
+	nocl_characterMatchArgs->atlas = atlas->pixels;
+	nocl_characterMatchArgs->charMap = atlas->charMap;
+	nocl_characterMatchArgs->numChars = atlas->numChars;
+	nocl_characterMatchArgs->matches = matches;
+	for (size_t i = 0; i < sizeof(nocl_fixedCellDiffs) / sizeof(nocl_fixedCellDiffs[0]); i++) {
+		const NOCL_FixedCellDiff *f = &nocl_fixedCellDiffs[i];
+		if (f->charW == charSize[0] && f->charH == charSize[1] && f->numImgs == numImgs) {
+			nocl_characterMatchArgs->cellDiff = f->cellDiff;
 		}
 	}
 
-	nocl_characterMatchArgs->imgSize = imgSize;
+	if (!nocl_exhaustiveMatch) return nocl_setAtlas(charSize, atlas->numChars);
 
-	nocl_characterMatchArgs->charImg = malloc(charSize[0] * charSize[1] * 3);
-	int res = nocl_loadImage(characters, nocl_characterMatchArgs->charImg, 0);
-	if (res == -1) return false;
+	nocl_characterMatchArgs->charImg = atlas->pixels;
 	nocl_characterMatchArgs->charMapX = 1;
-	nocl_characterMatchArgs->charSize = charSize;
-	nocl_characterMatchArgs->currentChar = charMap[0];
+	nocl_characterMatchArgs->currentChar = atlas->charMap[0];
 
 	unsigned int diffLen = (globalSize[0] - 1) * globalSize[1];
 	nocl_characterMatchArgs->diffs = malloc(sizeof(unsigned int) * diffLen);
+	statsAlloc(nocl_characterMatchArgs->diffs, sizeof(unsigned int) * diffLen);
 	for (size_t d = 0; d < diffLen; d++) nocl_characterMatchArgs->diffs[d] = 0xffffffff;
 
-	nocl_characterMatchArgs->matches = matches;
-
 	return true;
 }
 
 // Switches to the next character for comparison to the image
-bool nocl_setNextCharacter(ImageInfo *characters, char *charMap) {
-	int res = nocl_loadImage(&characters[nocl_characterMatchArgs->charMapX], nocl_characterMatchArgs->charImg, 0);
-	if (res == -1) return false;
-	
-	nocl_characterMatchArgs->currentChar = charMap[nocl_characterMatchArgs->charMapX++];
+void nocl_setNextCharacter() {
+	const int *charSize = nocl_characterMatchArgs->charSize;
+	const size_t c = nocl_characterMatchArgs->charMapX++;
+	nocl_characterMatchArgs->charImg = &nocl_characterMatchArgs->atlas[c * charSize[0] * charSize[1] * 3];
+	nocl_characterMatchArgs->currentChar = nocl_characterMatchArgs->charMap[c];
+}
+
+// Arguments shared by every tile of one character pass
+typedef struct NOCL_CharacterMatchTile {
+	const unsigned char *colorImg;
+	unsigned char *outColors;
+	const int *imgSize,
+			  *charSize;
+	int numImgs;
+	const size_t *globalSize;
+	const unsigned int *cells; // Cells matched by nocl_searchList, as indices into matches
+} NOCL_CharacterMatchTile;
+
+// Runs nocl_kCharacterMatch for the current character over rows [begin, end) of cells
+void nocl_characterMatchRows(void *args, size_t begin, size_t end) {
+	NOCL_CharacterMatchTile *tile = args;
+	size_t globalID[2] = {0, 0};
+
+	for (size_t j = begin; j < end; j++) {
+		globalID[1] = j;
+		for (size_t i = 0; i < tile->globalSize[0]; i++) {
+			globalID[0] = i;
+			nocl_kCharacterMatch(nocl_characterMatchArgs->imgs, tile->imgSize, tile->numImgs,
+								 nocl_characterMatchArgs->charImg, tile->charSize,
+								 nocl_characterMatchArgs->currentChar, nocl_characterMatchArgs->diffs,
+								 nocl_characterMatchArgs->matches, tile->colorImg, tile->outColors,
+								 globalID, tile->globalSize);
+		}
+	}
+}
+
+// Sum of absolute differences between character c and the cell, over all filtered images
+// Returns as soon as the partial sum is above bound, since c can no longer be the best match
+unsigned int nocl_cellDiff(NOCL_SearchCell *cell, const int c, const int numImgs,
+		const unsigned int bound) {
+	const int *charSize = nocl_characterMatchArgs->charSize;
+	const size_t rowLen = charSize[0] * 3;
+	const unsigned char *ch = &nocl_characterMatchArgs->atlas[c * rowLen * charSize[1]],
+						*px = cell->pixels;
+	if (nocl_characterMatchArgs->cellDiff != NULL) {
+		return nocl_characterMatchArgs->cellDiff(ch, px, bound, &cell->visited);
+	}
+	unsigned int diff = 0;
+	for (int y = 0; y < charSize[1]; y++) {
+		for (size_t x = 0; x < rowLen; x += 3) {
+			for (int img = 0; img < numImgs; img++, px += 3) {
+				diff += abs((int)ch[x] - (int)px[0]);
+				diff += abs((int)ch[x + 1] - (int)px[1]);
+				diff += abs((int)ch[x + 2] - (int)px[2]);
+			}
+		}
+		ch += rowLen;
+		cell->visited += charSize[0] * numImgs;
+		if (diff > bound) break;
+	}
+	return diff;
+}
+
+// Finds the same character as nocl_kCharacterMatch for the staged cell without comparing every pixel
+// |cell->sum - (numImgs * charSums[c])| is a lower bound of character c's difference, so
+// characters are tried by increasing bound and the search ends when the bound passes the best
+// difference. Ties go to the lowest index, like the exhaustive matcher.
+// Returns the index of the best character, or numChars if none is below 0xffffffff.
+int nocl_searchChars(NOCL_SearchCell *cell, const int numImgs) {
+	const int *sorted = nocl_characterMatchArgs->sortedChars;
+	const unsigned int *charSums = nocl_characterMatchArgs->charSums;
+	const int numChars = nocl_characterMatchArgs->numChars;
 
+	// Walk outward from the characters whose sums are closest to the cell's
+	int hi = 0, lo;
+	while (hi < numChars && numImgs * charSums[sorted[hi]] < cell->sum) hi++;
+	lo = hi - 1;
+	unsigned int best = 0xffffffff, diff;
+	int bestChar = numChars, c;
+	while (lo >= 0 || hi < numChars) {
+		const unsigned int loBound = (lo >= 0)? cell->sum - (numImgs * charSums[sorted[lo]]) : 0xffffffff,
+						   hiBound = (hi < numChars)? (numImgs * charSums[sorted[hi]]) - cell->sum : 0xffffffff;
+		if (loBound <= hiBound) {
+			if (loBound > best) break;
+			c = sorted[lo--];
+		}
+		else {
+			if (hiBound > best) break;
+			c = sorted[hi++];
+		}
+		diff = nocl_cellDiff(cell, c, numImgs, best);
+		if (diff < best || (diff == best && c < bestChar)) {
+			best = diff;
+			bestChar = c;
+		}
+	}
+	return bestChar;
+}
+
+// Compares only the pyramid's candidates at full size
+// Returns the index of the best candidate, or numChars if none is below 0xffffffff.
+int nocl_refineCandidates(NOCL_SearchCell *cell, const int numImgs) {
+	const int numChars = nocl_characterMatchArgs->numChars;
+	const size_t count = nocl_pyramidCandidates(cell->pyramid, cell->pixels,
+												nocl_characterMatchArgs->charSize, numChars, numImgs);
+	unsigned int best = 0xffffffff, diff;
+	int bestChar = numChars, c;
+	for (size_t i = 0; i < count; i++) {
+		c = cell->pyramid->candidates[i];
+		diff = nocl_cellDiff(cell, c, numImgs, best);
+		if (diff < best || (diff == best && c < bestChar)) {
+			best = diff;
+			bestChar = c;
+		}
+	}
+	return bestChar;
+}
+
+// Writes the newline that ends each row of cells, if (cellX, cellY) is in the last column
+// Returns true if it was
+bool nocl_newlineCell(const size_t cellX, const size_t cellY, unsigned char *colors,
+		const size_t *globalSize) {
+	if (cellX != globalSize[0] - 1) return false;
+	const size_t gID = cellX + (globalSize[0] * cellY);
+	nocl_characterMatchArgs->matches[gID] = '\n';
+	unsigned char ucharMax[3] = {255, 255, 255};
+	nocl_vstore3(ucharMax, gID, colors);
 	return true;
 }
 
+// Copies the cell at pixel (bx, by) of every filtered image into cell->pixels, and sums it
+void nocl_stageCell(NOCL_SearchCell *cell, const size_t bx, const size_t by, const int numImgs) {
+	const int *imgSize = nocl_characterMatchArgs->imgSize,
+			  *charSize = nocl_characterMatchArgs->charSize;
+	const size_t imgLen = imgSize[0] * imgSize[1] * 3;
+	unsigned char *px = cell->pixels;
+	cell->sum = 0;
+	for (size_t y = by; y < by + charSize[1]; y++) {
+		for (size_t x = bx; x < bx + charSize[0]; x++) {
+			const unsigned char *src = &nocl_characterMatchArgs->imgs[(x + (imgSize[0] * y)) * 3];
+			for (int img = 0; img < numImgs; img++, px += 3, src += imgLen) {
+				px[0] = src[0];
+				px[1] = src[1];
+				px[2] = src[2];
+				cell->sum += px[0] + px[1] + px[2];
+			}
+		}
+	}
+}
+
+// Matches the staged cell at pixel (bx, by) with nocl_searchChars, or nocl_refineCandidates when the
+// pyramid is in use, and sets its color
+void nocl_matchStagedCell(NOCL_SearchCell *cell, const size_t gID, const size_t bx, const size_t by,
+		const int numImgs, const unsigned char *colorImg, unsigned char *colors) {
+	const int *imgSize = nocl_characterMatchArgs->imgSize,
+			  *charSize = nocl_characterMatchArgs->charSize;
+	const int numChars = nocl_characterMatchArgs->numChars;
+
+	int bestChar;
+	if (cell->pyramid != NULL) {
+		bestChar = nocl_refineCandidates(cell, numImgs);
+		if (nocl_checkTopK) {
+			// The full search is only for the agreement rate, so its pixels are not counted
+			const unsigned long long visited = cell->visited;
+			if (nocl_searchChars(cell, numImgs) == bestChar) cell->agreed++;
+			cell->checked++;
+			cell->visited = visited;
+		}
+	}
+	else bestChar = nocl_searchChars(cell, numImgs);
+	if (bestChar < numChars) nocl_characterMatchArgs->matches[gID] = nocl_characterMatchArgs->charMap[bestChar];
+
+	// Same color as nocl_kCharacterMatch
+	unsigned int color[3] = {0, 0, 0};
+	unsigned int area = charSize[0] * charSize[1];
+	unsigned char colorPixel[3];
+	for (size_t x = bx; x < bx + charSize[0]; x++) {
+		for (size_t y = by; y < by + charSize[1]; y++) {
+			nocl_vload3(colorPixel, x + (imgSize[0] * y), colorImg);
+			color[0] += colorPixel[0];
+			color[1] += colorPixel[1];
+			color[2] += colorPixel[2];
+		}
+	}
+	unsigned char out[3];
+	out[0] = nocl_cellColor(color[0], area);
+	out[1] = nocl_cellColor(color[1], area);
+	out[2] = nocl_cellColor(color[2], area);
+	nocl_vstore3(out, gID, colors);
+}
+
+// Matches one cell of the filtered images
+void nocl_searchCell(NOCL_SearchCell *cell, const size_t cellX, const size_t cellY,
+		const int numImgs, const unsigned char *colorImg, unsigned char *colors,
+		const size_t *globalSize) {
+	if (nocl_newlineCell(cellX, cellY, colors, globalSize)) return;
+	// The grid only has whole cells, so a cell never crosses the edge of the image
+	const int *charSize = nocl_characterMatchArgs->charSize;
+	const size_t bx = cellX * charSize[0],
+				 by = cellY * charSize[1];
+	nocl_stageCell(cell, bx, by, numImgs);
+	nocl_matchStagedCell(cell, cellX + (globalSize[0] * cellY), bx, by, numImgs, colorImg, colors);
+}
+
+// Runs nocl_searchCell over cells [begin, end)
+// With a cell list, begin and end index tile->cells. Otherwise they are rows of cells.
+void nocl_searchCells(NOCL_CharacterMatchTile *tile, size_t begin, size_t end) {
+	const int *charSize = tile->charSize;
+	NOCL_SearchCell cell = { malloc(charSize[0] * charSize[1] * 3 * tile->numImgs), 0, NULL, 0, 0, 0 };
+	if (cell.pixels == NULL) return;
+	if (nocl_pyramid != NULL) {
+		cell.pyramid = nocl_newPyramidCell(tile->numImgs);
+		if (cell.pyramid == NULL) {
+			free(cell.pixels);
+			return;
+		}
+	}
+
+	if (tile->cells != NULL) {
+		for (size_t c = begin; c < end; c++) {
+			nocl_searchCell(&cell, tile->cells[c] % tile->globalSize[0], tile->cells[c] / tile->globalSize[0],
+							tile->numImgs, tile->colorImg, tile->outColors, tile->globalSize);
+		}
+	}
+	else {
+		for (size_t j = begin; j < end; j++) {
+			for (size_t i = 0; i < tile->globalSize[0]; i++) {
+				nocl_searchCell(&cell, i, j, tile->numImgs, tile->colorImg, tile->outColors,
+								tile->globalSize);
+			}
+		}
+	}
+	free(cell.pixels);
+	nocl_freePyramidCell(cell.pyramid);
+	__atomic_fetch_add(&nocl_visitedPixels, cell.visited, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&nocl_agreedCells, cell.agreed, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&nocl_checkedCells, cell.checked, __ATOMIC_RELAXED);
+}
+
+// Runs nocl_searchCell over rows [begin, end) of cells
+void nocl_searchRows(void *args, size_t begin, size_t end) {
+	nocl_searchCells(args, begin, end);
+}
+
+// Runs nocl_searchCell over entries [begin, end) of the cell list
+void nocl_searchList(void *args, size_t begin, size_t end) {
+	nocl_searchCells(args, begin, end);
+}
+
+// Selects the matcher used by NOCL_CharacterMatch
+// exhaustive compares every character to every cell, one character at a time. Otherwise each
+// cell searches for its best character, which gives the same result but skips most pixels.
+EXPORT void NOCL_SetExhaustiveMatch(bool exhaustive) {
+	nocl_exhaustiveMatch = exhaustive;
+}
+
+// Limits the full size comparison to the topK best characters of the pyramid (0 = no limit)
+// check also runs the full search on every cell to measure how often both agree
+EXPORT void NOCL_SetTopK(int topK, bool check) {
+	nocl_topK = (topK > 0)? (size_t)topK : 0;
+	nocl_checkTopK = check;
+}
+
+// Returns the fraction of cells where the pyramid picked the same character as the full search
+// Only measured when NOCL_SetTopK was called with check
+EXPORT double NOCL_GetAgreementRate() {
+	if (nocl_checkedCells == 0) return 1.0;
+	return (double)nocl_agreedCells / (double)nocl_checkedCells;
+}
+
+// Returns the fraction of character pixels compared by the last search match (1 = all of them)
+EXPORT double NOCL_GetVisitedFraction() {
+	if (nocl_totalPixels == 0) return 1.0;
+	return (double)nocl_visitedPixels / (double)nocl_totalPixels;
+}
+
 // Matches ASCII characters and colors to the input Image
-bool NOCL_CharacterMatch(unsigned char **imgs, int *imgSize, const int numImgs,
-		ImageInfo *characters, int numChars, char *charMap, unsigned char *matches,
-		unsigned char *colorImg, unsigned char *outColors) {
-	int charSize[2] = { characters[0].width, characters[0].height };
+// imgs holds numImgs filtered images back to back
+bool NOCL_CharacterMatch(const unsigned char *imgs, int *imgSize, const int numImgs,
+		const GlyphAtlas *atlas, unsigned char *matches,
+		const unsigned char *colorImg, unsigned char *outColors) {
+	int charSize[2] = { atlas->charWidth, atlas->charHeight };
+	const int numChars = atlas->numChars;
 	const size_t globalSize[2] = { (size_t)((imgSize[0] / charSize[0]) + 1),
 								  (size_t)((imgSize[1] / charSize[1])) };
-	size_t globalID[2] = {0, 0};
 	
-	if (!nocl_setCharacterMatchArgs(imgs, imgSize, numImgs, characters, charSize, numChars,
-							   charMap, matches, outColors, globalSize)) return false;
+	if (!nocl_setCharacterMatchArgs(imgs, imgSize, numImgs, atlas, charSize,
+							   matches, outColors, globalSize)) return false;
+
+	NOCL_CharacterMatchTile tile = { colorImg, outColors, imgSize, charSize, numImgs, globalSize, NULL };
+	if (!nocl_exhaustiveMatch) {
+		nocl_visitedPixels = nocl_agreedCells = nocl_checkedCells = 0;
+		nocl_totalPixels = (unsigned long long)(globalSize[0] - 1) * globalSize[1] *
+						   numChars * charSize[0] * charSize[1] * numImgs;
+		const double start = perfNow();
+		nocl_parallelFor(globalSize[1], 0, nocl_searchRows, &tile);
+		statsTime(STATS_MATCH, -1, perfNow() - start);
+		return true;
+	}
 
 	while (true) {
-		for (size_t i = 0; i < globalSize[0]; i++) {
-			globalID[0] = i;
-			for (size_t j = 0; j < globalSize[1]; j++) {
-				globalID[1] = j;
-				nocl_kCharacterMatch(nocl_characterMatchArgs->imgs, imgSize, numImgs,
-									 nocl_characterMatchArgs->charImg, charSize,
-									 nocl_characterMatchArgs->currentChar, nocl_characterMatchArgs->diffs,
-									 nocl_characterMatchArgs->matches, colorImg, outColors, globalID, globalSize);
-			}
-		}
+		const double start = perfNow();
+		nocl_parallelFor(globalSize[1], 0, nocl_characterMatchRows, &tile);
+		statsTime(STATS_MATCH, nocl_characterMatchArgs->charMapX - 1, perfNow() - start);
 
-		if (nocl_characterMatchArgs->charMapX < numChars) {
-			nocl_setNextCharacter(characters, charMap);
-		}
+		if (nocl_characterMatchArgs->charMapX < numChars) nocl_setNextCharacter();
 		else break;
 	}
 
 	return true;
 }
+
+// Matches only the listed cells, with the search matcher
+// cells are indices into matches and outColors; every other cell keeps its previous match
+bool nocl_matchCells(const unsigned char *imgs, int *imgSize, const int numImgs,
+		const GlyphAtlas *atlas, unsigned char *matches, const unsigned char *colorImg,
+		unsigned char *outColors, const unsigned int *cells, size_t numCells) {
+	int charSize[2] = { atlas->charWidth, atlas->charHeight };
+	const size_t globalSize[2] = { (size_t)((imgSize[0] / charSize[0]) + 1),
+								  (size_t)((imgSize[1] / charSize[1])) };
+
+	const bool exhaustive = nocl_exhaustiveMatch;
+	nocl_exhaustiveMatch = false;
+	bool ok = nocl_setCharacterMatchArgs(imgs, imgSize, numImgs, atlas, charSize,
+										 matches, outColors, globalSize);
+	nocl_exhaustiveMatch = exhaustive;
+	if (!ok) return false;
+
+	NOCL_CharacterMatchTile tile = { colorImg, outColors, imgSize, charSize, numImgs, globalSize, cells };
+	nocl_visitedPixels = nocl_agreedCells = nocl_checkedCells = 0;
+	nocl_totalPixels = (unsigned long long)numCells * atlas->numChars * charSize[0] * charSize[1] * numImgs;
+	const double start = perfNow();
+	nocl_parallelFor(numCells, 0, nocl_searchList, &tile);
+	statsTime(STATS_MATCH, -1, perfNow() - start);
+	return true;
+}
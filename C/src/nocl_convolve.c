@@ -7,17 +7,23 @@ extern void nocl_AddImg(const size_t globalWorkSize, const unsigned char *imgA,
 extern void nocl_kConvolve(const unsigned char *img, unsigned char *output, const float *k,
 		const unsigned int *knlSize, float knlMult, unsigned char knlInvert, float alpha,
 		const size_t *global_id, const size_t *global_size);
-extern int nocl_loadImage(ImageInfo *imgBufs, unsigned char *charBuf, size_t offset);
+extern bool nocl_convolveSIMD(const unsigned char *padded, unsigned char *output, const float *k,
+		const unsigned int *knlSize, float knlMult, unsigned char knlInvert, float alpha,
+		size_t imgW, size_t imgH, const size_t *globalWorkSize);
+extern bool nocl_convolveSeparable(const unsigned char *padded, unsigned char *output, const KernelInfo *k,
+		float alpha, size_t imgW, size_t imgH, const size_t *globalWorkSize);
+extern bool composeKernels(KernelInfo *kernels, size_t numKernels, KernelInfo *composed);
+extern bool gatherImage(ImageInfo *imgBufs, unsigned char **pixels, ImageView *img);
 
 void nocl_freeMultiConvolveArgs() {
 	if (nocl_multiConvolveArgs != NULL) {
-		if (nocl_multiConvolveArgs->input != NULL) free(nocl_multiConvolveArgs->input);
-		if (nocl_multiConvolveArgs->outputs != NULL) {
-			for (size_t i = 0; i < nocl_multiConvolveArgs->numKernels; i++) {
-				if (nocl_multiConvolveArgs->outputs[i] != NULL) free(nocl_multiConvolveArgs->outputs[i]);
-			}
-			free(nocl_multiConvolveArgs->outputs);
-		}
+		statsFree(nocl_multiConvolveArgs->inputCopy);
+		statsFree(nocl_multiConvolveArgs->outputBlock);
+		statsFree(nocl_multiConvolveArgs->pass);
+		if (nocl_multiConvolveArgs->inputCopy != NULL) free(nocl_multiConvolveArgs->inputCopy);
+		if (nocl_multiConvolveArgs->outputBlock != NULL) free(nocl_multiConvolveArgs->outputBlock);
+		if (nocl_multiConvolveArgs->outputs != NULL) free(nocl_multiConvolveArgs->outputs);
+		if (nocl_multiConvolveArgs->pass != NULL) free(nocl_multiConvolveArgs->pass);
 		if (nocl_multiConvolveArgs->kernels != NULL) {
 			for (size_t i = 0; i < nocl_multiConvolveArgs->numKernels; i++) {
 				if (nocl_multiConvolveArgs->kernels[i] != NULL) free(nocl_multiConvolveArgs->kernels[i]);
@@ -33,6 +39,7 @@ void nocl_freeMultiConvolveArgs() {
 }
 
 // Loads Kernel information into nocl_multiConvolveArgs
+// Kernels only given as factors are expanded, for the passes that cannot run them separably
 bool nocl_loadKernels(KernelInfo *kernelBufs, size_t numKernels) {
 	nocl_multiConvolveArgs->kernels = malloc(sizeof(float*) * numKernels);
 	nocl_multiConvolveArgs->knlSizes = malloc(sizeof(size_t) * numKernels);
@@ -44,9 +51,8 @@ bool nocl_loadKernels(KernelInfo *kernelBufs, size_t numKernels) {
 		const unsigned int knlSize[2] = { kernelBufs[i].width, kernelBufs[i].height };
 
 		nocl_multiConvolveArgs->kernels[i] = malloc(sizeof(float) * knlSize[0] * knlSize[1]);
-		for (size_t j = 0; j < knlSize[0] * knlSize[1]; j++) {
-			nocl_multiConvolveArgs->kernels[i][j] = kernelBufs[i].buffer[j];
-		}
+		if (nocl_multiConvolveArgs->kernels[i] == NULL) return false;
+		expandKernel(&kernelBufs[i], nocl_multiConvolveArgs->kernels[i]);
 		nocl_multiConvolveArgs->knlMults[i] = kernelBufs[i].mult;
 		nocl_multiConvolveArgs->knlInverts[i] = kernelBufs[i].invert? 1 : 0;
 	}
@@ -54,18 +60,42 @@ bool nocl_loadKernels(KernelInfo *kernelBufs, size_t numKernels) {
 }
 
 // Initializes nocl_multiConvolveArgs
-bool nocl_setMultiConvolveArgs(ImageInfo *imgBufs, KernelInfo *kernels, const size_t numKernels) {
+// The image is read in place when its rows are packed, otherwise it is copied once
+// pass allocates the intermediate buffer used by the exact pipeline
+bool nocl_setMultiConvolveArgs(const ImageView *img, KernelInfo *kernels, const size_t numKernels,
+		bool pass) {
 	nocl_freeMultiConvolveArgs();
 	nocl_multiConvolveArgs = calloc(1, sizeof(NOCL_MultiConvolveArgs));
+	if (nocl_multiConvolveArgs == NULL) return false;
 
-	const size_t length = imgBufs[0].width * imgBufs[0].height * 3;
+	const size_t rowLen = img->width * 3,
+				 length = rowLen * img->height;
 
-	nocl_multiConvolveArgs->input = calloc(length, sizeof(unsigned char));
-	if(nocl_loadImage(imgBufs, nocl_multiConvolveArgs->input, 0) == -1) return false;
+	if (img->stride == rowLen) nocl_multiConvolveArgs->input = img->pixels;
+	else {
+		const double start = perfNow();
+		nocl_multiConvolveArgs->inputCopy = malloc(length);
+		if (nocl_multiConvolveArgs->inputCopy == NULL) return false;
+		statsAlloc(nocl_multiConvolveArgs->inputCopy, length);
+		for (size_t y = 0; y < img->height; y++) {
+			memcpy(&nocl_multiConvolveArgs->inputCopy[y * rowLen], &img->pixels[y * img->stride], rowLen);
+		}
+		nocl_multiConvolveArgs->input = nocl_multiConvolveArgs->inputCopy;
+		statsTime(STATS_UPLOAD, -1, perfNow() - start);
+	}
 
+	// One block, so the matcher can read every output without another copy
+	nocl_multiConvolveArgs->outputBlock = calloc(length * numKernels, sizeof(unsigned char));
 	nocl_multiConvolveArgs->outputs = malloc(sizeof(unsigned char *) * numKernels);
+	if (nocl_multiConvolveArgs->outputBlock == NULL || nocl_multiConvolveArgs->outputs == NULL) return false;
+	statsAlloc(nocl_multiConvolveArgs->outputBlock, length * numKernels);
 	for (size_t i = 0; i < numKernels; i++) {
-		nocl_multiConvolveArgs->outputs[i] = calloc(length, sizeof(unsigned char));
+		nocl_multiConvolveArgs->outputs[i] = &nocl_multiConvolveArgs->outputBlock[i * length];
+	}
+	if (pass) {
+		nocl_multiConvolveArgs->pass = malloc(length);
+		if (nocl_multiConvolveArgs->pass == NULL) return false;
+		statsAlloc(nocl_multiConvolveArgs->pass, length);
 	}
 
 	if (!nocl_loadKernels(kernels, numKernels)) return false;
@@ -74,14 +104,15 @@ bool nocl_setMultiConvolveArgs(ImageInfo *imgBufs, KernelInfo *kernels, const si
 }
 
 // Pads an image for use with a Kernel
-void nocl_pad(unsigned char *img, unsigned char **padded, const size_t imgW, const size_t imgH, const size_t kernelW, const size_t kernelH) {
+void nocl_pad(const unsigned char *img, unsigned char **padded, const size_t imgW, const size_t imgH, const size_t kernelW, const size_t kernelH) {
 	const size_t padW = imgW + kernelW - 1,
 				 padH = imgH + kernelH - 1;
 
 	*padded = calloc(padW * padH * 3, sizeof(unsigned char));
+	statsAlloc(*padded, padW * padH * 3);
 	
 	size_t offset = 0; // Start at the beginning of the input
-	size_t padOffset = (padW * 3) + ((kernelW / 2) * 3); // Empty first row + Initial padding for second row
+	size_t padOffset = ((kernelH / 2) * padW * 3) + ((kernelW / 2) * 3); // Empty top rows + Initial padding for first image row
 	for (size_t row = 0; row < imgH; row++) {
 		for (size_t col = 0; col < imgW * 3; col++) {
 			(*padded)[padOffset + col] = img[offset + col];
@@ -91,65 +122,142 @@ void nocl_pad(unsigned char *img, unsigned char **padded, const size_t imgW, con
 	}
 }
 
-// Filter an Image through a Kernel
-bool nocl_convolve(unsigned char *input, ImageInfo imgBuf, KernelInfo kernelBuf, const size_t kernelIndex,
-	    const size_t *globalWorkSize, const float alpha) {
-
-	unsigned char **padded = malloc(sizeof(unsigned char *)); // Contents allocated in nocl_pad()
-	nocl_pad(input, padded, imgBuf.width, imgBuf.height, kernelBuf.width, kernelBuf.height);
+// Arguments shared by every tile of one nocl_convolve() call
+typedef struct NOCL_ConvolveTile {
+	const unsigned char *padded;
+	unsigned char *output;
+	const float *kernel;
+	unsigned int knlSize[2];
+	float knlMult,
+		  alpha;
+	unsigned char knlInvert;
+	const size_t *globalWorkSize;
+} NOCL_ConvolveTile;
 
-	const unsigned int knlSize[2] = { kernelBuf.width, kernelBuf.height };
+// Runs nocl_kConvolve over rows [begin, end) of the work grid
+void nocl_convolveRows(void *args, size_t begin, size_t end) {
+	NOCL_ConvolveTile *tile = args;
 	size_t globalID[2] = {};
 
-	for (size_t i = 0; i < globalWorkSize[0]; i++) {
-		globalID[0] = i;
-		for (size_t j = 0; j < globalWorkSize[1]; j++) {
-			globalID[1] = j;
-			nocl_kConvolve(*padded, nocl_multiConvolveArgs->outputs[nocl_multiConvolveArgs->outputIndex],
-						   nocl_multiConvolveArgs->kernels[kernelIndex], knlSize, kernelBuf.mult, kernelBuf.invert,
-						   alpha, globalID, globalWorkSize);
+	for (size_t j = begin; j < end; j++) {
+		globalID[1] = j;
+		for (size_t i = 0; i < tile->globalWorkSize[0]; i++) {
+			globalID[0] = i;
+			nocl_kConvolve(tile->padded, tile->output, tile->kernel, tile->knlSize, tile->knlMult,
+						   tile->knlInvert, tile->alpha, globalID, tile->globalWorkSize);
 		}
 	}
+}
+
+// Filter an Image through a Kernel
+// input is padded first, so output may be the same buffer
+bool nocl_convolve(const unsigned char *input, unsigned char *output, const unsigned int *imgSize,
+		const KernelInfo *kernelBuf, const size_t kernelIndex, const size_t *globalWorkSize, const float alpha) {
+	const double start = perfNow();
+	unsigned char **padded = malloc(sizeof(unsigned char *)); // Contents allocated in nocl_pad()
+	nocl_pad(input, padded, imgSize[0], imgSize[1], kernelBuf->width, kernelBuf->height);
+
+	NOCL_ConvolveTile tile = { *padded, output,
+							   nocl_multiConvolveArgs->kernels[kernelIndex], { kernelBuf->width, kernelBuf->height },
+							   kernelBuf->mult, alpha, kernelBuf->invert, globalWorkSize };
+	if (!nocl_convolveSeparable(tile.padded, tile.output, kernelBuf, alpha, imgSize[0], imgSize[1],
+								globalWorkSize) &&
+		!nocl_convolveSIMD(tile.padded, tile.output, tile.kernel, tile.knlSize, tile.knlMult, tile.knlInvert,
+						   alpha, imgSize[0], imgSize[1], globalWorkSize)) {
+		nocl_parallelFor(globalWorkSize[1], 0, nocl_convolveRows, &tile);
+	}
 	
+	statsFree(*padded);
 	free(*padded);
 	free(padded);
 
+	statsTime(STATS_CONVOLVE, kernelIndex, perfNow() - start);
 	return true;
 }
 
-// Run all Kernels to prepare an image for ASCII matching
-EXPORT bool NOCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels,
-		const size_t numKernels) {
-	if (!nocl_setMultiConvolveArgs(imgBufs, kernels, numKernels)) return false;
+// Runs one pass per kernel with kernels already composed by composeKernels()
+bool nocl_composedConvolve(const ImageView *img, KernelInfo *composed, const size_t numKernels) {
+	if (!nocl_setMultiConvolveArgs(img, composed, numKernels, false)) return false;
 
-	const size_t globalWorkSize[] = { imgBufs[0].width + kernels[0].width - 1,
-									  imgBufs[0].height + kernels[0].height - 1 };
-	const size_t length = imgBufs[0].width * imgBufs[0].height * 3;
+	const unsigned int imgSize[2] = { img->width, img->height };
+	for (size_t k = 0; k < numKernels; k++) {
+		const size_t globalWorkSize[] = { img->width + composed[k].width - 1,
+										  img->height + composed[k].height - 1 };
+		if (!nocl_convolve(nocl_multiConvolveArgs->input, nocl_multiConvolveArgs->outputs[k], imgSize,
+						   &composed[k], k, globalWorkSize, 1.f)) return false;
+	}
+	return true;
+}
 
-	unsigned char *sum = NULL, *totalOutput = NULL;
+// Runs every pass of the exact pipeline, on the buffers set by nocl_setMultiConvolveArgs
+bool nocl_runMultiConvolve(const ImageView *img, KernelInfo *kernels, const size_t numKernels) {
+	const unsigned int imgSize[2] = { img->width, img->height };
+	const size_t length = img->width * img->height * 3;
+	unsigned char *pass = nocl_multiConvolveArgs->pass;
+
+	// outputs[k] = sum over k2 of k2(k(input)), or k(input) alone when k == k2
 	for (size_t k = 0; k < numKernels; k++) {
-		nocl_multiConvolveArgs->outputIndex = k;
-		totalOutput = calloc(1, length);
+		unsigned char *output = nocl_multiConvolveArgs->outputs[k];
+		// Each pass is padded for its own kernel, so the grid follows that kernel's size
+		const size_t firstWorkSize[] = { img->width + kernels[k].width - 1,
+										 img->height + kernels[k].height - 1 };
+		memset(pass, 0, length);
 		for (size_t k2 = 0; k2 < numKernels; k2++) {
-			sum = calloc(1, length);
 			if (k == k2) {
-				if (!nocl_convolve(nocl_multiConvolveArgs->input, imgBufs[0], kernels[k], k,
-	          				  globalWorkSize, 1.f / (float)numKernels)) return false;
+				if (!nocl_convolve(nocl_multiConvolveArgs->input, pass, imgSize, &kernels[k], k,
+	          				  firstWorkSize, 1.f / (float)numKernels)) return false;
 			}
 			else {
-				if (!nocl_convolve(nocl_multiConvolveArgs->input, imgBufs[0], kernels[k], k,
-	          				  globalWorkSize, 1.f)) return false;
+				const size_t secondWorkSize[] = { img->width + kernels[k2].width - 1,
+												  img->height + kernels[k2].height - 1 };
+				if (!nocl_convolve(nocl_multiConvolveArgs->input, pass, imgSize, &kernels[k], k,
+	          				  firstWorkSize, 1.f)) return false;
 
-				if (!nocl_convolve(nocl_multiConvolveArgs->outputs[k], imgBufs[0], kernels[k2], k2,
-	          				  globalWorkSize, 1.f / (float)numKernels)) return false;
+				if (!nocl_convolve(pass, pass, imgSize, &kernels[k2], k2,
+	          				  secondWorkSize, 1.f / (float)numKernels)) return false;
 			}
-			nocl_AddImg(imgBufs[0].width * imgBufs[0].height, nocl_multiConvolveArgs->outputs[k], totalOutput, sum);
-			free(totalOutput);
-			totalOutput = sum;
-			sum = NULL;
+			nocl_AddImg(img->width * img->height, pass, output, output);
 		}
-		free(nocl_multiConvolveArgs->outputs[k]);
-		nocl_multiConvolveArgs->outputs[k] = totalOutput;
 	}
 	return true;
 }
+
+// Run all Kernels to prepare an image for ASCII matching
+// If composed is true, each kernel's passes are folded into one larger kernel (see compose.c)
+// Separable kernels are found first (see separable.c)
+bool nocl_multiConvolveImage(const ImageView *img, KernelInfo *kernels,
+		const size_t numKernels, bool composed) {
+	KernelInfo *prepared = prepareKernels(kernels, numKernels);
+	if (prepared == NULL) return false;
+	if (composed) {
+		KernelInfo *composedKernels = malloc(sizeof(KernelInfo) * numKernels);
+		if (composeKernels(prepared, numKernels, composedKernels)) {
+			bool ret = nocl_composedConvolve(img, composedKernels, numKernels);
+			free(composedKernels);
+			free(prepared);
+			return ret;
+		}
+		free(composedKernels);
+		fprintf(stderr, "Warning: These kernels cannot be composed. Using the exact pipeline.\n");
+	}
+	bool ret = nocl_setMultiConvolveArgs(img, prepared, numKernels, true) &&
+			   nocl_runMultiConvolve(img, prepared, numKernels);
+	free(prepared);
+	return ret;
+}
+
+// Run all Kernels to prepare an image for ASCII matching
+// Compatibility entry point for images split into ImageInfo buffers
+EXPORT bool NOCL_MultiConvolve(ImageInfo *imgBufs, KernelInfo *kernels,
+		const size_t numKernels, bool composed) {
+	unsigned char *pixels = NULL;
+	ImageView img;
+	if (!gatherImage(imgBufs, &pixels, &img)) return false;
+	if (!nocl_multiConvolveImage(&img, kernels, numKernels, composed)) {
+		free(pixels);
+		return false;
+	}
+	// The packed copy is read in place, so it is freed along with the outputs
+	nocl_multiConvolveArgs->inputCopy = pixels;
+	return true;
+}
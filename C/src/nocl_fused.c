@@ -0,0 +1,337 @@
+// Fused convolution and matching
+// The separate passes write numKernels filtered images the size of the input, which the matcher
+// then reads back. Here each thread filters one row of cells at a time into small band buffers and
+// matches it straight away, so the filtered images never exist in full. The output is identical to
+// the separate passes.
+
+#include <math.h>
+#include <stdlib.h>
+#include "artscii.h"
+
+bool nocl_fused = false;
+
+extern NOCL_CharacterMatchArgs *nocl_characterMatchArgs;
+extern NOCL_Pyramid *nocl_pyramid;
+extern bool nocl_exhaustiveMatch;
+extern unsigned long long nocl_visitedPixels, nocl_totalPixels, nocl_agreedCells, nocl_checkedCells;
+extern bool composeKernels(KernelInfo *kernels, size_t numKernels, KernelInfo *composed);
+extern bool nocl_setCharacterMatchArgs(const unsigned char *imgs, int *imgSize,
+		const int numImgs, const GlyphAtlas *atlas, int *charSize,
+		unsigned char *matches, unsigned char *outColors, const size_t *globalSize);
+extern NOCL_PyramidCell *nocl_newPyramidCell(const int numImgs);
+extern void nocl_freePyramidCell(NOCL_PyramidCell *cell);
+extern bool nocl_newlineCell(const size_t cellX, const size_t cellY, unsigned char *colors,
+		const size_t *globalSize);
+extern bool nocl_setSimdConvolve(NOCL_SimdConvolve *c, const float *k, const unsigned int *knlSize,
+		float knlMult, unsigned char knlInvert, float alpha, size_t padRow, size_t outRow);
+extern void nocl_simdConvolveRows(void *args, size_t begin, size_t end);
+extern void nocl_freeSimdConvolve(NOCL_SimdConvolve *c);
+extern void nocl_matchStagedCell(NOCL_SearchCell *cell, const size_t gID, const size_t bx, const size_t by,
+		const int numImgs, const unsigned char *colorImg, unsigned char *colors);
+
+// Arguments shared by every row of cells
+typedef struct NOCL_FusedTile {
+	const unsigned char *input; // Packed rows
+	const KernelInfo *kernels;  // Already composed when composed is true
+	int numImgs;
+	bool composed;
+	unsigned int radius[2];     // Half the size of the original kernels
+	const int *imgSize,
+			  *charSize;
+	const size_t *globalSize;
+	unsigned char *outColors;
+	bool failed;
+} NOCL_FusedTile;
+
+// Per-thread band buffers for one row of cells
+// Each band starts its margin left of the image, and ends its margin after the last whole cell
+typedef struct NOCL_FusedBands {
+	unsigned char *input,   // Input with 2 * radius pixels around the row, 0 outside the image
+				  *first,   // First pass of every kernel, with radius pixels around the row
+				  *pair,    // One pass of a pair
+				  *outputs; // Filtered row of every image
+	float *sums;
+	size_t inputW,
+		   firstW,
+		   outputW;
+} NOCL_FusedBands;
+
+// Selects whether NOCL_ToAsciiImage matches each row of cells as soon as it is filtered
+// Needs kernels of the same odd size, otherwise the separate passes are used.
+EXPORT void NOCL_SetFused(bool enable) {
+	nocl_fused = enable;
+}
+
+// True if kernels can be fused: every kernel has the same odd size, so every band has the same halo,
+// and its weights in buffer
+bool fusedKernels(const KernelInfo *kernels, size_t numKernels) {
+	for (size_t k = 0; k < numKernels; k++) {
+		if (kernels[k].width % 2 == 0 || kernels[k].height % 2 == 0 || !kernelHasWeights(&kernels[k]) ||
+			kernels[k].width != kernels[0].width || kernels[k].height != kernels[0].height) return false;
+	}
+	return true;
+}
+
+// Filters a w x h band through k, with the same arithmetic as nocl_kConvolve
+// src is srcW pixels wide, and the top-left tap of dst(x, y) reads src(x + offX, y + offY).
+// Runs on the calling thread, with nocl_simd.c when the CPU supports it. Otherwise taps are added
+// to each pixel in the same order as nocl_kConvolve, one row of pixels at a time.
+void nocl_fusedPass(const unsigned char *src, size_t srcW, size_t offX, size_t offY,
+		const KernelInfo *k, float alpha, unsigned char *dst, size_t w, size_t h, float *sums) {
+	const size_t rowLen = w * 3;
+	const unsigned int knlSize[2] = { k->width, k->height };
+	NOCL_SimdConvolve simd;
+	if (nocl_setSimdConvolve(&simd, k->buffer, knlSize, k->mult, k->invert? 1 : 0, alpha, srcW * 3,
+							 rowLen)) {
+		simd.padded = &src[((offY * srcW) + offX) * 3];
+		simd.output = dst;
+		nocl_simdConvolveRows(&simd, 0, h);
+		nocl_freeSimdConvolve(&simd);
+		return;
+	}
+
+	for (size_t y = 0; y < h; y++) {
+		memset(sums, 0, sizeof(float) * rowLen);
+		for (unsigned int kx = 0; kx < k->width; kx++) {
+			for (unsigned int ky = 0; ky < k->height; ky++) {
+				const float weight = k->buffer[kx + (k->width * ky)];
+				if (weight == 0.f) continue; // Adds nothing
+				const unsigned char *s = &src[(((y + offY + ky) * srcW) + offX + kx) * 3];
+				for (size_t i = 0; i < rowLen; i++) sums[i] += s[i] * weight;
+			}
+		}
+		unsigned char *out = &dst[y * rowLen];
+		for (size_t i = 0; i < rowLen; i++) {
+			float pixel = fmax(fmin(sums[i] * k->mult, 255.f), 0.f);
+			if (k->invert) pixel = 255.f - pixel;
+			out[i] = (unsigned char)(pixel * alpha);
+		}
+	}
+}
+
+void nocl_freeFusedBands(NOCL_FusedBands *bands) {
+	free(bands->input);
+	free(bands->first);
+	free(bands->pair);
+	free(bands->outputs);
+	free(bands->sums);
+}
+
+// Allocates the band buffers of one thread
+bool nocl_newFusedBands(NOCL_FusedTile *tile, NOCL_FusedBands *bands) {
+	const size_t rx = tile->radius[0],
+				 ry = tile->radius[1],
+				 charH = tile->charSize[1],
+				 n = tile->numImgs;
+	memset(bands, 0, sizeof(NOCL_FusedBands));
+	// Only whole cells are matched, so the band ends at the last one
+	bands->outputW = (tile->globalSize[0] - 1) * tile->charSize[0];
+	bands->firstW = bands->outputW + (2 * rx);
+	bands->inputW = bands->outputW + (4 * rx);
+
+	bands->input = malloc(bands->inputW * (charH + (4 * ry)) * 3);
+	bands->outputs = malloc(bands->outputW * charH * 3 * n);
+	bands->sums = malloc(sizeof(float) * bands->firstW * 3);
+	if (!tile->composed) {
+		bands->first = malloc(bands->firstW * (charH + (2 * ry)) * 3 * n);
+		bands->pair = malloc(bands->outputW * charH * 3);
+	}
+	return bands->input != NULL && bands->outputs != NULL && bands->sums != NULL &&
+		   (tile->composed || (bands->first != NULL && bands->pair != NULL));
+}
+
+// Copies the input around row j of cells into bands->input, with 0 outside the image
+void nocl_fusedLoadRow(NOCL_FusedTile *tile, NOCL_FusedBands *bands, size_t j) {
+	const long imgW = tile->imgSize[0],
+			   imgH = tile->imgSize[1],
+			   mx = 2 * tile->radius[0],
+			   my = 2 * tile->radius[1],
+			   y0 = ((long)j * tile->charSize[1]) - my,
+			   h = tile->charSize[1] + (2 * my);
+	const size_t rowLen = bands->inputW * 3;
+	// Columns of the band that are inside the image
+	const long x1 = (imgW < (long)bands->inputW - mx)? imgW : (long)bands->inputW - mx;
+
+	memset(bands->input, 0, rowLen * h);
+	for (long y = 0; y < h; y++) {
+		if (y0 + y < 0 || y0 + y >= imgH) continue;
+		memcpy(&bands->input[(y * rowLen) + (mx * 3)], &tile->input[(y0 + y) * imgW * 3], x1 * 3);
+	}
+}
+
+// Filters row j of cells into bands->outputs, the same as the separate passes of nocl_convolve.c
+void nocl_fusedFilterRow(NOCL_FusedTile *tile, NOCL_FusedBands *bands, size_t j) {
+	const size_t rx = tile->radius[0],
+				 ry = tile->radius[1],
+				 charH = tile->charSize[1],
+				 outLen = bands->outputW * charH * 3,
+				 n = tile->numImgs;
+	const KernelInfo *kernels = tile->kernels;
+	nocl_fusedLoadRow(tile, bands, j);
+
+	if (tile->composed) {
+		for (size_t k = 0; k < n; k++) {
+			nocl_fusedPass(bands->input, bands->inputW, 0, 0, &kernels[k], 1.f, &bands->outputs[k * outLen],
+						   bands->outputW, charH, bands->sums);
+		}
+		return;
+	}
+
+	// k(input) over the row and the radius around it. The separate passes read 0 around the image,
+	// so the part of the band outside it is cleared.
+	const long imgW = tile->imgSize[0],
+			   imgH = tile->imgSize[1],
+			   y0 = ((long)j * charH) - ry;
+	const size_t firstH = charH + (2 * ry),
+				 firstRow = bands->firstW * 3,
+				 firstLen = firstRow * firstH;
+	for (size_t k = 0; k < n; k++) {
+		unsigned char *first = &bands->first[k * firstLen];
+		nocl_fusedPass(bands->input, bands->inputW, 0, 0, &kernels[k], 1.f, first, bands->firstW, firstH,
+					   bands->sums);
+		for (size_t y = 0; y < firstH; y++) {
+			unsigned char *row = &first[y * firstRow];
+			if ((long)y + y0 < 0 || (long)y + y0 >= imgH) {
+				memset(row, 0, firstRow);
+				continue;
+			}
+			memset(row, 0, rx * 3);
+			if ((long)bands->firstW - (long)rx > imgW) {
+				memset(&row[(imgW + rx) * 3], 0, (bands->firstW - rx - imgW) * 3);
+			}
+		}
+	}
+
+	// outputs[k] = sum over k2 of k2(k(input)), or k(input) alone when k == k2
+	const float alpha = 1.f / (float)n;
+	for (size_t k = 0; k < n; k++) {
+		unsigned char *output = &bands->outputs[k * outLen];
+		memset(output, 0, outLen);
+		for (size_t k2 = 0; k2 < n; k2++) {
+			if (k == k2) {
+				nocl_fusedPass(bands->input, bands->inputW, rx, ry, &kernels[k], alpha, bands->pair,
+							   bands->outputW, charH, bands->sums);
+			}
+			else {
+				nocl_fusedPass(&bands->first[k * firstLen], bands->firstW, 0, 0, &kernels[k2], alpha,
+							   bands->pair, bands->outputW, charH, bands->sums);
+			}
+			for (size_t i = 0; i < outLen; i++) {
+				const unsigned int sum = output[i] + bands->pair[i];
+				output[i] = (sum < 255)? sum : 255;
+			}
+		}
+	}
+}
+
+// Filters and matches rows [begin, end) of cells
+void nocl_fusedRows(void *args, size_t begin, size_t end) {
+	NOCL_FusedTile *tile = args;
+	const int numImgs = tile->numImgs,
+			  charW = tile->charSize[0],
+			  charH = tile->charSize[1];
+	const size_t cols = tile->globalSize[0] - 1;
+
+	NOCL_FusedBands bands = { NULL, NULL, NULL, NULL, NULL, 0, 0, 0 };
+	NOCL_SearchCell cell = { malloc(charW * charH * 3 * numImgs), 0, NULL, 0, 0, 0 };
+	bool ok = cell.pixels != NULL;
+	if (ok && nocl_pyramid != NULL) {
+		cell.pyramid = nocl_newPyramidCell(numImgs);
+		ok = cell.pyramid != NULL;
+	}
+	if (ok && cols > 0) ok = nocl_newFusedBands(tile, &bands);
+
+	for (size_t j = begin; j < end && ok; j++) {
+		if (cols > 0) nocl_fusedFilterRow(tile, &bands, j);
+		const size_t outLen = bands.outputW * charH * 3;
+		for (size_t i = 0; i <= cols; i++) {
+			if (nocl_newlineCell(i, j, tile->outColors, tile->globalSize)) continue;
+
+			// Same layout as nocl_stageCell
+			const size_t bx = i * charW;
+			unsigned char *px = cell.pixels;
+			cell.sum = 0;
+			for (size_t y = 0; y < charH; y++) {
+				for (size_t x = bx; x < bx + charW; x++) {
+					const unsigned char *src = &bands.outputs[(x + (bands.outputW * y)) * 3];
+					for (int img = 0; img < numImgs; img++, px += 3, src += outLen) {
+						px[0] = src[0];
+						px[1] = src[1];
+						px[2] = src[2];
+						cell.sum += px[0] + px[1] + px[2];
+					}
+				}
+			}
+			nocl_matchStagedCell(&cell, i + (tile->globalSize[0] * j), bx, j * charH, numImgs, tile->input,
+								 tile->outColors);
+		}
+	}
+	if (!ok) tile->failed = true;
+
+	nocl_freeFusedBands(&bands);
+	free(cell.pixels);
+	nocl_freePyramidCell(cell.pyramid);
+	__atomic_fetch_add(&nocl_visitedPixels, cell.visited, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&nocl_agreedCells, cell.agreed, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&nocl_checkedCells, cell.checked, __ATOMIC_RELAXED);
+}
+
+// Converts an Image to ASCII characters, filtering each row of cells just before it is matched
+// kernels must pass fusedKernels(). Always uses the search matcher, which gives the same matches
+// as the exhaustive one.
+bool nocl_fusedToAscii(const ImageView *img, KernelInfo *kernels, size_t numKernels,
+		const GlyphAtlas *atlas, bool composed, unsigned char *outChars, unsigned char *outColors) {
+	int imgSize[2] = { img->width, img->height },
+		charSize[2] = { atlas->charWidth, atlas->charHeight };
+	const size_t globalSize[2] = { (size_t)((imgSize[0] / charSize[0]) + 1),
+								  (size_t)((imgSize[1] / charSize[1])) },
+				 rowLen = img->width * 3;
+
+	KernelInfo *composedKernels = NULL;
+	if (composed) {
+		composedKernels = malloc(sizeof(KernelInfo) * numKernels);
+		if (composedKernels == NULL) return false;
+		if (!composeKernels(kernels, numKernels, composedKernels)) {
+			free(composedKernels);
+			composedKernels = NULL;
+			fprintf(stderr, "Warning: These kernels cannot be composed. Using the exact pipeline.\n");
+		}
+	}
+
+	// The color is read from packed rows
+	unsigned char *inputCopy = NULL;
+	if (img->stride != rowLen) {
+		inputCopy = malloc(rowLen * img->height);
+		if (inputCopy == NULL) {
+			free(composedKernels);
+			return false;
+		}
+		for (size_t y = 0; y < img->height; y++) {
+			memcpy(&inputCopy[y * rowLen], &img->pixels[y * img->stride], rowLen);
+		}
+	}
+
+	const bool exhaustive = nocl_exhaustiveMatch;
+	nocl_exhaustiveMatch = false;
+	bool ok = nocl_setCharacterMatchArgs(NULL, imgSize, numKernels, atlas, charSize,
+										 outChars, outColors, globalSize);
+	nocl_exhaustiveMatch = exhaustive;
+
+	if (ok) {
+		NOCL_FusedTile tile = { (inputCopy != NULL)? inputCopy : img->pixels,
+								(composedKernels != NULL)? composedKernels : kernels, numKernels,
+								composedKernels != NULL, { kernels[0].width / 2, kernels[0].height / 2 },
+								imgSize, charSize, globalSize, outColors, false };
+		nocl_visitedPixels = nocl_agreedCells = nocl_checkedCells = 0;
+		nocl_totalPixels = (unsigned long long)(globalSize[0] - 1) * globalSize[1] *
+						   atlas->numChars * charSize[0] * charSize[1] * numKernels;
+		// Filtering and matching are interleaved, so their time counts as the match
+		const double start = perfNow();
+		nocl_parallelFor(globalSize[1], 0, nocl_fusedRows, &tile);
+		statsTime(STATS_MATCH, -1, perfNow() - start);
+		ok = !tile.failed;
+	}
+	free(inputCopy);
+	free(composedKernels);
+	return ok;
+}
@@ -0,0 +1,165 @@
+// Coarse-to-fine character search
+// Characters and cells are also summed over 2x2 and 4x4 blocks. A cell scores every character
+// on the 4x4 sums, rescores the best of those on the 2x2 sums, and only the best K are compared
+// at full size. This is much faster on large character sets, but can pick a different character.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+NOCL_Pyramid *nocl_pyramid = NULL;
+size_t nocl_topK = 0; // 0 = compare every character at full size
+
+// Characters kept after the 4x4 pass, for each character kept after the 2x2 pass
+#define NOCL_PYRAMID_SPREAD 4
+
+// Sums 3-channel pixels over block x block squares
+// Pixel (x, y) is at src[(x + (w * y)) * srcStep], block (bx, by) is at dst[(bx + (levelW * by)) * dstStep]
+void nocl_blockSums(const unsigned char *src, const size_t srcStep, const size_t w, const size_t h,
+		const size_t block, unsigned short *dst, const size_t dstStep) {
+	const size_t levelW = (w + block - 1) / block,
+				 levelH = (h + block - 1) / block;
+	for (size_t i = 0; i < levelW * levelH; i++) {
+		dst[i * dstStep] = dst[(i * dstStep) + 1] = dst[(i * dstStep) + 2] = 0;
+	}
+	for (size_t y = 0; y < h; y++) {
+		for (size_t x = 0; x < w; x++) {
+			const unsigned char *px = &src[(x + (w * y)) * srcStep];
+			unsigned short *sum = &dst[((x / block) + (levelW * (y / block))) * dstStep];
+			sum[0] += px[0];
+			sum[1] += px[1];
+			sum[2] += px[2];
+		}
+	}
+}
+
+void nocl_freePyramid() {
+	if (nocl_pyramid != NULL) {
+		for (int l = 0; l < NOCL_PYRAMID_LEVELS; l++) {
+			if (nocl_pyramid->levels[l] != NULL) free(nocl_pyramid->levels[l]);
+		}
+		free(nocl_pyramid);
+		nocl_pyramid = NULL;
+	}
+}
+
+// Builds the block sums of every character in atlas
+bool nocl_setPyramid(const unsigned char *atlas, const int *charSize, const int numChars) {
+	nocl_freePyramid();
+	nocl_pyramid = calloc(1, sizeof(NOCL_Pyramid));
+	if (nocl_pyramid == NULL) return false;
+	const size_t charLen = charSize[0] * charSize[1] * 3;
+
+	for (int l = 0; l < NOCL_PYRAMID_LEVELS; l++) {
+		const size_t block = 2 << l;
+		nocl_pyramid->levelSize[l] = ((charSize[0] + block - 1) / block) *
+									 ((charSize[1] + block - 1) / block);
+		nocl_pyramid->levels[l] = malloc(sizeof(unsigned short) * nocl_pyramid->levelSize[l] * 3 * numChars);
+		if (nocl_pyramid->levels[l] == NULL) {
+			nocl_freePyramid();
+			return false;
+		}
+		for (int c = 0; c < numChars; c++) {
+			nocl_blockSums(&atlas[c * charLen], 3, charSize[0], charSize[1], block,
+						   &nocl_pyramid->levels[l][c * nocl_pyramid->levelSize[l] * 3], 3);
+		}
+	}
+	return true;
+}
+
+void nocl_freePyramidCell(NOCL_PyramidCell *cell) {
+	if (cell != NULL) {
+		for (int l = 0; l < NOCL_PYRAMID_LEVELS; l++) {
+			if (cell->levels[l] != NULL) free(cell->levels[l]);
+		}
+		if (cell->scores != NULL) free(cell->scores);
+		if (cell->candidates != NULL) free(cell->candidates);
+		if (cell->survivors != NULL) free(cell->survivors);
+		free(cell);
+	}
+}
+
+// Allocates the buffers one thread needs to score cells against the pyramid
+NOCL_PyramidCell *nocl_newPyramidCell(const int numImgs) {
+	NOCL_PyramidCell *cell = calloc(1, sizeof(NOCL_PyramidCell));
+	if (cell == NULL) return NULL;
+	bool ok = true;
+	for (int l = 0; l < NOCL_PYRAMID_LEVELS; l++) {
+		cell->levels[l] = malloc(sizeof(unsigned short) * nocl_pyramid->levelSize[l] * 3 * numImgs);
+		ok = ok && cell->levels[l] != NULL;
+	}
+	cell->scores = malloc(sizeof(unsigned int) * nocl_topK * NOCL_PYRAMID_SPREAD);
+	cell->candidates = malloc(sizeof(int) * nocl_topK * NOCL_PYRAMID_SPREAD);
+	cell->survivors = malloc(sizeof(int) * nocl_topK * NOCL_PYRAMID_SPREAD);
+	if (!ok || cell->scores == NULL || cell->candidates == NULL || cell->survivors == NULL) {
+		nocl_freePyramidCell(cell);
+		return NULL;
+	}
+	return cell;
+}
+
+// Sum of absolute differences between character c's block sums and the cell's, on level l
+unsigned int nocl_levelDiff(const NOCL_PyramidCell *cell, const int l, const int c, const int numImgs) {
+	const size_t size = nocl_pyramid->levelSize[l];
+	const unsigned short *ch = &nocl_pyramid->levels[l][c * size * 3],
+						 *px = cell->levels[l];
+	unsigned int diff = 0;
+	for (size_t i = 0; i < size; i++, ch += 3) {
+		for (int img = 0; img < numImgs; img++, px += 3) {
+			diff += abs((int)ch[0] - (int)px[0]);
+			diff += abs((int)ch[1] - (int)px[1]);
+			diff += abs((int)ch[2] - (int)px[2]);
+		}
+	}
+	return diff;
+}
+
+// Keeps the max lowest scores in ascending order, ties going to the lower character index
+void nocl_keepCandidate(NOCL_PyramidCell *cell, size_t *count, const size_t max,
+		const unsigned int score, const int c) {
+	size_t i = *count;
+	if (i == max) {
+		if (score > cell->scores[i - 1] || (score == cell->scores[i - 1] && c > cell->candidates[i - 1])) return;
+		i--;
+	}
+	else (*count)++;
+	while (i > 0 && (score < cell->scores[i - 1] || (score == cell->scores[i - 1] && c < cell->candidates[i - 1]))) {
+		cell->scores[i] = cell->scores[i - 1];
+		cell->candidates[i] = cell->candidates[i - 1];
+		i--;
+	}
+	cell->scores[i] = score;
+	cell->candidates[i] = c;
+}
+
+// Fills cell->candidates with the nocl_topK characters most likely to match the cell
+// pixels is the staged cell, pixels[(img + (numImgs * (xRel + (charW * yRel)))) * 3]
+// Returns the number of candidates
+size_t nocl_pyramidCandidates(NOCL_PyramidCell *cell, const unsigned char *pixels,
+		const int *charSize, const int numChars, const int numImgs) {
+	for (int l = 0; l < NOCL_PYRAMID_LEVELS; l++) {
+		for (int img = 0; img < numImgs; img++) {
+			nocl_blockSums(&pixels[img * 3], numImgs * 3, charSize[0], charSize[1], 2 << l,
+						   &cell->levels[l][img * 3], numImgs * 3);
+		}
+	}
+
+	// Every character on the coarsest level
+	const int last = NOCL_PYRAMID_LEVELS - 1;
+	size_t count = 0, max = nocl_topK * NOCL_PYRAMID_SPREAD;
+	for (int c = 0; c < numChars; c++) {
+		nocl_keepCandidate(cell, &count, max, nocl_levelDiff(cell, last, c, numImgs), c);
+	}
+
+	// Only the survivors on the finer levels
+	for (int l = last - 1; l >= 0; l--) {
+		const size_t numSurvivors = count;
+		memcpy(cell->survivors, cell->candidates, sizeof(int) * numSurvivors);
+		max = (l == 0)? nocl_topK : max / NOCL_PYRAMID_SPREAD;
+		count = 0;
+		for (size_t i = 0; i < numSurvivors; i++) {
+			const int c = cell->survivors[i];
+			nocl_keepCandidate(cell, &count, max, nocl_levelDiff(cell, l, c, numImgs), c);
+		}
+	}
+	return count;
+}
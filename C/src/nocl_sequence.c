@@ -0,0 +1,255 @@
+// Incremental conversion of frame sequences
+// The previous frame, its filtered images, matches and colors stay resident between frames. Each
+// frame is compared to the previous one in blocks the size of a character cell, and only the
+// changed blocks, plus the pixels their filtered values reach, are convolved and matched again.
+// With a threshold of 0 every frame is identical to a full NOCL_ToAsciiImage() conversion.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+NOCL_Sequence *nocl_sequence = NULL;
+
+extern NOCL_MultiConvolveArgs *nocl_multiConvolveArgs;
+extern void nocl_freeMultiConvolveArgs();
+extern void nocl_freeCharacterMatchArgs();
+extern bool composeKernels(KernelInfo *kernels, size_t numKernels, KernelInfo *composed);
+extern bool nocl_composedConvolve(const ImageView *img, KernelInfo *composed, const size_t numKernels);
+extern bool nocl_multiConvolveImage(const ImageView *img, KernelInfo *kernels,
+		const size_t numKernels, bool composed);
+extern bool nocl_matchCells(const unsigned char *imgs, int *imgSize, const int numImgs,
+		const GlyphAtlas *atlas, unsigned char *matches, const unsigned char *colorImg,
+		unsigned char *outColors, const unsigned int *cells, size_t numCells);
+
+void nocl_freeSequence() {
+	if (nocl_sequence != NULL) {
+		if (nocl_sequence->kernels != NULL) free(nocl_sequence->kernels);
+		if (nocl_sequence->input != NULL) free(nocl_sequence->input);
+		if (nocl_sequence->outputs != NULL) free(nocl_sequence->outputs);
+		if (nocl_sequence->matches != NULL) free(nocl_sequence->matches);
+		if (nocl_sequence->colors != NULL) free(nocl_sequence->colors);
+		if (nocl_sequence->changed != NULL) free(nocl_sequence->changed);
+		if (nocl_sequence->dirty != NULL) free(nocl_sequence->dirty);
+		if (nocl_sequence->cells != NULL) free(nocl_sequence->cells);
+		free(nocl_sequence);
+		nocl_sequence = NULL;
+	}
+}
+
+// Starts a sequence of width x height frames, replacing any previous sequence
+// atlas is read by every frame and must stay valid until NOCL_EndSequence()
+// A block of a frame is converted again when any channel differs from the previous frame by more
+// than threshold
+EXPORT bool NOCL_BeginSequence(unsigned int width, unsigned int height, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, unsigned int threshold, int numThreads,
+		bool composed) {
+	nocl_freeSequence();
+	nocl_sequence = calloc(1, sizeof(NOCL_Sequence));
+	if (nocl_sequence == NULL) return false;
+	NOCL_Sequence *seq = nocl_sequence;
+	nocl_setThreadCount(numThreads);
+
+	seq->numKernels = numKernels;
+	seq->atlas = atlas;
+	seq->threshold = threshold;
+	seq->imgSize[0] = width;
+	seq->imgSize[1] = height;
+	seq->globalSize[0] = (width / atlas->charWidth) + 1;
+	seq->globalSize[1] = height / atlas->charHeight;
+	seq->blocks[0] = (width + atlas->charWidth - 1) / atlas->charWidth;
+	seq->blocks[1] = (height + atlas->charHeight - 1) / atlas->charHeight;
+
+	// Separable kernels are found once, rather than for every refiltered rectangle
+	KernelInfo *prepared = prepareKernels(kernels, numKernels);
+	seq->kernels = malloc(sizeof(KernelInfo) * numKernels);
+	if (prepared == NULL || seq->kernels == NULL) {
+		free(prepared);
+		return false;
+	}
+	if (composed && composeKernels(prepared, numKernels, seq->kernels)) seq->composed = true;
+	else {
+		if (composed) fprintf(stderr, "Warning: These kernels cannot be composed. Using the exact pipeline.\n");
+		memcpy(seq->kernels, prepared, sizeof(KernelInfo) * numKernels);
+	}
+	free(prepared);
+
+	// Each filtered pixel reads two passes of kernels, or one pass of a composed kernel twice the size
+	for (size_t k = 0; k < numKernels; k++) {
+		if (2 * (kernels[k].width / 2) > seq->halo[0]) seq->halo[0] = 2 * (kernels[k].width / 2);
+		if (2 * (kernels[k].height / 2) > seq->halo[1]) seq->halo[1] = 2 * (kernels[k].height / 2);
+	}
+
+	const size_t length = (size_t)width * height * 3,
+				 numCells = seq->globalSize[0] * seq->globalSize[1];
+	seq->input = malloc(length);
+	seq->outputs = malloc(length * numKernels);
+	seq->matches = malloc(numCells);
+	seq->colors = malloc(numCells * 3);
+	seq->changed = malloc((size_t)seq->blocks[0] * seq->blocks[1]);
+	seq->dirty = malloc(numCells);
+	seq->cells = malloc(sizeof(unsigned int) * numCells);
+	if (seq->input == NULL || seq->outputs == NULL || seq->matches == NULL || seq->colors == NULL ||
+		seq->changed == NULL || seq->dirty == NULL || seq->cells == NULL) {
+		nocl_freeSequence();
+		return false;
+	}
+	return true;
+}
+
+// Ends the current sequence and frees everything it kept
+EXPORT void NOCL_EndSequence() {
+	nocl_freeSequence();
+}
+
+// Compares block (bx, by) of pixels to the previous frame, and keeps it if it changed
+bool nocl_updateBlock(const unsigned char *pixels, size_t stride, unsigned int bx, unsigned int by) {
+	NOCL_Sequence *seq = nocl_sequence;
+	const size_t rowLen = (size_t)seq->imgSize[0] * 3,
+				 x0 = (size_t)bx * seq->atlas->charWidth * 3,
+				 y0 = (size_t)by * seq->atlas->charHeight;
+	size_t x1 = x0 + (seq->atlas->charWidth * 3),
+		   y1 = y0 + seq->atlas->charHeight;
+	if (x1 > rowLen) x1 = rowLen;
+	if (y1 > (size_t)seq->imgSize[1]) y1 = seq->imgSize[1];
+
+	bool changed = false;
+	for (size_t y = y0; y < y1 && !changed; y++) {
+		const unsigned char *src = &pixels[y * stride],
+							*old = &seq->input[y * rowLen];
+		for (size_t x = x0; x < x1; x++) {
+			if ((unsigned int)abs((int)src[x] - (int)old[x]) > seq->threshold) {
+				changed = true;
+				break;
+			}
+		}
+	}
+	if (changed) {
+		for (size_t y = y0; y < y1; y++) {
+			memcpy(&seq->input[(y * rowLen) + x0], &pixels[(y * stride) + x0], x1 - x0);
+		}
+	}
+	return changed;
+}
+
+// Filters pixels [x0, x1) x [y0, y1) of the kept frame again and marks the cells they cover
+// Only a window around the rectangle is convolved; it reaches halo pixels further in each direction,
+// so the rectangle gets the same values as a full conversion.
+bool nocl_refilterRect(size_t x0, size_t y0, size_t x1, size_t y1) {
+	NOCL_Sequence *seq = nocl_sequence;
+	const size_t imgW = seq->imgSize[0],
+				 imgH = seq->imgSize[1],
+				 wx0 = (x0 > seq->halo[0])? x0 - seq->halo[0] : 0,
+				 wy0 = (y0 > seq->halo[1])? y0 - seq->halo[1] : 0,
+				 wx1 = (x1 + seq->halo[0] < imgW)? x1 + seq->halo[0] : imgW,
+				 wy1 = (y1 + seq->halo[1] < imgH)? y1 + seq->halo[1] : imgH;
+
+	const ImageView window = { &seq->input[((wy0 * imgW) + wx0) * 3], wx1 - wx0, wy1 - wy0, imgW * 3 };
+	bool ok = seq->composed? nocl_composedConvolve(&window, seq->kernels, seq->numKernels) :
+							 nocl_multiConvolveImage(&window, seq->kernels, seq->numKernels, false);
+	if (ok) {
+		const size_t length = imgW * imgH * 3,
+					 rowLen = (x1 - x0) * 3;
+		for (size_t k = 0; k < seq->numKernels; k++) {
+			for (size_t y = y0; y < y1; y++) {
+				memcpy(&seq->outputs[(k * length) + (((y * imgW) + x0) * 3)],
+					   &nocl_multiConvolveArgs->outputs[k][(((y - wy0) * window.width) + (x0 - wx0)) * 3],
+					   rowLen);
+			}
+		}
+	}
+	nocl_freeMultiConvolveArgs();
+	if (!ok) return false;
+
+	// The newline column and the rows below the last full cell are never matched
+	const size_t cols = seq->globalSize[0] - 1,
+				 rows = seq->globalSize[1];
+	for (size_t j = y0 / seq->atlas->charHeight; j < rows && j * seq->atlas->charHeight < y1; j++) {
+		for (size_t i = x0 / seq->atlas->charWidth; i < cols && i * seq->atlas->charWidth < x1; i++) {
+			seq->dirty[i + (seq->globalSize[0] * j)] = 1;
+		}
+	}
+	return true;
+}
+
+static bool noclSequenceFrame(const unsigned char *pixels, size_t stride, unsigned char *outChars,
+		unsigned char *outColors, unsigned int *dirtyCells, size_t *numDirty) {
+	NOCL_Sequence *seq = nocl_sequence;
+	if (seq == NULL) return false;
+	const size_t imgW = seq->imgSize[0],
+				 imgH = seq->imgSize[1],
+				 rowLen = imgW * 3,
+				 numCells = seq->globalSize[0] * seq->globalSize[1],
+				 charW = seq->atlas->charWidth,
+				 charH = seq->atlas->charHeight;
+	memset(seq->dirty, 0, numCells);
+
+	if (seq->frame == 0) {
+		for (size_t y = 0; y < imgH; y++) memcpy(&seq->input[y * rowLen], &pixels[y * stride], rowLen);
+		if (!nocl_refilterRect(0, 0, imgW, imgH)) return false;
+		memset(seq->dirty, 1, numCells);
+	}
+	else {
+		// Every changed block is kept before filtering, since windows overlap neighbouring blocks
+		size_t numChanged = 0;
+		for (unsigned int by = 0; by < seq->blocks[1]; by++) {
+			for (unsigned int bx = 0; bx < seq->blocks[0]; bx++) {
+				seq->changed[bx + (seq->blocks[0] * by)] = nocl_updateBlock(pixels, stride, bx, by);
+				numChanged += seq->changed[bx + (seq->blocks[0] * by)];
+			}
+		}
+
+		// Overlapping windows cost more than one pass over the frame once most blocks change
+		if (numChanged * 2 > (size_t)seq->blocks[0] * seq->blocks[1]) {
+			if (!nocl_refilterRect(0, 0, imgW, imgH)) return false;
+			numChanged = 0;
+		}
+
+		// One rectangle per run of changed blocks in a row, grown by the halo
+		for (unsigned int by = 0; by < seq->blocks[1] && numChanged > 0; by++) {
+			const unsigned char *changed = &seq->changed[seq->blocks[0] * by];
+			for (unsigned int bx = 0; bx < seq->blocks[0]; bx++) {
+				if (!changed[bx]) continue;
+				const unsigned int first = bx;
+				while (bx + 1 < seq->blocks[0] && changed[bx + 1]) bx++;
+
+				size_t x0 = first * charW,
+					   y0 = by * charH,
+					   x1 = (bx + 1) * charW,
+					   y1 = (by + 1) * charH;
+				x0 = (x0 > seq->halo[0])? x0 - seq->halo[0] : 0;
+				y0 = (y0 > seq->halo[1])? y0 - seq->halo[1] : 0;
+				x1 = (x1 + seq->halo[0] < imgW)? x1 + seq->halo[0] : imgW;
+				y1 = (y1 + seq->halo[1] < imgH)? y1 + seq->halo[1] : imgH;
+				if (!nocl_refilterRect(x0, y0, x1, y1)) return false;
+			}
+		}
+	}
+
+	size_t count = 0;
+	for (size_t c = 0; c < numCells; c++) {
+		if (seq->dirty[c]) seq->cells[count++] = c;
+	}
+	if (count > 0) {
+		bool ok = nocl_matchCells(seq->outputs, seq->imgSize, seq->numKernels, seq->atlas, seq->matches,
+								  seq->input, seq->colors, seq->cells, count);
+		nocl_freeCharacterMatchArgs();
+		if (!ok) return false;
+	}
+	seq->frame++;
+
+	memcpy(outChars, seq->matches, numCells);
+	memcpy(outColors, seq->colors, numCells * 3);
+	if (dirtyCells != NULL) memcpy(dirtyCells, seq->cells, sizeof(unsigned int) * count);
+	if (numDirty != NULL) *numDirty = count;
+	return true;
+}
+
+// Converts the next frame of the current sequence
+// outChars and outColors always receive the whole frame. If dirtyCells is not NULL, it receives the
+// indices into outChars of the cells converted again, and numDirty their number.
+EXPORT bool NOCL_SequenceFrame(const unsigned char *pixels, size_t stride, unsigned char *outChars,
+		unsigned char *outColors, unsigned int *dirtyCells, size_t *numDirty) {
+	statsBegin();
+	bool ok = noclSequenceFrame(pixels, stride, outChars, outColors, dirtyCells, numDirty);
+	statsEnd();
+	return ok;
+}
@@ -0,0 +1,676 @@
+// Row-vectorized version of nocl_kConvolve for x86 CPUs
+// The SSE2 or AVX2 path is chosen at runtime, and kernels with integer weights are
+// accumulated in int16/int32 lanes. Results are identical to nocl_kConvolve.
+// Separable kernels (see separable.c) run as a row pass into int16 or float rows, then a column pass.
+// Int16 passes of up to NOCL_FIXED_TAPS taps, which covers every 3x3 kernel, use AVX2 variants
+// instantiated for each tap count, so the tap loop has a fixed trip count and the weights stay in
+// registers.
+
+#include <math.h>
+#include <stdlib.h>
+#include "artscii.h"
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define NOCL_SIMD_X86
+#endif
+
+#define NOCL_SIMD_NONE 0
+#define NOCL_SIMD_SSE2 1
+#define NOCL_SIMD_AVX2 2
+
+#define NOCL_ACC_FLOAT 0
+#define NOCL_ACC_INT16 1
+#define NOCL_ACC_INT32 2
+
+#define NOCL_FIXED_TAPS 9
+
+typedef unsigned char uchar;
+
+int nocl_simdLevel = -1; // -1 = not detected yet
+
+// Returns the best instruction set supported by this CPU
+int nocl_getSimdLevel() {
+	if (nocl_simdLevel < 0) {
+	#ifdef NOCL_SIMD_X86
+		__builtin_cpu_init();
+		nocl_simdLevel = __builtin_cpu_supports("avx2")? NOCL_SIMD_AVX2 : NOCL_SIMD_SSE2;
+	#else
+		nocl_simdLevel = NOCL_SIMD_NONE;
+	#endif
+	}
+	return nocl_simdLevel;
+}
+
+// Forces an instruction set (for testing). Levels above what the CPU supports are ignored.
+void nocl_setSimdLevel(int level) {
+	nocl_simdLevel = -1;
+	if (level < nocl_getSimdLevel()) nocl_simdLevel = level;
+}
+
+// Same math as the end of nocl_kConvolve
+static inline uchar nocl_simdFinish(float pixel, const NOCL_SimdConvolve *c) {
+	pixel = fmax(fmin(pixel * c->knlMult, 255.f), 0.f);
+	if (c->knlInvert > 0) pixel = 255.f - pixel;
+	return (uchar)(pixel * c->alpha);
+}
+
+// Scalar fallback for the bytes [b, end) of one output row
+void nocl_simdConvolveBytes(const NOCL_SimdConvolve *c, const uchar *src, uchar *dst,
+		size_t b, size_t end) {
+	for (; b < end; b++) {
+		float pixel = 0.f;
+		for (size_t t = 0; t < c->numTaps; t++) {
+			pixel += src[b + c->tapOffsets[t]] * c->taps[t];
+		}
+		dst[b] = nocl_simdFinish(pixel, c);
+	}
+}
+
+// Scalar fallback for the bytes [b, outRow) of one row of the row pass
+void nocl_separableRowBytes(const NOCL_SimdSeparable *s, const uchar *src, void *dst, size_t b) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	for (; b < c->outRow; b++) {
+		if (c->accumulator == NOCL_ACC_INT16) {
+			int sum = 0;
+			for (size_t t = 0; t < c->numTaps; t++) sum += src[b + c->tapOffsets[t]] * c->iTaps[t];
+			((short *)dst)[b] = (short)sum;
+		}
+		else {
+			float sum = 0.f;
+			for (size_t t = 0; t < c->numTaps; t++) sum += src[b + c->tapOffsets[t]] * c->taps[t];
+			((float *)dst)[b] = sum;
+		}
+	}
+}
+
+// Scalar fallback for the bytes [b, outRow) of one output row of the column pass
+// rows[j] is the row pass of the padded row under kernel row j
+void nocl_separableColumnBytes(const NOCL_SimdSeparable *s, const void **rows, uchar *dst, size_t b) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	for (; b < c->outRow; b++) {
+		float pixel = 0.f;
+		if (c->accumulator == NOCL_ACC_INT16) {
+			int sum = 0;
+			for (size_t t = 0; t < s->numColTaps; t++) {
+				sum += ((const short *)rows[s->colRows[t]])[b] * s->iColTaps[t];
+			}
+			pixel = (float)sum;
+		}
+		else {
+			for (size_t t = 0; t < s->numColTaps; t++) {
+				pixel += ((const float *)rows[s->colRows[t]])[b] * s->colTaps[t];
+			}
+		}
+		dst[b] = nocl_simdFinish(pixel, c);
+	}
+}
+
+#ifdef NOCL_SIMD_X86
+// ---------------------- SSE2 ------------------- //
+static inline __m128i nocl_sse2Finish(__m128 pixel, const NOCL_SimdConvolve *c) {
+	const __m128 max = _mm_set1_ps(255.f);
+	pixel = _mm_mul_ps(pixel, _mm_set1_ps(c->knlMult));
+	pixel = _mm_max_ps(_mm_min_ps(pixel, max), _mm_setzero_ps());
+	if (c->knlInvert > 0) pixel = _mm_sub_ps(max, pixel);
+	return _mm_cvttps_epi32(_mm_mul_ps(pixel, _mm_set1_ps(c->alpha)));
+}
+
+// Converts two sets of 4 finished pixels to 8 bytes
+static inline void nocl_sse2Store(uchar *dst, __m128i lo, __m128i hi) {
+	__m128i packed = _mm_packs_epi32(lo, hi);
+	_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(packed, packed));
+}
+
+void nocl_sse2ConvolveRow(const NOCL_SimdConvolve *c, const uchar *src, uchar *dst) {
+	const __m128i zero = _mm_setzero_si128();
+	size_t b = 0;
+	for (; b + 8 <= c->outRow; b += 8) {
+		__m128i lo, hi;
+		if (c->accumulator == NOCL_ACC_INT16) {
+			__m128i acc = zero;
+			for (size_t t = 0; t < c->numTaps; t++) {
+				__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[b + c->tapOffsets[t]]), zero);
+				acc = _mm_add_epi16(acc, _mm_mullo_epi16(px, _mm_set1_epi16((short)c->iTaps[t])));
+			}
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(acc, acc), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(acc, acc), 16);
+			lo = nocl_sse2Finish(_mm_cvtepi32_ps(lo), c);
+			hi = nocl_sse2Finish(_mm_cvtepi32_ps(hi), c);
+		}
+		else if (c->accumulator == NOCL_ACC_INT32) {
+			__m128i accLo = zero, accHi = zero;
+			for (size_t t = 0; t < c->numTaps; t++) {
+				// (pixel, 0) * (weight, 0) pairs give pixel * weight in each int32 lane
+				__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[b + c->tapOffsets[t]]), zero),
+						w = _mm_set1_epi32(c->iTaps[t] & 0xffff);
+				accLo = _mm_add_epi32(accLo, _mm_madd_epi16(_mm_unpacklo_epi16(px, zero), w));
+				accHi = _mm_add_epi32(accHi, _mm_madd_epi16(_mm_unpackhi_epi16(px, zero), w));
+			}
+			lo = nocl_sse2Finish(_mm_cvtepi32_ps(accLo), c);
+			hi = nocl_sse2Finish(_mm_cvtepi32_ps(accHi), c);
+		}
+		else {
+			__m128 accLo = _mm_setzero_ps(), accHi = _mm_setzero_ps();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[b + c->tapOffsets[t]]), zero);
+				__m128 w = _mm_set1_ps(c->taps[t]);
+				accLo = _mm_add_ps(accLo, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(px, zero)), w));
+				accHi = _mm_add_ps(accHi, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(px, zero)), w));
+			}
+			lo = nocl_sse2Finish(accLo, c);
+			hi = nocl_sse2Finish(accHi, c);
+		}
+		nocl_sse2Store(&dst[b], lo, hi);
+	}
+	nocl_simdConvolveBytes(c, src, dst, b, c->outRow);
+}
+
+void nocl_sse2SeparableRow(const NOCL_SimdSeparable *s, const uchar *src, void *dst) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	const __m128i zero = _mm_setzero_si128();
+	size_t b = 0;
+	for (; b + 8 <= c->outRow; b += 8) {
+		if (c->accumulator == NOCL_ACC_INT16) {
+			__m128i acc = zero;
+			for (size_t t = 0; t < c->numTaps; t++) {
+				__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[b + c->tapOffsets[t]]), zero);
+				acc = _mm_add_epi16(acc, _mm_mullo_epi16(px, _mm_set1_epi16((short)c->iTaps[t])));
+			}
+			_mm_storeu_si128((__m128i *)&((short *)dst)[b], acc);
+		}
+		else {
+			__m128 accLo = _mm_setzero_ps(), accHi = _mm_setzero_ps();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				__m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src[b + c->tapOffsets[t]]), zero);
+				__m128 w = _mm_set1_ps(c->taps[t]);
+				accLo = _mm_add_ps(accLo, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(px, zero)), w));
+				accHi = _mm_add_ps(accHi, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(px, zero)), w));
+			}
+			_mm_storeu_ps(&((float *)dst)[b], accLo);
+			_mm_storeu_ps(&((float *)dst)[b + 4], accHi);
+		}
+	}
+	nocl_separableRowBytes(s, src, dst, b);
+}
+
+void nocl_sse2SeparableColumn(const NOCL_SimdSeparable *s, const void **rows, uchar *dst) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	size_t b = 0;
+	for (; b + 8 <= c->outRow; b += 8) {
+		__m128i lo, hi;
+		if (c->accumulator == NOCL_ACC_INT16) {
+			__m128i acc = _mm_setzero_si128();
+			for (size_t t = 0; t < s->numColTaps; t++) {
+				__m128i px = _mm_loadu_si128((const __m128i *)&((const short *)rows[s->colRows[t]])[b]);
+				acc = _mm_add_epi16(acc, _mm_mullo_epi16(px, _mm_set1_epi16((short)s->iColTaps[t])));
+			}
+			lo = _mm_srai_epi32(_mm_unpacklo_epi16(acc, acc), 16);
+			hi = _mm_srai_epi32(_mm_unpackhi_epi16(acc, acc), 16);
+			lo = nocl_sse2Finish(_mm_cvtepi32_ps(lo), c);
+			hi = nocl_sse2Finish(_mm_cvtepi32_ps(hi), c);
+		}
+		else {
+			__m128 accLo = _mm_setzero_ps(), accHi = _mm_setzero_ps();
+			for (size_t t = 0; t < s->numColTaps; t++) {
+				const float *p = &((const float *)rows[s->colRows[t]])[b];
+				__m128 w = _mm_set1_ps(s->colTaps[t]);
+				accLo = _mm_add_ps(accLo, _mm_mul_ps(_mm_loadu_ps(p), w));
+				accHi = _mm_add_ps(accHi, _mm_mul_ps(_mm_loadu_ps(p + 4), w));
+			}
+			lo = nocl_sse2Finish(accLo, c);
+			hi = nocl_sse2Finish(accHi, c);
+		}
+		nocl_sse2Store(&dst[b], lo, hi);
+	}
+	nocl_separableColumnBytes(s, rows, dst, b);
+}
+// ----------------------------------------------- //
+
+// ---------------------- AVX2 ------------------- //
+__attribute__((target("avx2")))
+static inline __m256i nocl_avx2Finish(__m256 pixel, const NOCL_SimdConvolve *c) {
+	const __m256 max = _mm256_set1_ps(255.f);
+	pixel = _mm256_mul_ps(pixel, _mm256_set1_ps(c->knlMult));
+	pixel = _mm256_max_ps(_mm256_min_ps(pixel, max), _mm256_setzero_ps());
+	if (c->knlInvert > 0) pixel = _mm256_sub_ps(max, pixel);
+	return _mm256_cvttps_epi32(_mm256_mul_ps(pixel, _mm256_set1_ps(c->alpha)));
+}
+
+// Converts two sets of 8 finished pixels to 16 bytes
+__attribute__((target("avx2")))
+static inline void nocl_avx2Store(uchar *dst, __m256i lo, __m256i hi) {
+	__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xd8);
+	_mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(_mm256_castsi256_si128(packed),
+													  _mm256_extracti128_si256(packed, 1)));
+}
+
+__attribute__((target("avx2")))
+void nocl_avx2ConvolveRow(const NOCL_SimdConvolve *c, const uchar *src, uchar *dst) {
+	size_t b = 0;
+	for (; b + 16 <= c->outRow; b += 16) {
+		__m256i lo, hi;
+		if (c->accumulator == NOCL_ACC_INT16) {
+			__m256i acc = _mm256_setzero_si256();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				__m256i px = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&src[b + c->tapOffsets[t]]));
+				acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(px, _mm256_set1_epi16((short)c->iTaps[t])));
+			}
+			lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(acc));
+			hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(acc, 1));
+			lo = nocl_avx2Finish(_mm256_cvtepi32_ps(lo), c);
+			hi = nocl_avx2Finish(_mm256_cvtepi32_ps(hi), c);
+		}
+		else if (c->accumulator == NOCL_ACC_INT32) {
+			__m256i accLo = _mm256_setzero_si256(), accHi = _mm256_setzero_si256();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				const uchar *p = &src[b + c->tapOffsets[t]];
+				__m256i w = _mm256_set1_epi32(c->iTaps[t]);
+				accLo = _mm256_add_epi32(accLo, _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p)), w));
+				accHi = _mm256_add_epi32(accHi, _mm256_mullo_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + 8))), w));
+			}
+			lo = nocl_avx2Finish(_mm256_cvtepi32_ps(accLo), c);
+			hi = nocl_avx2Finish(_mm256_cvtepi32_ps(accHi), c);
+		}
+		else {
+			__m256 accLo = _mm256_setzero_ps(), accHi = _mm256_setzero_ps();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				const uchar *p = &src[b + c->tapOffsets[t]];
+				__m256 w = _mm256_set1_ps(c->taps[t]);
+				accLo = _mm256_add_ps(accLo, _mm256_mul_ps(_mm256_cvtepi32_ps(
+					_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p))), w));
+				accHi = _mm256_add_ps(accHi, _mm256_mul_ps(_mm256_cvtepi32_ps(
+					_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + 8)))), w));
+			}
+			lo = nocl_avx2Finish(accLo, c);
+			hi = nocl_avx2Finish(accHi, c);
+		}
+		nocl_avx2Store(&dst[b], lo, hi);
+	}
+	nocl_simdConvolveBytes(c, src, dst, b, c->outRow);
+}
+
+__attribute__((target("avx2")))
+void nocl_avx2SeparableRow(const NOCL_SimdSeparable *s, const uchar *src, void *dst) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	size_t b = 0;
+	for (; b + 16 <= c->outRow; b += 16) {
+		if (c->accumulator == NOCL_ACC_INT16) {
+			__m256i acc = _mm256_setzero_si256();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				__m256i px = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&src[b + c->tapOffsets[t]]));
+				acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(px, _mm256_set1_epi16((short)c->iTaps[t])));
+			}
+			_mm256_storeu_si256((__m256i *)&((short *)dst)[b], acc);
+		}
+		else {
+			__m256 accLo = _mm256_setzero_ps(), accHi = _mm256_setzero_ps();
+			for (size_t t = 0; t < c->numTaps; t++) {
+				const uchar *p = &src[b + c->tapOffsets[t]];
+				__m256 w = _mm256_set1_ps(c->taps[t]);
+				accLo = _mm256_add_ps(accLo, _mm256_mul_ps(_mm256_cvtepi32_ps(
+					_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p))), w));
+				accHi = _mm256_add_ps(accHi, _mm256_mul_ps(_mm256_cvtepi32_ps(
+					_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(p + 8)))), w));
+			}
+			_mm256_storeu_ps(&((float *)dst)[b], accLo);
+			_mm256_storeu_ps(&((float *)dst)[b + 8], accHi);
+		}
+	}
+	nocl_separableRowBytes(s, src, dst, b);
+}
+
+__attribute__((target("avx2")))
+void nocl_avx2SeparableColumn(const NOCL_SimdSeparable *s, const void **rows, uchar *dst) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	size_t b = 0;
+	for (; b + 16 <= c->outRow; b += 16) {
+		__m256i lo, hi;
+		if (c->accumulator == NOCL_ACC_INT16) {
+			__m256i acc = _mm256_setzero_si256();
+			for (size_t t = 0; t < s->numColTaps; t++) {
+				__m256i px = _mm256_loadu_si256((const __m256i *)&((const short *)rows[s->colRows[t]])[b]);
+				acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(px, _mm256_set1_epi16((short)s->iColTaps[t])));
+			}
+			lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(acc));
+			hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(acc, 1));
+			lo = nocl_avx2Finish(_mm256_cvtepi32_ps(lo), c);
+			hi = nocl_avx2Finish(_mm256_cvtepi32_ps(hi), c);
+		}
+		else {
+			__m256 accLo = _mm256_setzero_ps(), accHi = _mm256_setzero_ps();
+			for (size_t t = 0; t < s->numColTaps; t++) {
+				const float *p = &((const float *)rows[s->colRows[t]])[b];
+				__m256 w = _mm256_set1_ps(s->colTaps[t]);
+				accLo = _mm256_add_ps(accLo, _mm256_mul_ps(_mm256_loadu_ps(p), w));
+				accHi = _mm256_add_ps(accHi, _mm256_mul_ps(_mm256_loadu_ps(p + 8), w));
+			}
+			lo = nocl_avx2Finish(accLo, c);
+			hi = nocl_avx2Finish(accHi, c);
+		}
+		nocl_avx2Store(&dst[b], lo, hi);
+	}
+	nocl_separableColumnBytes(s, rows, dst, b);
+}
+
+// Finishes 16 int16 sums like the NOCL_ACC_INT16 path of nocl_avx2ConvolveRow
+__attribute__((target("avx2")))
+static inline void nocl_avx2FinishInt16(__m256i acc, const NOCL_SimdConvolve *c, uchar *dst) {
+	__m256i lo = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(acc)),
+			hi = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(acc, 1));
+	nocl_avx2Store(dst, nocl_avx2Finish(_mm256_cvtepi32_ps(lo), c), nocl_avx2Finish(_mm256_cvtepi32_ps(hi), c));
+}
+
+// Int16 pass of nocl_avx2ConvolveRow, or of nocl_avx2SeparableRow when s is set, with n taps
+// Only called with constant n and s, so each instantiation below unrolls its own copy.
+__attribute__((target("avx2"), always_inline))
+static inline void nocl_avx2Int16Taps(const NOCL_SimdConvolve *c, const NOCL_SimdSeparable *s,
+		const uchar *src, void *dst, const size_t n) {
+	__m256i w[NOCL_FIXED_TAPS];
+	const uchar *p[NOCL_FIXED_TAPS];
+	for (size_t t = 0; t < n; t++) {
+		w[t] = _mm256_set1_epi16((short)c->iTaps[t]);
+		p[t] = &src[c->tapOffsets[t]];
+	}
+	size_t b = 0;
+	for (; b + 16 <= c->outRow; b += 16) {
+		__m256i acc = _mm256_setzero_si256();
+		for (size_t t = 0; t < n; t++) {
+			__m256i px = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&p[t][b]));
+			acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(px, w[t]));
+		}
+		if (s == NULL) nocl_avx2FinishInt16(acc, c, &((uchar *)dst)[b]);
+		else _mm256_storeu_si256((__m256i *)&((short *)dst)[b], acc);
+	}
+	if (s == NULL) nocl_simdConvolveBytes(c, src, dst, b, c->outRow);
+	else nocl_separableRowBytes(s, src, dst, b);
+}
+
+// Int16 column pass of nocl_avx2SeparableColumn with n taps
+__attribute__((target("avx2"), always_inline))
+static inline void nocl_avx2Int16Column(const NOCL_SimdSeparable *s, const void **rows, uchar *dst,
+		const size_t n) {
+	const NOCL_SimdConvolve *c = &s->rows;
+	__m256i w[NOCL_FIXED_TAPS];
+	const short *p[NOCL_FIXED_TAPS];
+	for (size_t t = 0; t < n; t++) {
+		w[t] = _mm256_set1_epi16((short)s->iColTaps[t]);
+		p[t] = rows[s->colRows[t]];
+	}
+	size_t b = 0;
+	for (; b + 16 <= c->outRow; b += 16) {
+		__m256i acc = _mm256_setzero_si256();
+		for (size_t t = 0; t < n; t++) {
+			acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(_mm256_loadu_si256((const __m256i *)&p[t][b]), w[t]));
+		}
+		nocl_avx2FinishInt16(acc, c, &dst[b]);
+	}
+	nocl_separableColumnBytes(s, rows, dst, b);
+}
+
+typedef void (*NOCL_Int16Convolve)(const NOCL_SimdConvolve *c, const uchar *src, uchar *dst);
+typedef void (*NOCL_Int16Row)(const NOCL_SimdSeparable *s, const uchar *src, void *dst);
+typedef void (*NOCL_Int16Column)(const NOCL_SimdSeparable *s, const void **rows, uchar *dst);
+
+#define NOCL_INT16_FIXED(n) \
+	__attribute__((target("avx2"))) \
+	static void nocl_avx2ConvolveInt16_##n(const NOCL_SimdConvolve *c, const uchar *src, uchar *dst) { \
+		nocl_avx2Int16Taps(c, NULL, src, dst, n); \
+	} \
+	__attribute__((target("avx2"))) \
+	static void nocl_avx2RowInt16_##n(const NOCL_SimdSeparable *s, const uchar *src, void *dst) { \
+		nocl_avx2Int16Taps(&s->rows, s, src, dst, n); \
+	} \
+	__attribute__((target("avx2"))) \
+	static void nocl_avx2ColumnInt16_##n(const NOCL_SimdSeparable *s, const void **rows, uchar *dst) { \
+		nocl_avx2Int16Column(s, rows, dst, n); \
+	}
+NOCL_INT16_FIXED(1)
+NOCL_INT16_FIXED(2)
+NOCL_INT16_FIXED(3)
+NOCL_INT16_FIXED(4)
+NOCL_INT16_FIXED(5)
+NOCL_INT16_FIXED(6)
+NOCL_INT16_FIXED(7)
+NOCL_INT16_FIXED(8)
+NOCL_INT16_FIXED(9)
+
+// Indexed by tap count
+static const NOCL_Int16Convolve nocl_avx2ConvolveInt16[NOCL_FIXED_TAPS + 1] = { NULL,
+	nocl_avx2ConvolveInt16_1, nocl_avx2ConvolveInt16_2, nocl_avx2ConvolveInt16_3,
+	nocl_avx2ConvolveInt16_4, nocl_avx2ConvolveInt16_5, nocl_avx2ConvolveInt16_6,
+	nocl_avx2ConvolveInt16_7, nocl_avx2ConvolveInt16_8, nocl_avx2ConvolveInt16_9 };
+static const NOCL_Int16Row nocl_avx2RowInt16[NOCL_FIXED_TAPS + 1] = { NULL,
+	nocl_avx2RowInt16_1, nocl_avx2RowInt16_2, nocl_avx2RowInt16_3,
+	nocl_avx2RowInt16_4, nocl_avx2RowInt16_5, nocl_avx2RowInt16_6,
+	nocl_avx2RowInt16_7, nocl_avx2RowInt16_8, nocl_avx2RowInt16_9 };
+static const NOCL_Int16Column nocl_avx2ColumnInt16[NOCL_FIXED_TAPS + 1] = { NULL,
+	nocl_avx2ColumnInt16_1, nocl_avx2ColumnInt16_2, nocl_avx2ColumnInt16_3,
+	nocl_avx2ColumnInt16_4, nocl_avx2ColumnInt16_5, nocl_avx2ColumnInt16_6,
+	nocl_avx2ColumnInt16_7, nocl_avx2ColumnInt16_8, nocl_avx2ColumnInt16_9 };
+
+// True if an int16 pass of numTaps taps has an instantiation above
+static inline bool nocl_fixedInt16(const NOCL_SimdConvolve *c, size_t numTaps) {
+	return c->accumulator == NOCL_ACC_INT16 && numTaps > 0 && numTaps <= NOCL_FIXED_TAPS;
+}
+// ----------------------------------------------- //
+#endif
+
+// Convolves output rows [begin, end)
+void nocl_simdConvolveRows(void *args, size_t begin, size_t end) {
+	NOCL_SimdConvolve *c = args;
+	for (size_t row = begin; row < end; row++) {
+		const uchar *src = &c->padded[row * c->padRow];
+		uchar *dst = &c->output[row * c->outRow];
+	#ifdef NOCL_SIMD_X86
+		if (nocl_getSimdLevel() == NOCL_SIMD_AVX2) {
+			if (nocl_fixedInt16(c, c->numTaps)) nocl_avx2ConvolveInt16[c->numTaps](c, src, dst);
+			else nocl_avx2ConvolveRow(c, src, dst);
+		}
+		else nocl_sse2ConvolveRow(c, src, dst);
+	#else
+		nocl_simdConvolveBytes(c, src, dst, 0, c->outRow);
+	#endif
+	}
+}
+
+void nocl_freeSimdConvolve(NOCL_SimdConvolve *c) {
+	free(c->tapOffsets);
+	free(c->taps);
+	free(c->iTaps);
+}
+
+// Prepares a pass of kernel k from rows of padRow bytes into rows of outRow bytes
+// padded and output are set by the caller. Returns false if the kernel cannot be vectorized.
+bool nocl_setSimdConvolve(NOCL_SimdConvolve *c, const float *k, const unsigned int *knlSize,
+		float knlMult, uchar knlInvert, float alpha, size_t padRow, size_t outRow) {
+	memset(c, 0, sizeof(NOCL_SimdConvolve));
+	// Even kernel sizes use nocl_kConvolve's exact indexing
+	if (nocl_getSimdLevel() == NOCL_SIMD_NONE ||
+		knlSize[0] % 2 == 0 || knlSize[1] % 2 == 0 ||
+		!(alpha >= 0.f && alpha <= 1.f)) return false;
+
+	const size_t area = knlSize[0] * knlSize[1];
+	c->tapOffsets = malloc(sizeof(size_t) * area);
+	c->taps = malloc(sizeof(float) * area);
+	c->iTaps = malloc(sizeof(int) * area);
+	if (c->tapOffsets == NULL || c->taps == NULL || c->iTaps == NULL) {
+		nocl_freeSimdConvolve(c);
+		return false;
+	}
+	c->padRow = padRow;
+	c->outRow = outRow;
+	c->knlMult = knlMult;
+	c->alpha = alpha;
+	c->knlInvert = knlInvert;
+
+	// Same tap order as nocl_kConvolve so float sums round the same way
+	bool integral = true;
+	double absSum = 0;
+	for (size_t x = 0; x < knlSize[0]; x++) {
+		for (size_t y = 0; y < knlSize[1]; y++) {
+			float w = k[x + (knlSize[0] * y)];
+			if (w == 0.f) continue;
+			if (w != floorf(w) || fabsf(w) > 32767.f) integral = false;
+			absSum += fabsf(w);
+			c->tapOffsets[c->numTaps] = (y * c->padRow) + (x * 3);
+			c->taps[c->numTaps] = w;
+			c->iTaps[c->numTaps] = (int)w;
+			c->numTaps++;
+		}
+	}
+	// Integer sums are only identical to float sums while every partial sum is exact
+	if (integral && absSum * 255 <= 32767) c->accumulator = NOCL_ACC_INT16;
+	else if (integral && absSum * 255 < 16777216) c->accumulator = NOCL_ACC_INT32;
+	else c->accumulator = NOCL_ACC_FLOAT;
+	return true;
+}
+
+// Filters a padded image thru a kernel with SIMD instructions
+// Returns false without touching output if the kernel cannot be vectorized
+bool nocl_convolveSIMD(const uchar *padded, uchar *output, const float *k,
+		const unsigned int *knlSize, float knlMult, uchar knlInvert, float alpha,
+		size_t imgW, size_t imgH, const size_t *globalWorkSize) {
+	// Mismatched work sizes use nocl_kConvolve's exact indexing
+	if (globalWorkSize[0] != imgW + knlSize[0] - 1 ||
+		globalWorkSize[1] != imgH + knlSize[1] - 1) return false;
+
+	NOCL_SimdConvolve c;
+	if (!nocl_setSimdConvolve(&c, k, knlSize, knlMult, knlInvert, alpha, globalWorkSize[0] * 3,
+							  imgW * 3)) return false;
+	c.padded = padded;
+	c.output = output;
+
+	nocl_parallelFor(imgH, 0, nocl_simdConvolveRows, &c);
+
+	nocl_freeSimdConvolve(&c);
+	return true;
+}
+
+// One row of the row pass, with the best instruction set
+static inline void nocl_separableRow(const NOCL_SimdSeparable *s, const uchar *src, void *dst) {
+#ifdef NOCL_SIMD_X86
+	if (nocl_getSimdLevel() == NOCL_SIMD_AVX2) {
+		if (nocl_fixedInt16(&s->rows, s->rows.numTaps)) nocl_avx2RowInt16[s->rows.numTaps](s, src, dst);
+		else nocl_avx2SeparableRow(s, src, dst);
+	}
+	else if (nocl_getSimdLevel() == NOCL_SIMD_SSE2) nocl_sse2SeparableRow(s, src, dst);
+	else nocl_separableRowBytes(s, src, dst, 0);
+#else
+	nocl_separableRowBytes(s, src, dst, 0);
+#endif
+}
+
+// One output row of the column pass, with the best instruction set
+static inline void nocl_separableColumn(const NOCL_SimdSeparable *s, const void **rows, uchar *dst) {
+#ifdef NOCL_SIMD_X86
+	if (nocl_getSimdLevel() == NOCL_SIMD_AVX2) {
+		if (nocl_fixedInt16(&s->rows, s->numColTaps)) nocl_avx2ColumnInt16[s->numColTaps](s, rows, dst);
+		else nocl_avx2SeparableColumn(s, rows, dst);
+	}
+	else if (nocl_getSimdLevel() == NOCL_SIMD_SSE2) nocl_sse2SeparableColumn(s, rows, dst);
+	else nocl_separableColumnBytes(s, rows, dst, 0);
+#else
+	nocl_separableColumnBytes(s, rows, dst, 0);
+#endif
+}
+
+// Filters output rows [begin, end) thru both passes
+// The row passes of the last knlH padded rows are kept in a ring, so each padded row is only
+// filtered again by the tile below it.
+void nocl_separableRows(void *args, size_t begin, size_t end) {
+	NOCL_SimdSeparable *s = args;
+	const NOCL_SimdConvolve *c = &s->rows;
+	const size_t knlH = s->knlH,
+				 rowBytes = c->outRow * sizeof(float); // Also fits int16 rows
+	uchar *ring = malloc(rowBytes * knlH);
+	const void **rows = malloc(sizeof(void *) * knlH);
+	if (ring == NULL || rows == NULL) {
+		free(ring);
+		free(rows);
+		s->failed = true;
+		return;
+	}
+
+	for (size_t y = begin; y < end + knlH - 1; y++) {
+		nocl_separableRow(s, &c->padded[y * c->padRow], &ring[(y % knlH) * rowBytes]);
+		if (y < begin + knlH - 1) continue;
+
+		const size_t outY = y + 1 - knlH;
+		for (size_t j = 0; j < knlH; j++) rows[j] = &ring[((outY + j) % knlH) * rowBytes];
+		nocl_separableColumn(s, rows, &c->output[outY * c->outRow]);
+	}
+	free(ring);
+	free(rows);
+}
+
+void nocl_freeSimdSeparable(NOCL_SimdSeparable *s) {
+	nocl_freeSimdConvolve(&s->rows);
+	free(s->colRows);
+	free(s->colTaps);
+	free(s->iColTaps);
+}
+
+// Filters a padded image thru a separable kernel, as a row pass then a column pass
+// Returns false if the kernel cannot be run this way; output is then written again by the caller
+bool nocl_convolveSeparable(const uchar *padded, uchar *output, const KernelInfo *k, float alpha,
+		size_t imgW, size_t imgH, const size_t *globalWorkSize) {
+	// Even kernel sizes and mismatched work sizes use nocl_kConvolve's exact indexing
+	if (!k->separable || k->width % 2 == 0 || k->height % 2 == 0 ||
+		globalWorkSize[0] != imgW + k->width - 1 ||
+		globalWorkSize[1] != imgH + k->height - 1 ||
+		!(alpha >= 0.f && alpha <= 1.f)) return false;
+
+	NOCL_SimdSeparable s;
+	memset(&s, 0, sizeof(NOCL_SimdSeparable));
+	NOCL_SimdConvolve *c = &s.rows;
+	c->tapOffsets = malloc(sizeof(size_t) * k->width);
+	c->taps = malloc(sizeof(float) * k->width);
+	c->iTaps = malloc(sizeof(int) * k->width);
+	s.colRows = malloc(sizeof(size_t) * k->height);
+	s.colTaps = malloc(sizeof(float) * k->height);
+	s.iColTaps = malloc(sizeof(int) * k->height);
+	if (c->tapOffsets == NULL || c->taps == NULL || c->iTaps == NULL ||
+		s.colRows == NULL || s.colTaps == NULL || s.iColTaps == NULL) {
+		nocl_freeSimdSeparable(&s);
+		return false;
+	}
+	c->padded = padded;
+	c->output = output;
+	c->padRow = globalWorkSize[0] * 3;
+	c->outRow = imgW * 3;
+	c->knlMult = k->mult;
+	c->alpha = alpha;
+	c->knlInvert = k->invert? 1 : 0;
+	s.knlH = k->height;
+
+	bool integral = true;
+	double rowSum = 0, colSum = 0;
+	for (size_t x = 0; x < k->width; x++) {
+		const float w = k->rowTaps[x];
+		if (w == 0.f) continue;
+		if (w != floorf(w) || fabsf(w) > 32767.f) integral = false;
+		rowSum += fabsf(w);
+		c->tapOffsets[c->numTaps] = x * 3;
+		c->taps[c->numTaps] = w;
+		c->iTaps[c->numTaps] = (int)w;
+		c->numTaps++;
+	}
+	for (size_t y = 0; y < k->height; y++) {
+		const float w = k->colTaps[y];
+		if (w == 0.f) continue;
+		if (w != floorf(w) || fabsf(w) > 32767.f) integral = false;
+		colSum += fabsf(w);
+		s.colRows[s.numColTaps] = y;
+		s.colTaps[s.numColTaps] = w;
+		s.iColTaps[s.numColTaps] = (int)w;
+		s.numColTaps++;
+	}
+	// Both passes stay in int16 while the largest possible sum fits
+	c->accumulator = (integral && rowSum * colSum * 255 <= 32767)? NOCL_ACC_INT16 : NOCL_ACC_FLOAT;
+
+	// Each tile filters knlH - 1 more padded rows than it outputs, so tiles are kept well above that
+	nocl_parallelFor(imgH, 16 * s.knlH, nocl_separableRows, &s);
+
+	nocl_freeSimdSeparable(&s);
+	return !s.failed;
+}
@@ -0,0 +1,182 @@
+// Persistent worker pool used to spread NOCL work-items across CPU cores
+// Work is split into tiles of rows, and idle threads steal tiles from busy ones
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "artscii.h"
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <unistd.h>
+#endif
+
+// Tiles assigned to one thread. next is advanced atomically by the owner and by thieves.
+typedef struct NOCL_TileQueue {
+	size_t next,
+		   end;
+	char pad[64 - (2 * sizeof(size_t))]; // Keep each queue on its own cache line
+} NOCL_TileQueue;
+
+typedef struct NOCL_ThreadPool {
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t start,
+				   done;
+	NOCL_TileQueue *queues;
+	NOCL_TileFunc func;
+	void *args;
+	size_t numThreads, // Including the calling thread
+		   count,
+		   tileSize,
+		   running;
+	unsigned long generation;
+	bool quit;
+} NOCL_ThreadPool;
+
+NOCL_ThreadPool *nocl_threadPool = NULL;
+size_t nocl_numThreads = 0; // 0 = one thread per CPU
+
+// Returns the number of CPUs available to this process
+size_t nocl_cpuCount() {
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+#else
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	return (cpus > 0)? (size_t)cpus : 1;
+#endif
+}
+
+// Runs tiles from queue q, then steals from the other queues until all are empty
+void nocl_runTiles(NOCL_ThreadPool *pool, size_t q) {
+	for (size_t i = 0; i < pool->numThreads; i++) {
+		NOCL_TileQueue *queue = &pool->queues[(q + i) % pool->numThreads];
+		while (true) {
+			size_t tile = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+			if (tile >= queue->end) break;
+			size_t begin = tile * pool->tileSize,
+				   end = begin + pool->tileSize;
+			if (end > pool->count) end = pool->count;
+			pool->func(pool->args, begin, end);
+		}
+	}
+}
+
+void *nocl_worker(void *arg) {
+	NOCL_ThreadPool *pool = nocl_threadPool;
+	size_t q = (size_t)arg;
+	unsigned long generation = 0;
+	while (true) {
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->quit && pool->generation == generation) {
+			pthread_cond_wait(&pool->start, &pool->lock);
+		}
+		if (pool->quit) {
+			pthread_mutex_unlock(&pool->lock);
+			return NULL;
+		}
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
+
+		nocl_runTiles(pool, q);
+
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->running == 0) pthread_cond_signal(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+void nocl_freeThreadPool() {
+	if (nocl_threadPool != NULL) {
+		pthread_mutex_lock(&nocl_threadPool->lock);
+		nocl_threadPool->quit = true;
+		pthread_cond_broadcast(&nocl_threadPool->start);
+		pthread_mutex_unlock(&nocl_threadPool->lock);
+		for (size_t i = 1; i < nocl_threadPool->numThreads; i++) {
+			pthread_join(nocl_threadPool->threads[i], NULL);
+		}
+		pthread_mutex_destroy(&nocl_threadPool->lock);
+		pthread_cond_destroy(&nocl_threadPool->start);
+		pthread_cond_destroy(&nocl_threadPool->done);
+		free(nocl_threadPool->threads);
+		free(nocl_threadPool->queues);
+		free(nocl_threadPool);
+		nocl_threadPool = NULL;
+	}
+}
+
+// Starts numThreads - 1 workers; the calling thread is used as the last one
+bool nocl_initThreadPool(size_t numThreads) {
+	nocl_freeThreadPool();
+	nocl_threadPool = calloc(1, sizeof(NOCL_ThreadPool));
+	if (nocl_threadPool == NULL) return false;
+	nocl_threadPool->numThreads = numThreads;
+	nocl_threadPool->threads = calloc(numThreads, sizeof(pthread_t));
+	nocl_threadPool->queues = calloc(numThreads, sizeof(NOCL_TileQueue));
+	pthread_mutex_init(&nocl_threadPool->lock, NULL);
+	pthread_cond_init(&nocl_threadPool->start, NULL);
+	pthread_cond_init(&nocl_threadPool->done, NULL);
+	if (nocl_threadPool->threads == NULL || nocl_threadPool->queues == NULL) {
+		nocl_threadPool->numThreads = 1;
+		nocl_freeThreadPool();
+		return false;
+	}
+	for (size_t i = 1; i < numThreads; i++) {
+		if (pthread_create(&nocl_threadPool->threads[i], NULL, nocl_worker, (void *)i) != 0) {
+			nocl_threadPool->numThreads = i;
+			nocl_freeThreadPool();
+			return false;
+		}
+	}
+	return true;
+}
+
+// Sets the number of threads used by NOCL functions (0 = one per CPU)
+void nocl_setThreadCount(int numThreads) {
+	nocl_numThreads = (numThreads > 0)? (size_t)numThreads : 0;
+}
+
+// Returns the count set by nocl_setThreadCount (0 = one per CPU)
+int nocl_getThreadCount() {
+	return (int)nocl_numThreads;
+}
+
+// Calls func(args, begin, end) over [0, count) in tiles of tileSize rows (0 = automatic)
+// Each row is processed exactly once, so results do not depend on the thread count
+void nocl_parallelFor(size_t count, size_t tileSize, NOCL_TileFunc func, void *args) {
+	size_t numThreads = (nocl_numThreads > 0)? nocl_numThreads : nocl_cpuCount();
+	if (tileSize == 0) tileSize = count / (numThreads * 8);
+	if (tileSize == 0) tileSize = 1;
+	size_t numTiles = (count + tileSize - 1) / tileSize;
+	if (numThreads > 1 && numTiles > 1 &&
+		(nocl_threadPool == NULL || nocl_threadPool->numThreads != numThreads)) {
+		nocl_initThreadPool(numThreads);
+	}
+	if (numThreads <= 1 || numTiles <= 1 || nocl_threadPool == NULL) {
+		func(args, 0, count);
+		return;
+	}
+
+	NOCL_ThreadPool *pool = nocl_threadPool;
+	for (size_t i = 0; i < numThreads; i++) {
+		pool->queues[i].next = (numTiles * i) / numThreads;
+		pool->queues[i].end = (numTiles * (i + 1)) / numThreads;
+	}
+	pool->func = func;
+	pool->args = args;
+	pool->count = count;
+	pool->tileSize = tileSize;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->running = numThreads - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->lock);
+
+	nocl_runTiles(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->running > 0) pthread_cond_wait(&pool->done, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,112 @@
+// Input preprocessing
+// Turns decoded pixels into the input of *_ToAscii in one pass: optional greyscale, then the brightness
+// remap (c * 0.75) + 64 that keeps dark areas from filtering to black. Both are exact in integers, so
+// the SIMD and scalar paths give the same bytes.
+
+#include <stdlib.h>
+#include "artscii.h"
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define PRE_SIMD_X86
+#endif
+
+extern int nocl_getSimdLevel();
+
+// Same value as NOCL_SIMD_AVX2 in nocl_simd.c
+#define PRE_SIMD_AVX2 2
+
+typedef unsigned char uchar;
+
+// (int)(c * 0.75f) + 64
+static inline uchar preRemap(unsigned int c) {
+	return (uchar)(((3 * c) >> 2) + 64);
+}
+
+// Brightest channel plus half the darkest, at most 255
+static inline unsigned int preGrey(unsigned int r, unsigned int g, unsigned int b) {
+	unsigned int max = (r > g)? r : g,
+				 min = (r < g)? r : g;
+	if (b > max) max = b;
+	if (b < min) min = b;
+	max += min >> 1;
+	return (max > 255)? 255 : max;
+}
+
+// Pixels [x, width) of one row
+void prePixels(const uchar *src, unsigned int srcBpp, bool bgr, bool grey, uchar *dst, size_t x,
+		size_t width) {
+	const size_t r = bgr? 2 : 0,
+				 b = bgr? 0 : 2;
+	for (; x < width; x++) {
+		const uchar *px = &src[x * srcBpp];
+		uchar *out = &dst[x * 3];
+		if (grey) out[0] = out[1] = out[2] = preRemap(preGrey(px[0], px[1], px[2]));
+		else {
+			// Read before writing, since dst can be src
+			const uchar pr = px[r], pg = px[1], pb = px[b];
+			out[0] = preRemap(pr);
+			out[1] = preRemap(pg);
+			out[2] = preRemap(pb);
+		}
+	}
+}
+
+#ifdef PRE_SIMD_X86
+// 8 pixels of 4 bytes at a time. Each step stores 28 bytes for 24, so it stops 2 pixels early.
+__attribute__((target("avx2")))
+void preRowAVX2(const uchar *src, bool bgr, bool grey, uchar *dst, size_t width) {
+	const __m256i zero = _mm256_setzero_si256(),
+				  bias = _mm256_set1_epi16(64),
+				  half = _mm256_set1_epi8(0x7f),
+				  broadcast = _mm256_setr_epi8(0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1,
+											   0, 0, 0, -1, 4, 4, 4, -1, 8, 8, 8, -1, 12, 12, 12, -1),
+				  pack = bgr? _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+											   2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) :
+							  _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+											   0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	size_t x = 0;
+	for (; x + 10 <= width; x += 8) {
+		__m256i px = _mm256_loadu_si256((const __m256i *)&src[x * 4]);
+		if (grey) {
+			// Channels 1 and 2 are shifted onto channel 0 of each pixel
+			__m256i c1 = _mm256_srli_epi32(px, 8),
+					c2 = _mm256_srli_epi32(px, 16),
+					max = _mm256_max_epu8(_mm256_max_epu8(px, c1), c2),
+					min = _mm256_min_epu8(_mm256_min_epu8(px, c1), c2);
+			min = _mm256_and_si256(_mm256_srli_epi16(min, 1), half);
+			px = _mm256_shuffle_epi8(_mm256_adds_epu8(max, min), broadcast);
+		}
+		__m256i lo = _mm256_unpacklo_epi8(px, zero),
+				hi = _mm256_unpackhi_epi8(px, zero);
+		lo = _mm256_add_epi16(_mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_slli_epi16(lo, 1)), 2), bias);
+		hi = _mm256_add_epi16(_mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_slli_epi16(hi, 1)), 2), bias);
+		__m256i rgb = _mm256_shuffle_epi8(_mm256_packus_epi16(lo, hi), pack);
+		_mm_storeu_si128((__m128i *)&dst[x * 3], _mm256_castsi256_si128(rgb));
+		_mm_storeu_si128((__m128i *)&dst[(x * 3) + 12], _mm256_extracti128_si256(rgb, 1));
+	}
+	prePixels(src, 4, bgr, grey, dst, x, width);
+}
+#endif
+
+// Converts decoded pixels to the input of *_ToAscii
+// src holds width x height pixels of srcBpp (3 or 4) bytes, in RGB order or BGR if bgr is set; a
+// fourth byte is ignored. output gets packed RGB rows of stride bytes. output can be src, to convert in
+// place, as long as stride <= srcStride. grey sets every channel to the brightest channel plus half
+// the darkest. Then every channel c becomes (c * 0.75) + 64.
+EXPORT bool PRE_Preprocess(const unsigned char *src, size_t srcStride, unsigned int srcBpp, bool bgr,
+		unsigned int width, unsigned int height, bool grey, unsigned char *output, size_t stride) {
+	if ((srcBpp != 3 && srcBpp != 4) || stride < (size_t)width * 3 ||
+		(src == output && stride > srcStride)) return false;
+	for (size_t y = 0; y < height; y++) {
+		const uchar *row = &src[y * srcStride];
+		uchar *out = &output[y * stride];
+	#ifdef PRE_SIMD_X86
+		if (srcBpp == 4 && nocl_getSimdLevel() == PRE_SIMD_AVX2) {
+			preRowAVX2(row, bgr, grey, out, width);
+			continue;
+		}
+	#endif
+		prePixels(row, srcBpp, bgr, grey, out, 0, width);
+	}
+	return true;
+}
@@ -0,0 +1,234 @@
+// OpenCL program binary cache
+// Building kernels.cl from source can take seconds on CPU devices, so the built binary is saved and
+// loaded with clCreateProgramWithBinary on later runs. A binary is only used if its key matches. The
+// key names the platform, device, driver, build options, library version and kernel source, so any
+// change to them builds from source again.
+//
+// File layout (native byte order):
+//   ProgramFileHeader
+//   key          keyLen bytes, not terminated
+//   binary       binarySize bytes
+
+#include <stdlib.h>
+#include "artscii.h"
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
+typedef struct ProgramFileHeader {
+	char magic[8];
+	unsigned int version,
+				 keyLen;
+	unsigned long long binarySize;
+} ProgramFileHeader;
+
+static const char programMagic[8] = { 'A', 'R', 'T', 'C', 'L', 'B', 'I', 'N' };
+
+char *programCacheDir = NULL; // NULL = always build from source
+bool programCacheHit = false;
+
+// Sets the directory where built programs are saved; it must already exist
+// NULL disables the cache
+EXPORT void OCL_SetCacheDirectory(const char *dir) {
+	free(programCacheDir);
+	programCacheDir = NULL;
+	if (dir != NULL) {
+		programCacheDir = malloc(strlen(dir) + 1);
+		if (programCacheDir != NULL) strcpy(programCacheDir, dir);
+	}
+}
+
+// True if the last OCL_Init() loaded its program from the cache
+EXPORT bool OCL_ProgramCacheHit() {
+	return programCacheHit;
+}
+
+// 64-bit FNV-1a
+unsigned long long fnv1a(const char *str) {
+	unsigned long long hash = 14695981039346656037ULL;
+	for (; *str != '\0'; str++) {
+		hash = (hash ^ (unsigned char)*str) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Appends a platform or device string to key
+bool appendInfo(char **key, const char *value) {
+	char *longer = realloc(*key, strlen(*key) + strlen(value) + 2);
+	if (longer == NULL) return false;
+	strcat(longer, value);
+	strcat(longer, "|");
+	*key = longer;
+	return true;
+}
+
+// Builds the cache key for src built with options on device, which the caller frees
+char *programCacheKey(const char *src, const char *options) {
+	const cl_platform_info platformInfo[] = { CL_PLATFORM_NAME, CL_PLATFORM_VERSION };
+	const cl_device_info deviceInfo[] = { CL_DEVICE_NAME, CL_DEVICE_VERSION, CL_DRIVER_VERSION };
+	char *key = malloc(64);
+	if (key == NULL) return NULL;
+	snprintf(key, 64, "ArtSCII " ARTSCII_VERSION "|%016llx|", fnv1a(src));
+
+	char value[1024];
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(platformInfo) / sizeof(platformInfo[0]) && ok; i++) {
+		ok = clGetPlatformInfo(platform, platformInfo[i], sizeof(value), value, NULL) == CL_SUCCESS &&
+			 appendInfo(&key, value);
+	}
+	for (size_t i = 0; i < sizeof(deviceInfo) / sizeof(deviceInfo[0]) && ok; i++) {
+		ok = clGetDeviceInfo(device, deviceInfo[i], sizeof(value), value, NULL) == CL_SUCCESS &&
+			 appendInfo(&key, value);
+	}
+	ok = ok && appendInfo(&key, options);
+	if (!ok) {
+		free(key);
+		return NULL;
+	}
+	return key;
+}
+
+// Path of the cached binary for key, which the caller frees
+char *programCachePath(const char *key) {
+	const size_t len = strlen(programCacheDir) + 64;
+	char *path = malloc(len);
+	if (path == NULL) return NULL;
+#ifdef _WIN32
+	snprintf(path, len, "%s\\program_%016llx.bin", programCacheDir, fnv1a(key));
+#else
+	snprintf(path, len, "%s/program_%016llx.bin", programCacheDir, fnv1a(key));
+#endif
+	return path;
+}
+
+// Reads the binary saved at path for key, which the caller frees
+// Returns NULL if the file is missing, was saved with another key, or is damaged
+unsigned char *loadProgramBinary(const char *path, const char *key, size_t *binarySize) {
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) return NULL;
+
+	ProgramFileHeader header;
+	const size_t keyLen = strlen(key);
+	char *fileKey = malloc(keyLen);
+	unsigned char *binary = NULL;
+	bool valid = fileKey != NULL &&
+				 fread(&header, sizeof(header), 1, file) == 1 &&
+				 memcmp(header.magic, programMagic, sizeof(programMagic)) == 0 &&
+				 header.version == PROGRAM_FILE_VERSION &&
+				 header.keyLen == keyLen &&
+				 header.binarySize > 0 &&
+				 fread(fileKey, 1, keyLen, file) == keyLen &&
+				 memcmp(fileKey, key, keyLen) == 0;
+	if (valid) {
+		binary = malloc(header.binarySize);
+		valid = binary != NULL && fread(binary, 1, header.binarySize, file) == header.binarySize &&
+				fgetc(file) == EOF;
+	}
+	fclose(file);
+	free(fileKey);
+	if (!valid) {
+		free(binary);
+		return NULL;
+	}
+	*binarySize = header.binarySize;
+	return binary;
+}
+
+// Saves binary to path for key
+// The file is written next to path and then renamed, so other processes never read a partial file.
+bool saveProgramBinary(const char *path, const char *key, const unsigned char *binary, size_t binarySize) {
+	char *tmpPath = malloc(strlen(path) + 5);
+	if (tmpPath == NULL) return false;
+	strcpy(tmpPath, path);
+	strcat(tmpPath, ".tmp");
+
+	ProgramFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, programMagic, sizeof(programMagic));
+	header.version = PROGRAM_FILE_VERSION;
+	header.keyLen = strlen(key);
+	header.binarySize = binarySize;
+
+	bool ok = false;
+	FILE *file = fopen(tmpPath, "wb");
+	if (file != NULL) {
+		ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+			 fwrite(key, 1, header.keyLen, file) == header.keyLen &&
+			 fwrite(binary, 1, binarySize, file) == binarySize;
+		ok = (fclose(file) == 0) && ok;
+	#ifdef _WIN32
+		ok = ok && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING);
+	#else
+		ok = ok && rename(tmpPath, path) == 0;
+	#endif
+		if (!ok) remove(tmpPath);
+	}
+	free(tmpPath);
+	return ok;
+}
+
+// Saves the binary of a program built from source
+void cacheProgram(cl_program built, const char *path, const char *key) {
+	size_t binarySize = 0;
+	if (clGetProgramInfo(built, CL_PROGRAM_BINARY_SIZES, sizeof(binarySize), &binarySize, NULL) != CL_SUCCESS ||
+		binarySize == 0) return;
+	unsigned char *binary = malloc(binarySize);
+	if (binary == NULL) return;
+	if (clGetProgramInfo(built, CL_PROGRAM_BINARIES, sizeof(binary), &binary, NULL) == CL_SUCCESS) {
+		saveProgramBinary(path, key, binary, binarySize);
+	}
+	free(binary);
+}
+
+// Creates and builds a program for device, from the cache if possible
+// Falls back to building src. Sets result, and prints the build log if src does not build.
+cl_program buildProgram(const char *src, const char *options) {
+	programCacheHit = false;
+	char *key = NULL, *path = NULL;
+	if (programCacheDir != NULL) {
+		key = programCacheKey(src, options);
+		if (key != NULL) path = programCachePath(key);
+	}
+
+	cl_program built = NULL;
+	if (path != NULL) {
+		size_t binarySize = 0;
+		unsigned char *binary = loadProgramBinary(path, key, &binarySize);
+		if (binary != NULL) {
+			const unsigned char *binaries[] = { binary };
+			cl_int status = CL_SUCCESS;
+			built = clCreateProgramWithBinary(context, 1, &device, &binarySize, binaries, &status, &result);
+			if (result == CL_SUCCESS && status == CL_SUCCESS) {
+				result = clBuildProgram(built, 1, &device, options, NULL, NULL);
+			}
+			else if (result == CL_SUCCESS) result = status;
+			if (result != CL_SUCCESS && built != NULL) {
+				// Rejected by the driver, so it is replaced below
+				clReleaseProgram(built);
+				built = NULL;
+			}
+			programCacheHit = built != NULL;
+			free(binary);
+		}
+	}
+
+	if (built == NULL) {
+		built = clCreateProgramWithSource(context, 1, &src, NULL, &result);
+		if (result == CL_SUCCESS) result = clBuildProgram(built, 1, &device, options, NULL, NULL);
+		if (result != CL_SUCCESS) {
+			// kernel.cl build logs
+			if (built != NULL) {
+				char *buf = calloc(999999, sizeof(char));
+				if (buf != NULL) {
+					clGetProgramBuildInfo(built, device, CL_PROGRAM_BUILD_LOG, 999999, buf, NULL);
+					printf("%s", buf);
+					free(buf);
+				}
+			}
+		}
+		else if (path != NULL) cacheProgram(built, path, key);
+	}
+	free(key);
+	free(path);
+	return built;
+}
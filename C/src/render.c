@@ -0,0 +1,232 @@
+// Glyph compositor for bitmap output
+// Each character of an atlas is turned into a coverage mask once, then the masks are blended over
+// the image, tinted by the colour of each cell. Later cells are drawn over earlier ones, so glyphs
+// larger than a cell (-overlap) overlap the same way as drawing the characters one by one.
+// The image is split into bands of pixel rows, and each band draws every glyph that reaches into it,
+// so bands can be drawn in parallel and the output does not depend on the number of threads.
+
+#include <stdlib.h>
+#include "artscii.h"
+#if defined(__x86_64__) || defined(__i386__)
+	#include <immintrin.h>
+	#define RENDER_SIMD_X86
+#endif
+
+extern int nocl_getSimdLevel();
+
+// Same values as NOCL_SIMD_SSE2 and NOCL_SIMD_AVX2 in nocl_simd.c
+#define RENDER_SIMD_AVX2 2
+
+// Atlas characters are drawn in white over this grey
+#define RENDER_GLYPH_BACKGROUND 17
+
+typedef unsigned char uchar;
+
+typedef struct RenderArgs {
+	const uchar *chars,
+				*colors,
+				*masks;       // One mask per atlas character, same layout as GlyphAtlas pixels
+	const size_t *rowStarts;  // Index of the first cell of each text row
+	size_t numRows;
+	int glyphIndex[256];      // -1 = not in the atlas
+	unsigned int glyphW,
+				 glyphH,
+				 width,
+				 height,
+				 stepX,
+				 stepY;
+	int originX,
+		originY;
+	size_t stride;
+	uchar background;
+	bool bgr,
+		 failed;
+	uchar *image;
+} RenderArgs;
+
+// Coverage of each byte of every atlas character, from 0 (background) to 255 (white)
+// bgr swaps the first and last byte of each pixel, to match the image.
+uchar *renderMasks(const GlyphAtlas *atlas, bool bgr) {
+	const size_t len = (size_t)atlas->numChars * atlas->charWidth * atlas->charHeight * 3;
+	uchar *masks = malloc(len);
+	if (masks == NULL) return NULL;
+	for (size_t b = 0; b < len; b++) {
+		const int v = atlas->pixels[bgr? (b - (b % 3)) + 2 - (b % 3) : b] - RENDER_GLYPH_BACKGROUND;
+		masks[b] = (v > 0)? (uchar)(((v * 255) + ((255 - RENDER_GLYPH_BACKGROUND) / 2)) /
+									(255 - RENDER_GLYPH_BACKGROUND)) : 0;
+	}
+	return masks;
+}
+
+// Blends n bytes of tint over dst, weighted by mask
+// (dst * (255 - mask) + tint * mask) / 255, rounded
+static inline void renderBlendBytes(uchar *dst, const uchar *mask, const uchar *tint, size_t b, size_t n) {
+	for (; b < n; b++) {
+		unsigned int t = (dst[b] * (255u - mask[b])) + (tint[b] * (unsigned int)mask[b]) + 128u;
+		dst[b] = (uchar)((t + (t >> 8)) >> 8);
+	}
+}
+
+#ifdef RENDER_SIMD_X86
+// 8 bytes at a time in 16-bit lanes
+void renderBlendSSE2(uchar *dst, const uchar *mask, const uchar *tint, size_t n) {
+	const __m128i zero = _mm_setzero_si128(),
+				  max = _mm_set1_epi16(255),
+				  half = _mm_set1_epi16(128);
+	size_t b = 0;
+	for (; b + 8 <= n; b += 8) {
+		__m128i d = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&dst[b]), zero),
+				m = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&mask[b]), zero),
+				c = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&tint[b]), zero);
+		__m128i t = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(d, _mm_sub_epi16(max, m)),
+												_mm_mullo_epi16(c, m)), half);
+		t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		_mm_storel_epi64((__m128i *)&dst[b], _mm_packus_epi16(t, t));
+	}
+	renderBlendBytes(dst, mask, tint, b, n);
+}
+
+// 16 bytes at a time in 16-bit lanes
+__attribute__((target("avx2")))
+void renderBlendAVX2(uchar *dst, const uchar *mask, const uchar *tint, size_t n) {
+	const __m256i max = _mm256_set1_epi16(255),
+				  half = _mm256_set1_epi16(128);
+	size_t b = 0;
+	for (; b + 16 <= n; b += 16) {
+		__m256i d = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&dst[b])),
+				m = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&mask[b])),
+				c = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)&tint[b]));
+		__m256i t = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(d, _mm256_sub_epi16(max, m)),
+													  _mm256_mullo_epi16(c, m)), half);
+		t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+		__m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(t), _mm256_extracti128_si256(t, 1));
+		_mm_storeu_si128((__m128i *)&dst[b], packed);
+	}
+	renderBlendBytes(dst, mask, tint, b, n);
+}
+#endif
+
+static inline void renderBlend(uchar *dst, const uchar *mask, const uchar *tint, size_t n) {
+#ifdef RENDER_SIMD_X86
+	if (nocl_getSimdLevel() == RENDER_SIMD_AVX2) renderBlendAVX2(dst, mask, tint, n);
+	else renderBlendSSE2(dst, mask, tint, n);
+#else
+	renderBlendBytes(dst, mask, tint, 0, n);
+#endif
+}
+
+// Fills and draws image rows [begin, end)
+void renderRows(void *args, size_t begin, size_t end) {
+	RenderArgs *r = args;
+	const size_t glyphRow = (size_t)r->glyphW * 3,
+				 glyphLen = glyphRow * r->glyphH;
+	uchar *tint = malloc(glyphRow);
+	for (size_t y = begin; y < end; y++) {
+		memset(&r->image[y * r->stride], r->background, (size_t)r->width * 3);
+	}
+	if (tint == NULL) {
+		__atomic_store_n(&r->failed, true, __ATOMIC_RELAXED);
+		return;
+	}
+
+	for (size_t row = 0; row < r->numRows; row++) {
+		// Skip text rows whose glyphs do not reach into this band
+		const long long top = r->originY + ((long long)row * r->stepY),
+						y0 = (top > (long long)begin)? top : (long long)begin,
+						y1 = (top + r->glyphH < (long long)end)? top + r->glyphH : (long long)end;
+		if (y0 >= y1) continue;
+
+		long long left = r->originX;
+		for (size_t cell = r->rowStarts[row]; cell < r->rowStarts[row + 1] && r->chars[cell] != '\n';
+			 cell++, left += r->stepX) {
+			const int glyph = r->glyphIndex[r->chars[cell]];
+			const long long x0 = (left > 0)? left : 0,
+							x1 = (left + r->glyphW < r->width)? left + r->glyphW : r->width;
+			if (glyph < 0 || x0 >= x1) continue;
+
+			const uchar *color = &r->colors[cell * 3];
+			for (size_t b = 0; b < glyphRow; b += 3) {
+				tint[b] = color[r->bgr? 2 : 0];
+				tint[b + 1] = color[1];
+				tint[b + 2] = color[r->bgr? 0 : 2];
+			}
+			const size_t skip = (size_t)(x0 - left) * 3,
+						 n = (size_t)(x1 - x0) * 3;
+			for (long long y = y0; y < y1; y++) {
+				const uchar *mask = &r->masks[(glyph * glyphLen) + ((size_t)(y - top) * glyphRow) + skip];
+				renderBlend(&r->image[((size_t)y * r->stride) + ((size_t)x0 * 3)], mask, &tint[skip], n);
+			}
+		}
+	}
+	free(tint);
+}
+
+// Draws the characters of an ASCII image into an RGB image of width x height pixels
+// chars and colors are the output of *_ToAscii, numChars long including each '\n'. The image is
+// filled with background first. The first glyph is drawn with its top left corner at originX,
+// originY and each next glyph is stepX pixels right, or stepY pixels down after a '\n'. Glyphs are
+// drawn from atlas, which can be larger than a step. bgr writes pixels in BGR order.
+// numThreads = 1 draws on the calling thread without the NOCL thread pool, so it is safe while
+// another thread converts an image.
+EXPORT bool RENDER_Glyphs(const unsigned char *chars, const unsigned char *colors, size_t numChars,
+		const GlyphAtlas *atlas, unsigned char *image, unsigned int width, unsigned int height,
+		size_t stride, int originX, int originY, unsigned int stepX, unsigned int stepY,
+		unsigned char background, bool bgr, int numThreads) {
+	RenderArgs r;
+	memset(&r, 0, sizeof(r));
+	r.chars = chars;
+	r.colors = colors;
+	r.glyphW = atlas->charWidth;
+	r.glyphH = atlas->charHeight;
+	r.width = width;
+	r.height = height;
+	r.stride = stride;
+	r.originX = originX;
+	r.originY = originY;
+	r.stepX = stepX;
+	r.stepY = stepY;
+	r.background = background;
+	r.bgr = bgr;
+	r.image = image;
+
+	for (int c = 0; c < 256; c++) r.glyphIndex[c] = -1;
+	for (unsigned int c = 0; c < atlas->numChars; c++) {
+		r.glyphIndex[(uchar)atlas->charMap[c]] = (int)c;
+	}
+
+	// Text rows end with '\n', except possibly the last
+	size_t numRows = 0;
+	for (size_t c = 0; c < numChars; c++) {
+		if (chars[c] == '\n') numRows++;
+	}
+	if (numChars > 0 && chars[numChars - 1] != '\n') numRows++;
+	size_t *rowStarts = malloc(sizeof(size_t) * (numRows + 1));
+	uchar *masks = renderMasks(atlas, bgr);
+	if (rowStarts == NULL || masks == NULL) {
+		free(rowStarts);
+		free(masks);
+		return false;
+	}
+	rowStarts[0] = 0;
+	for (size_t c = 0, row = 1; c < numChars; c++) {
+		if (chars[c] == '\n' && row < numRows) rowStarts[row++] = c + 1;
+	}
+	rowStarts[numRows] = numChars;
+	r.rowStarts = rowStarts;
+	r.numRows = numRows;
+	r.masks = masks;
+
+	// One band per text row
+	if (numThreads == 1) renderRows(&r, 0, height);
+	else {
+		// The pool is shared with the NOCL_* functions, so their count is put back afterwards
+		const int previousThreads = nocl_getThreadCount();
+		nocl_setThreadCount(numThreads);
+		nocl_parallelFor(height, (stepY > 0)? stepY : 1, renderRows, &r);
+		nocl_setThreadCount(previousThreads);
+	}
+
+	free(rowStarts);
+	free(masks);
+	return !r.failed;
+}
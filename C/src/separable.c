@@ -0,0 +1,130 @@
+// Separable kernels
+// A kernel whose weights are rowTaps[x] * colTaps[y] is filtered as a pass along each row, then a pass
+// down each column, which reads width + height taps per pixel instead of width * height. Kernels can
+// be given as factors, which is the only way to pass kernels larger than KNL_INFO_BUF_SIZE. Otherwise
+// integer factors are looked for in the weights, and are only used when both passes give exactly the
+// same bytes as the 2D kernel.
+
+#include <math.h>
+#include <stdlib.h>
+#include "artscii.h"
+
+// Integers up to 2^24 are exact in floats
+#define SEP_EXACT_LIMIT 16777216.0
+
+// True if buffer holds every weight of k
+bool kernelHasWeights(const KernelInfo *k) {
+	const size_t area = (size_t)k->width * k->height;
+	return area <= KNL_INFO_BUF_SIZE && k->bufSize >= area;
+}
+
+// Copies the width * height weights of k into weights, from its factors if buffer does not hold them
+void expandKernel(const KernelInfo *k, float *weights) {
+	for (size_t y = 0; y < k->height; y++) {
+		for (size_t x = 0; x < k->width; x++) {
+			weights[x + (k->width * y)] = kernelHasWeights(k)? k->buffer[x + (k->width * y)] :
+															   k->rowTaps[x] * k->colTaps[y];
+		}
+	}
+}
+
+static size_t countTaps(const float *taps, size_t numTaps) {
+	size_t count = 0;
+	for (size_t i = 0; i < numTaps; i++) count += (taps[i] != 0.f);
+	return count;
+}
+
+static double absSum(const float *taps, size_t numTaps) {
+	double sum = 0;
+	for (size_t i = 0; i < numTaps; i++) sum += fabs(taps[i]);
+	return sum;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+	while (b != 0) {
+		const unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+// Looks for integer factors of the weights of k, and sets them if they are exact
+// Every partial sum of both passes has to be an integer below 2^24, so the float sums are exact and
+// the output is the same as the 2D kernel's.
+static bool factorKernel(KernelInfo *k) {
+	const size_t w = k->width,
+				 h = k->height;
+	const float *weights = k->buffer;
+	if (w > KNL_MAX_SIDE || h > KNL_MAX_SIDE) return false;
+
+	// The largest weight is the pivot: its row gives the row factors, its column the column factors
+	size_t px = 0, py = 0;
+	for (size_t y = 0; y < h; y++) {
+		for (size_t x = 0; x < w; x++) {
+			const float v = weights[x + (w * y)];
+			if (v != floorf(v) || fabsf(v) >= SEP_EXACT_LIMIT) return false;
+			if (fabsf(v) > fabsf(weights[px + (w * py)])) {
+				px = x;
+				py = y;
+			}
+		}
+	}
+	const float pivot = weights[px + (w * py)];
+	if (pivot == 0.f) return false;
+
+	// The pivot's row is divided by its common factor, keeping the pivot positive
+	unsigned int div = 0;
+	for (size_t x = 0; x < w; x++) div = gcd(div, (unsigned int)fabsf(weights[x + (w * py)]));
+	const float scale = (pivot < 0.f)? -(float)div : (float)div;
+	float row[KNL_MAX_SIDE], col[KNL_MAX_SIDE];
+	for (size_t x = 0; x < w; x++) row[x] = weights[x + (w * py)] / scale;
+	for (size_t y = 0; y < h; y++) {
+		col[y] = weights[px + (w * y)] / row[px];
+		if (col[y] != floorf(col[y])) return false;
+	}
+	for (size_t y = 0; y < h; y++) {
+		for (size_t x = 0; x < w; x++) {
+			if (row[x] * col[y] != weights[x + (w * y)]) return false;
+		}
+	}
+	if (absSum(row, w) * absSum(col, h) * 255 >= SEP_EXACT_LIMIT) return false;
+
+	memcpy(k->rowTaps, row, sizeof(float) * w);
+	memcpy(k->colTaps, col, sizeof(float) * h);
+	return true;
+}
+
+// Returns a copy of kernels to filter with, or NULL if a kernel is invalid or memory runs out
+// Kernels given as factors also get their weights when they fit in buffer. Kernels given as weights
+// are marked separable when exact factors are found and take fewer taps than the 2D kernel.
+KernelInfo *prepareKernels(const KernelInfo *kernels, size_t numKernels) {
+	KernelInfo *prepared = malloc(sizeof(KernelInfo) * numKernels);
+	if (prepared == NULL) return NULL;
+	memcpy(prepared, kernels, sizeof(KernelInfo) * numKernels);
+
+	bool valid = true;
+	for (size_t i = 0; i < numKernels && valid; i++) {
+		KernelInfo *k = &prepared[i];
+		const size_t area = (size_t)k->width * k->height;
+		if (k->separable) {
+			valid = k->width <= KNL_MAX_SIDE && k->height <= KNL_MAX_SIDE;
+			if (valid && !kernelHasWeights(k) && area <= KNL_INFO_BUF_SIZE) {
+				expandKernel(k, k->buffer);
+				k->bufSize = area;
+			}
+		}
+		else {
+			valid = kernelHasWeights(k);
+			k->separable = valid && factorKernel(k) &&
+						   countTaps(k->rowTaps, k->width) + countTaps(k->colTaps, k->height) <
+						   countTaps(k->buffer, area);
+		}
+	}
+	if (!valid) {
+		fprintf(stderr, "Warning: A kernel has no weights, or factors longer than %d taps.\n", KNL_MAX_SIDE);
+		free(prepared);
+		return NULL;
+	}
+	return prepared;
+}
@@ -0,0 +1,159 @@
+// Specialized OpenCL programs
+// kernels.cl reads kernel weights, kernel sizes, the number of images and the cell size from buffers,
+// so its loops have variable trip counts. For each kernel set, it is built again with -D options that
+// bake them in as constants: convolveFixed<k> has the non-zero taps of kernel k unrolled, and the
+// match kernels get MATCH_NUM_IMGS, MATCH_CHAR_W and MATCH_CHAR_H. Programs are kept by options until
+// OCL_Cleanup(), and go through buildProgram(), so they are also saved in the program cache.
+// Whenever a program cannot be built, the generic kernels are used.
+
+#include <math.h>
+#include <stdlib.h>
+#include "artscii.h"
+
+// Programs kept at once; later kernel sets use the generic kernels
+#define SPEC_MAX_PROGRAMS 8
+#define SPEC_MAX_KERNELS 16
+// Kernels of more taps are left to the generic or separable passes
+#define SPEC_MAX_TAPS 25
+// Same as the number of convolveFixed<k> in kernels.cl
+#define SPEC_MAX_FIXED 8
+
+typedef struct SpecializedProgram {
+	char *options;
+	cl_program program; // NULL if it did not build
+	size_t numKernels;
+	char names[SPEC_MAX_KERNELS][32];
+	cl_kernel kernels[SPEC_MAX_KERNELS];
+} SpecializedProgram;
+
+extern const char *kernelSrc;
+extern bool programCacheHit;
+
+static SpecializedProgram specPrograms[SPEC_MAX_PROGRAMS];
+static size_t numSpecPrograms = 0;
+
+// Releases every specialized program and its kernels
+void freeSpecializedPrograms() {
+	for (size_t i = 0; i < numSpecPrograms; i++) {
+		for (size_t k = 0; k < specPrograms[i].numKernels; k++) clReleaseKernel(specPrograms[i].kernels[k]);
+		if (specPrograms[i].program != NULL) clReleaseProgram(specPrograms[i].program);
+		free(specPrograms[i].options);
+	}
+	memset(specPrograms, 0, sizeof(specPrograms));
+	numSpecPrograms = 0;
+}
+
+// Returns the program built with options, building it on first use
+// Returns NULL if it does not build or too many programs are kept
+static SpecializedProgram *specializedProgram(const char *options) {
+	for (size_t i = 0; i < numSpecPrograms; i++) {
+		if (strcmp(specPrograms[i].options, options) == 0) {
+			return (specPrograms[i].program != NULL)? &specPrograms[i] : NULL;
+		}
+	}
+	if (numSpecPrograms == SPEC_MAX_PROGRAMS) return NULL;
+	SpecializedProgram *spec = &specPrograms[numSpecPrograms];
+	spec->options = malloc(strlen(options) + 1);
+	if (spec->options == NULL) return NULL;
+	strcpy(spec->options, options);
+	numSpecPrograms++;
+
+	// OCL_ProgramCacheHit() only reports the program of OCL_Init()
+	const bool initHit = programCacheHit;
+	spec->program = buildProgram(kernelSrc, options);
+	programCacheHit = initHit;
+	if (result != CL_SUCCESS) {
+		if (spec->program != NULL) clReleaseProgram(spec->program);
+		spec->program = NULL;
+		result = CL_SUCCESS;
+		fprintf(stderr, "Warning: Could not build specialized kernels. Using the generic ones.\n");
+		return NULL;
+	}
+	return spec;
+}
+
+// Returns kernel name of the program built with options, or fallback if there is none
+cl_kernel specializedKernel(const char *options, const char *name, cl_kernel fallback) {
+	SpecializedProgram *spec = specializedProgram(options);
+	if (spec == NULL) return fallback;
+	for (size_t k = 0; k < spec->numKernels; k++) {
+		if (strcmp(spec->names[k], name) == 0) return spec->kernels[k];
+	}
+	if (spec->numKernels == SPEC_MAX_KERNELS || strlen(name) >= sizeof(spec->names[0])) return fallback;
+
+	cl_int status = CL_SUCCESS;
+	cl_kernel kernel = clCreateKernel(spec->program, name, &status);
+	if (status != CL_SUCCESS) return fallback;
+	strcpy(spec->names[spec->numKernels], name);
+	spec->kernels[spec->numKernels++] = kernel;
+	return kernel;
+}
+
+// Options that bake numImgs and charSize into the match kernels
+// options holds at least SPEC_MATCH_OPTIONS_LEN characters
+void matchOptions(char *options, int numImgs, const int *charSize) {
+	snprintf(options, SPEC_MATCH_OPTIONS_LEN, "-D MATCH_NUM_IMGS=%d -D MATCH_CHAR_W=%d -D MATCH_CHAR_H=%d",
+			 numImgs, charSize[0], charSize[1]);
+}
+
+// True if kernel index of a set can run as convolveFixed<index>
+// Kernels of even width or height are left to convolve, which reads one more row and column of taps
+bool convolveFixable(const KernelInfo *k, size_t index) {
+	if (index >= SPEC_MAX_FIXED || !kernelHasWeights(k) || !isfinite(k->mult)) return false;
+	if (k->width % 2 == 0 || k->height % 2 == 0) return false;
+	size_t numTaps = 0;
+	for (size_t i = 0; i < (size_t)k->width * k->height; i++) {
+		if (!isfinite(k->buffer[i])) return false;
+		numTaps += (k->buffer[i] != 0.f);
+	}
+	return numTaps <= SPEC_MAX_TAPS;
+}
+
+// Appends str to the options being built, growing them as needed
+static bool appendOption(char **options, size_t *len, size_t *max, const char *str) {
+	const size_t strLen = strlen(str);
+	if (*len + strLen + 1 > *max) {
+		const size_t newMax = (*len + strLen + 1) * 2;
+		char *grown = realloc(*options, newMax);
+		if (grown == NULL) return false;
+		*options = grown;
+		*max = newMax;
+	}
+	memcpy(&(*options)[*len], str, strLen + 1);
+	*len += strLen;
+	return true;
+}
+
+// Options that bake every kernel passing convolveFixable() into convolveFixed<k>, which the caller
+// frees. Returns NULL if no kernel does.
+// Taps are TAP(dx, dy, weight) in the order of convolve, and every float is printed in hex, so the
+// sums are identical to convolve's.
+char *convolveOptions(const KernelInfo *kernels, size_t numKernels) {
+	char *options = NULL, str[128];
+	size_t len = 0, max = 0;
+	bool any = false, ok = true;
+	for (size_t i = 0; i < numKernels && ok; i++) {
+		const KernelInfo *k = &kernels[i];
+		if (!convolveFixable(k, i)) continue;
+		any = true;
+		snprintf(str, sizeof(str), " -D KNL%u_TAPS=", (unsigned int)i);
+		ok = appendOption(&options, &len, &max, str);
+		for (long x = 0; x < k->width && ok; x++) {
+			for (long y = 0; y < k->height && ok; y++) {
+				const float w = k->buffer[x + (k->width * y)];
+				if (w == 0.f) continue;
+				snprintf(str, sizeof(str), "TAP(%ld,%ld,%af)", x - (long)(k->width / 2),
+						 y - (long)(k->height / 2), w);
+				ok = appendOption(&options, &len, &max, str);
+			}
+		}
+		snprintf(str, sizeof(str), " -D KNL%u_MULT=%af -D KNL%u_INVERT=%d", (unsigned int)i, k->mult,
+				 (unsigned int)i, k->invert? 1 : 0);
+		ok = ok && appendOption(&options, &len, &max, str);
+	}
+	if (!ok || !any) {
+		free(options);
+		return NULL;
+	}
+	return options;
+}
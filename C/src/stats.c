@@ -0,0 +1,159 @@
+// Conversion statistics
+// Every *_ToAscii call fills one ConversionStats, read with STATS_Get(). Host work is timed with
+// perfNow(). OpenCL commands keep their events until the call ends, and are then timed from their
+// CL_PROFILING_COMMAND_START/END, so nothing waits on the device earlier than it already did.
+// Calls made inside another one (each strip of *_ToAsciiStrips) add up into the outer call.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+// An OpenCL command timed at the end of the call
+typedef struct StatsEvent {
+	cl_event event;
+	int stage,
+		index;
+} StatsEvent;
+
+// A live buffer, so its size is known when it is freed
+typedef struct StatsBuffer {
+	const void *handle;
+	size_t size;
+} StatsBuffer;
+
+ConversionStats stats;
+
+static int statsDepth = 0;
+static double statsStart = 0;
+static StatsEvent *statsEvents = NULL;
+static size_t numStatsEvents = 0,
+			  maxStatsEvents = 0;
+static StatsBuffer *statsBuffers = NULL;
+static size_t numStatsBuffers = 0,
+			  maxStatsBuffers = 0;
+static unsigned long long statsLiveBytes = 0;
+
+// Starts a call, unless one is already running
+void statsBegin() {
+	if (statsDepth++ > 0) return;
+	memset(&stats, 0, sizeof(stats));
+	stats.peakBytes = statsLiveBytes;
+	statsStart = perfNow();
+}
+
+// Adds ms to a stage, and to its kernel or character
+static void statsAddTime(int stage, int index, double ms) {
+	stats.stageMs[stage] += ms;
+	if (index < 0) return;
+	if (stage == STATS_CONVOLVE && index < STATS_MAX_KERNELS) {
+		stats.convolveMs[index] += ms;
+		if (index >= stats.numKernels) stats.numKernels = index + 1;
+	}
+	else if (stage == STATS_MATCH && index < STATS_MAX_GLYPHS) {
+		stats.glyphMatchMs[index] += ms;
+		if (index >= stats.numGlyphs) stats.numGlyphs = index + 1;
+	}
+}
+
+// Adds ms of host work to a stage of the running call
+// index is the kernel of STATS_CONVOLVE or the character of STATS_MATCH, or -1 for neither
+void statsTime(int stage, int index, double ms) {
+	if (statsDepth > 0) statsAddTime(stage, index, ms);
+}
+
+// Keeps an OpenCL command to time at the end of the call
+void statsEvent(cl_event event, int stage, int index) {
+	if (statsDepth == 0 || event == NULL) return;
+	if (numStatsEvents == maxStatsEvents) {
+		const size_t max = (maxStatsEvents > 0)? maxStatsEvents * 2 : 256;
+		StatsEvent *events = realloc(statsEvents, sizeof(StatsEvent) * max);
+		if (events == NULL) return;
+		statsEvents = events;
+		maxStatsEvents = max;
+	}
+	clRetainEvent(event);
+	statsEvents[numStatsEvents++] = (StatsEvent){ event, stage, index };
+	stats.numCommands++;
+}
+
+// Times every kept command that completed, then releases them
+void statsResolveEvents() {
+	for (size_t i = 0; i < numStatsEvents; i++) {
+		cl_int status = CL_QUEUED;
+		cl_ulong start = 0, end = 0;
+		if (clGetEventInfo(statsEvents[i].event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status),
+						   &status, NULL) == CL_SUCCESS && status == CL_COMPLETE &&
+			clGetEventProfilingInfo(statsEvents[i].event, CL_PROFILING_COMMAND_START, sizeof(start),
+									&start, NULL) == CL_SUCCESS &&
+			clGetEventProfilingInfo(statsEvents[i].event, CL_PROFILING_COMMAND_END, sizeof(end),
+									&end, NULL) == CL_SUCCESS) {
+			statsAddTime(statsEvents[i].stage, statsEvents[i].index, (end - start) / 1e6);
+			stats.deviceTimes = 1;
+		}
+		clReleaseEvent(statsEvents[i].event);
+	}
+	numStatsEvents = 0;
+}
+
+// Ends a call; the outermost one resolves its OpenCL commands
+void statsEnd() {
+	if (statsDepth == 0 || --statsDepth > 0) return;
+	statsResolveEvents();
+	stats.totalMs = perfNow() - statsStart;
+}
+
+// Counts bytes moved between the host and the device
+void statsTransfer(size_t uploaded, size_t read) {
+	stats.bytesUploaded += uploaded;
+	stats.bytesRead += read;
+}
+
+// Counts an allocation of size bytes, known by handle until statsFree()
+void statsAlloc(const void *handle, size_t size) {
+	if (handle == NULL) return;
+	if (numStatsBuffers == maxStatsBuffers) {
+		const size_t max = (maxStatsBuffers > 0)? maxStatsBuffers * 2 : 64;
+		StatsBuffer *buffers = realloc(statsBuffers, sizeof(StatsBuffer) * max);
+		if (buffers == NULL) return;
+		statsBuffers = buffers;
+		maxStatsBuffers = max;
+	}
+	statsBuffers[numStatsBuffers++] = (StatsBuffer){ handle, size };
+	statsLiveBytes += size;
+	stats.numAllocations++;
+	if (statsLiveBytes > stats.peakBytes) stats.peakBytes = statsLiveBytes;
+	if (size > stats.largestBuffer) stats.largestBuffer = size;
+}
+
+// Forgets an allocation counted by statsAlloc()
+// Handles that were not counted, or were already freed, are ignored
+void statsFree(const void *handle) {
+	if (handle == NULL) return;
+	for (size_t i = numStatsBuffers; i > 0; i--) {
+		if (statsBuffers[i - 1].handle == handle) {
+			statsLiveBytes -= statsBuffers[i - 1].size;
+			statsBuffers[i - 1] = statsBuffers[--numStatsBuffers];
+			return;
+		}
+	}
+}
+
+// clCreateBuffer() in the shared context, counted as an allocation
+// Sets result. A buffer copied from host memory counts as uploaded bytes.
+cl_mem statsCreateBuffer(cl_mem_flags flags, size_t size, void *host) {
+	cl_mem mem = clCreateBuffer(context, flags, size, host, &result);
+	if (result != CL_SUCCESS) return mem;
+	statsAlloc(mem, size);
+	if (flags & CL_MEM_COPY_HOST_PTR) statsTransfer(size, 0);
+	return mem;
+}
+
+// clReleaseMemObject() of a buffer from statsCreateBuffer()
+void statsReleaseBuffer(cl_mem mem) {
+	statsFree(mem);
+	clReleaseMemObject(mem);
+}
+
+// Copies the statistics of the last *_ToAscii call into out
+EXPORT void STATS_Get(ConversionStats *out) {
+	*out = stats;
+}
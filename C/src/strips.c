@@ -0,0 +1,126 @@
+// Conversion in horizontal strips
+// Large images are converted a few character rows at a time, so memory use depends on the budget
+// instead of the image height. Each strip is converted with the rows around it that its filtered
+// values read, and starts on a character row, so the output is identical to converting the whole image.
+
+#include <stdlib.h>
+#include "artscii.h"
+
+extern bool OCL_ToAsciiImage(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, bool composed);
+extern bool NOCL_ToAsciiImage(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, int numThreads, bool composed);
+
+// Rows above and below a pixel that its filtered value reads
+// Two passes of the tallest kernel, or one pass of a composed kernel twice its size
+unsigned int stripHalo(const KernelInfo *kernels, size_t numKernels) {
+	unsigned int halo = 0;
+	for (size_t k = 0; k < numKernels; k++) {
+		if (2 * (kernels[k].height / 2) > halo) halo = 2 * (kernels[k].height / 2);
+	}
+	return halo;
+}
+
+// Character rows per strip that fit in maxMem bytes, when each image row takes rowBytes
+// Returns at least 1
+size_t stripCharRows(size_t maxMem, size_t rowBytes, unsigned int charHeight, unsigned int haloTop,
+		unsigned int halo) {
+	const size_t rows = maxMem / rowBytes;
+	if (rows <= (size_t)haloTop + halo + charHeight) return 1;
+	return (rows - haloTop - halo) / charHeight;
+}
+
+// Converts the image in strips of charRows character rows
+// Statistics cover every strip, as one call
+bool toAsciiStrips(bool useCL, const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, int numThreads, bool composed, size_t charRows) {
+	const unsigned int charH = atlas->charHeight,
+					   halo = stripHalo(kernels, numKernels),
+					   haloTop = ((halo + charH - 1) / charH) * charH; // Keeps strips on character rows
+	const size_t cols = (width / atlas->charWidth) + 1,
+				 rows = height / charH;
+
+	statsBegin();
+	if (charRows >= rows) {
+		bool ok = useCL? OCL_ToAsciiImage(pixels, width, height, stride, outChars, outColors, kernels,
+										  numKernels, atlas, composed) :
+						 NOCL_ToAsciiImage(pixels, width, height, stride, outChars, outColors, kernels,
+										   numKernels, atlas, numThreads, composed);
+		statsEnd();
+		return ok;
+	}
+
+	// One strip's output, including the character rows of its halo
+	const size_t maxRows = charRows + (haloTop / charH) + ((halo + charH - 1) / charH);
+	unsigned char *chars = malloc(cols * maxRows),
+				  *colors = malloc(cols * maxRows * 3);
+	bool ok = chars != NULL && colors != NULL;
+
+	for (size_t r0 = 0; r0 < rows && ok; r0 += charRows) {
+		const size_t r1 = (r0 + charRows < rows)? r0 + charRows : rows,
+					 y0 = (r0 * charH > haloTop)? (r0 * charH) - haloTop : 0,
+					 y1 = ((r1 * charH) + halo < height)? (r1 * charH) + halo : height,
+					 skip = (r0 * charH - y0) / charH; // Halo rows above the strip
+		const unsigned char *window = &pixels[y0 * stride];
+
+		ok = useCL? OCL_ToAsciiImage(window, width, y1 - y0, stride, chars, colors, kernels,
+									 numKernels, atlas, composed) :
+					NOCL_ToAsciiImage(window, width, y1 - y0, stride, chars, colors, kernels,
+									  numKernels, atlas, numThreads, composed);
+		if (ok) {
+			memcpy(&outChars[r0 * cols], &chars[skip * cols], (r1 - r0) * cols);
+			memcpy(&outColors[r0 * cols * 3], &colors[skip * cols * 3], (r1 - r0) * cols * 3);
+		}
+	}
+	free(chars);
+	free(colors);
+	statsEnd();
+	return ok;
+}
+
+// Converts an Image to ASCII characters with OpenCL, in strips that fit in maxMem bytes
+// Strips are also kept within the device's memory and largest allocation. maxMem = 0 only uses the
+// device limits. The output is identical to OCL_ToAsciiImage.
+EXPORT bool OCL_ToAsciiStrips(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, bool composed, size_t maxMem) {
+	cl_ulong globalMem = 0, maxAlloc = 0;
+	result = clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, NULL);
+	CHECK_RESULT(false)
+	result = clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, NULL);
+	CHECK_RESULT(false)
+
+	// Input, one output and two intermediate passes per kernel; half the device is left for the rest
+	const size_t rowLen = (size_t)width * 3,
+				 halo = stripHalo(kernels, numKernels),
+				 haloTop = ((halo + atlas->charHeight - 1) / atlas->charHeight) * atlas->charHeight;
+	size_t charRows = stripCharRows(globalMem / 2, rowLen * ((3 * numKernels) + 1), atlas->charHeight,
+									haloTop, halo);
+	const size_t allocRows = stripCharRows(maxAlloc, rowLen * numKernels, atlas->charHeight, haloTop, halo);
+	if (allocRows < charRows) charRows = allocRows;
+	if (maxMem > 0) {
+		const size_t memRows = stripCharRows(maxMem, rowLen * ((3 * numKernels) + 1), atlas->charHeight,
+											 haloTop, halo);
+		if (memRows < charRows) charRows = memRows;
+	}
+	return toAsciiStrips(true, pixels, width, height, stride, outChars, outColors, kernels, numKernels,
+						 atlas, 0, composed, charRows);
+}
+
+// Converts an Image to ASCII characters without OpenCL, in strips that fit in maxMem bytes
+// maxMem = 0 converts the whole image at once. The output is identical to NOCL_ToAsciiImage.
+EXPORT bool NOCL_ToAsciiStrips(const unsigned char *pixels, unsigned int width, unsigned int height,
+		size_t stride, unsigned char *outChars, unsigned char *outColors, KernelInfo *kernels,
+		size_t numKernels, const GlyphAtlas *atlas, int numThreads, bool composed, size_t maxMem) {
+	// Input copy, one output per kernel, the intermediate pass and the padded copy made by each pass
+	const size_t halo = stripHalo(kernels, numKernels),
+				 haloTop = ((halo + atlas->charHeight - 1) / atlas->charHeight) * atlas->charHeight,
+				 charRows = (maxMem > 0)? stripCharRows(maxMem, (size_t)width * 3 * (numKernels + 3),
+														atlas->charHeight, haloTop, halo) :
+										  (size_t)-1;
+	return toAsciiStrips(false, pixels, width, height, stride, outChars, outColors, kernels, numKernels,
+						 atlas, numThreads, composed, charRows);
+}
@@ -0,0 +1,156 @@
+// Checks of the NOCL_* pipeline against a plain reference
+// Built as its own executable by test.sh, so it is not part of artscii.so.
+// Each case runs the exact multi-kernel pipeline on a small synthetic image and compares every output
+// with the same passes computed pixel by pixel. Kernels of different sizes are mixed on purpose, since
+// every pass pads the image for its own kernel. Exits with 1 if any case fails.
+
+#include <stdlib.h>
+#include <math.h>
+#include "artscii.h"
+
+extern bool nocl_setMultiConvolveArgs(const ImageView *img, KernelInfo *kernels, const size_t numKernels,
+		bool pass);
+extern bool nocl_runMultiConvolve(const ImageView *img, KernelInfo *kernels, const size_t numKernels);
+extern void nocl_freeMultiConvolveArgs();
+extern void nocl_setSimdLevel(int level);
+extern int nocl_getSimdLevel();
+
+extern NOCL_MultiConvolveArgs *nocl_multiConvolveArgs;
+
+#define TEST_MAX_KERNELS 4
+
+// Filters an image through k with the arithmetic of nocl_kConvolve, reading zeros outside the image
+void refConvolve(const unsigned char *img, unsigned char *output, unsigned int width, unsigned int height,
+		const KernelInfo *k, float alpha) {
+	const int halfW = k->width / 2,
+			  halfH = k->height / 2;
+	for (int py = 0; py < (int)height; py++) {
+		for (int px = 0; px < (int)width; px++) {
+			float pixel[3] = { 0.f, 0.f, 0.f };
+			for (int x = 0; x < (int)k->width; x++) {
+				for (int y = 0; y < (int)k->height; y++) {
+					const int ix = px + x - halfW,
+							  iy = py + y - halfH;
+					const float weight = k->buffer[x + (k->width * y)];
+					if (ix < 0 || iy < 0 || ix >= (int)width || iy >= (int)height) continue;
+					for (int c = 0; c < 3; c++) {
+						pixel[c] += img[(((size_t)iy * width) + ix) * 3 + c] * weight;
+					}
+				}
+			}
+			for (int c = 0; c < 3; c++) {
+				pixel[c] = fmax(fmin(pixel[c] * k->mult, 255.f), 0.f);
+				if (k->invert) pixel[c] = 255.f - pixel[c];
+				output[(((size_t)py * width) + px) * 3 + c] = (unsigned char)(pixel[c] * alpha);
+			}
+		}
+	}
+}
+
+// outputs[k] = sum over k2 of k2(k(input)), or k(input) alone when k == k2, as in nocl_runMultiConvolve
+bool refMultiConvolve(const unsigned char *img, unsigned int width, unsigned int height,
+		const KernelInfo *kernels, size_t numKernels, unsigned char *outputs) {
+	const size_t length = (size_t)width * height * 3;
+	unsigned char *first = malloc(length),
+				  *second = malloc(length);
+	if (first == NULL || second == NULL) {
+		free(first);
+		free(second);
+		return false;
+	}
+	memset(outputs, 0, length * numKernels);
+	for (size_t k = 0; k < numKernels; k++) {
+		unsigned char *output = &outputs[k * length];
+		for (size_t k2 = 0; k2 < numKernels; k2++) {
+			if (k == k2) refConvolve(img, second, width, height, &kernels[k], 1.f / (float)numKernels);
+			else {
+				refConvolve(img, first, width, height, &kernels[k], 1.f);
+				refConvolve(first, second, width, height, &kernels[k2], 1.f / (float)numKernels);
+			}
+			for (size_t i = 0; i < length; i++) {
+				output[i] = (unsigned char)fmin(output[i] + second[i], 255);
+			}
+		}
+	}
+	free(first);
+	free(second);
+	return true;
+}
+
+// A kernel of width x height taps with no two rows alike, so it is never run separably
+void testKernel(KernelInfo *k, unsigned int width, unsigned int height, float mult, bool invert) {
+	memset(k, 0, sizeof(KernelInfo));
+	k->width = width;
+	k->height = height;
+	k->mult = mult;
+	k->invert = invert;
+	k->bufSize = width * height;
+	for (unsigned int i = 0; i < k->bufSize; i++) {
+		k->buffer[i] = (float)((int)((i * 7) % 5) - 2);
+	}
+	k->buffer[(width / 2) + (width * (height / 2))] += (float)(width * height);
+}
+
+// Runs one case at one SIMD level, 0 = none. Every level must match the reference exactly.
+bool testCase(const char *name, const KernelInfo *kernels, size_t numKernels, unsigned int width,
+		unsigned int height, int simdLevel) {
+	const size_t length = (size_t)width * height * 3;
+	unsigned char *pixels = malloc(length),
+				  *expected = malloc(length * numKernels);
+	KernelInfo copies[TEST_MAX_KERNELS];
+	if (pixels == NULL || expected == NULL) {
+		free(pixels);
+		free(expected);
+		fprintf(stderr, "Error: Not enough memory for case %s.\n", name);
+		return false;
+	}
+	unsigned int seed = 0x9e3779b9u ^ width ^ (height << 16);
+	for (size_t i = 0; i < length; i++) {
+		seed = (seed * 1103515245u) + 12345u;
+		pixels[i] = (unsigned char)(seed >> 16);
+	}
+	memcpy(copies, kernels, sizeof(KernelInfo) * numKernels);
+
+	nocl_setSimdLevel(simdLevel);
+	const ImageView img = { pixels, width, height, (size_t)width * 3 };
+	bool ok = refMultiConvolve(pixels, width, height, kernels, numKernels, expected) &&
+			  nocl_setMultiConvolveArgs(&img, copies, numKernels, true) &&
+			  nocl_runMultiConvolve(&img, copies, numKernels);
+	int worst = 0;
+	if (ok) {
+		const unsigned char *actual = nocl_multiConvolveArgs->outputBlock;
+		for (size_t i = 0; i < length * numKernels; i++) {
+			const int diff = abs((int)actual[i] - (int)expected[i]);
+			if (diff > worst) worst = diff;
+		}
+		ok = worst == 0;
+	}
+	nocl_freeMultiConvolveArgs();
+	free(pixels);
+	free(expected);
+
+	printf("%s %s, %ux%u, simd %d: largest difference %d\n", ok? "PASS" : "FAIL", name, width, height,
+		   simdLevel, worst);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	KernelInfo mixed[3], square[2];
+	testKernel(&mixed[0], 3, 3, 1.f / 9.f, false);
+	testKernel(&mixed[1], 5, 5, 1.f / 25.f, false);
+	testKernel(&mixed[2], 5, 3, 1.f / 15.f, true);
+	testKernel(&square[0], 3, 3, 1.f / 9.f, false);
+	testKernel(&square[1], 3, 3, 1.f / 4.f, true);
+
+	const int bestLevel = nocl_getSimdLevel();
+	bool ok = true;
+	for (int level = 0; level <= bestLevel; level++) {
+		ok = testCase("3x3", square, 2, 37, 23, level) && ok;
+		ok = testCase("3x3+5x5", mixed, 2, 37, 23, level) && ok;
+		ok = testCase("3x3+5x5+5x3", mixed, 3, 37, 23, level) && ok;
+		ok = testCase("3x3+5x5+5x3", mixed, 3, 4, 3, level) && ok;
+	}
+	nocl_setSimdLevel(bestLevel);
+	nocl_freeThreadPool();
+	return ok? 0 : 1;
+}
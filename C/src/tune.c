@@ -0,0 +1,300 @@
+// Work-group size tuning
+// Every launch of an image kernel goes through tunedEnqueue(). Until a kernel is tuned on this device,
+// its launches cycle through candidate local sizes, including the implementation's own choice, and
+// are timed from their profiling events. Once every candidate has TUNE_SAMPLES timed launches, the
+// fastest per work-item wins. The global size is padded to a multiple of the local size, and the
+// kernels return early outside the image.
+// Winners are saved in the directory set by OCL_SetCacheDirectory(), one file per device, and loaded
+// by OCL_Init(). The file is keyed like the program cache, so a new driver or kernels.cl tunes again.
+//
+// File layout (text):
+//   key
+//   name localX localY localZ    one line per tuned kernel, 0 0 0 = the implementation's choice
+
+#include <stdlib.h>
+#include "artscii.h"
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
+#define TUNE_MAX_KERNELS 16
+#define TUNE_MAX_CANDIDATES 12
+// Timed launches per candidate
+#define TUNE_SAMPLES 3
+
+typedef struct TuneCandidate {
+	size_t local[3]; // local[0] == 0: no local size, the implementation chooses
+	bool failed;
+	int launched,
+		timed;
+	double ns; // Sum of timed launches, per work-item
+	cl_event pending[TUNE_SAMPLES];
+	size_t items[TUNE_SAMPLES];
+} TuneCandidate;
+
+typedef struct TuneKernel {
+	char name[32];
+	bool tuned;
+	size_t best[3];
+	size_t numCandidates;
+	TuneCandidate candidates[TUNE_MAX_CANDIDATES];
+} TuneKernel;
+
+extern const char *kernelSrc;
+extern char *programCacheDir;
+extern unsigned long long fnv1a(const char *str);
+extern char *programCacheKey(const char *src, const char *options);
+
+static TuneKernel tuneKernels[TUNE_MAX_KERNELS];
+static size_t numTuneKernels = 0;
+
+// Path of the tuning file for key, which the caller frees
+static char *tuningPath(const char *key) {
+	const size_t len = strlen(programCacheDir) + 64;
+	char *path = malloc(len);
+	if (path == NULL) return NULL;
+#ifdef _WIN32
+	snprintf(path, len, "%s\\tuning_%016llx.txt", programCacheDir, fnv1a(key));
+#else
+	snprintf(path, len, "%s/tuning_%016llx.txt", programCacheDir, fnv1a(key));
+#endif
+	return path;
+}
+
+// Key of the tuning file for this device and kernels.cl, which the caller frees
+static char *tuningKey() {
+	return programCacheKey(kernelSrc, "tuning");
+}
+
+// Returns the entry for name, adding it if there is room
+static TuneKernel *tuneKernel(const char *name) {
+	for (size_t i = 0; i < numTuneKernels; i++) {
+		if (strcmp(tuneKernels[i].name, name) == 0) return &tuneKernels[i];
+	}
+	if (numTuneKernels == TUNE_MAX_KERNELS || strlen(name) >= sizeof(tuneKernels[0].name)) return NULL;
+	TuneKernel *t = &tuneKernels[numTuneKernels++];
+	memset(t, 0, sizeof(TuneKernel));
+	strcpy(t->name, name);
+	return t;
+}
+
+// Releases the pending events of t
+static void releasePending(TuneKernel *t) {
+	for (size_t c = 0; c < t->numCandidates; c++) {
+		TuneCandidate *cand = &t->candidates[c];
+		for (int i = cand->timed; i < cand->launched; i++) {
+			if (cand->pending[i] != NULL) clReleaseEvent(cand->pending[i]);
+			cand->pending[i] = NULL;
+		}
+	}
+}
+
+// Forgets every tuned kernel and releases pending events
+void freeTuning() {
+	for (size_t i = 0; i < numTuneKernels; i++) releasePending(&tuneKernels[i]);
+	memset(tuneKernels, 0, sizeof(tuneKernels));
+	numTuneKernels = 0;
+}
+
+// Reads the tuning file of this device, if there is one
+// Called by OCL_Init() once the program is built
+void loadTuning() {
+	freeTuning();
+	if (programCacheDir == NULL) return;
+	char *key = tuningKey(),
+		 *path = (key != NULL)? tuningPath(key) : NULL;
+	FILE *file = (path != NULL)? fopen(path, "r") : NULL;
+	if (file != NULL) {
+		// The key is one line, with '|' between its parts
+		const size_t keyLen = strlen(key);
+		char *fileKey = malloc(keyLen + 2);
+		if (fileKey != NULL && fgets(fileKey, keyLen + 2, file) != NULL &&
+			strncmp(fileKey, key, keyLen) == 0 && fileKey[keyLen] == '\n') {
+			char name[32];
+			size_t local[3];
+			while (fscanf(file, "%31s %zu %zu %zu", name, &local[0], &local[1], &local[2]) == 4) {
+				TuneKernel *t = tuneKernel(name);
+				if (t == NULL) break;
+				t->tuned = true;
+				memcpy(t->best, local, sizeof(local));
+			}
+		}
+		free(fileKey);
+		fclose(file);
+	}
+	free(key);
+	free(path);
+}
+
+// Writes every tuned kernel to the tuning file of this device
+// The file is written next to its path and then renamed, like the program cache.
+static void saveTuning() {
+	if (programCacheDir == NULL) return;
+	char *key = tuningKey(),
+		 *path = (key != NULL)? tuningPath(key) : NULL,
+		 *tmpPath = (path != NULL)? malloc(strlen(path) + 5) : NULL;
+	if (tmpPath != NULL) {
+		strcpy(tmpPath, path);
+		strcat(tmpPath, ".tmp");
+		FILE *file = fopen(tmpPath, "w");
+		bool ok = file != NULL && fprintf(file, "%s\n", key) > 0;
+		for (size_t i = 0; i < numTuneKernels && ok; i++) {
+			const TuneKernel *t = &tuneKernels[i];
+			if (!t->tuned) continue;
+			ok = fprintf(file, "%s %zu %zu %zu\n", t->name, t->best[0], t->best[1], t->best[2]) > 0;
+		}
+		if (file != NULL) ok = (fclose(file) == 0) && ok;
+	#ifdef _WIN32
+		ok = ok && MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING);
+	#else
+		ok = ok && rename(tmpPath, path) == 0;
+	#endif
+		if (!ok) remove(tmpPath);
+	}
+	free(tmpPath);
+	free(key);
+	free(path);
+}
+
+// Adds a candidate local size, if kernel and the device allow it
+static void addCandidate(TuneKernel *t, size_t x, size_t y, size_t maxGroup, const size_t *maxItems) {
+	if (t->numCandidates == TUNE_MAX_CANDIDATES || x * y > maxGroup || x > maxItems[0] || y > maxItems[1]) return;
+	for (size_t c = 0; c < t->numCandidates; c++) {
+		if (t->candidates[c].local[0] == x && t->candidates[c].local[1] == y) return;
+	}
+	TuneCandidate *cand = &t->candidates[t->numCandidates++];
+	cand->local[0] = x;
+	cand->local[1] = y;
+	cand->local[2] = 1;
+}
+
+// Fills the candidates of t from the limits of kernel
+// 1D kernels try powers of 2, 2D and 3D kernels (whose third dimension is 1) try rectangles whose
+// width is a multiple of the preferred multiple where possible.
+static void setCandidates(TuneKernel *t, cl_kernel kernel, cl_uint dims) {
+	// Devices have at least 3 dimensions; the first 2 are enough here
+	size_t maxGroup = 1, multiple = 1, maxItems[8] = { 1, 1, 1 };
+	clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxGroup, NULL);
+	clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t),
+							 &multiple, NULL);
+	clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, NULL);
+	if (multiple == 0) multiple = 1;
+
+	// The implementation's choice is always a candidate
+	t->numCandidates = 1;
+	memset(&t->candidates[0], 0, sizeof(TuneCandidate));
+	if (dims == 1) {
+		maxItems[1] = 1;
+		addCandidate(t, multiple, 1, maxGroup, maxItems);
+		for (size_t x = 32; x <= 512; x *= 2) addCandidate(t, x, 1, maxGroup, maxItems);
+	}
+	else {
+		static const size_t sizes[][2] = { { 8, 8 }, { 16, 4 }, { 16, 8 }, { 16, 16 }, { 32, 2 },
+										   { 32, 4 }, { 32, 8 }, { 64, 1 }, { 64, 4 } };
+		addCandidate(t, multiple, 1, maxGroup, maxItems);
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			addCandidate(t, sizes[i][0], sizes[i][1], maxGroup, maxItems);
+		}
+	}
+}
+
+// Times the finished launches of t, and picks the winner once every candidate is timed
+static void resolveKernel(TuneKernel *t) {
+	bool done = true;
+	for (size_t c = 0; c < t->numCandidates; c++) {
+		TuneCandidate *cand = &t->candidates[c];
+		while (cand->timed < cand->launched) {
+			cl_event e = cand->pending[cand->timed];
+			cl_int status = CL_QUEUED;
+			cl_ulong start = 0, end = 0;
+			if (clGetEventInfo(e, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, NULL) != CL_SUCCESS ||
+				status > CL_COMPLETE) break;
+			if (status < 0 ||
+				clGetEventProfilingInfo(e, CL_PROFILING_COMMAND_START, sizeof(start), &start, NULL) != CL_SUCCESS ||
+				clGetEventProfilingInfo(e, CL_PROFILING_COMMAND_END, sizeof(end), &end, NULL) != CL_SUCCESS) {
+				cand->failed = true;
+			}
+			else cand->ns += (double)(end - start) / cand->items[cand->timed];
+			clReleaseEvent(e);
+			cand->pending[cand->timed++] = NULL;
+		}
+		if (!cand->failed && cand->timed < TUNE_SAMPLES) done = false;
+	}
+	if (!done) return;
+
+	const TuneCandidate *best = &t->candidates[0];
+	for (size_t c = 1; c < t->numCandidates; c++) {
+		const TuneCandidate *cand = &t->candidates[c];
+		if (!cand->failed && (best->failed || cand->ns < best->ns)) best = cand;
+	}
+	releasePending(t);
+	memcpy(t->best, best->local, sizeof(t->best));
+	t->tuned = true;
+	saveTuning();
+}
+
+// Times every finished tuning launch
+// Called after each conversion, once its launches are done
+void resolveTuning() {
+	for (size_t i = 0; i < numTuneKernels; i++) {
+		if (!tuneKernels[i].tuned && tuneKernels[i].numCandidates > 0) resolveKernel(&tuneKernels[i]);
+	}
+}
+
+// Enqueues kernel over globalSize with no offset, like clEnqueueNDRangeKernel
+// The local size is the tuned one for name, or the next candidate while name is being tuned, and
+// globalSize is padded to a multiple of it. Launches whose local size is rejected are enqueued again
+// with the implementation's choice. Returns the status of the enqueue.
+cl_int tunedEnqueue(cl_kernel kernel, const char *name, cl_uint dims, const size_t *globalSize,
+		cl_uint numWait, const cl_event *waitList, cl_event *event) {
+	TuneKernel *t = tuneKernel(name);
+	TuneCandidate *cand = NULL;
+	const size_t *local = NULL;
+	if (t != NULL && t->tuned) local = t->best;
+	else if (t != NULL) {
+		if (t->numCandidates == 0) setCandidates(t, kernel, dims);
+		else resolveKernel(t);
+		if (t->tuned) local = t->best;
+		else {
+			// The candidate with the fewest launches, until each has TUNE_SAMPLES
+			for (size_t c = 0; c < t->numCandidates; c++) {
+				TuneCandidate *next = &t->candidates[c];
+				if (!next->failed && next->launched < TUNE_SAMPLES &&
+					(cand == NULL || next->launched < cand->launched)) cand = next;
+			}
+			if (cand != NULL) local = cand->local;
+		}
+	}
+
+	size_t padded[3] = { 1, 1, 1 }, items = 1;
+	for (cl_uint d = 0; d < dims; d++) {
+		padded[d] = globalSize[d];
+		items *= globalSize[d];
+		if (local != NULL && local[0] != 0) padded[d] = ((globalSize[d] + local[d] - 1) / local[d]) * local[d];
+	}
+	if (local != NULL && local[0] == 0) local = NULL;
+
+	cl_event launched = NULL;
+	cl_int status = clEnqueueNDRangeKernel(queue, kernel, dims, NULL, local != NULL? padded : globalSize,
+										   local, numWait, waitList, &launched);
+	if (status == CL_INVALID_WORK_GROUP_SIZE || status == CL_INVALID_WORK_ITEM_SIZE ||
+		status == CL_OUT_OF_RESOURCES) {
+		if (cand != NULL) cand->failed = true;
+		else if (t != NULL && t->tuned) {
+			// The saved size does not fit this kernel any more, so it is tuned again
+			t->tuned = false;
+			t->numCandidates = 0;
+		}
+		status = clEnqueueNDRangeKernel(queue, kernel, dims, NULL, globalSize, NULL, numWait, waitList,
+										&launched);
+	}
+	else if (status == CL_SUCCESS && cand != NULL) {
+		clRetainEvent(launched);
+		cand->items[cand->launched] = items;
+		cand->pending[cand->launched++] = launched;
+	}
+
+	if (event != NULL) *event = launched;
+	else if (launched != NULL) clReleaseEvent(launched);
+	return status;
+}
@@ -0,0 +1 @@
+mkdir obj & gcc -IC:\include -c "src\test.c" -o "obj\test.o" -lopencl -std=gnu99 -m64 && gcc -LC:\lib -o "test.exe" "obj\test.o" "obj\addimg.o" "obj\artscii.o" "obj\atlas.o" "obj\charactermatch.o" "obj\compose.o" "obj\convolve.o" "obj\emit.o" "obj\fused.o" "obj\mult.o" "obj\nocl.o" "obj\nocl_charactermatch.o" "obj\nocl_convolve.o" "obj\nocl_fused.o" "obj\nocl_pyramid.o" "obj\nocl_sequence.o" "obj\nocl_simd.o" "obj\nocl_threads.o" "obj\preprocess.o" "obj\programcache.o" "obj\render.o" "obj\separable.o" "obj\specialize.o" "obj\tune.o" "obj\stats.o" "obj\strips.o" -lopencl -lpthread -std=gnu99 -m64 && echo "Compiled test.exe successfully" && test.exe
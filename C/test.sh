@@ -0,0 +1,7 @@
+#!/bin/bash
+# Builds the tests from the objects of compile.sh and runs them
+mkdir obj 2>/dev/null
+gcc -I/usr/include -c "src/test.c" -o "obj/test.o" -std=gnu99 -m64 -fPIC &&
+gcc -L/usr/lib -o "test" "obj/test.o" "obj/addimg.o" "obj/artscii.o" "obj/atlas.o" "obj/charactermatch.o" "obj/compose.o" "obj/convolve.o" "obj/emit.o" "obj/fused.o" "obj/mult.o" "obj/nocl.o" "obj/nocl_charactermatch.o" "obj/nocl_convolve.o" "obj/nocl_fused.o" "obj/nocl_pyramid.o" "obj/nocl_sequence.o" "obj/nocl_simd.o" "obj/nocl_threads.o" "obj/preprocess.o" "obj/programcache.o" "obj/render.o" "obj/separable.o" "obj/specialize.o" "obj/tune.o" "obj/stats.o" "obj/strips.o" -lOpenCL -lpthread -lm -std=gnu99 -m64 &&
+echo "Compiled test successfully" || exit 1
+./test
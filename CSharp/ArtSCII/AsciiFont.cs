@@ -2,6 +2,7 @@ using System;
 using System.Collections.Generic;
 
 using Bitmap = System.Drawing.Bitmap;
+using CairoAPI = Cairo.CairoAPI;
 using Context = Cairo.Context;
 using FontFamily = System.Drawing.FontFamily;
 using FontSlant = Cairo.FontSlant;
@@ -11,6 +12,7 @@ using Format = Cairo.Format;
 using Graphics = System.Drawing.Graphics;
 using GraphicsUnit = System.Drawing.GraphicsUnit;
 using ImageSurface = Cairo.ImageSurface;
+using Path = System.IO.Path;
 using TextExtents = Cairo.TextExtents;
 
 namespace ArtSCII
@@ -33,6 +35,7 @@ namespace ArtSCII
         public static string asciiString = InitAsciiString();
 
         public Dictionary<char, PixelSet> characters;
+        private byte[] atlas;
 
         /// <summary>
         /// Gets a map of array indexes to characters.
@@ -50,6 +53,24 @@ namespace ArtSCII
             return map;
         }
 
+        /// <summary>
+        /// Packs every character into one buffer, in the same order as GetCharacterMap.
+        /// The buffer is built once and shared by every caller, so it must not be changed.
+        /// </summary>
+        /// <returns>Serialized characters back to back</returns>
+        public byte[] GetCharacterAtlas()
+        {
+            if (atlas != null) return atlas;
+            PixelSet[] chars = GetCharacterPixels();
+            int charLen = (int)(chars[0].Width * chars[0].Height * 3);
+            atlas = new byte[charLen * chars.Length];
+            for (int c = 0; c < chars.Length; c++)
+            {
+                Buffer.BlockCopy(chars[c].Serialize(), 0, atlas, c * charLen, charLen);
+            }
+            return atlas;
+        }
+
         /// <summary>
         /// Gets a list of all PixelSets that are associated to characters.
         /// </summary>
@@ -75,16 +96,17 @@ namespace ArtSCII
         private void CreateFont(FontStyle fontStyle)
         {
             Font = null;
-            FontFamily[] fonts = FontFamily.Families;
-            // Search for the user-defined font
-            for (int i = 0; i < fonts.Length; i++)
+            // Look up the user-defined font by name, rather than listing every installed family
+            if (FontName != string.Empty)
             {
-                if (fonts[i].Name.ToLower() == FontName.ToLower())
+                try
                 {
-                    Font = new System.Drawing.Font(fonts[i], FontSize, fontStyle, GraphicsUnit.Pixel);
-                    break;
+                    Font = new System.Drawing.Font(new FontFamily(FontName), FontSize, fontStyle, GraphicsUnit.Pixel);
+                }
+                catch (ArgumentException)
+                {
+                    Font = null;
                 }
-
             }
             // If found, make sure it is a monospaced font
             if (Font != null)
@@ -163,18 +185,94 @@ namespace ArtSCII
             }
         }
 
+        /// <summary>
+        /// Gets the path of the glyph atlas cache for a key.
+        /// </summary>
+        /// <param name="key">Atlas key</param>
+        /// <returns>Path in the local application data folder</returns>
+        private static string AtlasPath(string key)
+        {
+            // FNV-1a, to give every key its own short file name
+            uint hash = 2166136261;
+            foreach (char c in key)
+            {
+                hash = (hash ^ c) * 16777619;
+            }
+            return Path.Combine(OCL.CacheDirectory, string.Format("glyphs_{0:x8}.atlas", hash));
+        }
+
+        /// <summary>
+        /// Loads the characters from the glyph atlas cache.
+        /// </summary>
+        /// <param name="key">Atlas key</param>
+        /// <returns>True if a matching atlas was found</returns>
+        private unsafe bool LoadAtlas(string key)
+        {
+            OCL.CGlyphAtlas* atlas;
+            try
+            {
+                atlas = OCL.ATLAS_Load(AtlasPath(key), key);
+            }
+            catch (Exception e) when (e is DllNotFoundException || e is EntryPointNotFoundException)
+            {
+                return false;
+            }
+            if (atlas == null) return false;
+
+            characters = new Dictionary<char, PixelSet>();
+            uint charLen = atlas->charWidth * atlas->charHeight * 3;
+            for (uint c = 0; c < atlas->numChars; c++)
+            {
+                characters.Add((char)atlas->charMap[c],
+                    new PixelSet(&atlas->pixels[c * charLen], atlas->charWidth, atlas->charHeight));
+            }
+            OCL.ATLAS_Free(atlas);
+            return true;
+        }
+
+        /// <summary>
+        /// Saves the characters to the glyph atlas cache, so the next run can skip CreateBitmaps.
+        /// </summary>
+        /// <param name="key">Atlas key</param>
+        private unsafe void SaveAtlas(string key)
+        {
+            byte[] map = GetCharacterMap(), pixels = GetCharacterAtlas();
+            PixelSet[] chars = GetCharacterPixels();
+
+            string path = AtlasPath(key);
+            bool saved = false;
+            try
+            {
+                System.IO.Directory.CreateDirectory(Path.GetDirectoryName(path));
+                fixed (byte* m = map, p = pixels)
+                {
+                    saved = OCL.ATLAS_Save(path, key, m, (uint)map.Length, chars[0].Width, chars[0].Height, p);
+                }
+            }
+            catch (Exception e) when (e is DllNotFoundException || e is EntryPointNotFoundException ||
+                                      e is System.IO.IOException || e is UnauthorizedAccessException) { }
+            if (!saved) Program.Log(Program.LogType.Warning, "The glyph atlas could not be cached at \"{0}\".", path);
+        }
+
         /// <summary>
         /// AsciiFont Constructor
         /// </summary>
         /// <param name="fontName">Font name</param>
         /// <param name="fontSize">Font size in pixels</param>
         /// <param name="fontStyle">Optional FontStyle</param>
-        public AsciiFont(string fontName, int fontSize, FontStyle fontStyle = FontStyle.Regular)
+        /// <param name="createBitmaps">False if only Font is needed</param>
+        public AsciiFont(string fontName, int fontSize, FontStyle fontStyle = FontStyle.Regular, bool createBitmaps = true)
         {
             FontName = fontName;
             FontSize = fontSize;
             CreateFont(fontStyle);
+            if (!createBitmaps) return;
+
+            // The rendered characters depend on the font, its size and style, and the version of Cairo
+            string key = string.Format("{0}|{1}|{2}|Cairo {3}", FontName, FontSize, fontStyle, CairoAPI.VersionString);
+            if (LoadAtlas(key)) return;
             CreateBitmaps();
+            SaveAtlas(key);
         }
 
         /// <summary>
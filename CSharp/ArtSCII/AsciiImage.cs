@@ -0,0 +1,59 @@
+﻿using System;
+
+namespace ArtSCII
+{
+    /// <summary>
+    /// The ASCII output of an image: one character and one RGB color per cell, with '\n' ending each line.
+    /// Characters and colors are kept in separate flat buffers, which artscii.dll writes and reads in place.
+    /// </summary>
+    class AsciiImage
+    {
+        /// <summary>
+        /// One character per cell
+        /// </summary>
+        public byte[] Chars { get; private set; }
+
+        /// <summary>
+        /// Color of each cell as R, G, B bytes
+        /// </summary>
+        public byte[] Colors { get; private set; }
+
+        /// <summary>
+        /// Number of cells, including each '\n'
+        /// </summary>
+        public int Length
+        {
+            get { return Chars.Length; }
+        }
+
+        /// <summary>
+        /// AsciiImage Constructor
+        /// </summary>
+        /// <param name="length">Number of cells, including each '\n'</param>
+        public AsciiImage(int length)
+        {
+            Chars = new byte[length];
+            Colors = new byte[length * 3];
+        }
+
+        /// <summary>
+        /// Gets the character of a cell.
+        /// </summary>
+        /// <param name="i">Cell index</param>
+        /// <returns>Character</returns>
+        public char CharAt(int i)
+        {
+            return (char)Chars[i];
+        }
+
+        /// <summary>
+        /// Gets the color of a cell.
+        /// </summary>
+        /// <param name="i">Cell index</param>
+        /// <returns>Color</returns>
+        public System.Drawing.Color ColorAt(int i)
+        {
+            return System.Drawing.Color.FromArgb(Colors[i * 3], Colors[(i * 3) + 1], Colors[(i * 3) + 2]);
+        }
+    }
+}
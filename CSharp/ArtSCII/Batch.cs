@@ -0,0 +1,256 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Collections.Generic;
+using System.Linq;
+using System.Threading;
+
+using Bitmap = System.Drawing.Bitmap;
+using Directory = System.IO.Directory;
+using File = System.IO.File;
+using FStream = System.IO.FileStream;
+using Path = System.IO.Path;
+using Stopwatch = System.Diagnostics.Stopwatch;
+
+namespace ArtSCII
+{
+    /// <summary>
+    /// Converts many images with one font and one OpenCL context.
+    /// Decoding, preprocessing, conversion and encoding run on separate threads, connected by bounded
+    /// queues, so the conversion never waits on image files.
+    /// </summary>
+    static class Batch
+    {
+        /// <summary>
+        /// Images waiting between two stages. Keeps memory bounded when one stage is slower than the others.
+        /// </summary>
+        private const int queueSize = 4;
+
+        private static readonly string[] imageExtensions = { ".bmp", ".gif", ".jpg", ".jpeg", ".png", ".tif", ".tiff" };
+
+        /// <summary>
+        /// One image as it moves through the stages.
+        /// </summary>
+        private class Job
+        {
+            public string inPath, outPath;
+            public Bitmap input;
+            public int width, height;
+            public PixelSet pixels;
+            public AsciiImage ascii;
+        }
+
+        private static int numDone, numFailed;
+
+        /// <summary>
+        /// Finds the images to convert.
+        /// </summary>
+        /// <param name="input">A directory, a file listing one image path per line, a path with * and ?
+        /// wildcards, or a single image</param>
+        /// <returns>Image paths, or null if input does not exist</returns>
+        static string[] FindInputs(string input)
+        {
+            if (Directory.Exists(input))
+            {
+                return Directory.GetFiles(input)
+                    .Where(f => imageExtensions.Contains(Path.GetExtension(f).ToLower()))
+                    .OrderBy(f => f, StringComparer.Ordinal).ToArray();
+            }
+            if (input.IndexOfAny(new char[] { '*', '?' }) >= 0)
+            {
+                string dir = Path.GetDirectoryName(input);
+                if (dir == string.Empty) dir = ".";
+                if (!Directory.Exists(dir)) return null;
+                return Directory.GetFiles(dir, Path.GetFileName(input))
+                    .OrderBy(f => f, StringComparer.Ordinal).ToArray();
+            }
+            if (!File.Exists(input)) return null;
+            if (imageExtensions.Contains(Path.GetExtension(input).ToLower())) return new string[] { input };
+            return File.ReadAllLines(input).Select(l => l.Trim()).Where(l => l.Length > 0).ToArray();
+        }
+
+        /// <summary>
+        /// Logs an image that could not be converted.
+        /// </summary>
+        static void Fail(string path, string message)
+        {
+            Interlocked.Increment(ref numFailed);
+            Program.Log(Program.LogType.Error, "\"{0}\": {1}", path, message);
+        }
+
+        /// <summary>
+        /// Opens each image. Runs on its own thread.
+        /// </summary>
+        static void Decode(string[] paths, string outDir, string ext, BlockingCollection<Job> decoded,
+            CancellationToken cancel)
+        {
+            try
+            {
+                foreach (string path in paths)
+                {
+                    Job job = new Job
+                    {
+                        inPath = path,
+                        outPath = Path.Combine(outDir, Path.GetFileNameWithoutExtension(path) + "." + ext)
+                    };
+                    try
+                    {
+                        job.input = (Bitmap)Bitmap.FromFile(path);
+                    }
+                    catch (OutOfMemoryException)
+                    {
+                        Fail(path, "Not a valid BMP, GIF, JPEG, PNG, or TIFF file.");
+                        continue;
+                    }
+                    catch (Exception e)
+                    {
+                        Fail(path, e.Message);
+                        continue;
+                    }
+                    decoded.Add(job, cancel);
+                }
+            }
+            catch (OperationCanceledException) { }
+            finally
+            {
+                decoded.CompleteAdding();
+            }
+        }
+
+        /// <summary>
+        /// Reads the pixels of each image and adjusts them for conversion. Runs on its own thread.
+        /// </summary>
+        static void Preprocess(BlockingCollection<Job> decoded, BlockingCollection<Job> prepared,
+            CancellationToken cancel)
+        {
+            try
+            {
+                foreach (Job job in decoded.GetConsumingEnumerable(cancel))
+                {
+                    job.width = job.input.Width;
+                    job.height = job.input.Height;
+                    try
+                    {
+                        job.pixels = Program.Preprocess(job.input);
+                    }
+                    catch (Exception e)
+                    {
+                        Fail(job.inPath, e.Message);
+                        continue;
+                    }
+                    finally
+                    {
+                        job.input.Dispose();
+                        job.input = null;
+                    }
+                    prepared.Add(job, cancel);
+                }
+            }
+            catch (OperationCanceledException) { }
+            finally
+            {
+                prepared.CompleteAdding();
+            }
+        }
+
+        /// <summary>
+        /// Saves each converted image. Runs on its own thread.
+        /// </summary>
+        static void Encode(BlockingCollection<Job> converted)
+        {
+            foreach (Job job in converted.GetConsumingEnumerable())
+            {
+                try
+                {
+                    if (File.Exists(job.outPath)) File.Delete(job.outPath);
+                    using (FStream output = File.OpenWrite(job.outPath))
+                    {
+                        Program.WriteOutput(job.width, job.height, job.ascii, output, concurrent: true);
+                    }
+                    Interlocked.Increment(ref numDone);
+                    Program.Log(Program.LogType.Done, "\"{0}\"", job.outPath);
+                }
+                catch (Exception e)
+                {
+                    Fail(job.inPath, e.Message);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Converts every image found in input and saves them to outDir.
+        /// OpenCL and the font must already be initialized. Conversion runs on the calling thread.
+        /// </summary>
+        /// <param name="input">A directory, list file, or path with wildcards (see FindInputs)</param>
+        /// <param name="outDir">Output directory. It is created if it does not exist.</param>
+        /// <param name="ext">Extension of the output files</param>
+        /// <returns>True if every image was converted</returns>
+        public static bool Run(string input, string outDir, string ext)
+        {
+            string[] paths;
+            try
+            {
+                paths = FindInputs(input);
+                if (paths != null) Directory.CreateDirectory(outDir);
+            }
+            catch (Exception e)
+            {
+                Program.Log(Program.LogType.Error, e.Message);
+                return false;
+            }
+            if (paths == null)
+            {
+                Program.Log(Program.LogType.Error, "The path: \"" + input + "\" does not exist.");
+                return false;
+            }
+            Program.Log(Program.LogType.Info, "Converting {0} images...", paths.Length);
+
+            Stopwatch timer = Stopwatch.StartNew();
+            numDone = numFailed = 0;
+            BlockingCollection<Job> decoded = new BlockingCollection<Job>(queueSize),
+                                    prepared = new BlockingCollection<Job>(queueSize),
+                                    converted = new BlockingCollection<Job>(queueSize);
+            CancellationTokenSource cancel = new CancellationTokenSource();
+            Thread[] stages =
+            {
+                new Thread(() => Decode(paths, outDir, ext, decoded, cancel.Token)),
+                new Thread(() => Preprocess(decoded, prepared, cancel.Token)),
+                new Thread(() => Encode(converted))
+            };
+            foreach (Thread t in stages)
+            {
+                t.IsBackground = true;
+                t.Start();
+            }
+
+            // The library keeps its state between calls, so every conversion stays on this thread
+            bool useCL = Program.openCL;
+            try
+            {
+                foreach (Job job in prepared.GetConsumingEnumerable(cancel.Token))
+                {
+                    if (useCL) job.ascii = OCL.ToAscii(job.pixels, Program.asciiFont);
+                    else job.ascii = OCL.ToAscii_NOCL(job.pixels, Program.asciiFont);
+                    job.pixels = null;
+                    if (useCL && !Program.openCL)
+                    {
+                        // OpenCL failed and the library has already shut down
+                        Fail(job.inPath, "OpenCL failed. The batch will stop.");
+                        cancel.Cancel();
+                        break;
+                    }
+                    converted.Add(job);
+                }
+            }
+            catch (OperationCanceledException) { }
+            converted.CompleteAdding();
+            foreach (Thread t in stages) t.Join();
+
+            timer.Stop();
+            double seconds = timer.Elapsed.TotalSeconds;
+            Program.Log(numFailed == 0 ? Program.LogType.Done : Program.LogType.Warning,
+                "Converted {0} of {1} images in {2:F1}s ({3:F1} images/s).",
+                numDone, paths.Length, seconds, numDone / Math.Max(seconds, 0.001));
+            return numFailed == 0 && numDone == paths.Length;
+        }
+    }
+}
@@ -34,6 +34,33 @@ namespace ArtSCII
             /// </summary>
             public bool invert;
 
+            /// <summary>
+            /// Optional factors of a separable kernel, where pixels[x, y] = row[x] * column[y].
+            /// The kernel is then filtered as a pass along each row and a pass down each column,
+            /// so sides of up to 64 pixels stay affordable. pixels can be left null.
+            /// </summary>
+            public float[] row, column;
+
+            /// <summary>
+            /// Creates a separable kernel from its factors.
+            /// </summary>
+            /// <param name="row">Weights along a row</param>
+            /// <param name="column">Weights down a column</param>
+            /// <param name="mult">Output multiplier</param>
+            /// <returns>A kernel of row.Length x column.Length pixels</returns>
+            public static Kernel Separable(float[] row, float[] column, float mult)
+            {
+                return new Kernel
+                {
+                    row = row,
+                    column = column,
+                    mult = mult,
+                    width = (uint)row.Length,
+                    height = (uint)column.Length,
+                    invert = false
+                };
+            }
+
             /// <summary>
             /// Creates a flat array of kernel values.
             /// </summary>
@@ -46,7 +73,7 @@ namespace ArtSCII
                 {
                     for (int x = 0; x < width; x++)
                     {
-                        floats[i++] = pixels[x, y];
+                        floats[i++] = pixels != null ? pixels[x, y] : row[x] * column[y];
                     }
                 }
                 return floats;
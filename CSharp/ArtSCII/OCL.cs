@@ -1,8 +1,12 @@
 ﻿using System;
-using System.Collections.Generic;
 using System.Runtime.InteropServices;
 
-using Color = System.Drawing.Color;
+using Bitmap = System.Drawing.Bitmap;
+using BitmapData = System.Drawing.Imaging.BitmapData;
+using ImageLockMode = System.Drawing.Imaging.ImageLockMode;
+using PixelFormat = System.Drawing.Imaging.PixelFormat;
+using Rectangle = System.Drawing.Rectangle;
+using Path = System.IO.Path;
 
 namespace ArtSCII
 {
@@ -20,6 +24,7 @@ namespace ArtSCII
         }
 
         private const int maxKernelBufSize = 256; // 1 KB buffer
+        private const int maxKernelSide = 64; // Longest side of a separable kernel
         [StructLayout(LayoutKind.Sequential)]
         public unsafe struct CKernelInfo
         {
@@ -29,6 +34,52 @@ namespace ArtSCII
             public bool invert;
             public uint bufSize;
             public fixed float buffer[maxKernelBufSize];
+            public bool separable;
+            public fixed float rowTaps[maxKernelSide];
+            public fixed float colTaps[maxKernelSide];
+        }
+
+        [StructLayout(LayoutKind.Sequential)]
+        public unsafe struct CGlyphAtlas
+        {
+            public uint numChars;
+            public uint charWidth;
+            public uint charHeight;
+            public byte* charMap;
+            public byte* pixels;
+            public IntPtr mapping;
+            public UIntPtr mapSize;
+        }
+
+        /// <summary>
+        /// Stages of a conversion, in the order of CConversionStats.stageMs.
+        /// </summary>
+        public enum StatsStage
+        {
+            Upload,
+            Convolve,
+            Add,
+            Match,
+            Readback,
+        }
+
+        public const int statsNumStages = 5, statsMaxKernels = 16, statsMaxGlyphs = 256;
+        [StructLayout(LayoutKind.Sequential)]
+        public unsafe struct CConversionStats
+        {
+            public double totalMs;
+            public fixed double stageMs[statsNumStages];
+            public fixed double convolveMs[statsMaxKernels];
+            public fixed double glyphMatchMs[statsMaxGlyphs];
+            public ulong bytesUploaded;
+            public ulong bytesRead;
+            public ulong numAllocations;
+            public ulong peakBytes;
+            public ulong largestBuffer;
+            public ulong numCommands;
+            public int deviceTimes;
+            public int numKernels;
+            public int numGlyphs;
         }
     #if Windows
         [DllImport("artscii.dll")]
@@ -48,16 +99,198 @@ namespace ArtSCII
     #elif Linux
         [DllImport("artscii.so")]
     #endif
-        private static unsafe extern bool OCL_ToAscii(IntPtr imgBufs, byte* outChars, byte* outColors,
-            IntPtr kernels, uint numKernels, IntPtr charBufs, int numChars, byte* charMap);
+        private static extern void OCL_SetCacheDirectory(string dir);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        public static extern bool OCL_ProgramCacheHit();
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool OCL_ToAsciiStrips(byte* pixels, uint width, uint height, UIntPtr stride,
+            byte* outChars, byte* outColors, IntPtr kernels, UIntPtr numKernels, CGlyphAtlas* atlas,
+            [MarshalAs(UnmanagedType.I1)] bool composed, UIntPtr maxMem);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool NOCL_ToAsciiStrips(byte* pixels, uint width, uint height, UIntPtr stride,
+            byte* outChars, byte* outColors, IntPtr kernels, UIntPtr numKernels, CGlyphAtlas* atlas, int numThreads,
+            [MarshalAs(UnmanagedType.I1)] bool composed, UIntPtr maxMem);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool NOCL_CompareComposed(IntPtr imgBufs, IntPtr kernels, uint numKernels,
+            int numThreads, out double meanDiff, out uint maxDiff);
 
     #if Windows
         [DllImport("artscii.dll")]
     #elif Linux
         [DllImport("artscii.so")]
     #endif
-        private static unsafe extern bool NOCL_ToAscii(IntPtr imgBufs, byte* outChars, byte* outColors,
-            IntPtr kernels, uint numKernels, IntPtr charBufs, int numChars, byte* charMap);
+        public static extern void NOCL_SetExhaustiveMatch([MarshalAs(UnmanagedType.I1)] bool exhaustive);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static extern void NOCL_SetFused([MarshalAs(UnmanagedType.I1)] bool enable);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static extern void OCL_SetFused([MarshalAs(UnmanagedType.I1)] bool enable);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static extern double NOCL_GetVisitedFraction();
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static extern void NOCL_SetTopK(int topK, [MarshalAs(UnmanagedType.I1)] bool check);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static extern double NOCL_GetAgreementRate();
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static extern void STATS_Get(out CConversionStats stats);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        public static unsafe extern bool ATLAS_Save(string path, string key, byte* charMap, uint numChars,
+            uint charWidth, uint charHeight, byte* pixels);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static unsafe extern CGlyphAtlas* ATLAS_Load(string path, string key);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        public static unsafe extern void ATLAS_Free(CGlyphAtlas* atlas);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool RENDER_Glyphs(byte* chars, byte* colors, UIntPtr numChars, CGlyphAtlas* atlas,
+            byte* image, uint width, uint height, UIntPtr stride, int originX, int originY, uint stepX, uint stepY,
+            byte background, [MarshalAs(UnmanagedType.I1)] bool bgr, int numThreads);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        public static unsafe extern bool PRE_Preprocess(byte* src, UIntPtr srcStride, uint srcBpp,
+            [MarshalAs(UnmanagedType.I1)] bool bgr, uint width, uint height, [MarshalAs(UnmanagedType.I1)] bool grey,
+            byte* output, UIntPtr stride);
+
+        /// <summary>
+        /// Receives each part of a text output from artscii.dll.
+        /// </summary>
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        [return: MarshalAs(UnmanagedType.I1)]
+        private unsafe delegate bool EmitWrite(byte* buf, UIntPtr len);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool EMIT_Html(byte* chars, byte* colors, UIntPtr numChars, byte* head,
+            byte* fontName, uint fontSize, EmitWrite write, out ulong bytesWritten);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool EMIT_Ansi(byte* chars, byte* colors, UIntPtr numChars, EmitWrite write,
+            out ulong bytesWritten);
+
+    #if Windows
+        [DllImport("artscii.dll")]
+    #elif Linux
+        [DllImport("artscii.so")]
+    #endif
+        [return: MarshalAs(UnmanagedType.I1)]
+        private static unsafe extern bool EMIT_Text(byte* chars, UIntPtr numChars, EmitWrite write,
+            out ulong bytesWritten);
+
+        // Font and kernels as last sent to artscii.dll, pinned until the font changes
+        private static AsciiFont preparedFont;
+        private static GCHandle charMapHandle, atlasHandle;
+        private static unsafe CGlyphAtlas* preparedAtlas;
+        private static CKernelInfo[] kernelBuffers;
+
+        /// <summary>
+        /// Directory of the glyph atlas and OpenCL program caches.
+        /// </summary>
+        public static readonly string CacheDirectory =
+            Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData), "ArtSCII");
+
+        /// <summary>
+        /// Lets OCL_Init load the OpenCL program from CacheDirectory, and save it there after building it.
+        /// </summary>
+        public static void UseProgramCache()
+        {
+            try
+            {
+                System.IO.Directory.CreateDirectory(CacheDirectory);
+                OCL_SetCacheDirectory(CacheDirectory);
+            }
+            catch (Exception e) when (e is System.IO.IOException || e is UnauthorizedAccessException)
+            {
+                Program.Log(Program.LogType.Warning, "The OpenCL program cache cannot be used: {0}", e.Message);
+            }
+        }
 
         /// <summary>
         /// Creates image buffers to send to artscii.dll.
@@ -89,41 +322,6 @@ namespace ArtSCII
             return buffers;
         }
 
-        /// <summary>
-        /// Creates image buffers to send to artscii.dll.
-        /// </summary>
-        /// <param name="p">List of source images</param>
-        /// <returns>Array of CImageInfo buffers</returns>
-        public static unsafe CImageInfo[] MakeMultiImageBuffers(PixelSet[] p)
-        {
-            int maxBufs = (int)(((p[0].Width * p[0].Height * 3) /
-                    (float)maxImageBufSize) + 0.9999f) * p.Length;
-            CImageInfo[] buffers = new CImageInfo[maxBufs];
-            int i = 0;
-            for (int ps = 0; ps < p.Length; ps++)
-            {
-                byte[] img = p[ps].Serialize();
-                int numBufs = (img.Length / maxImageBufSize) + 1, ix = 0;
-                numBufs += numBufs * ps;
-                for (; i < numBufs; i++)
-                {
-                    buffers[i].width = p[ps].Width;
-                    buffers[i].height = p[ps].Height;
-                    if (i == (numBufs - 1) && (img.Length % maxImageBufSize) > 0)
-                    {
-                        buffers[i].bufSize = (uint)(img.Length % maxImageBufSize);
-                    }
-                    else buffers[i].bufSize = maxImageBufSize;
-                    for (int j = 0; j < buffers[i].bufSize; j++, ix++)
-                    {
-                        buffers[i].buffer[j] = img[ix];
-                    }
-                    buffers[i].final = ix == img.Length;
-                }
-            }
-            return buffers;
-        }
-
         /// <summary>
         /// Creates Kernel buffers to send to artscii.dll.
         /// </summary>
@@ -134,11 +332,26 @@ namespace ArtSCII
             CKernelInfo[] buffers = new CKernelInfo[kernels.Length];
             for (int i = 0; i < kernels.Length; i++)
             {
-                float[] k = kernels[i].Serialize();
                 buffers[i].width = kernels[i].width;
                 buffers[i].height = kernels[i].height;
                 buffers[i].mult = kernels[i].mult;
                 buffers[i].invert = kernels[i].invert;
+                if (kernels[i].row != null)
+                {
+                    buffers[i].separable = true;
+                    for (int x = 0; x < kernels[i].width && x < maxKernelSide; x++)
+                    {
+                        buffers[i].rowTaps[x] = kernels[i].row[x];
+                    }
+                    for (int y = 0; y < kernels[i].height && y < maxKernelSide; y++)
+                    {
+                        buffers[i].colTaps[y] = kernels[i].column[y];
+                    }
+                }
+
+                // Kernels larger than the buffer are only sent as factors
+                if (kernels[i].width * kernels[i].height > maxKernelBufSize) continue;
+                float[] k = kernels[i].Serialize();
                 buffers[i].bufSize = (uint)k.Length;
                 for (int j = 0; j < k.Length; j++)
                 {
@@ -149,79 +362,225 @@ namespace ArtSCII
         }
 
         /// <summary>
-        /// Calls artscii.dll to generate a list of ASCII characters and colors from an image.
+        /// Measures how much the composed kernel mode differs from the exact pipeline.
         /// </summary>
         /// <param name="p">Input image</param>
-        /// <param name="font">Font to render</param>
-        /// <returns>List of ASCII characters and colors</returns>
-        public static unsafe List<Tuple<char, Color>> ToAscii(PixelSet p, AsciiFont font)
+        /// <param name="meanDiff">Average difference per color channel</param>
+        /// <param name="maxDiff">Largest difference in any color channel</param>
+        /// <returns>True if successful</returns>
+        public static unsafe bool CompareComposed(PixelSet p, out double meanDiff, out uint maxDiff)
         {
-            int outLen = (int)(((p.Width / Program.charWidth) + 1) *
-                               ((p.Height / Program.charHeight)));
-            List<Tuple<char, Color>> output = new List<Tuple<char, Color>>();
             fixed (CImageInfo* i = MakeImageBuffers(p))
             {
-                fixed (byte* o = new byte[outLen])
+                fixed (CKernelInfo* k = MakeKernelBuffers(Convolver.Kernels))
                 {
-                    fixed (CKernelInfo* k = MakeKernelBuffers(Convolver.Kernels))
-                    {
-                        fixed (CImageInfo* ch = MakeMultiImageBuffers(font.GetCharacterPixels()))
-                        {
-                            fixed (byte* m = font.GetCharacterMap())
-                            {
-                                fixed (byte* cl = new byte[outLen * 3])
-                                {
-                                    Program.openCL = OCL_ToAscii((IntPtr)i, o, cl, (IntPtr)k, (uint)Convolver.Kernels.Length,
-                                                                 (IntPtr)ch, font.characters.Count, m);
-                                    for (int x = 0, c = 0; x < outLen; x++, c += 3)
-                                    {
-                                        output.Add(new Tuple<char, Color>((char)o[x], Color.FromArgb(cl[c], cl[c + 1], cl[c + 2])));
-                                    }
-                                }
-                            }
-                        }
-                    }
+                    return NOCL_CompareComposed((IntPtr)i, (IntPtr)k, (uint)Convolver.Kernels.Length,
+                                                Program.threads, out meanDiff, out maxDiff);
                 }
             }
-            return output;
         }
 
         /// <summary>
-        /// Calls artscii.dll to generate a list of ASCII characters and colors from an image.
+        /// Pins the characters of a font and builds the kernel buffers, unless they are already prepared.
+        /// </summary>
+        /// <param name="font">Font to render</param>
+        private static unsafe void PrepareFont(AsciiFont font)
+        {
+            if (kernelBuffers == null) kernelBuffers = MakeKernelBuffers(Convolver.Kernels);
+            if (font == preparedFont) return;
+            ReleaseFont();
+
+            PixelSet[] chars = font.GetCharacterPixels();
+            charMapHandle = GCHandle.Alloc(font.GetCharacterMap(), GCHandleType.Pinned);
+            atlasHandle = GCHandle.Alloc(font.GetCharacterAtlas(), GCHandleType.Pinned);
+            preparedAtlas = (CGlyphAtlas*)Marshal.AllocHGlobal(sizeof(CGlyphAtlas));
+            *preparedAtlas = new CGlyphAtlas
+            {
+                numChars = (uint)chars.Length,
+                charWidth = chars[0].Width,
+                charHeight = chars[0].Height,
+                charMap = (byte*)charMapHandle.AddrOfPinnedObject(),
+                pixels = (byte*)atlasHandle.AddrOfPinnedObject()
+            };
+            preparedFont = font;
+        }
+
+        /// <summary>
+        /// Unpins the characters of the prepared font.
+        /// </summary>
+        public static unsafe void ReleaseFont()
+        {
+            if (preparedFont == null) return;
+            charMapHandle.Free();
+            atlasHandle.Free();
+            Marshal.FreeHGlobal((IntPtr)preparedAtlas);
+            preparedAtlas = null;
+            preparedFont = null;
+        }
+
+        /// <summary>
+        /// Calls artscii.dll to generate ASCII characters and colors from an image.
+        /// The image and the characters are passed as single buffers, which the library reads in place.
         /// </summary>
         /// <param name="p">Input image</param>
         /// <param name="font">Font to render</param>
-        /// <returns>List of ASCII characters and colors</returns>
-        public static unsafe List<Tuple<char, Color>> ToAscii_NOCL(PixelSet p, AsciiFont font)
+        /// <param name="useCL">True to use OpenCL</param>
+        /// <returns>ASCII characters and colors</returns>
+        private static unsafe AsciiImage ConvertImage(PixelSet p, AsciiFont font, bool useCL)
         {
             int outLen = (int)(((p.Width / Program.charWidth) + 1) *
                                ((p.Height / Program.charHeight)));
-            List<Tuple<char, Color>> output = new List<Tuple<char, Color>>();
-            fixed (CImageInfo* i = MakeImageBuffers(p))
+            AsciiImage output = new AsciiImage(outLen);
+            PrepareFont(font);
+            fixed (byte* i = p.Data)
             {
-                fixed (byte* o = new byte[outLen])
+                fixed (CKernelInfo* k = kernelBuffers)
                 {
-                    fixed (CKernelInfo* k = MakeKernelBuffers(Convolver.Kernels))
+                    fixed (byte* op = output.Chars, clp = output.Colors)
                     {
-                        fixed (CImageInfo* ch = MakeMultiImageBuffers(font.GetCharacterPixels()))
+                        UIntPtr stride = (UIntPtr)p.Stride,
+                                maxMem = (UIntPtr)(Program.maxMem * 1024 * 1024);
+                        if (useCL)
                         {
-                            fixed (byte* m = font.GetCharacterMap())
-                            {
-                                fixed (byte* cl = new byte[outLen * 3])
-                                {
-                                    NOCL_ToAscii((IntPtr)i, o, cl, (IntPtr)k, (uint)Convolver.Kernels.Length,
-                                                 (IntPtr)ch, font.characters.Count, m);
-                                    for (int x = 0, c = 0; x < outLen; x++, c += 3)
-                                    {
-                                        output.Add(new Tuple<char, Color>((char)o[x], Color.FromArgb(cl[c], cl[c + 1], cl[c + 2])));
-                                    }
-                                }
-                            }
+                            OCL_SetFused(Program.fused);
+                            Program.openCL = OCL_ToAsciiStrips(i, p.Width, p.Height, stride, op, clp, (IntPtr)k,
+                                                               (UIntPtr)kernelBuffers.Length, preparedAtlas, Program.composed,
+                                                               maxMem);
+                        }
+                        else
+                        {
+                            NOCL_SetExhaustiveMatch(Program.exhaustive);
+                            NOCL_SetTopK(Program.topK, Program.compare);
+                            NOCL_SetFused(Program.fused);
+                            NOCL_ToAsciiStrips(i, p.Width, p.Height, stride, op, clp, (IntPtr)k,
+                                               (UIntPtr)kernelBuffers.Length, preparedAtlas, Program.threads,
+                                               Program.composed, maxMem);
                         }
                     }
                 }
             }
             return output;
         }
+
+        /// <summary>
+        /// Calls artscii.dll to draw ASCII characters and colors into a bitmap, using the glyphs of a font.
+        /// The bitmap is filled with the background first.
+        /// </summary>
+        /// <param name="ascii">ASCII characters and colors</param>
+        /// <param name="font">Font whose glyphs are drawn</param>
+        /// <param name="bmp">Output bitmap in Format24bppRgb</param>
+        /// <param name="originX">Left of the first character</param>
+        /// <param name="originY">Top of the first character</param>
+        /// <param name="stepX">Pixels between characters</param>
+        /// <param name="stepY">Pixels between lines</param>
+        /// <param name="background">Grey level of the background</param>
+        /// <param name="numThreads">Number of threads (0 = one per CPU). 1 only draws on the calling thread.</param>
+        /// <returns>True if the characters were drawn</returns>
+        public static unsafe bool RenderGlyphs(AsciiImage ascii, AsciiFont font, Bitmap bmp, int originX,
+            int originY, int stepX, int stepY, byte background, int numThreads)
+        {
+            PixelSet[] glyphs = font.GetCharacterPixels();
+            byte[] map = font.GetCharacterMap(), pixels = font.GetCharacterAtlas();
+
+            BitmapData data = bmp.LockBits(new Rectangle(0, 0, bmp.Width, bmp.Height), ImageLockMode.WriteOnly,
+                                           PixelFormat.Format24bppRgb);
+            try
+            {
+                fixed (byte* c = ascii.Chars, cl = ascii.Colors, m = map, p = pixels)
+                {
+                    CGlyphAtlas atlas = new CGlyphAtlas
+                    {
+                        numChars = (uint)glyphs.Length,
+                        charWidth = glyphs[0].Width,
+                        charHeight = glyphs[0].Height,
+                        charMap = m,
+                        pixels = p
+                    };
+                    // Bitmaps store their pixels as BGR
+                    return RENDER_Glyphs(c, cl, (UIntPtr)ascii.Length, &atlas, (byte*)data.Scan0, (uint)bmp.Width,
+                                         (uint)bmp.Height, (UIntPtr)data.Stride, originX, originY, (uint)stepX,
+                                         (uint)stepY, background, true, numThreads);
+                }
+            }
+            finally
+            {
+                bmp.UnlockBits(data);
+            }
+        }
+
+        /// <summary>
+        /// Calls artscii.dll to write ASCII characters and colors to a stream as HTML, ANSI or plain text.
+        /// The output is written in one pass, a part at a time.
+        /// </summary>
+        /// <param name="ascii">ASCII characters and colors</param>
+        /// <param name="output">Output stream</param>
+        /// <param name="type">Html, Ansi or Text</param>
+        /// <param name="head">Written at the start of HTML outputs</param>
+        /// <param name="fontName">Font of HTML outputs</param>
+        /// <param name="fontSize">Font size of HTML outputs, in pixels</param>
+        /// <returns>Number of bytes written</returns>
+        public static unsafe ulong WriteText(AsciiImage ascii, System.IO.Stream output, Program.OutputType type,
+            string head, string fontName, int fontSize)
+        {
+            byte[] headBytes = System.Text.Encoding.UTF8.GetBytes(head + "\0"),
+                   fontBytes = System.Text.Encoding.UTF8.GetBytes(fontName + "\0");
+
+            // Exceptions cannot pass through artscii.dll, so they stop the output and are thrown afterwards
+            byte[] part = new byte[0];
+            Exception error = null;
+            EmitWrite write = (buf, len) =>
+            {
+                try
+                {
+                    if (part.Length < (int)len) part = new byte[(int)len];
+                    Marshal.Copy((IntPtr)buf, part, 0, (int)len);
+                    output.Write(part, 0, (int)len);
+                    return true;
+                }
+                catch (Exception e)
+                {
+                    error = e;
+                    return false;
+                }
+            };
+
+            ulong size;
+            bool ok;
+            fixed (byte* c = ascii.Chars, cl = ascii.Colors, h = headBytes, f = fontBytes)
+            {
+                if (type == Program.OutputType.Html)
+                {
+                    ok = EMIT_Html(c, cl, (UIntPtr)ascii.Length, h, f, (uint)fontSize, write, out size);
+                }
+                else if (type == Program.OutputType.Ansi) ok = EMIT_Ansi(c, cl, (UIntPtr)ascii.Length, write, out size);
+                else ok = EMIT_Text(c, (UIntPtr)ascii.Length, write, out size);
+            }
+            GC.KeepAlive(write);
+            if (error != null) throw error;
+            if (!ok) throw new OutOfMemoryException("The output could not be written.");
+            return size;
+        }
+
+        /// <summary>
+        /// Calls artscii.dll to generate ASCII characters and colors from an image with OpenCL.
+        /// </summary>
+        /// <param name="p">Input image</param>
+        /// <param name="font">Font to render</param>
+        /// <returns>ASCII characters and colors</returns>
+        public static AsciiImage ToAscii(PixelSet p, AsciiFont font)
+        {
+            return ConvertImage(p, font, true);
+        }
+
+        /// <summary>
+        /// Calls artscii.dll to generate ASCII characters and colors from an image.
+        /// </summary>
+        /// <param name="p">Input image</param>
+        /// <param name="font">Font to render</param>
+        /// <returns>ASCII characters and colors</returns>
+        public static AsciiImage ToAscii_NOCL(PixelSet p, AsciiFont font)
+        {
+            return ConvertImage(p, font, false);
+        }
     }
 }
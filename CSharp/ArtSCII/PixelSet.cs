@@ -1,97 +1,27 @@
 ﻿using Bitmap = System.Drawing.Bitmap;
-using Color = System.Drawing.Color;
+using BitmapData = System.Drawing.Imaging.BitmapData;
+using ImageLockMode = System.Drawing.Imaging.ImageLockMode;
 using ImageSurface = Cairo.ImageSurface;
+using PixelFormat = System.Drawing.Imaging.PixelFormat;
+using Rectangle = System.Drawing.Rectangle;
 
 using System;
 
 namespace ArtSCII
 {
+    /// <summary>
+    /// An RGB image stored as one buffer of interleaved pixels, which artscii.dll reads in place.
+    /// </summary>
     class PixelSet
     {
-        private byte[,][] pixels;
-        public byte[,][] Pixels {
-            get { return pixels; }
-            set { SetPixels(value); }
-        }
-
-        public uint Width { get; private set; }
-        public uint Height { get; private set; }
-
         /// <summary>
-        /// Adds a scalar value to all pixels in a PixelSet.
+        /// Pixels as R, G, B bytes, row by row. Each row starts Stride bytes after the last.
         /// </summary>
-        /// <param name="p">PixelSet</param>
-        /// <param name="add">Value to add</param>
-        /// <returns>PixelSet</returns>
-        public static PixelSet operator +(PixelSet p, int add)
-        {
-            PixelSet output = new PixelSet(p.Width, p.Height);
-            byte[,][] pixels = new byte[3, p.Width][];
-            int sum;
-            for (int x = 0; x < p.Width; x++)
-            {
-                pixels[0, x] = new byte[p.Height];
-                pixels[1, x] = new byte[p.Height];
-                pixels[2, x] = new byte[p.Height];
-                for (int y = 0; y < p.Height; y++)
-                {
-                    sum = p.Pixels[0, x][y] + add;
-                    if (sum > 255) sum = 255;
-                    else if (sum < 0) sum = 0;
-                    pixels[0, x][y] = (byte)sum;
+        public byte[] Data { get; private set; }
 
-                    sum = p.Pixels[1, x][y] + add;
-                    if (sum > 255) sum = 255;
-                    else if (sum < 0) sum = 0;
-                    pixels[1, x][y] = (byte)sum;
-
-                    sum = p.Pixels[2, x][y] + add;
-                    if (sum > 255) sum = 255;
-                    else if (sum < 0) sum = 0;
-                    pixels[2, x][y] = (byte)sum;
-                }
-            }
-            p.Pixels = pixels;
-            return p;
-        }
-
-        /// <summary>
-        /// Multiplies all pixels in a PixelSet by a scalar value.
-        /// </summary>
-        /// <param name="p">PixelSet</param>
-        /// <param name="mult">Value to multipy by</param>
-        /// <returns>PixelSet</returns>
-        public static PixelSet operator *(PixelSet p, float mult)
-        {
-            PixelSet output = new PixelSet(p.Width, p.Height);
-            byte[,][] pixels = new byte[3, p.Width][];
-            int product;
-            for (int x = 0; x < p.Width; x++)
-            {
-                pixels[0, x] = new byte[p.Height];
-                pixels[1, x] = new byte[p.Height];
-                pixels[2, x] = new byte[p.Height];
-                for (int y = 0; y < p.Height; y++)
-                {
-                    product = (int)(p.Pixels[0, x][y] * mult);
-                    if (product > 255) product = 255;
-                    else if (product < 0) product = 0;
-                    pixels[0, x][y] = (byte)product;
-
-                    product = (int)(p.Pixels[1, x][y] * mult);
-                    if (product > 255) product = 255;
-                    else if (product < 0) product = 0;
-                    pixels[1, x][y] = (byte)product;
-
-                    product = (int)(p.Pixels[2, x][y] * mult);
-                    if (product > 255) product = 255;
-                    else if (product < 0) product = 0;
-                    pixels[2, x][y] = (byte)product;
-                }
-            }
-            p.Pixels = pixels;
-            return p;
-        }
+        public uint Width { get; private set; }
+        public uint Height { get; private set; }
+        public uint Stride { get; private set; }
 
         /// <summary>
         /// Check if 2 PixelSets contain the same image.
@@ -103,13 +33,13 @@ namespace ArtSCII
         {
             if (a.Width != b.Width || a.Height != b.Height) return false;
 
-            for (int x = 0; x < a.Width; x++)
+            uint rowLen = a.Width * 3;
+            for (uint y = 0; y < a.Height; y++)
             {
-                for (int y = 0; y < a.Height; y++)
+                uint ia = y * a.Stride, ib = y * b.Stride;
+                for (uint x = 0; x < rowLen; x++)
                 {
-                    if (a.pixels[0,x][y] != b.pixels[0,x][y] ||
-                        a.pixels[1,x][y] != b.pixels[1,x][y] ||
-                        a.pixels[2,x][y] != b.pixels[2,x][y]) return false;
+                    if (a.Data[ia + x] != b.Data[ib + x]) return false;
                 }
             }
             return true;
@@ -156,70 +86,63 @@ namespace ArtSCII
         {
             Width = width;
             Height = height;
-            pixels = new byte[3, Width][];
-            for (uint x = 0; x < Width; x++)
+            Stride = width * 3;
+            Data = new byte[Stride * height];
+            if (brightness != 0)
             {
-                pixels[0, x] = new byte[Height];
-                pixels[1, x] = new byte[Height];
-                pixels[2, x] = new byte[Height];
-                for (uint y = 0; y < Height; y++)
-                {
-                    pixels[0, x][y] = brightness;
-                    pixels[1, x][y] = brightness;
-                    pixels[2, x][y] = brightness;
-                }
+                for (int i = 0; i < Data.Length; i++) Data[i] = brightness;
             }
         }
 
         /// <summary>
-        /// PixelSet Constructor
+        /// PixelSet Constructor. The buffer is used as is, not copied.
         /// </summary>
-        /// <param name="bmp">Bitmap to copy</param>
-        public PixelSet(Bitmap bmp)
+        /// <param name="data">Pixels in the format of Data</param>
+        /// <param name="width">Image width</param>
+        /// <param name="height">Image height</param>
+        /// <param name="stride">Bytes from the start of one row to the next</param>
+        public PixelSet(byte[] data, uint width, uint height, uint stride)
         {
-            Width = (uint)bmp.Width;
-            Height = (uint)bmp.Height;
-            pixels = new byte[3, Width][];
-            for (uint x = 0; x < Width; x++)
+            if (stride < width * 3 || data.Length < (long)stride * height)
             {
-                pixels[0, x] = new byte[Height];
-                pixels[1, x] = new byte[Height];
-                pixels[2, x] = new byte[Height];
-                for (uint y = 0; y < Height; y++)
-                {
-                    pixels[0, x][y] = bmp.GetPixel((int) x, (int) y).R;
-                    pixels[1, x][y] = bmp.GetPixel((int) x, (int) y).G;
-                    pixels[2, x][y] = bmp.GetPixel((int) x, (int) y).B;
-                }
+                throw new ArgumentException("The buffer is too small for the image.");
             }
+            Width = width;
+            Height = height;
+            Stride = stride;
+            Data = data;
         }
 
         /// <summary>
         /// PixelSet Constructor
         /// </summary>
-        /// <param name="bmp">ImageSurface to copy</param>
-        public PixelSet(ImageSurface img)
+        /// <param name="img">ImageSurface to copy</param>
+        public PixelSet(ImageSurface img) : this((uint)img.Width, (uint)img.Height)
         {
-            Width = (uint)img.Width;
-            Height = (uint)img.Height;
             byte[] data = img.Data;
-            pixels = new byte[3, Width][];
-            for (uint x = 0; x < Width; x++)
+            for (uint y = 0, o = 0; y < Height; y++)
             {
-                pixels[0, x] = new byte[Height];
-                pixels[1, x] = new byte[Height];
-                pixels[2, x] = new byte[Height];
-                for (uint y = 0; y < Height; y++)
+                for (uint x = 0, i = y * (uint)img.Stride; x < Width; x++, i += 4)
                 {
-                    uint i = (x + (Width * y)) * 4;
                     float alpha = data[i + 3] / 255.0f;
-                    pixels[0, x][y] = (byte)(data[i] * alpha);
-                    pixels[1, x][y] = (byte)(data[i + 1] * alpha);
-                    pixels[2, x][y] = (byte)(data[i + 2] * alpha);
+                    Data[o++] = (byte)(data[i] * alpha);
+                    Data[o++] = (byte)(data[i + 1] * alpha);
+                    Data[o++] = (byte)(data[i + 2] * alpha);
                 }
             }
         }
 
+        /// <summary>
+        /// PixelSet Constructor
+        /// </summary>
+        /// <param name="data">Packed pixels in the format of Data, which are copied</param>
+        /// <param name="width">Image width</param>
+        /// <param name="height">Image height</param>
+        public unsafe PixelSet(byte* data, uint width, uint height) : this(width, height)
+        {
+            System.Runtime.InteropServices.Marshal.Copy((IntPtr)data, Data, 0, Data.Length);
+        }
+
         /// <summary>
         /// Inverts the color of a PixelSet.
         /// </summary>
@@ -227,13 +150,11 @@ namespace ArtSCII
         public PixelSet Invert()
         {
             PixelSet p = new PixelSet(Width, Height);
-            for (uint x = 0; x < Width; x++)
+            for (uint y = 0, o = 0; y < Height; y++)
             {
-                for (uint y = 0; y < Height; y++)
+                for (uint i = y * Stride, end = i + (Width * 3); i < end; i++)
                 {
-                    p.Pixels[0, x][y] = (byte)(255 - pixels[0, x][y]);
-                    p.Pixels[1, x][y] = (byte)(255 - pixels[1, x][y]);
-                    p.Pixels[2, x][y] = (byte)(255 - pixels[2, x][y]);
+                    p.Data[o++] = (byte)(255 - Data[i]);
                 }
             }
             return p;
@@ -243,53 +164,47 @@ namespace ArtSCII
         /// Converts this PixelSet to a Bitmap.
         /// </summary>
         /// <returns>Bitmap</returns>
-        public Bitmap ToBitmap()
+        public unsafe Bitmap ToBitmap()
         {
-            Bitmap bmp = new Bitmap((int) Width, (int) Height);
-            for (int x = 0; x < Width; x++)
+            Bitmap bmp = new Bitmap((int)Width, (int)Height, PixelFormat.Format24bppRgb);
+            BitmapData data = bmp.LockBits(new Rectangle(0, 0, bmp.Width, bmp.Height), ImageLockMode.WriteOnly,
+                                           PixelFormat.Format24bppRgb);
+            try
             {
-                for (int y = 0; y < Height; y++)
+                // Bitmaps store their pixels as BGR
+                for (uint y = 0; y < Height; y++)
                 {
-                    Color c = Color.FromArgb(pixels[0, x][y], pixels[1, x][y], pixels[2, x][y]);
-                    bmp.SetPixel(x, y, c);
+                    byte* row = (byte*)data.Scan0 + (y * data.Stride);
+                    for (uint x = 0, i = y * Stride; x < Width * 3; x += 3, i += 3)
+                    {
+                        row[x] = Data[i + 2];
+                        row[x + 1] = Data[i + 1];
+                        row[x + 2] = Data[i];
+                    }
                 }
             }
+            finally
+            {
+                bmp.UnlockBits(data);
+            }
             return bmp;
         }
 
         /// <summary>
-        /// Serialzes the pixel data in the following format:
-        /// [pixels[0, 0][0], pixels[1, 0][0], pixels[2, 0][0],
-        ///  pixels[0, 1][0], pixels[1, 1][0], pixels[2, 1][0],
-        ///  pixels[0, 0][1], pixels[1, 0][1], pixels[2, 0][1],
-        ///  pixels[0, 1][1], pixels[1, 1][1], pixels[2, 1][1]]
+        /// Gets the pixels without gaps between rows, as R, G, B bytes row by row.
+        /// Data is returned as is when its rows are already packed, so nothing is copied.
         /// </summary>
-        /// <returns></returns>
+        /// <returns>Packed pixels</returns>
         public byte[] Serialize()
         {
-            byte[] bytes = new byte[Width * Height * 3];
-            uint i = 0;
+            uint rowLen = Width * 3;
+            if (Stride == rowLen) return Data;
+            byte[] bytes = new byte[rowLen * Height];
             for (uint y = 0; y < Height; y++)
             {
-                for (uint x = 0; x < Width; x++)
-                {
-                    bytes[i++] = pixels[0, x][y];
-                    bytes[i++] = pixels[1, x][y];
-                    bytes[i++] = pixels[2, x][y];
-                }
+                Buffer.BlockCopy(Data, (int)(y * Stride), bytes, (int)(y * rowLen), (int)rowLen);
             }
             return bytes;
         }
-
-        /// <summary>
-        /// Sets pixels and recalculates dimensions.
-        /// </summary>
-        /// <param name="p">Pixels to set</param>
-        private void SetPixels(byte[,][] p)
-        {
-            Width = (uint) p.Length / 3;
-            Height = (uint) p[0, 0].Length;
-            pixels = p;
-        }
     }
 }
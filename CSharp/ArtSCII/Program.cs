@@ -4,13 +4,19 @@ using System.Linq;
 using System.Text;
 
 using Bitmap = System.Drawing.Bitmap;
+using BitmapData = System.Drawing.Imaging.BitmapData;
 using Color = System.Drawing.Color;
 using File = System.IO.File;
 using FStream = System.IO.FileStream;
 using Graphics = System.Drawing.Graphics;
 using ImageFormat = System.Drawing.Imaging.ImageFormat;
+using ImageLockMode = System.Drawing.Imaging.ImageLockMode;
+using PixelFormat = System.Drawing.Imaging.PixelFormat;
 using PointF = System.Drawing.PointF;
+using Rectangle = System.Drawing.Rectangle;
 using SolidBrush = System.Drawing.SolidBrush;
+using Stopwatch = System.Diagnostics.Stopwatch;
+using Stream = System.IO.Stream;
 
 namespace ArtSCII
 {
@@ -19,15 +25,24 @@ namespace ArtSCII
         static string inPath = string.Empty;
         static string outPath = string.Empty;
         static string fontName = string.Empty;
+        static string batchExt = null;
         static int fontSize = 12;
         public static uint charWidth, charHeight;
         static float scale = 1;
         static float overlap = 1;
         static uint logMode = 3;
-        static bool html;
-        public static bool grey = false, nocl = false, openCL = false;
+        public static int threads = 0, topK = 0;
+        public static ulong maxMem = 0;
+        static OutputType outputType;
+        public static bool grey = false, nocl = false, openCL = false, composed = false, exhaustive = false,
+                           fused = false;
+        public static bool compare = false;
+        static bool printStats = false;
+        static string statsPath = null;
         static ImageFormat outputFmt;
-        static AsciiFont asciiFont;
+        public static AsciiFont asciiFont;
+        static AsciiFont outFont;
+        static readonly object logLock = new object();
 
         /// <summary>
         /// Parses command line arguments and sets values.
@@ -50,12 +65,28 @@ namespace ArtSCII
             {
                 switch (args[i].ToLower())
                 {
+                    case "-batch":
+                        batchExt = args[++i].TrimStart('.');
+                        if (batchExt == string.Empty) return "Batch extension cannot be empty.";
+                        break;
+                    case "-compare":
+                        compare = true;
+                        break;
+                    case "-composed":
+                        composed = true;
+                        break;
+                    case "-exhaustive":
+                        exhaustive = true;
+                        break;
                     case "-font":
                         fontName = args[++i];
                         break;
                     case "-fontsize":
                         if (!int.TryParse(args[++i], out fontSize)) return "Font size must be an integer.";
                         break;
+                    case "-fused":
+                        fused = true;
+                        break;
                     case "-grey":
                         grey = true;
                         break;
@@ -65,22 +96,35 @@ namespace ArtSCII
                         Console.WriteLine("\nUsage: ArtSCII \"input\" \"output\" [optional parameters]\n" +
                             " input | File path to a BMP, GIF, JPG, PNG, or TIFF file.\n" +
                             " output | File path to save the output. The extension determines the output type.\n" +
-                            "        | Valid extensions are .BMP .GIF .HTM .HTML .JPG .JPEG .PNG .TIF and .TIFF\n" +
+                            "        | Valid extensions are .ANS .BMP .GIF .HTM .HTML .JPG .JPEG .PNG .TIF .TIFF and .TXT\n" +
+                            "        | .ANS is text with ANSI 24-bit color codes, for terminals. .TXT is plain text.\n" +
                             "        | If no matching extension is found, BMP format will be used.\n" +
-                            "        | Please note that it is not recommended to generate HTML files from large images for performance reasons.\n" +
                             " optional parameters:\n" +
+                            "  -batch <ext> | Converts many images with one font and OpenCL context. The input is a directory, a file listing one image path per line, or a path with * and ? wildcards. The output is a directory; each image is saved there with its own name and the extension <ext>.\n" +
+                            "  -compare | Reports how much -composed would change the filtered images before converting, and how often -topk picks the same characters as the full search.\n" +
+                            "  -composed | Combines the filter passes of each kernel into one. This is faster, but the output is not identical.\n" +
+                            "  -exhaustive | Compares every character to every part of the image when OpenCL is disabled. This is slower, but the output is the same.\n" +
                             "  -font \"name\" | Specifies the font used. If this is not supplied or cannot be found, a generic monospace font is used.\n" +
                             "  -fontsize <n> | Sets the font size in pixels. <n> Must be an integer. Default is 12 pixels.\n" +
+                            "  -fused | Filters each part of the image just before matching it, instead of filtering the whole image first. This uses less memory and is usually faster. The output is the same. Needs kernels of the same odd size.\n" +
                             "  -grey | Produces a greyscale output.\n" +
                             "  -logmode <n> | Specifies the console log mode. 0 = Silent, 1 = Errors only, 2 = Errors and Warnings, 3 = All. Default is 3.\n" +
+                            "  -maxmem <n> | Converts large images in strips so that conversion uses about <n> MB of memory. With OpenCL, strips also fit in the device's memory. The output is the same. Default is 0 (no limit).\n" +
                             "  -nocl | Disables OpenCL.\n" +
-                            "  -overlap <n> | Specifies the overlap multiplier. This will increase or decrease the font size used to render the output without changing the character spacing. Cannot be used with HTML outputs.\n" +
-                            "  -scale <n> | Scales the output by <n>."
+                            "  -overlap <n> | Specifies the overlap multiplier. This will increase or decrease the font size used to render the output without changing the character spacing. Cannot be used with HTML or text outputs.\n" +
+                            "  -scale <n> | Scales the output by <n>.\n" +
+                            "  -stats | Prints the time of each conversion stage, the bytes moved to and from the OpenCL device, and the memory allocated.\n" +
+                            "  -statsjson \"file\" | Writes the same statistics as -stats to a JSON file.\n" +
+                            "  -threads <n> | Sets the number of CPU threads used when OpenCL is disabled. Default is 0 (one per CPU).\n" +
+                            "  -topk <n> | When OpenCL is disabled, only compares the <n> most likely characters at full size. This is faster, but the output is not identical. Default is 0 (all characters)."
                             );
                         return "NoError";
                     case "-logmode":
                         if (!uint.TryParse(args[++i], out logMode) || logMode > 3) return "Log mode must be a number between 0 and 3.";
                         break;
+                    case "-maxmem":
+                        if (!ulong.TryParse(args[++i], out maxMem)) return "Max memory must be a whole number of megabytes.";
+                        break;
                     case "-nocl":
                         nocl = true;
                         break;
@@ -88,10 +132,22 @@ namespace ArtSCII
                         if (!float.TryParse(args[++i], out overlap) || logMode > 3) return "Overlap must be a number greater than 0.";
                         if (overlap == 0) return "Overlap cannot be 0.";
                         break;
+                    case "-stats":
+                        printStats = true;
+                        break;
+                    case "-statsjson":
+                        statsPath = args[++i];
+                        break;
                     case "-scale":
                         if (!float.TryParse(args[++i], out scale)) return "Scale must be a number.";
                         if (scale == 0) return "Scale cannot be 0.";
                         break;
+                    case "-threads":
+                        if (!int.TryParse(args[++i], out threads) || threads < 0) return "Threads must be an integer of at least 0.";
+                        break;
+                    case "-topk":
+                        if (!int.TryParse(args[++i], out topK) || topK < 0) return "Top K must be an integer of at least 0.";
+                        break;
                     default:
                         if (inPath == string.Empty) inPath = args[i];
                         else if (outPath == string.Empty) outPath = args[i];
@@ -100,6 +156,17 @@ namespace ArtSCII
             }
             if (outPath == string.Empty) return "You must provide an input and output file path.";
 
+            if (batchExt != null)
+            {
+                // Batch inputs and outputs are opened by each stage in Batch
+                if (compare) Log(LogType.Warning, "-compare is not supported in batch mode.");
+                compare = false;
+                if (printStats || statsPath != null) Log(LogType.Warning, "-stats and -statsjson are not supported in batch mode.");
+                printStats = false;
+                statsPath = null;
+                SetOutputFileType("." + batchExt);
+                return string.Empty;
+            }
             SetOutputFileType(outPath);
 
             return OpenFiles(out input, out output);
@@ -112,13 +179,17 @@ namespace ArtSCII
         static void SetOutputFileType(string outPath)
         {
             outPath = outPath.ToLower();
-            html = (outPath.EndsWith(".htm") || outPath.EndsWith(".html"));
-            if (html)
+            if (outPath.EndsWith(".htm") || outPath.EndsWith(".html")) outputType = OutputType.Html;
+            else if (outPath.EndsWith(".ans")) outputType = OutputType.Ansi;
+            else if (outPath.EndsWith(".txt")) outputType = OutputType.Text;
+            else outputType = OutputType.Bitmap;
+            if (outputType != OutputType.Bitmap)
             {
-                if (overlap != 1) Log(LogType.Warning, "Overlap is not supported for HTML outputs.");
+                if (overlap != 1) Log(LogType.Warning, "Overlap is not supported for HTML or text outputs.");
                 return;
             }
-            else if (outPath.EndsWith(".bmp")) outputFmt = ImageFormat.Bmp;
+
+            if (outPath.EndsWith(".bmp")) outputFmt = ImageFormat.Bmp;
             else if (outPath.EndsWith(".gif")) outputFmt = ImageFormat.Gif;
             else if (outPath.EndsWith(".jpg")) outputFmt = ImageFormat.Jpeg;
             else if (outPath.EndsWith(".jpeg")) outputFmt = ImageFormat.Jpeg;
@@ -144,7 +215,6 @@ namespace ArtSCII
             try
             {
                 bmp = (Bitmap)Bitmap.FromFile(inPath);
-                if (grey) bmp = ToGreyscale(bmp);
                 if (File.Exists(outPath)) File.Delete(outPath);
                 fstream = File.OpenWrite(outPath);
             }
@@ -180,65 +250,43 @@ namespace ArtSCII
             return string.Empty;
         }
 
-        /// <summary>
-        /// Converts an image to greyscale.
-        /// </summary>
-        /// <param name="bmp">Image to convert</param>
-        /// <returns>Greyscale Bitmap</returns>
-        static Bitmap ToGreyscale(Bitmap bmp)
-        {
-            Bitmap grey = new Bitmap(bmp.Width, bmp.Height);
-            Color c;
-            int pixel;
-            for (int x = 0; x < bmp.Width; x++)
-            {
-                for (int y = 0; y < bmp.Height; y++)
-                {
-                    c = bmp.GetPixel(x, y);
-                    pixel = (int)Math.Min((Math.Max(Math.Max(c.R, c.G), c.B) +
-                        Math.Min(Math.Min(c.R, c.G), c.B) * 0.5f), 255);
-                    grey.SetPixel(x, y, Color.FromArgb(pixel, pixel, pixel));
-                }
-            }
-            return grey;
-        }
-
         /// <summary>
         /// Creates a Bitmap containing the ASCII output.
+        /// The glyphs are drawn by artscii.dll, or with Graphics.DrawString if the library cannot be loaded.
         /// </summary>
         /// <param name="inputW">Width of the input image</param>
         /// <param name="inputH">Height of the input image</param>
-        /// <param name="ascii">List of ASCII characters and colors</param>
+        /// <param name="ascii">ASCII characters and colors</param>
         /// <param name="fontName">Font name</param>
         /// <param name="fontSize">Font size</param>
+        /// <param name="renderThreads">Number of threads that draw the glyphs (0 = one per CPU)</param>
         /// <returns>Bitmap</returns>
-        static Bitmap FormatOutputBmp(int inputW, int inputH, List<Tuple<char, Color>> ascii, string fontName, int fontSize)
+        static Bitmap FormatOutputBmp(int inputW, int inputH, AsciiImage ascii, string fontName, int fontSize,
+            int renderThreads)
         {
             inputW = (int)(inputW * scale);
             inputH = (int)(inputH * scale);
             fontSize = (int)(fontSize * scale * overlap);
 
-            Bitmap bmp = new PixelSet((uint)inputW, (uint)inputH, 0x11).ToBitmap();
-            SolidBrush b = new SolidBrush(Color.White);
-            Graphics g = Graphics.FromImage(bmp);
-            
-            // Temporarily disable logging to prevent repeats of AsciiFont warnings
-            uint lm = logMode;
-            logMode = 0;
-            AsciiFont outFont = new AsciiFont(fontName, fontSize);
-            logMode = lm;
+            // Created once, since batch mode formats every image with the same font
+            if (outFont == null)
+            {
+                // Temporarily disable logging to prevent repeats of AsciiFont warnings
+                uint lm = logMode;
+                logMode = 0;
+                outFont = new AsciiFont(fontName, fontSize);
+                logMode = lm;
+            }
 
             float lineW = -1;
             int numLines = 1;
-            for (int i = 0; i < ascii.Count; i++)
+            for (int i = Array.IndexOf(ascii.Chars, (byte)'\n'); i >= 0;
+                 i = Array.IndexOf(ascii.Chars, (byte)'\n', i + 1))
             {
-                if (ascii[i].Item1 == '\n')
-                {
-                    if (numLines < 2) lineW = i;
-                    numLines++;
-                }
+                if (numLines < 2) lineW = i;
+                numLines++;
             }
-            if (lineW == -1) lineW = ascii.Count;
+            if (lineW == -1) lineW = ascii.Length;
         #if Windows
             float padW = (inputW - (int)(lineW * charWidth * scale)) * 0.25f;
             PointF textPos = new PointF(padW, -1f);
@@ -247,10 +295,22 @@ namespace ArtSCII
             PointF textPos = new PointF(padW, 0f);
         #endif
 
-            for (int i = 0; i < ascii.Count; i++)
+            Bitmap bmp = new Bitmap(inputW, inputH, PixelFormat.Format24bppRgb);
+            try
             {
-                string str = string.Empty + ascii[i].Item1;
-                b.Color = ascii[i].Item2;
+                if (OCL.RenderGlyphs(ascii, outFont, bmp, (int)textPos.X, (int)textPos.Y, (int)(charWidth * scale),
+                                     (int)(charHeight * scale), 0x11, renderThreads)) return bmp;
+            }
+            catch (Exception e) when (e is DllNotFoundException || e is EntryPointNotFoundException) { }
+
+            SolidBrush b = new SolidBrush(Color.White);
+            Graphics g = Graphics.FromImage(bmp);
+            g.Clear(Color.FromArgb(0x11, 0x11, 0x11));
+
+            for (int i = 0; i < ascii.Length; i++)
+            {
+                string str = string.Empty + ascii.CharAt(i);
+                b.Color = ascii.ColorAt(i);
 
                 g.DrawString(str, outFont.Font, b, textPos);
 
@@ -263,80 +323,154 @@ namespace ArtSCII
             }
 
             g.Flush();
+            g.Dispose();
             b.Dispose();
 
             return bmp;
         }
 
         /// <summary>
-        /// Creates an HTML file containing the ASCII output.
+        /// Reads the pixels of an image and adjusts their brightness for conversion, in one pass in artscii.dll.
+        /// With -grey, the pixels are also made greyscale.
+        /// </summary>
+        /// <param name="input">Input image</param>
+        /// <returns>Pixels to convert</returns>
+        public static unsafe PixelSet Preprocess(Bitmap input)
+        {
+            PixelSet pixels = new PixelSet((uint)input.Width, (uint)input.Height);
+            BitmapData data = input.LockBits(new Rectangle(0, 0, input.Width, input.Height), ImageLockMode.ReadOnly,
+                                             PixelFormat.Format32bppArgb);
+            try
+            {
+                fixed (byte* p = pixels.Data)
+                {
+                    // Bitmaps store their pixels as BGRA
+                    OCL.PRE_Preprocess((byte*)data.Scan0, (UIntPtr)data.Stride, 4, true, pixels.Width, pixels.Height,
+                                       grey, p, (UIntPtr)pixels.Stride);
+                }
+                return pixels;
+            }
+            finally
+            {
+                input.UnlockBits(data);
+            }
+        }
+
+        /// <summary>
+        /// Writes the ASCII output in the format chosen by the output extension.
         /// </summary>
-        /// <param name="ascii">List of ASCII characters and colors</param>
-        /// <returns>bytes of an HTML file</returns>
-        static byte[] FormatOutputHtm(List<Tuple<char, Color>> ascii)
+        /// <param name="inputW">Width of the input image</param>
+        /// <param name="inputH">Height of the input image</param>
+        /// <param name="ascii">ASCII characters and colors</param>
+        /// <param name="output">Output stream</param>
+        /// <param name="concurrent">True if another thread can convert an image at the same time. The glyphs
+        /// are then drawn on the calling thread only.</param>
+        public static void WriteOutput(int inputW, int inputH, AsciiImage ascii, Stream output,
+            bool concurrent = false)
         {
-            Dictionary<Color, int> colorCounts = new Dictionary<Color, int>();
-            Dictionary<Color, string> colorIDs = new Dictionary<Color, string>();
-            Color c;
-            for (int i = 0; i < ascii.Count(); i++)
+            if (outputType != OutputType.Bitmap)
             {
-                c = ascii[i].Item2;
-                if (colorCounts.ContainsKey(c))
+                string head = "<!-- Generated by ArtSCII on " + DateTime.Now.ToString() + " -->\n" +
+                    "<!-- For more information, visit https://bpatterson.dev/projects/artscii -->\n\n";
+                Stopwatch timer = Stopwatch.StartNew();
+                ulong size = OCL.WriteText(ascii, output, outputType, head, asciiFont.FontName,
+                                           (int)(asciiFont.FontSize * scale));
+                double seconds = Math.Max(timer.Elapsed.TotalSeconds, 1e-6);
+                if (!concurrent)
                 {
-                    colorCounts[c]++;
-                    if (!colorIDs.ContainsKey(c)) colorIDs.Add(c, i.ToString("x"));
+                    Log(LogType.Info, "Wrote {0:F1} MB in {1:F0} ms ({2:F0} MB/s).", size / 1e6, seconds * 1000,
+                        size / 1e6 / seconds);
                 }
-                else colorCounts.Add(c, 1);
             }
-            string html = "<!-- Generated by ArtSCII on " + DateTime.Now.ToString() + " -->\n" +
-            "<!-- For more information, visit https://bpatterson.dev/projects/artscii -->\n\n" +
-            "<!DOCTYPE html><html><head><style>\n";
-            Color[] colors = colorCounts.Keys.ToArray();
-            for (int i = 0; i < colors.Length; i++)
+            else
+            {
+                Bitmap outBmp = FormatOutputBmp(inputW, inputH, ascii, fontName, fontSize, concurrent? 1 : threads);
+                outBmp.Save(output, outputFmt);
+                outBmp.Dispose();
+            }
+        }
+
+        /// <summary>
+        /// Prints the statistics of the last conversion if -stats is set, and writes them to the -statsjson
+        /// file if there is one.
+        /// </summary>
+        static unsafe void ReportStats()
+        {
+            OCL.CConversionStats stats;
+            OCL.STATS_Get(out stats);
+            string[] stages = Enum.GetNames(typeof(OCL.StatsStage));
+            int numKernels = Math.Min(stats.numKernels, OCL.statsMaxKernels),
+                numGlyphs = Math.Min(stats.numGlyphs, OCL.statsMaxGlyphs);
+
+            if (printStats)
             {
-                c = colors[i];
-                if (!colorIDs.ContainsKey(c)) continue;
-                html += ".c" + colorIDs[c] + "{color:#" +
-                    c.R.ToString("x2") + c.G.ToString("x2") + c.B.ToString("x2") + ";}\n";
+                Log(LogType.Info, "Conversion took {0:F1} ms. Stage times are from the {1}.", stats.totalMs,
+                    stats.deviceTimes != 0 ? "OpenCL device" : "CPU");
+                for (int s = 0; s < stages.Length; s++)
+                {
+                    if (stats.stageMs[s] > 0) Log(LogType.Info, "  {0}: {1:F2} ms", stages[s], stats.stageMs[s]);
+                }
+                for (int k = 0; k < numKernels; k++)
+                {
+                    Log(LogType.Info, "  Kernel {0}: {1:F2} ms", k, stats.convolveMs[k]);
+                }
+                if (numGlyphs > 0)
+                {
+                    double slowest = 0;
+                    for (int g = 0; g < numGlyphs; g++) slowest = Math.Max(slowest, stats.glyphMatchMs[g]);
+                    Log(LogType.Info, "  {0} characters matched one at a time, {1:F3} ms on average (max {2:F3}).",
+                        numGlyphs, stats.stageMs[(int)OCL.StatsStage.Match] / numGlyphs, slowest);
+                }
+                Log(LogType.Info, "Moved {0:F1} MB to and {1:F1} MB from the device in {2} commands.",
+                    stats.bytesUploaded / 1e6, stats.bytesRead / 1e6, stats.numCommands);
+                Log(LogType.Info, "Made {0} allocations. At most {1:F1} MB were allocated at once; the largest was {2:F1} MB.",
+                    stats.numAllocations, stats.peakBytes / 1e6, stats.largestBuffer / 1e6);
             }
-            html += "\nbody{font-family:\"" + asciiFont.FontName + "\",monospace;" +
-                "font-size:" + (int)(asciiFont.FontSize * scale) +
-                "px;background-color:#111111;white-space:pre;}\n</style></head><body>\n";
-            Color last = Color.FromArgb(0, 0, 0, 0);
-            string colorStr;
-            string ch;
-            bool newLine = true;
-            for (int i = 0; i < ascii.Count; i++)
+
+            if (statsPath != null)
             {
-                ch = ascii[i].Item1.ToString();
-                if (ch == "&") ch = "&amp;";
-                else if (ch == ">") ch = "&gt;";
-                else if (ch == "<") ch = "&lt;";
-                else if (ch == "\"") ch = "&quot;";
-                else if (ch == "\'") ch = "&#39;";
-                c = ascii[i].Item2;
-                if (ch == "\n")
+                var inv = System.Globalization.CultureInfo.InvariantCulture;
+                StringBuilder json = new StringBuilder();
+                json.AppendFormat(inv, "{{\n  \"total_ms\": {0:F3},\n  \"device_times\": {1},\n  \"stage_ms\": {{ ",
+                    stats.totalMs, stats.deviceTimes != 0 ? "true" : "false");
+                for (int s = 0; s < stages.Length; s++)
+                {
+                    json.AppendFormat(inv, "{0}\"{1}\": {2:F3}", s > 0 ? ", " : "", stages[s].ToLower(), stats.stageMs[s]);
+                }
+                json.Append(" },\n  \"convolve_ms\": [");
+                for (int k = 0; k < numKernels; k++)
                 {
-                    html += "</span><br>";
-                    last = Color.FromArgb(0, 0, 0, 0);
-                    newLine = true;
+                    json.AppendFormat(inv, "{0}{1:F3}", k > 0 ? ", " : "", stats.convolveMs[k]);
                 }
-                else if (!newLine && c == last) html += ch;
-                else
+                json.Append("],\n  \"glyph_match_ms\": [");
+                for (int g = 0; g < numGlyphs; g++)
                 {
-                    newLine = false;
-                    if (colorIDs.ContainsKey(c)) colorStr = "<span class='c" + colorIDs[c] + "'>";
-                    else colorStr = "<span style='color:#" +
-                            c.R.ToString("x2") + c.G.ToString("x2") + c.B.ToString("x2") + ";'>";
-
-                    if (last.A == 0) html += colorStr + ch;
-                    else html += "</span>" + colorStr + ch;
-                    last = c;
+                    json.AppendFormat(inv, "{0}{1:F4}", g > 0 ? ", " : "", stats.glyphMatchMs[g]);
+                }
+                json.AppendFormat(inv, "],\n  \"bytes_uploaded\": {0},\n  \"bytes_read\": {1},\n  \"commands\": {2},\n" +
+                    "  \"allocations\": {3},\n  \"peak_bytes\": {4},\n  \"largest_buffer\": {5}\n}}\n",
+                    stats.bytesUploaded, stats.bytesRead, stats.numCommands, stats.numAllocations, stats.peakBytes,
+                    stats.largestBuffer);
+                try
+                {
+                    File.WriteAllText(statsPath, json.ToString());
+                }
+                catch (Exception e)
+                {
+                    Log(LogType.Warning, "Could not write \"{0}\": {1}", statsPath, e.Message);
                 }
             }
-            html += "\n</body></html>\n";
-            byte[] bytes = Encoding.UTF8.GetBytes(html);
-            return bytes;
+        }
+
+        /// <summary>
+        /// Output types, chosen by the output extension.
+        /// </summary>
+        public enum OutputType
+        {
+            Ansi,
+            Bitmap,
+            Html,
+            Text,
         }
 
         /// <summary>
@@ -361,28 +495,32 @@ namespace ArtSCII
             if (logMode == 0 || 
                 (logMode == 1 && type != LogType.Error) ||
                 (logMode == 2 && type != LogType.Error && type != LogType.Warning)) return;
-            ConsoleColor dftColor = Console.ForegroundColor;
-            switch (type) {
-                case LogType.Done:
-                    Console.ForegroundColor = ConsoleColor.Green;
-                    Console.Write("✓ ");
-                    break;
-                case LogType.Error:
-                    Console.ForegroundColor = ConsoleColor.Red;
-                    Console.Error.Write("X ");
-                    break;
-                case LogType.Info:
-                    Console.ForegroundColor = ConsoleColor.Blue;
-                    Console.Write("■ ");
-                    break;
-                case LogType.Warning:
-                    Console.ForegroundColor = ConsoleColor.Yellow;
-                    Console.Write("! ");
-                    break;
+            // Batch stages log from several threads
+            lock (logLock)
+            {
+                ConsoleColor dftColor = Console.ForegroundColor;
+                switch (type) {
+                    case LogType.Done:
+                        Console.ForegroundColor = ConsoleColor.Green;
+                        Console.Write("✓ ");
+                        break;
+                    case LogType.Error:
+                        Console.ForegroundColor = ConsoleColor.Red;
+                        Console.Error.Write("X ");
+                        break;
+                    case LogType.Info:
+                        Console.ForegroundColor = ConsoleColor.Blue;
+                        Console.Write("■ ");
+                        break;
+                    case LogType.Warning:
+                        Console.ForegroundColor = ConsoleColor.Yellow;
+                        Console.Write("! ");
+                        break;
+                }
+                Console.ForegroundColor = dftColor;
+                if (type == LogType.Error) Console.Error.WriteLine(message, consoleParams);
+                else Console.WriteLine(message, consoleParams);
             }
-            Console.ForegroundColor = dftColor;
-            if (type == LogType.Error) Console.Error.WriteLine(message, consoleParams);
-            else Console.WriteLine(message, consoleParams);
         }
 
         /// <summary>
@@ -402,7 +540,13 @@ namespace ArtSCII
             }
 
             if (!nocl) {
+                OCL.UseProgramCache();
                 openCL = OCL.OCL_Init();
+                if (openCL)
+                {
+                    Log(LogType.Info, OCL.OCL_ProgramCacheHit() ? "OpenCL program loaded from the cache." :
+                        "OpenCL program built from source.");
+                }
             }
             Log(LogType.Info, "OpenCL is {0}.", openCL ? "enabled" : "disabled. This may take a while");
             asciiFont = new AsciiFont(fontName, fontSize);
@@ -413,32 +557,52 @@ namespace ArtSCII
             charWidth = en.Current.Width;
             charHeight = en.Current.Height;
 
+            if (batchExt != null)
+            {
+                Batch.Run(inPath, outPath, batchExt);
+                OCL.ReleaseFont();
+                OCL.OCL_Cleanup();
+                return;
+            }
+
+            PixelSet pixels = Preprocess(input);
+            if (compare)
+            {
+                double meanDiff;
+                uint maxDiff;
+                if (OCL.CompareComposed(pixels, out meanDiff, out maxDiff))
+                {
+                    Log(LogType.Info, "Composed kernels differ by {0:F2} on average (max {1}) per color channel.", meanDiff, maxDiff);
+                }
+                else Log(LogType.Warning, "Could not compare composed kernels.");
+            }
+
             Log(LogType.Info, "Converting to ascii...");
-            List<Tuple<char, Color>> ascii;
+            AsciiImage ascii;
             if (openCL) {
-                ascii = OCL.ToAscii((new PixelSet(input) * 0.75f) + 64, asciiFont);
+                ascii = OCL.ToAscii(pixels, asciiFont);
                 if (!openCL) return;
             }
             else {
-                ascii = OCL.ToAscii_NOCL((new PixelSet(input) * 0.75f) + 64, asciiFont);
+                ascii = OCL.ToAscii_NOCL(pixels, asciiFont);
+                if (!exhaustive)
+                {
+                    Log(LogType.Info, "Character search compared {0:P1} of the character pixels.", OCL.NOCL_GetVisitedFraction());
+                    if (compare && topK > 0)
+                    {
+                        Log(LogType.Info, "-topk picked the same character as the full search in {0:P1} of cells.", OCL.NOCL_GetAgreementRate());
+                    }
+                }
             }
+            if (printStats || statsPath != null) ReportStats();
             Log(LogType.Info, "Saving \"{0}\"...", output.Name);
-            if (html)
-            {
-                byte[] bytes = FormatOutputHtm(ascii);
-                output.Write(bytes, 0, bytes.Length);
-            }
-            else
-            {
-                Bitmap outBmp = FormatOutputBmp(input.Width, input.Height, ascii, fontName, fontSize);
-                outBmp.Save(output, outputFmt);
-                outBmp.Dispose();
-            }
+            WriteOutput(input.Width, input.Height, ascii, output);
             Log(LogType.Done, "Done");
 
             output.Close();
             output.Dispose();
             input.Dispose();
+            OCL.ReleaseFont();
             OCL.OCL_Cleanup();
         }
     }